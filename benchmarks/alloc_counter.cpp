@@ -0,0 +1,53 @@
+#include "bench.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+using namespace std;
+
+static atomic<bool> g_is_counting = {false};
+static atomic<uint64_t> g_nr_allocs = {0};
+static atomic<uint64_t> g_nr_bytes = {0};
+
+void* operator new(size_t size) {
+    if (g_is_counting.load(memory_order_relaxed)) {
+        g_nr_allocs.fetch_add(1, memory_order_relaxed);
+        g_nr_bytes.fetch_add(size, memory_order_relaxed);
+    }
+    void* ptr = malloc(size);
+    if (!ptr) {
+        throw bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    if (g_is_counting.load(memory_order_relaxed)) {
+        g_nr_allocs.fetch_add(1, memory_order_relaxed);
+        g_nr_bytes.fetch_add(size, memory_order_relaxed);
+    }
+    return malloc(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+namespace netkit { namespace bench {
+
+void StartCountingAllocs() {
+    g_nr_allocs.store(0, memory_order_relaxed);
+    g_nr_bytes.store(0, memory_order_relaxed);
+    g_is_counting.store(true, memory_order_relaxed);
+}
+
+void StopCountingAllocs(uint64_t* nr_allocs, uint64_t* nr_bytes) {
+    g_is_counting.store(false, memory_order_relaxed);
+    *nr_allocs = g_nr_allocs.load(memory_order_relaxed);
+    *nr_bytes = g_nr_bytes.load(memory_order_relaxed);
+}
+
+}}
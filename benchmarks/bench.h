@@ -0,0 +1,112 @@
+#ifndef __NETKIT_BENCHMARKS_BENCH_H__
+#define __NETKIT_BENCHMARKS_BENCH_H__
+
+#include "logger/logger.h"
+#include <errno.h>
+#include <stdint.h>
+#include <time.h> // clock_gettime()
+#include <unistd.h> // read()/write()
+
+namespace netkit { namespace bench {
+
+inline uint64_t GetNowNsec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// returns 0 or -errno
+inline int WriteAll(int fd, const char* buf, uint64_t sz) {
+    while (sz > 0) {
+        ssize_t ret = write(fd, buf, sz);
+        if (ret < 0) {
+            return -errno;
+        }
+        buf += ret;
+        sz -= ret;
+    }
+    return 0;
+}
+
+// returns 0 or -errno
+inline int ReadAll(int fd, char* buf, uint64_t sz) {
+    while (sz > 0) {
+        ssize_t ret = read(fd, buf, sz);
+        if (ret <= 0) {
+            return (ret == 0) ? -ECONNRESET : -errno;
+        }
+        buf += ret;
+        sz -= ret;
+    }
+    return 0;
+}
+
+/**
+   @brief counts heap allocations made by all threads between the two calls.
+   they must not be nested.
+*/
+void StartCountingAllocs();
+void StopCountingAllocs(uint64_t* nr_allocs, uint64_t* nr_bytes);
+
+/**
+   @brief passed to a benchmark, which runs `nr_ops` operations between
+   `Start()` and `Stop()`. setup and cleanup are done outside of them.
+*/
+class Context final {
+public:
+    static constexpr uint32_t MAX_METRIC_NUM = 4;
+
+    struct Metric final {
+        const char* name;
+        double value;
+    };
+
+public:
+    Context(uint64_t _nr_ops, Logger* l) : nr_ops(_nr_ops), logger(l) {}
+
+    void Start() {
+        m_begin_nsec = GetNowNsec();
+    }
+    void Stop() {
+        m_elapsed_nsec = GetNowNsec() - m_begin_nsec;
+    }
+
+    uint64_t GetElapsedNsec() const {
+        return m_elapsed_nsec;
+    }
+
+    /**
+       @brief reported along with the timing, e.g. throughput in bytes.
+       `name` must be a string literal. extra ones are ignored.
+    */
+    void SetMetric(const char* name, double value) {
+        if (m_nr_metrics < MAX_METRIC_NUM) {
+            m_metric_list[m_nr_metrics] = Metric{name, value};
+            ++m_nr_metrics;
+        }
+    }
+
+    uint32_t GetMetricNum() const {
+        return m_nr_metrics;
+    }
+    const Metric& GetMetric(uint32_t idx) const {
+        return m_metric_list[idx];
+    }
+
+public:
+    const uint64_t nr_ops;
+    Logger* const logger;
+
+private:
+    uint64_t m_begin_nsec = 0;
+    uint64_t m_elapsed_nsec = 0;
+    uint32_t m_nr_metrics = 0;
+    Metric m_metric_list[MAX_METRIC_NUM];
+};
+
+// returns 0 or -errno
+typedef int (*Func)(Context*);
+
+}}
+
+#endif
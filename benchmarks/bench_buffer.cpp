@@ -0,0 +1,52 @@
+#include "bench.h"
+#include "netkit/buffer.h"
+#include <string.h> // memset()
+using namespace std;
+
+#define MSG_SIZE 64
+// appends to one buffer before it is released
+#define NR_APPENDS 1024
+#define RESERVE_SIZE 4096
+
+namespace netkit { namespace bench {
+
+/** @brief appends to a buffer growing from empty, like a read buffer */
+int BenchBufferAppend(Context* ctx) {
+    char msg[MSG_SIZE];
+    memset(msg, 'x', MSG_SIZE);
+
+    ctx->Start();
+    Buffer* b = nullptr;
+    for (uint64_t i = 0; i < ctx->nr_ops; ++i) {
+        if (i % NR_APPENDS == 0) {
+            delete b;
+            b = new Buffer();
+        }
+        int err = b->Append(msg, MSG_SIZE);
+        if (err) {
+            delete b;
+            return err;
+        }
+    }
+    delete b;
+    ctx->Stop();
+
+    return 0;
+}
+
+/** @brief reserves and releases a buffer of the default read size */
+int BenchBufferReserve(Context* ctx) {
+    ctx->Start();
+    for (uint64_t i = 0; i < ctx->nr_ops; ++i) {
+        Buffer b;
+        int err = b.Reserve(RESERVE_SIZE);
+        if (err) {
+            return err;
+        }
+    }
+    ctx->Stop();
+
+    return 0;
+}
+
+}}
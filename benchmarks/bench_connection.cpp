@@ -0,0 +1,177 @@
+#include "bench.h"
+#include "netkit/connection.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+namespace netkit { namespace bench {
+
+struct LegacyEndpointInfo final {
+    uint16_t local_port = 0;
+    uint16_t remote_port = 0;
+    string local_addr;
+    string remote_addr;
+};
+
+// the layout before connections were pooled and refcounted intrusively
+struct LegacyConnection final {
+    LegacyConnection(int _fd) : fd(_fd) {}
+
+    atomic<uint32_t> is_valid = {1};
+    atomic<uint64_t> mem_usage = {0};
+    LegacyEndpointInfo info;
+    const int fd;
+    mutex timer_lock;
+    set<int> timer_fds;
+    mutex send_lock;
+    uint32_t send_offset = 0;
+    queue<SendItem> send_queue;
+};
+
+// rounds up to the size class of the object pool
+static uint64_t GetBlockSize(uint64_t size) {
+    uint64_t block_size = 64;
+    while (block_size < size) {
+        block_size *= 2;
+    }
+    return block_size;
+}
+
+/**
+   @brief connections with one timer each, in the legacy layout. an operation
+   is creating one connection, and heap bytes per connection are reported.
+*/
+int BenchConnectionCreateLegacy(Context* ctx) {
+    vector<shared_ptr<LegacyConnection>> conn_list;
+    conn_list.reserve(ctx->nr_ops);
+
+    uint64_t nr_allocs, nr_bytes;
+    StartCountingAllocs();
+    ctx->Start();
+    for (uint64_t i = 0; i < ctx->nr_ops; ++i) {
+        auto conn = make_shared<LegacyConnection>(-1);
+        conn->timer_fds.insert(i); // one timer per connection
+        conn_list.push_back(std::move(conn));
+    }
+    ctx->Stop();
+    StopCountingAllocs(&nr_allocs, &nr_bytes);
+
+    ctx->SetMetric("object_bytes", sizeof(LegacyConnection));
+    ctx->SetMetric("bytes_per_conn", (double)nr_bytes / ctx->nr_ops);
+    return 0;
+}
+
+/** @brief like `BenchConnectionCreateLegacy()`, with pooled `Connection`s */
+int BenchConnectionCreate(Context* ctx) {
+    vector<ConnectionPtr> conn_list;
+    conn_list.reserve(ctx->nr_ops);
+
+    uint64_t nr_allocs, nr_bytes;
+    StartCountingAllocs();
+    ctx->Start();
+    for (uint64_t i = 0; i < ctx->nr_ops; ++i) {
+        conn_list.push_back(Connection::Create(-1));
+    }
+    ctx->Stop();
+    StopCountingAllocs(&nr_allocs, &nr_bytes);
+
+    // connections come from the object pool instead of the heap
+    ctx->SetMetric("object_bytes", sizeof(Connection));
+    ctx->SetMetric("bytes_per_conn", GetBlockSize(sizeof(Connection)) +
+                                         (double)nr_bytes / ctx->nr_ops);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/*
+  ownership changes of a request which is parsed by the reader, processed by a
+  task and answered by a sender started in the task. returns the number of
+  refcount operations.
+*/
+static uint32_t LegacyRequest(const shared_ptr<LegacyConnection>& conn) {
+    shared_ptr<LegacyConnection> task_ref = conn; // Task::Init()
+    shared_ptr<LegacyConnection> sender_ref = task_ref; // new Sender
+    task_ref.reset(); // the task is deleted
+    sender_ref.reset(); // all data is sent
+    return 4;
+}
+
+static uint32_t Request(const ConnectionPtr& conn) {
+    ConnectionPtr task_ref = conn; // Task::Init()
+    ConnectionPtr sender_ref = std::move(task_ref); // handed over by Emit()
+    sender_ref.reset(); // all data is sent
+    return 2;
+}
+
+/*
+  `ctx->nr_ops` requests on `conn` split among `nr_threads` threads. an
+  operation is one request, and refcount operations per request are
+  reported.
+*/
+template <typename PtrType, typename FuncType>
+static int MeasureRefcount(Context* ctx, const PtrType& conn,
+                           uint32_t nr_threads, const FuncType& f) {
+    atomic<uint64_t> nr_refcount_ops = {0};
+    vector<thread> thread_list;
+    thread_list.reserve(nr_threads);
+
+    ctx->Start();
+    for (uint32_t i = 0; i < nr_threads; ++i) {
+        const uint64_t nr_req = ctx->nr_ops / nr_threads +
+            ((i == 0) ? ctx->nr_ops % nr_threads : 0);
+        thread_list.emplace_back([&conn, &f, &nr_refcount_ops,
+                                  nr_req]() -> void {
+            uint64_t n = 0;
+            for (uint64_t j = 0; j < nr_req; ++j) {
+                n += f(conn);
+            }
+            nr_refcount_ops.fetch_add(n, memory_order_relaxed);
+        });
+    }
+    for (auto& t : thread_list) {
+        t.join();
+    }
+    ctx->Stop();
+
+    ctx->SetMetric("threads", nr_threads);
+    ctx->SetMetric("refcount_ops_per_op",
+                   (double)nr_refcount_ops.load() / ctx->nr_ops);
+    return 0;
+}
+
+static uint32_t GetThreadNum() {
+    return max(thread::hardware_concurrency(), 2u);
+}
+
+/** @brief requests of one connection in one thread, in the legacy layout */
+int BenchConnectionRefcountLegacy(Context* ctx) {
+    auto conn = make_shared<LegacyConnection>(-1);
+    return MeasureRefcount(ctx, conn, 1, LegacyRequest);
+}
+
+/** @brief like `BenchConnectionRefcountLegacy()`, with `ConnectionPtr` */
+int BenchConnectionRefcount(Context* ctx) {
+    auto conn = Connection::Create(-1);
+    return MeasureRefcount(ctx, conn, 1, Request);
+}
+
+/** @brief requests of one connection in every CPU, in the legacy layout */
+int BenchConnectionRefcountLegacyShared(Context* ctx) {
+    auto conn = make_shared<LegacyConnection>(-1);
+    return MeasureRefcount(ctx, conn, GetThreadNum(), LegacyRequest);
+}
+
+/** @brief like `BenchConnectionRefcountLegacyShared()`, with `ConnectionPtr` */
+int BenchConnectionRefcountShared(Context* ctx) {
+    auto conn = Connection::Create(-1);
+    return MeasureRefcount(ctx, conn, GetThreadNum(), Request);
+}
+
+}}
@@ -0,0 +1,145 @@
+#include "echo_fixture.h"
+#include "netkit/coro.h"
+using namespace std;
+
+#define NR_CLIENTS 4
+#define REQ_SIZE 64
+
+namespace netkit { namespace bench {
+
+static coro::Async<> ServeClient(NotificationQueue* nq, int fd) {
+    char buf[REQ_SIZE * 4];
+    while (true) {
+        int nr = co_await coro::Read(nq, fd, buf, sizeof(buf));
+        if (nr <= 0) {
+            break;
+        }
+        for (int off = 0; off < nr;) {
+            int ret = co_await coro::Write(nq, fd, buf + off, nr - off);
+            if (ret <= 0) {
+                close(fd);
+                co_return;
+            }
+            off += ret;
+        }
+    }
+    close(fd);
+}
+
+static coro::Async<> AcceptClients(NotificationQueue* nq, int svr_fd,
+                                   Logger* logger) {
+    while (true) {
+        int fd = co_await coro::Accept(nq, svr_fd);
+        if (fd < 0) {
+            logger_error(logger, "accept failed: [%s].", strerror(-fd));
+            break;
+        }
+
+        int opt = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+        int err = coro::Spawn(ServeClient(nq, fd));
+        if (err) {
+            logger_error(logger, "spawn client failed: [%s].", strerror(-err));
+            close(fd);
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+// returns the manager, or nullptr if failed
+static EventManager* CreateManager(Logger* logger) {
+    EventManager::Options options;
+    options.single_thread = true;
+
+    // the loop never returns, so the manager lives until the process exits
+    auto mgr = new EventManager(logger);
+    int err = mgr->Init(options);
+    if (err) {
+        logger_error(logger, "init manager failed: [%s].", strerror(-err));
+        return nullptr;
+    }
+    return mgr;
+}
+
+// returns -errno or the port of the server shared by all runs
+static int GetCallbackServerPort(Logger* logger) {
+    static int port = 0;
+    if (port != 0) {
+        return port;
+    }
+
+    auto mgr = CreateManager(logger);
+    if (!mgr) {
+        return -ENOMEM;
+    }
+
+    TcpServer::Options options;
+    options.client.socket.tcp_nodelay = true;
+    port = AddEchoServer(mgr, TcpServerPtr(new EchoServer<>(logger)), options,
+                         true, logger);
+    return port;
+}
+
+// returns -errno or the port of the server shared by all runs
+static int GetCoroutineServerPort(Logger* logger) {
+    static int port = 0;
+    if (port != 0) {
+        return port;
+    }
+
+    auto mgr = CreateManager(logger);
+    if (!mgr) {
+        return -ENOMEM;
+    }
+
+    int fd = utils::CreateTcpServerFd("127.0.0.1", 0, logger);
+    if (fd < 0) {
+        logger_error(logger, "create server fd failed: [%s].", strerror(-fd));
+        return fd;
+    }
+
+    int err = mgr->Post(0, [fd, logger](NotificationQueue* nq) -> void {
+        int err = coro::Spawn(AcceptClients(nq, fd, logger));
+        if (err) {
+            logger_error(logger, "spawn server failed: [%s].", strerror(-err));
+        }
+    });
+    if (err) {
+        logger_error(logger, "post server failed: [%s].", strerror(-err));
+        close(fd);
+        return err;
+    }
+
+    SocketAddr addr;
+    utils::GetLocalAddr(fd, &addr);
+
+    thread(&EventManager::Loop, mgr).detach();
+    port = addr.GetPort();
+    return port;
+}
+
+/**
+   @brief small requests from a few blocking clients are echoed by callbacks
+   of `TcpClient` in a single-thread manager. an operation is one round trip,
+   and heap allocations per operation are reported.
+*/
+int BenchEchoCallback(Context* ctx) {
+    int port = GetCallbackServerPort(ctx->logger);
+    if (port < 0) {
+        return port;
+    }
+    return MeasureEcho(ctx, port, NR_CLIENTS, REQ_SIZE, true);
+}
+
+/** @brief like `BenchEchoCallback()`, echoed by coroutines instead */
+int BenchEchoCoroutine(Context* ctx) {
+    int port = GetCoroutineServerPort(ctx->logger);
+    if (port < 0) {
+        return port;
+    }
+    return MeasureEcho(ctx, port, NR_CLIENTS, REQ_SIZE, true);
+}
+
+}}
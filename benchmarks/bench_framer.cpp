@@ -0,0 +1,156 @@
+#include "bench.h"
+#include "netkit/framer.h"
+#include <cstdlib> // rand()
+#include <string>
+using namespace std;
+
+#define SEGMENT_SIZE 1460
+#define PAYLOAD_SIZE (16 * 1024 * 1024)
+
+namespace netkit { namespace bench {
+
+/*
+  a typical hand-written `Check()`: scans the whole buffer byte by byte every
+  time new data arrives.
+*/
+class NaiveDelimiterFramer final {
+public:
+    ReqStat Check(const Buffer& buf, uint32_t* req_bytes) {
+        const char* data = buf.data();
+        for (uint64_t i = 1; i < buf.size(); ++i) {
+            if (data[i - 1] == '\r' && data[i] == '\n') {
+                *req_bytes = i + 1;
+                return ReqStat::VALID;
+            }
+        }
+        *req_bytes = 0;
+        return ReqStat::MORE_DATA;
+    }
+};
+
+/*
+  mostly small requests with a long tail, like headers and commands of text
+  protocols. generated once and shared by all runs.
+*/
+static const string& GetTextPayload() {
+    static string payload;
+    if (!payload.empty()) {
+        return payload;
+    }
+
+    srand(12345);
+    while (payload.size() < PAYLOAD_SIZE) {
+        uint32_t len;
+        int r = rand() % 100;
+        if (r < 70) {
+            len = 16 + rand() % 112;
+        } else if (r < 95) {
+            len = 128 + rand() % 1920;
+        } else {
+            len = 2048 + rand() % (62 * 1024);
+        }
+        for (uint32_t i = 0; i < len; ++i) {
+            payload.push_back('a' + rand() % 26);
+        }
+        payload.append("\r\n");
+    }
+    return payload;
+}
+
+static const string& GetBinaryPayload(bool varint) {
+    static string payload_list[2];
+    string& payload = payload_list[varint];
+    if (!payload.empty()) {
+        return payload;
+    }
+
+    srand(12345);
+    while (payload.size() < PAYLOAD_SIZE) {
+        uint32_t len = (rand() % 100 < 90) ? (rand() % 512) : (rand() % 65536);
+        if (varint) {
+            uint32_t v = len;
+            while (v >= 0x80) {
+                payload.push_back((char)(v | 0x80));
+                v >>= 7;
+            }
+            payload.push_back((char)v);
+        } else {
+            payload.push_back((char)(len >> 24));
+            payload.push_back((char)(len >> 16));
+            payload.push_back((char)(len >> 8));
+            payload.push_back((char)len);
+        }
+        payload.append(len, 'x');
+    }
+    return payload;
+}
+
+/*
+  feeds `payload` in segments like TcpClient does, starting over at its end,
+  and consumes `ctx->nr_ops` requests. an operation is one request, and the
+  throughput in bytes is reported. returns 0 or -errno.
+*/
+template <typename FramerType>
+static int Feed(Context* ctx, const string& payload, FramerType* framer) {
+    Buffer buf, rest;
+    uint64_t offset = 0, nr_bytes = 0, nr_req = 0;
+
+    ctx->Start();
+    while (nr_req < ctx->nr_ops) {
+        if (offset == payload.size()) {
+            offset = 0;
+        }
+        const uint64_t len = min<uint64_t>(payload.size() - offset,
+                                           SEGMENT_SIZE);
+        buf.Append(payload.data() + offset, len);
+        offset += len;
+
+        while (nr_req < ctx->nr_ops) {
+            uint32_t req_bytes = 0;
+            auto stat = framer->Check(buf, &req_bytes);
+            if (stat != ReqStat::VALID) {
+                if (stat == ReqStat::INVALID) {
+                    logger_error(ctx->logger,
+                                 "invalid request at offset [%lu].", offset);
+                    return -EINVAL;
+                }
+                break;
+            }
+            ++nr_req;
+            nr_bytes += req_bytes;
+            rest.Assign(buf.data() + req_bytes, buf.size() - req_bytes);
+            swap(buf, rest);
+        }
+    }
+    ctx->Stop();
+
+    ctx->SetMetric("mb_per_sec", (double)nr_bytes / 1024 / 1024 /
+                                     ((double)ctx->GetElapsedNsec() / 1e9));
+    return 0;
+}
+
+/** @brief requests ending with "\r\n", found by `NaiveDelimiterFramer` */
+int BenchFramerDelimiterNaive(Context* ctx) {
+    NaiveDelimiterFramer framer;
+    return Feed(ctx, GetTextPayload(), &framer);
+}
+
+/** @brief requests ending with "\r\n", found by `DelimiterFramer` */
+int BenchFramerDelimiter(Context* ctx) {
+    DelimiterFramer framer;
+    return Feed(ctx, GetTextPayload(), &framer);
+}
+
+/** @brief requests after a 32-bit big-endian length */
+int BenchFramerLengthField(Context* ctx) {
+    LengthFieldFramer<uint32_t, Endian::BIG> framer;
+    return Feed(ctx, GetBinaryPayload(false), &framer);
+}
+
+/** @brief requests after a varint length */
+int BenchFramerVarint(Context* ctx) {
+    VarintFramer framer;
+    return Feed(ctx, GetBinaryPayload(true), &framer);
+}
+
+}}
@@ -0,0 +1,58 @@
+#include "echo_fixture.h"
+using namespace std;
+
+#define NR_CLIENTS 4
+#define REQ_SIZE 64
+
+namespace netkit { namespace bench {
+
+// returns -errno or the port of an echo server shared by all runs
+static int GetServerPort(bool single_thread, Logger* logger) {
+    static int port_list[2] = {0, 0};
+    int& port = port_list[single_thread];
+    if (port != 0) {
+        return port;
+    }
+
+    EventManager::Options options;
+    if (single_thread) {
+        options.single_thread = true;
+    } else {
+        options.worker_num = 1;
+    }
+
+    // the loop never returns, so the manager lives until the process exits
+    auto mgr = new EventManager(logger);
+    int err = mgr->Init(options);
+    if (err) {
+        logger_error(logger, "init manager failed: [%s].", strerror(-err));
+        return err;
+    }
+
+    port = AddEchoServer(mgr, TcpServerPtr(new EchoServer<>(logger)),
+                         TcpServer::Options(), true, logger);
+    return port;
+}
+
+static int BenchEcho(Context* ctx, bool single_thread) {
+    int port = GetServerPort(single_thread, ctx->logger);
+    if (port < 0) {
+        return port;
+    }
+    return MeasureEcho(ctx, port, NR_CLIENTS, REQ_SIZE);
+}
+
+/**
+   @brief small requests from a few blocking clients are echoed by tasks run
+   on a worker thread. an operation is one round trip.
+*/
+int BenchEchoThreaded(Context* ctx) {
+    return BenchEcho(ctx, false);
+}
+
+/** @brief like `BenchEchoThreaded()`, with tasks run inline by the reader */
+int BenchEchoInline(Context* ctx) {
+    return BenchEcho(ctx, true);
+}
+
+}}
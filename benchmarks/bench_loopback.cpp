@@ -0,0 +1,196 @@
+#include "echo_fixture.h"
+#include <atomic>
+#include <mutex>
+#include <string.h> // strerror()
+#include <thread>
+using namespace std;
+
+#define REQ_SIZE 64
+
+namespace netkit { namespace bench {
+
+// requests left to be sent in the current run, written by the loop thread
+// during a run
+static atomic<uint64_t> g_nr_left = {0};
+static atomic<uint64_t> g_nr_round_trips = {0};
+static atomic<uint64_t> g_nr_corrupted = {0};
+
+static mutex g_mutex; // protects the following variables
+// of the pinging client, never released since it may outlive the pool of
+// connections at exit
+static ConnectionHandle* g_handle = nullptr;
+static bool g_is_connected = false;
+
+static const char* GetRequest() {
+    static char req[REQ_SIZE];
+    if (req[0] == '\0') {
+        for (uint32_t i = 0; i < REQ_SIZE; ++i) {
+            req[i] = 'a' + i % 26;
+        }
+    }
+    return req;
+}
+
+class PingTask final : public Task {
+public:
+    PingTask(Logger* l) : Task(l) {}
+    void Run(SendContext* ctx) override {
+        if (memcmp(m_buffer.data(), GetRequest(), REQ_SIZE) != 0) {
+            g_nr_corrupted.fetch_add(1, memory_order_relaxed);
+        }
+
+        const uint64_t nr_left = g_nr_left.load(memory_order_relaxed);
+        if (nr_left > 0) {
+            g_nr_left.store(nr_left - 1, memory_order_relaxed);
+            // the buffer is sent back as the next request
+            ctx->Emit(std::move(m_buffer));
+        }
+        g_nr_round_trips.fetch_add(1, memory_order_release);
+    }
+};
+
+template <typename TaskType>
+class FixedSizeClient : public TcpClient {
+public:
+    FixedSizeClient(Logger* l) : TcpClient(l) {}
+    int OnConnected(SendContext*) override {
+        return 0;
+    }
+    void OnDisconnected() override {}
+    ReqStat Check(const Buffer& req, uint32_t* size) override {
+        if (req.size() < REQ_SIZE) {
+            *size = REQ_SIZE - req.size();
+            return ReqStat::MORE_DATA;
+        }
+        *size = REQ_SIZE;
+        return ReqStat::VALID;
+    }
+    TaskPtr CreateTask() override {
+        return TaskPtr(new TaskType(m_logger));
+    }
+};
+
+// accepted in the loop thread, where handles are bound to its inbox
+class PingClient final : public FixedSizeClient<PingTask> {
+public:
+    PingClient(Logger* l) : FixedSizeClient<PingTask>(l) {}
+    int OnConnected(SendContext* ctx) override {
+        auto handle = new ConnectionHandle(ctx->GetHandle());
+        if (!handle) {
+            return -ENOMEM;
+        }
+
+        lock_guard<mutex> _l(g_mutex);
+        g_handle = handle;
+        g_is_connected = true;
+        return 0;
+    }
+};
+
+class PingServer final : public TcpServer {
+public:
+    PingServer(Logger* l) : TcpServer(l) {}
+    TcpClientPtr CreateClient() override {
+        return TcpClientPtr(new PingClient(m_logger));
+    }
+};
+
+// returns 0 or -errno. the manager and the connection are shared by all runs.
+static int InitManager(Logger* logger) {
+    static bool is_initialized = false;
+    if (is_initialized) {
+        return 0;
+    }
+
+    EventManager::Options options;
+    options.single_thread = true;
+    options.loopback = true;
+
+    // the loop never returns, so the manager lives until the process exits
+    auto mgr = new EventManager(logger);
+    int err = mgr->Init(options);
+    if (err) {
+        logger_error(logger, "init manager failed: [%s].", strerror(-err));
+        return err;
+    }
+
+    int fd = mgr->AddTcpServer("127.0.0.1", 0,
+                               TcpServerPtr(new PingServer(logger)));
+    if (fd < 0) {
+        logger_error(logger, "add server failed: [%s].", strerror(-fd));
+        return fd;
+    }
+
+    SocketAddr addr;
+    utils::GetLocalAddr(fd, &addr);
+
+    // connected before the loop starts, and accepted in it
+    TcpClientPtr client(new FixedSizeClient<EchoTask>(logger));
+    fd = mgr->AddTcpClient("127.0.0.1", addr.GetPort(), std::move(client));
+    if (fd < 0) {
+        logger_error(logger, "add client failed: [%s].", strerror(-fd));
+        return fd;
+    }
+
+    thread(&EventManager::Loop, mgr).detach();
+
+    while (true) {
+        {
+            lock_guard<mutex> _l(g_mutex);
+            if (g_is_connected) {
+                break;
+            }
+        }
+        this_thread::yield();
+    }
+
+    is_initialized = true;
+    return 0;
+}
+
+/**
+   @brief a request bounces between the two ends of a loopback connection,
+   one of which echoes it, running `Check()`, tasks and senders of both sides
+   without syscalls. an operation is one round trip.
+*/
+int BenchLoopbackEchoRoundTrip(Context* ctx) {
+    int err = InitManager(ctx->logger);
+    if (err) {
+        return err;
+    }
+
+    Buffer req;
+    err = req.Assign(GetRequest(), REQ_SIZE);
+    if (err) {
+        return err;
+    }
+
+    const uint64_t target = g_nr_round_trips.load(memory_order_acquire) +
+        ctx->nr_ops;
+    g_nr_left.store(ctx->nr_ops - 1, memory_order_relaxed);
+
+    ctx->Start();
+    {
+        lock_guard<mutex> _l(g_mutex);
+        err = g_handle->Emit(std::move(req));
+    }
+    if (err) {
+        logger_error(ctx->logger, "send request failed: [%s].",
+                     strerror(-err));
+        return err;
+    }
+    while (g_nr_round_trips.load(memory_order_acquire) < target) {
+        this_thread::yield();
+    }
+    ctx->Stop();
+
+    const uint64_t nr_corrupted = g_nr_corrupted.load(memory_order_relaxed);
+    if (nr_corrupted > 0) {
+        logger_error(ctx->logger, "[%lu] echoed requests are corrupted.",
+                     nr_corrupted);
+        return -EIO;
+    }
+    return 0;
+}
+
+}}
@@ -0,0 +1,159 @@
+#include "bench.h"
+#include "netkit/iouring/notification_queue_impl.h"
+#include <string.h> // strerror()
+#include <unistd.h>
+#include <sys/socket.h>
+using namespace std;
+using namespace netkit::iouring;
+
+#define MSG_SIZE 64
+// messages written before the peer is drained, within the socket buffer
+#define BATCH_SIZE 256
+
+namespace netkit { namespace bench {
+
+// returns 0 or -errno
+static int InitQueue(NotificationQueueImpl* nq, Logger* logger) {
+    int err = nq->Init(NotificationQueueImpl::Options(), logger);
+    if (err) {
+        logger_error(logger, "init queue failed: [%s].", strerror(-err));
+    }
+    return err;
+}
+
+// returns 0 or -errno
+static int WaitOne(NotificationQueue* nq, Logger* logger) {
+    EventResult res;
+    void* tag;
+    int err = nq->Next(&res, &tag, nullptr);
+    if (err) {
+        logger_error(logger, "get event failed: [%s].", strerror(-err));
+        return err;
+    }
+    if (res.err) {
+        logger_error(logger, "event failed: [%s].", strerror(res.err));
+        return -res.err;
+    }
+    return 0;
+}
+
+/*
+  a notification to the queue itself is the cheapest operation with a
+  completion, and stands for a nop since the interface has none.
+*/
+int BenchQueueNotify(Context* ctx) {
+    NotificationQueueImpl nq;
+    int err = InitQueue(&nq, ctx->logger);
+    if (err) {
+        return err;
+    }
+
+    ctx->Start();
+    for (uint64_t i = 0; i < ctx->nr_ops; ++i) {
+        err = nq.NotifyAsync(&nq, 0, &nq);
+        if (!err) {
+            err = WaitOne(&nq, ctx->logger);
+        }
+        if (err) {
+            return err;
+        }
+    }
+    ctx->Stop();
+
+    return 0;
+}
+
+// returns 0 or -errno
+static int CreateSocketPair(int sv[2], Logger* logger) {
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+        logger_error(logger, "create socket pair failed: [%s].",
+                     strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
+/** @brief writes to a socket pair, whose peer is drained once per batch */
+int BenchQueueWrite(Context* ctx) {
+    NotificationQueueImpl nq;
+    int err = InitQueue(&nq, ctx->logger);
+    if (err) {
+        return err;
+    }
+
+    int sv[2];
+    err = CreateSocketPair(sv, ctx->logger);
+    if (err) {
+        return err;
+    }
+
+    char msg[MSG_SIZE];
+    memset(msg, 'x', MSG_SIZE);
+    static char buf[MSG_SIZE * BATCH_SIZE];
+
+    ctx->Start();
+    for (uint64_t i = 0; i < ctx->nr_ops; ++i) {
+        err = nq.WriteAsync(sv[0], msg, MSG_SIZE, &nq);
+        if (!err) {
+            err = WaitOne(&nq, ctx->logger);
+        }
+        if (!err && (i + 1) % BATCH_SIZE == 0) {
+            err = ReadAll(sv[1], buf, sizeof(buf));
+        }
+        if (err) {
+            goto end;
+        }
+    }
+    ctx->Stop();
+
+end:
+    close(sv[0]);
+    close(sv[1]);
+    return err;
+}
+
+/** @brief reads from a socket pair, whose peer is filled once per batch */
+int BenchQueueRead(Context* ctx) {
+    NotificationQueueImpl nq;
+    int err = InitQueue(&nq, ctx->logger);
+    if (err) {
+        return err;
+    }
+
+    int sv[2];
+    err = CreateSocketPair(sv, ctx->logger);
+    if (err) {
+        return err;
+    }
+
+    char msg[MSG_SIZE];
+    static char buf[MSG_SIZE * BATCH_SIZE];
+    memset(buf, 'x', sizeof(buf));
+
+    ctx->Start();
+    for (uint64_t i = 0; i < ctx->nr_ops; ++i) {
+        if (i % BATCH_SIZE == 0) {
+            if (write(sv[1], buf, sizeof(buf)) != sizeof(buf)) {
+                err = -errno;
+                logger_error(ctx->logger, "fill peer failed: [%s].",
+                             strerror(errno));
+                goto end;
+            }
+        }
+        err = nq.ReadAsync(sv[0], msg, MSG_SIZE, &nq);
+        if (!err) {
+            err = WaitOne(&nq, ctx->logger);
+        }
+        if (err) {
+            goto end;
+        }
+    }
+    ctx->Stop();
+
+end:
+    close(sv[0]);
+    close(sv[1]);
+    return err;
+}
+
+}}
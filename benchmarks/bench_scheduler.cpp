@@ -0,0 +1,88 @@
+#include "bench.h"
+#include "netkit/scheduler.h"
+#include "netkit/iouring/notification_queue_impl.h"
+#include <string.h> // strerror()
+#include <thread>
+using namespace std;
+using namespace netkit::iouring;
+
+namespace netkit { namespace bench {
+
+// sends each notification back to the queue given as its tag
+static void EchoLoop(NotificationQueue* nq, Logger* logger) {
+    while (true) {
+        EventResult res;
+        void* tag = nullptr;
+        int err = nq->Next(&res, &tag, nullptr);
+        if (err) {
+            logger_error(logger, "get event failed: [%s].", strerror(-err));
+            break;
+        }
+        if (!tag) {
+            break;
+        }
+
+        auto origin = (NotificationQueue*)tag;
+        err = nq->NotifyAsync(origin, 0, tag);
+        if (err) {
+            logger_error(logger, "notify back failed: [%s].", strerror(-err));
+            break;
+        }
+    }
+}
+
+/**
+   @brief `Scheduler::Schedule()` to a worker ring, which notifies back. an
+   operation is a round trip of two messages between threads.
+*/
+int BenchScheduleRoundTrip(Context* ctx) {
+    NotificationQueueImpl nq;
+    int err = nq.Init(NotificationQueueImpl::Options(), ctx->logger);
+    if (err) {
+        logger_error(ctx->logger, "init queue failed: [%s].", strerror(-err));
+        return err;
+    }
+
+    vector<unique_ptr<NotificationQueue>> worker_nq_list;
+    auto worker_nq = new NotificationQueueImpl();
+    if (!worker_nq) {
+        return -ENOMEM;
+    }
+    worker_nq_list.emplace_back(worker_nq);
+    err = worker_nq->Init(NotificationQueueImpl::Options(), ctx->logger);
+    if (err) {
+        logger_error(ctx->logger, "init worker queue failed: [%s].",
+                     strerror(-err));
+        return err;
+    }
+
+    Scheduler sched(&worker_nq_list);
+    thread worker(EchoLoop, worker_nq, ctx->logger);
+
+    ctx->Start();
+    for (uint64_t i = 0; i < ctx->nr_ops; ++i) {
+        err = sched.Schedule(0, &nq, &nq);
+        if (err) {
+            logger_error(ctx->logger, "schedule failed: [%s].",
+                         strerror(-err));
+            break;
+        }
+
+        EventResult res;
+        void* tag;
+        err = nq.Next(&res, &tag, nullptr);
+        if (err) {
+            logger_error(ctx->logger, "get event failed: [%s].",
+                         strerror(-err));
+            break;
+        }
+    }
+    ctx->Stop();
+
+    // stops the worker
+    nq.NotifyAsync(worker_nq, 0, nullptr);
+    worker.join();
+    return err;
+}
+
+}}
@@ -0,0 +1,94 @@
+#include "bench.h"
+#include "netkit/send_context.h"
+#include "netkit/iouring/notification_queue_impl.h"
+#include "event_dispatcher.h"
+#include <string.h> // strerror()
+#include <unistd.h>
+#include <sys/socket.h>
+using namespace std;
+using namespace netkit::iouring;
+
+#define MSG_SIZE 64
+// messages sent before the peer is drained, within the socket buffer
+#define BATCH_SIZE 256
+
+namespace netkit { namespace bench {
+
+/**
+   @brief `SendContext::Emit()` on an idle connection, which launches a
+   sender, and the write completion dispatched to it.
+*/
+int BenchEmitSend(Context* ctx) {
+    NotificationQueueImpl nq;
+    int err = nq.Init(NotificationQueueImpl::Options(), ctx->logger);
+    if (err) {
+        logger_error(ctx->logger, "init queue failed: [%s].", strerror(-err));
+        return err;
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+        logger_error(ctx->logger, "create socket pair failed: [%s].",
+                     strerror(errno));
+        return -errno;
+    }
+
+    // takes `sv[0]`
+    ConnectionPtr conn = Connection::Create(sv[0]);
+    if (!conn) {
+        close(sv[0]);
+        close(sv[1]);
+        return -ENOMEM;
+    }
+
+    HandleTable table;
+    HandleTable::SetCurrent(&table);
+
+    char msg[MSG_SIZE];
+    memset(msg, 'x', MSG_SIZE);
+    static char buf[MSG_SIZE * BATCH_SIZE];
+
+    ctx->Start();
+    for (uint64_t i = 0; i < ctx->nr_ops; ++i) {
+        {
+            Buffer b;
+            err = b.Assign(msg, MSG_SIZE);
+            if (err) {
+                goto end;
+            }
+
+            SendContext sc(conn.get(), &nq, ctx->logger);
+            err = sc.Emit(std::move(b));
+            if (err) {
+                logger_error(ctx->logger, "emit failed: [%s].",
+                             strerror(-err));
+                goto end;
+            }
+        }
+
+        EventResult res;
+        void* tag;
+        err = nq.Next(&res, &tag, nullptr);
+        if (err) {
+            logger_error(ctx->logger, "get event failed: [%s].",
+                         strerror(-err));
+            goto end;
+        }
+        EventDispatcher::Dispatch(tag, res, &nq);
+
+        if ((i + 1) % BATCH_SIZE == 0) {
+            err = ReadAll(sv[1], buf, sizeof(buf));
+            if (err) {
+                goto end;
+            }
+        }
+    }
+    ctx->Stop();
+
+end:
+    HandleTable::SetCurrent(nullptr);
+    close(sv[1]);
+    return err;
+}
+
+}}
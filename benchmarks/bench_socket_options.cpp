@@ -0,0 +1,109 @@
+#include "echo_fixture.h"
+using namespace std;
+
+#define SMALL_SIZE 64
+#define LARGE_SIZE (256 * 1024)
+
+namespace netkit { namespace bench {
+
+// echoes in two writes, which is where Nagle's algorithm waits for an ack
+class SplitEchoTask final : public Task {
+public:
+    SplitEchoTask(Logger* l) : Task(l) {}
+    void Run(SendContext* ctx) override {
+        const uint64_t half = m_buffer.size() / 2;
+        Buffer first, second;
+        if (first.Assign(m_buffer.data(), half) != 0 ||
+            second.Assign(m_buffer.data() + half, m_buffer.size() - half) !=
+                0) {
+            logger_error(m_logger, "allocate buffer failed.");
+            return;
+        }
+        ctx->Emit(std::move(first));
+        ctx->Emit(std::move(second));
+    }
+};
+
+enum Case {
+    DEFAULT,
+    NODELAY,
+    NODELAY_NOTSENT_LOWAT,
+    CASE_NUM,
+};
+
+// returns -errno or the port of the server of `c`. servers of all cases are
+// started together in one manager shared by all runs.
+static int GetServerPort(Case c, Logger* logger) {
+    static int port_list[CASE_NUM] = {0};
+    if (port_list[c] != 0) {
+        return port_list[c];
+    }
+
+    // the loop never returns, so the manager lives until the process exits
+    auto mgr = new EventManager(logger);
+    int err = mgr->Init(EventManager::Options());
+    if (err) {
+        logger_error(logger, "init manager failed: [%s].", strerror(-err));
+        return err;
+    }
+
+    int new_port_list[CASE_NUM];
+    for (int i = 0; i < CASE_NUM; ++i) {
+        TcpServer::Options options;
+        if (i != DEFAULT) {
+            options.client.socket.tcp_nodelay = true;
+        }
+        if (i == NODELAY_NOTSENT_LOWAT) {
+            options.client.socket.notsent_lowat = 16 * 1024;
+        }
+
+        TcpServerPtr svr(new EchoServer<SplitEchoTask>(logger));
+        int port = AddEchoServer(mgr, std::move(svr), options,
+                                 (i == CASE_NUM - 1), logger);
+        if (port < 0) {
+            return port;
+        }
+        new_port_list[i] = port;
+    }
+
+    // published after the loop is started by the last one
+    memcpy(port_list, new_port_list, sizeof(port_list));
+    return port_list[c];
+}
+
+static int BenchSplitEcho(Context* ctx, Case c, uint32_t size) {
+    int port = GetServerPort(c, ctx->logger);
+    if (port < 0) {
+        return port;
+    }
+    return MeasureEcho(ctx, port, 1, size);
+}
+
+/**
+   @brief responses written in two parts by one client at a time, with the
+   default options of accepted sockets. an operation is one round trip.
+*/
+int BenchSocketDefaultSmall(Context* ctx) {
+    return BenchSplitEcho(ctx, DEFAULT, SMALL_SIZE);
+}
+int BenchSocketDefaultLarge(Context* ctx) {
+    return BenchSplitEcho(ctx, DEFAULT, LARGE_SIZE);
+}
+
+/** @brief like the default ones, with `tcp_nodelay` set */
+int BenchSocketNodelaySmall(Context* ctx) {
+    return BenchSplitEcho(ctx, NODELAY, SMALL_SIZE);
+}
+int BenchSocketNodelayLarge(Context* ctx) {
+    return BenchSplitEcho(ctx, NODELAY, LARGE_SIZE);
+}
+
+/** @brief like the default ones, with `tcp_nodelay` and `notsent_lowat` set */
+int BenchSocketNotsentLowatSmall(Context* ctx) {
+    return BenchSplitEcho(ctx, NODELAY_NOTSENT_LOWAT, SMALL_SIZE);
+}
+int BenchSocketNotsentLowatLarge(Context* ctx) {
+    return BenchSplitEcho(ctx, NODELAY_NOTSENT_LOWAT, LARGE_SIZE);
+}
+
+}}
@@ -0,0 +1,150 @@
+#include "bench.h"
+#include "netkit/event_manager.h"
+#include "netkit/utils.h"
+#include <atomic>
+#include <string.h> // strerror()
+#include <thread>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+using namespace std;
+
+#define REQ_SIZE 16
+// requests written at once
+#define BATCH_SIZE 1024
+
+namespace netkit { namespace bench {
+
+static atomic<uint64_t> g_nr_tasks = {0};
+
+class CountTask final : public Task {
+public:
+    CountTask(Logger* l) : Task(l) {}
+    void Run(SendContext*) override {
+        g_nr_tasks.fetch_add(1, memory_order_relaxed);
+    }
+};
+
+class FixedSizeClient final : public TcpClient {
+public:
+    FixedSizeClient(Logger* l) : TcpClient(l) {}
+    int OnConnected(SendContext*) override {
+        return 0;
+    }
+    void OnDisconnected() override {}
+    ReqStat Check(const Buffer& req, uint32_t* size) override {
+        if (req.size() < REQ_SIZE) {
+            *size = REQ_SIZE - req.size();
+            return ReqStat::MORE_DATA;
+        }
+        *size = REQ_SIZE;
+        return ReqStat::VALID;
+    }
+    TaskPtr CreateTask() override {
+        return TaskPtr(new CountTask(m_logger));
+    }
+};
+
+class FixedSizeServer final : public TcpServer {
+public:
+    FixedSizeServer(Logger* l) : TcpServer(l) {}
+    TcpClientPtr CreateClient() override {
+        return TcpClientPtr(new FixedSizeClient(m_logger));
+    }
+};
+
+// returns -errno or the port of a single-thread server shared by all runs
+static int GetServerPort(Logger* logger) {
+    static int port = 0;
+    if (port != 0) {
+        return port;
+    }
+
+    EventManager::Options options;
+    options.single_thread = true;
+
+    // the loop never returns, so the manager lives until the process exits
+    auto mgr = new EventManager(logger);
+    int err = mgr->Init(options);
+    if (err) {
+        logger_error(logger, "init manager failed: [%s].", strerror(-err));
+        return err;
+    }
+
+    int fd = mgr->AddTcpServer("127.0.0.1", 0,
+                               TcpServerPtr(new FixedSizeServer(logger)));
+    if (fd < 0) {
+        logger_error(logger, "add server failed: [%s].", strerror(-fd));
+        return fd;
+    }
+
+    SocketAddr addr;
+    utils::GetLocalAddr(fd, &addr);
+
+    thread(&EventManager::Loop, mgr).detach();
+    port = addr.GetPort();
+    return port;
+}
+
+/**
+   @brief requests pipelined over loopback are read, checked and run inline by
+   `TcpClient`. an operation is one request, with syscalls amortized by
+   batching.
+*/
+int BenchTcpClientDispatch(Context* ctx) {
+    int port = GetServerPort(ctx->logger);
+    if (port < 0) {
+        return port;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        int err = -errno;
+        logger_error(ctx->logger, "connect failed: [%s].", strerror(errno));
+        close(fd);
+        return err;
+    }
+
+    static char buf[REQ_SIZE * BATCH_SIZE];
+    memset(buf, 'x', sizeof(buf));
+    const uint64_t target = g_nr_tasks.load(memory_order_relaxed) +
+        ctx->nr_ops;
+
+    int err = 0;
+    ctx->Start();
+    for (uint64_t i = 0; i < ctx->nr_ops; i += BATCH_SIZE) {
+        const uint64_t nr = min<uint64_t>(BATCH_SIZE, ctx->nr_ops - i);
+        const char* data = buf;
+        uint64_t sz = nr * REQ_SIZE;
+        while (sz > 0) {
+            ssize_t ret = write(fd, data, sz);
+            if (ret < 0) {
+                err = -errno;
+                logger_error(ctx->logger, "write failed: [%s].",
+                             strerror(errno));
+                goto end;
+            }
+            data += ret;
+            sz -= ret;
+        }
+    }
+    while (g_nr_tasks.load(memory_order_relaxed) < target) {
+        this_thread::yield();
+    }
+    ctx->Stop();
+
+end:
+    close(fd);
+    return err;
+}
+
+}}
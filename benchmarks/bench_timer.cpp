@@ -0,0 +1,85 @@
+#include "bench.h"
+#include "netkit/send_context.h"
+#include "netkit/iouring/notification_queue_impl.h"
+#include "event_dispatcher.h"
+#include <string.h> // strerror()
+#include <unistd.h>
+#include <sys/socket.h>
+using namespace std;
+using namespace netkit::iouring;
+
+namespace netkit { namespace bench {
+
+class OneShotTimer final : public Timer {
+public:
+    OneShotTimer(bool* is_fired, Logger* l) : Timer(l), m_is_fired(is_fired) {}
+    bool OnExpiration(int, SendContext*) override {
+        *m_is_fired = true;
+        return false;
+    }
+
+private:
+    bool* m_is_fired;
+};
+
+/**
+   @brief `SendContext::AddTimer()` with an interval of 1us, and the first
+   expiration dispatched to the timer, which then goes away.
+*/
+int BenchTimerArmFire(Context* ctx) {
+    NotificationQueueImpl nq;
+    int err = nq.Init(NotificationQueueImpl::Options(), ctx->logger);
+    if (err) {
+        logger_error(ctx->logger, "init queue failed: [%s].", strerror(-err));
+        return err;
+    }
+
+    // timers are attached to a connection, whose socket is never used here
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -errno;
+    }
+    ConnectionPtr conn = Connection::Create(fd);
+    if (!conn) {
+        close(fd);
+        return -ENOMEM;
+    }
+
+    HandleTable table;
+    HandleTable::SetCurrent(&table);
+
+    const TimeVal interval = {0, 1};
+
+    ctx->Start();
+    for (uint64_t i = 0; i < ctx->nr_ops; ++i) {
+        bool is_fired = false;
+        {
+            SendContext sc(conn.get(), &nq, ctx->logger);
+            int ret = sc.AddTimer(
+                interval, TimerPtr(new OneShotTimer(&is_fired, ctx->logger)));
+            if (ret < 0) {
+                err = ret;
+                goto end;
+            }
+        }
+
+        while (!is_fired) {
+            EventResult res;
+            void* tag;
+            err = nq.Next(&res, &tag, nullptr);
+            if (err) {
+                logger_error(ctx->logger, "get event failed: [%s].",
+                             strerror(-err));
+                goto end;
+            }
+            EventDispatcher::Dispatch(tag, res, &nq);
+        }
+    }
+    ctx->Stop();
+
+end:
+    HandleTable::SetCurrent(nullptr);
+    return err;
+}
+
+}}
@@ -0,0 +1,210 @@
+#ifndef __NETKIT_BENCHMARKS_ECHO_FIXTURE_H__
+#define __NETKIT_BENCHMARKS_ECHO_FIXTURE_H__
+
+#include "bench.h"
+#include "netkit/event_manager.h"
+#include "netkit/utils.h"
+#include <algorithm>
+#include <string.h> // memset()/strerror()
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <arpa/inet.h>
+
+namespace netkit { namespace bench {
+
+class EchoTask final : public Task {
+public:
+    EchoTask(Logger* l) : Task(l) {}
+    void Run(SendContext* ctx) override {
+        ctx->Emit(std::move(m_buffer));
+    }
+};
+
+/** @brief treats whatever is read as one request, handled by `TaskType` */
+template <typename TaskType = EchoTask>
+class EchoClient final : public TcpClient {
+public:
+    EchoClient(Logger* l) : TcpClient(l) {}
+    int OnConnected(SendContext*) override {
+        return 0;
+    }
+    void OnDisconnected() override {}
+    ReqStat Check(const Buffer& req, uint32_t* size) override {
+        *size = req.size();
+        return ReqStat::VALID;
+    }
+    TaskPtr CreateTask() override {
+        return TaskPtr(new TaskType(m_logger));
+    }
+};
+
+template <typename TaskType = EchoTask>
+class EchoServer final : public TcpServer {
+public:
+    EchoServer(Logger* l) : TcpServer(l) {}
+    TcpClientPtr CreateClient() override {
+        return TcpClientPtr(new EchoClient<TaskType>(m_logger));
+    }
+};
+
+/* ------------------------------------------------------------------------- */
+
+/**
+   @brief returns -errno or the port of `svr` listening on 127.0.0.1. the loop
+   of `mgr` is started if `start_loop` is true, and never returns, so `mgr`
+   must live until the process exits. `listener_per_worker` is not supported
+   because no fd is returned to look up the port.
+*/
+inline int AddEchoServer(EventManager* mgr, TcpServerPtr svr,
+                         const TcpServer::Options& options, bool start_loop,
+                         Logger* logger) {
+    if (options.listener_per_worker) {
+        return -EINVAL;
+    }
+
+    int fd = mgr->AddTcpServer("127.0.0.1", 0, std::move(svr), options);
+    if (fd < 0) {
+        logger_error(logger, "add server failed: [%s].", strerror(-fd));
+        return fd;
+    }
+
+    SocketAddr addr;
+    utils::GetLocalAddr(fd, &addr);
+
+    if (start_loop) {
+        std::thread(&EventManager::Loop, mgr).detach();
+    }
+    return addr.GetPort();
+}
+
+// returns -errno or the fd connected to `port` on the loopback interface
+inline int Connect(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    // only the options of the server side make a difference
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        int err = -errno;
+        close(fd);
+        return err;
+    }
+
+    return fd;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/**
+   @brief sends `size` bytes through `fd` and waits for them to be echoed,
+   `nr_rounds` times. latency of each round is appended to `nsec_list`.
+   returns 0 or -errno.
+*/
+inline int EchoRounds(int fd, uint32_t size, uint64_t nr_rounds,
+                      std::vector<uint64_t>* nsec_list) {
+    std::vector<char> req(size, 'x'), res(size);
+    for (uint64_t i = 0; i < nr_rounds; ++i) {
+        const uint64_t begin = GetNowNsec();
+        int err = WriteAll(fd, req.data(), size);
+        if (!err) {
+            err = ReadAll(fd, res.data(), size);
+        }
+        if (err) {
+            return err;
+        }
+        nsec_list->push_back(GetNowNsec() - begin);
+    }
+    return 0;
+}
+
+/**
+   @brief `ctx->nr_ops` round trips of `size` bytes through `nr_clients`
+   connections to `port` at the same time, one thread each. an operation is
+   one round trip, and p50/p99 of their latencies are reported. allocations
+   per operation are also reported if `count_allocs` is true. returns 0 or
+   -errno.
+*/
+inline int MeasureEcho(Context* ctx, uint16_t port, uint32_t nr_clients,
+                       uint32_t size, bool count_allocs = false) {
+    std::vector<int> fd_list;
+    for (uint32_t i = 0; i < nr_clients; ++i) {
+        int fd = Connect(port);
+        if (fd < 0) {
+            logger_error(ctx->logger, "connect to port [%u] failed: [%s].",
+                         port, strerror(-fd));
+            for (auto f : fd_list) {
+                close(f);
+            }
+            return fd;
+        }
+        fd_list.push_back(fd);
+    }
+
+    // connections and buffers are set up before timing
+    std::vector<std::vector<uint64_t>> nsec_lists(nr_clients);
+    std::vector<uint64_t> nr_rounds_list(nr_clients, ctx->nr_ops / nr_clients);
+    nr_rounds_list[0] += ctx->nr_ops % nr_clients;
+    for (uint32_t i = 0; i < nr_clients; ++i) {
+        nsec_lists[i].reserve(nr_rounds_list[i]);
+    }
+    std::vector<int> err_list(nr_clients, 0);
+    std::vector<std::thread> thread_list;
+    thread_list.reserve(nr_clients);
+
+    if (count_allocs) {
+        StartCountingAllocs();
+    }
+    ctx->Start();
+    for (uint32_t i = 0; i < nr_clients; ++i) {
+        thread_list.emplace_back([&, i]() -> void {
+            err_list[i] = EchoRounds(fd_list[i], size, nr_rounds_list[i],
+                                     &nsec_lists[i]);
+        });
+    }
+    for (auto& t : thread_list) {
+        t.join();
+    }
+    ctx->Stop();
+    if (count_allocs) {
+        uint64_t nr_allocs, nr_bytes;
+        StopCountingAllocs(&nr_allocs, &nr_bytes);
+        // creating client threads costs a few allocations, too
+        ctx->SetMetric("allocs_per_op", (double)nr_allocs / ctx->nr_ops);
+    }
+
+    for (auto fd : fd_list) {
+        close(fd);
+    }
+    for (auto err : err_list) {
+        if (err) {
+            logger_error(ctx->logger, "echo failed: [%s].", strerror(-err));
+            return err;
+        }
+    }
+
+    std::vector<uint64_t> nsec_list;
+    nsec_list.reserve(ctx->nr_ops);
+    for (auto& l : nsec_lists) {
+        nsec_list.insert(nsec_list.end(), l.begin(), l.end());
+    }
+    std::sort(nsec_list.begin(), nsec_list.end());
+    ctx->SetMetric("p50_us", nsec_list[nsec_list.size() / 2] / 1000.0);
+    ctx->SetMetric("p99_us", nsec_list[nsec_list.size() * 99 / 100] / 1000.0);
+    return 0;
+}
+
+}}
+
+#endif
@@ -0,0 +1,236 @@
+#include "bench.h"
+#include "logger/stdout_logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring> // strerror()
+#include <vector>
+#include <pthread.h>
+#include <sched.h> // cpu_set_t
+#include <unistd.h> // getopt()/dup()/dup2()
+using namespace std;
+using namespace netkit::bench;
+
+namespace netkit { namespace bench {
+
+int BenchFramerDelimiterNaive(Context*);
+int BenchFramerDelimiter(Context*);
+int BenchFramerLengthField(Context*);
+int BenchFramerVarint(Context*);
+int BenchConnectionCreateLegacy(Context*);
+int BenchConnectionCreate(Context*);
+int BenchConnectionRefcountLegacy(Context*);
+int BenchConnectionRefcount(Context*);
+int BenchConnectionRefcountLegacyShared(Context*);
+int BenchConnectionRefcountShared(Context*);
+int BenchSocketDefaultSmall(Context*);
+int BenchSocketDefaultLarge(Context*);
+int BenchSocketNodelaySmall(Context*);
+int BenchSocketNodelayLarge(Context*);
+int BenchSocketNotsentLowatSmall(Context*);
+int BenchSocketNotsentLowatLarge(Context*);
+int BenchEchoThreaded(Context*);
+int BenchEchoInline(Context*);
+#ifdef NETKIT_BENCH_CORO
+int BenchEchoCallback(Context*);
+int BenchEchoCoroutine(Context*);
+#endif
+int BenchQueueNotify(Context*);
+int BenchQueueWrite(Context*);
+int BenchQueueRead(Context*);
+int BenchScheduleRoundTrip(Context*);
+int BenchEmitSend(Context*);
+int BenchTcpClientDispatch(Context*);
+int BenchBufferAppend(Context*);
+int BenchBufferReserve(Context*);
+int BenchTimerArmFire(Context*);
+int BenchLoopbackEchoRoundTrip(Context*);
+
+}}
+
+struct BenchInfo final {
+    const char* name;
+    Func func;
+    uint64_t nr_ops; // of one run with the default scale
+};
+
+static const BenchInfo g_bench_list[] = {
+    {"framer_delimiter_naive", BenchFramerDelimiterNaive, 100000},
+    {"framer_delimiter", BenchFramerDelimiter, 100000},
+    {"framer_length_field_u32be", BenchFramerLengthField, 50000},
+    {"framer_varint", BenchFramerVarint, 50000},
+    {"connection_create_legacy", BenchConnectionCreateLegacy, 10000},
+    {"connection_create", BenchConnectionCreate, 10000},
+    {"connection_refcount_legacy", BenchConnectionRefcountLegacy, 1000000},
+    {"connection_refcount", BenchConnectionRefcount, 1000000},
+    {"connection_refcount_legacy_shared", BenchConnectionRefcountLegacyShared,
+     4000000},
+    {"connection_refcount_shared", BenchConnectionRefcountShared, 4000000},
+    {"socket_default_small", BenchSocketDefaultSmall, 100},
+    {"socket_default_large", BenchSocketDefaultLarge, 100},
+    {"socket_nodelay_small", BenchSocketNodelaySmall, 100},
+    {"socket_nodelay_large", BenchSocketNodelayLarge, 100},
+    {"socket_notsent_lowat_small", BenchSocketNotsentLowatSmall, 100},
+    {"socket_notsent_lowat_large", BenchSocketNotsentLowatLarge, 100},
+    {"echo_threaded", BenchEchoThreaded, 80000},
+    {"echo_inline", BenchEchoInline, 80000},
+#ifdef NETKIT_BENCH_CORO
+    {"echo_callback", BenchEchoCallback, 80000},
+    {"echo_coroutine", BenchEchoCoroutine, 80000},
+#endif
+    {"queue_notify", BenchQueueNotify, 200000},
+    {"queue_write", BenchQueueWrite, 200000},
+    {"queue_read", BenchQueueRead, 200000},
+    {"schedule_round_trip", BenchScheduleRoundTrip, 100000},
+    {"emit_send", BenchEmitSend, 200000},
+    {"tcp_client_dispatch", BenchTcpClientDispatch, 1000000},
+    {"buffer_append", BenchBufferAppend, 10000000},
+    {"buffer_reserve", BenchBufferReserve, 10000000},
+    {"timer_arm_fire", BenchTimerArmFire, 20000},
+    {"loopback_echo_round_trip", BenchLoopbackEchoRoundTrip, 100000},
+};
+
+static void PrintUsage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-r runs] [-s scale] [-c cpu] [name_substring...]\n"
+            "  -r  timed runs of each benchmark, default 5\n"
+            "  -s  multiplies the number of operations per run, default 1\n"
+            "  -c  pins the benchmarking thread to `cpu`\n"
+            "results are printed to stdout as one JSON object per line, and\n"
+            "logs to stderr.\n",
+            prog);
+}
+
+static bool IsSelected(const char* name, int argc, char* argv[]) {
+    if (argc == 0) {
+        return true;
+    }
+    for (int i = 0; i < argc; ++i) {
+        if (strstr(name, argv[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// results are printed here, and everything else written to stdout, e.g. by
+// the logger, goes to stderr
+static FILE* g_result_fp = nullptr;
+
+// returns 0 or -errno
+static int Measure(const BenchInfo& info, uint32_t nr_runs, double scale,
+                   Logger* logger) {
+    const uint64_t nr_ops = max<uint64_t>(info.nr_ops * scale, 1);
+
+    // warms up caches, pools and lazily created objects
+    Context warmup(max<uint64_t>(nr_ops / 10, 1), logger);
+    int err = info.func(&warmup);
+    if (err) {
+        fprintf(stderr, "benchmark [%s] failed: [%s].\n", info.name,
+                strerror(-err));
+        return err;
+    }
+
+    vector<double> nsec_list; // per operation
+    nsec_list.reserve(nr_runs);
+    vector<Context::Metric> metric_list; // of the last run
+    for (uint32_t i = 0; i < nr_runs; ++i) {
+        Context ctx(nr_ops, logger);
+        err = info.func(&ctx);
+        if (err) {
+            fprintf(stderr, "benchmark [%s] failed: [%s].\n", info.name,
+                    strerror(-err));
+            return err;
+        }
+        nsec_list.push_back((double)ctx.GetElapsedNsec() / nr_ops);
+        metric_list.clear();
+        for (uint32_t j = 0; j < ctx.GetMetricNum(); ++j) {
+            metric_list.push_back(ctx.GetMetric(j));
+        }
+    }
+
+    sort(nsec_list.begin(), nsec_list.end());
+    const double median = nsec_list[nsec_list.size() / 2];
+    fprintf(g_result_fp,
+            "{\"name\":\"%s\",\"ops\":%lu,\"runs\":%u,"
+            "\"ns_per_op_min\":%.2f,\"ns_per_op_median\":%.2f,"
+            "\"ns_per_op_max\":%.2f,\"ops_per_sec\":%.0f",
+            info.name, nr_ops, nr_runs, nsec_list.front(), median,
+            nsec_list.back(), 1e9 / median);
+    for (auto& metric : metric_list) {
+        fprintf(g_result_fp, ",\"%s\":%.2f", metric.name, metric.value);
+    }
+    fprintf(g_result_fp, "}\n");
+    fflush(g_result_fp);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t nr_runs = 5;
+    double scale = 1;
+    int cpu = -1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:s:c:h")) != -1) {
+        switch (opt) {
+            case 'r':
+                nr_runs = atoi(optarg);
+                break;
+            case 's':
+                scale = atof(optarg);
+                break;
+            case 'c':
+                cpu = atoi(optarg);
+                break;
+            default:
+                PrintUsage(argv[0]);
+                return -1;
+        }
+    }
+    if (nr_runs == 0 || scale <= 0) {
+        PrintUsage(argv[0]);
+        return -1;
+    }
+
+    if (cpu >= 0) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpu, &cpu_set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set),
+                                         &cpu_set);
+        if (err) {
+            fprintf(stderr, "pin to cpu [%d] failed: [%s].\n", cpu,
+                    strerror(err));
+            return -1;
+        }
+    }
+
+    // results keep the original stdout, which is then pointed to stderr
+    int result_fd = dup(STDOUT_FILENO);
+    if (result_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+        fprintf(stderr, "redirect stdout failed: [%s].\n", strerror(errno));
+        return -1;
+    }
+    g_result_fp = fdopen(result_fd, "w");
+    if (!g_result_fp) {
+        fprintf(stderr, "fdopen() failed: [%s].\n", strerror(errno));
+        return -1;
+    }
+
+    // logs go to stderr, so they never mix with results
+    StdoutLogger logger;
+    stdout_logger_init(&logger);
+
+    int rc = 0;
+    for (auto& info : g_bench_list) {
+        if (!IsSelected(info.name, argc - optind, argv + optind)) {
+            continue;
+        }
+        if (Measure(info, nr_runs, scale, &logger.l) != 0) {
+            rc = -1;
+        }
+    }
+
+    return rc;
+}
@@ -0,0 +1,37 @@
+#ifndef __NETKIT_ALLOCATOR_H__
+#define __NETKIT_ALLOCATOR_H__
+
+#include <stdint.h>
+
+namespace netkit {
+
+class Allocator {
+public:
+    virtual ~Allocator() = default;
+
+    /**
+       @brief allocates at least `size` bytes and sets `capacity` to the
+       number of usable bytes. returns nullptr if failed.
+    */
+    virtual void* Alloc(uint64_t size, uint64_t* capacity) = 0;
+
+    /** @brief `capacity` is the value returned by `Alloc()`. */
+    virtual void Free(void* ptr, uint64_t capacity) = 0;
+};
+
+/** @brief returns the allocator based on malloc()/free(). */
+Allocator* GetDefaultAllocator();
+
+/**
+   @brief sets the allocator used by all `Buffer`s, or restores the default one
+   if `nullptr` is given. it must be called before any `Buffer` allocates
+   memory, e.g. at the beginning of `main()`, and the allocator must outlive
+   all `Buffer`s.
+*/
+void SetBufferAllocator(Allocator*);
+
+Allocator* GetBufferAllocator();
+
+}
+
+#endif
@@ -1,78 +1,81 @@
 #ifndef __NETKIT_BUFFER_H__
 #define __NETKIT_BUFFER_H__
 
+#include "allocator.h"
 #include "cutils/qbuf.h"
 #include <stdint.h>
 
 namespace netkit {
 
+/** @brief memory is allocated by the allocator set by `SetBufferAllocator()`. */
 class Buffer final {
 public:
-    Buffer() {
-        qbuf_init(&m_data);
-    }
+    Buffer() {}
     ~Buffer() {
-        qbuf_destroy(&m_data);
+        Destroy();
     }
 
     Buffer(Buffer&& b) {
-        qbuf_move_construct(&b.m_data, &m_data);
-    }
-    Buffer(QBuf&& b) {
-        qbuf_move_construct(&b, &m_data);
+        DoMove(&b);
     }
 
     void operator=(Buffer&& b) {
-        qbuf_move(&b.m_data, &m_data);
-    }
-    void operator=(QBuf&& b) {
-        qbuf_move(&b, &m_data);
+        if (&b != this) {
+            Destroy();
+            DoMove(&b);
+        }
     }
 
     char* data() {
-        return (char*)qbuf_data(&m_data);
+        return m_data;
     }
     const char* data() const {
-        return (const char*)qbuf_data(&m_data);
+        return m_data;
     }
 
     uint64_t size() const {
-        return qbuf_size(&m_data);
-    }
-
-    bool IsEmpty() const {
-        return qbuf_empty(&m_data);
+        return m_size;
     }
 
-    int Reserve(uint64_t new_size) {
-        return qbuf_reserve(&m_data, new_size);
+    uint64_t capacity() const {
+        return m_capacity;
     }
 
-    int Resize(uint64_t new_size) {
-        return qbuf_resize(&m_data, new_size);
+    bool IsEmpty() const {
+        return (m_size == 0);
     }
 
-    int Assign(const char* data, uint64_t len) {
-        return qbuf_assign(&m_data, data, len);
-    }
+    int Reserve(uint64_t new_size);
+    int Resize(uint64_t new_size);
+    int Assign(const char* data, uint64_t len);
 
-    int Append(const char* data, uint64_t len) {
-        return qbuf_append(&m_data, data, len);
-    }
+    /**
+       @brief copies the content of `b`, which is then emptied. returns 0 or
+       -ENOMEM, in which case `b` is left unchanged.
+    */
+    int Assign(QBuf&& b);
+    int Append(const char* data, uint64_t len);
 
     int Append(const Buffer& b) {
         if (!b.IsEmpty()) {
-            return qbuf_append(&m_data, b.data(), b.size());
+            return Append(b.data(), b.size());
         }
         return 0;
     }
 
+    /** @brief sets size to 0 and keeps the allocated memory */
     void Clear() {
-        qbuf_clear(&m_data);
+        m_size = 0;
     }
 
 private:
-    QBuf m_data;
+    void Destroy();
+    void DoMove(Buffer*);
+
+private:
+    char* m_data = nullptr;
+    uint64_t m_size = 0;
+    uint64_t m_capacity = 0;
 
 private:
     Buffer(const Buffer&) = delete;
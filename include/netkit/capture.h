@@ -0,0 +1,55 @@
+#ifndef __NETKIT_CAPTURE_H__
+#define __NETKIT_CAPTURE_H__
+
+#include "logger/logger.h"
+#include <stdint.h>
+
+namespace netkit {
+
+/*
+  a capture file starts with `CAPTURE_MAGIC`, followed by records, each of
+  which is a `CaptureRecord` and `len` bytes of data. records are written in
+  batches of each thread, so they are in order within a thread, and readers
+  sort them by `nsec` to merge those of different threads.
+*/
+
+#define CAPTURE_MAGIC "NKCAP001"
+#define CAPTURE_MAGIC_LEN 8
+
+struct CaptureRecord final {
+    enum Type : uint32_t {
+        OPEN, // the connection is created
+        IN, // bytes read from the peer
+        OUT, // bytes written to the peer
+        CLOSE, // the reader of the connection is gone
+    };
+
+    static constexpr uint32_t TYPE_SHIFT = 30;
+    static constexpr uint32_t MAX_LEN = (1u << TYPE_SHIFT) - 1;
+
+    Type GetType() const {
+        return (Type)(type_len >> TYPE_SHIFT);
+    }
+    uint32_t GetLen() const {
+        return type_len & MAX_LEN;
+    }
+
+    uint64_t nsec; // CLOCK_MONOTONIC
+    uint32_t conn_id; // starts from 1
+    uint32_t type_len; // type in the top 2 bits
+};
+
+/**
+   @brief writes bytes read and written by `TcpClient`s initialized from now
+   on to `path`, which is truncated. it is meant for collecting traffic to
+   replay, and costs a copy per read and write, and a lock per batch of them,
+   while running. returns 0 or -errno.
+*/
+int StartCapture(const char* path, Logger*);
+
+/** @brief flushes and closes the capture file */
+void StopCapture();
+
+}
+
+#endif
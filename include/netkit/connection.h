@@ -2,37 +2,300 @@
 #define __NETKIT_CONNECTION_H__
 
 #include "send_item.h"
+#include "spin_lock.h"
 #include "endpoint_info.h"
 #include "logger/logger.h"
-#include <set>
 #include <atomic>
-#include <mutex>
-#include <queue>
+#include <functional>
+#include <stddef.h> // size_t
+#include <utility>
 
 namespace netkit {
 
-class Connection final {
-private:
-    std::atomic<uint32_t> m_is_valid = {1};
-    EndpointInfo m_info;
+class Timer;
+class Inbox;
+class SendContext;
+class ConnectionPtr;
+
+/**
+   @brief limits of the send queue of a connection. `Emit()` fails with
+   -ENOBUFS after the queue reaches any high mark, until the queue drains to
+   both low marks. 0 for a high mark means unlimited, and 0 for a low mark
+   means half of the high mark.
+*/
+struct SendWatermark final {
+    uint64_t high_bytes = 0;
+    uint64_t low_bytes = 0;
+    uint32_t high_items = 0;
+    uint32_t low_items = 0;
+};
+
+/**
+   @brief state shared by the reader, tasks, timers and the sender of a
+   connection. it is allocated from a per-thread pool and released when the
+   last `ConnectionPtr` is gone.
 
+   handlers that may outlive the current event own a `ConnectionPtr`. code
+   running inside a handler that is pinned by an in-flight operation, e.g.
+   `SendContext`, borrows a plain pointer instead.
+*/
+class alignas(64) Connection final {
 public:
-    Connection(int _fd) : fd(_fd) {}
-    ~Connection();
+    /** @brief returns an empty pointer if allocation fails */
+    static ConnectionPtr Create(int fd);
+
+    void AddRef() {
+        m_refcount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Release() {
+        if (m_refcount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
 
+    /**
+       @brief addresses are retrieved on the first successful call, except the
+       local one set by `SetLocalAddr()`. if they cannot be retrieved, the
+       remote address returned is empty, and the result is valid until the
+       next call in the same thread.
+    */
     const EndpointInfo& GetEndpointInfo();
+
+    /** @brief must be called before the connection is shared */
+    void SetLocalAddr(const SocketAddr& addr) {
+        m_info.local = addr;
+        m_has_local_addr = true;
+    }
+
     void ShutDown(Logger*);
 
     bool IsValid() const {
         return m_is_valid.load(std::memory_order_relaxed);
     }
 
+    /** @brief bytes used by read buffer, send queue and timers */
+    uint64_t GetMemoryUsage() const {
+        return m_mem_usage.load(std::memory_order_relaxed);
+    }
+
+    /** @brief `nr_bytes` can be negative to release memory */
+    void ChargeMemory(int64_t nr_bytes);
+
+    /**
+       @brief appends `item` to the send queue and sets `is_first` to true if
+       the queue was empty before. returns 0, or -ENOBUFS if the queue is over
+       its high watermark, in which case `item` is not added.
+    */
+    int PushSendItem(SendItem* item, bool* is_first);
+
+    /** @brief the first item in the send queue, or nullptr if it is empty */
+    SendItem* GetFrontSendItem();
+
+    /**
+       @brief gets at most `max` items from the front of the send queue.
+       returns the number of items.
+    */
+    uint32_t GetFrontSendItems(SendItem** item_list, uint32_t max);
+
+    /**
+       @brief removes the first item and returns the next one, or nullptr.
+       `is_writable` is set to true if the queue drains to the low watermark
+       after `PushSendItem()` failed.
+    */
+    SendItem* PopSendItem(bool* is_writable = nullptr);
+
+    /**
+       @brief used in ordered mode. appends the list [`head`, `tail`] emitted
+       by request `seq` to the send queue if all earlier requests are done, or
+       holds it in the reorder buffer until they are. `is_done` means request
+       `seq` emits nothing more, and the list can be empty. sets `is_first` to
+       true if the send queue was empty before and is not now. returns 0 or
+       -ENOMEM, in which case the list is not taken.
+    */
+    int CommitSendItems(uint64_t seq, SendItem* head, SendItem* tail,
+                        bool is_done, bool* is_first);
+
+    /** @brief set before the connection is shared */
+    void SetSendWatermark(const SendWatermark&);
+
+    /**
+       @brief the connection is only used in the thread reading requests, so
+       its lock is skipped. set before the connection is shared.
+    */
+    void SetSingleThread() {
+        m_is_single_thread = true;
+    }
+
+    bool IsSingleThread() const {
+        return m_is_single_thread;
+    }
+
+    /** @brief true if the send queue is over its high watermark */
+    bool IsSendBlocked() const {
+        return m_is_send_blocked.load(std::memory_order_relaxed);
+    }
+
+    /**
+       @brief `f` is called in the thread of the sender when the send queue
+       drains to its low watermark after `Emit()` failed with -ENOBUFS.
+    */
+    void SetOnWritable(const std::function<void(SendContext*)>& f);
+
+    /** @brief called by sender */
+    void NotifyWritable(SendContext*);
+
+    /**
+       @brief the reader pauses reading until `WakeReader()` dispatches `tag`
+       with a zero result in the thread of `inbox`. called by the reader only,
+       which has no operations in flight while paused.
+    */
+    void PauseReader(Inbox* inbox, void* tag);
+
+    /**
+       @brief called by the reader to take back the tag set by
+       `PauseReader()`. returns false if a wakeup is already on its way.
+    */
+    bool ResumeReader() {
+        return (m_reader_tag.exchange(nullptr, std::memory_order_acq_rel) !=
+                nullptr);
+    }
+
+    /** @brief thread-safe. returns 0 or -errno. */
+    int WakeReader();
+
+    // returns 0 or -ENOTCONN
+    int AttachTimer(Timer*);
+    void DetachTimer(Timer*);
+
+    static void* operator new(size_t) noexcept;
+    static void operator delete(void*, size_t);
+
+private:
+    Connection(int _fd) : fd(_fd) {}
+    ~Connection();
+
+public:
     const int fd;
-    std::mutex timer_lock;
-    std::set<int> timer_fds;
-    std::mutex send_lock;
+
+    /** @brief offset of the first item in the send queue. used by sender. */
     uint32_t send_offset = 0;
-    std::queue<SendItem> send_queue;
+
+    /**
+       @brief data emitted in a handler is sent after the handler returns. set
+       before the connection is shared.
+    */
+    bool auto_cork = false;
+
+    /**
+       @brief id in the capture file if bytes of this connection are
+       captured, or 0. see `StartCapture()`. set before the connection is
+       shared.
+    */
+    uint32_t capture_id = 0;
+
+private:
+    struct PendingResponse;
+    class LockGuard;
+
+    // appends without checking watermarks. called with `m_lock` held.
+    void AppendSendItems(SendItem* head, SendItem* tail);
+
+private:
+    // read-mostly or owned by one thread at a time
+    std::atomic<uint8_t> m_is_valid = {1};
+    std::atomic<bool> m_has_info = {false}; // `m_info` is filled
+    std::atomic<bool> m_is_send_blocked = {false};
+    std::atomic<uint32_t> m_refcount = {0};
+    std::atomic<uint64_t> m_mem_usage = {0};
+    SendWatermark m_watermark;
+    bool m_is_single_thread = false;
+    Inbox* m_reader_inbox = nullptr; // set before `m_reader_tag`
+    std::atomic<void*> m_reader_tag = {nullptr}; // set if the reader pauses
+
+    // written by all threads emitting data or adding timers
+    alignas(64) SpinLock m_lock; // protects the following members
+    SendItem* m_send_head = nullptr;
+    SendItem* m_send_tail = nullptr;
+    uint64_t m_send_bytes = 0;
+    uint32_t m_send_items = 0;
+    Timer* m_timer_list = nullptr;
+    bool m_is_waking_timers = false; // timers wait to be detached if set
+    std::function<void(SendContext*)> m_on_writable;
+    uint64_t m_commit_seq = 0; // the request whose responses go out now
+    PendingResponse* m_pending_list = nullptr; // sorted by seq
+
+    // rarely used
+    EndpointInfo m_info;
+    bool m_has_local_addr = false; // `m_info.local` is set before sharing
+
+private:
+    Connection(const Connection&) = delete;
+    Connection(Connection&&) = delete;
+    void operator=(const Connection&) = delete;
+    void operator=(Connection&&) = delete;
+};
+
+/** @brief an owning reference to a `Connection` */
+class ConnectionPtr final {
+public:
+    ConnectionPtr() {}
+
+    /** @brief takes a new reference of `c` */
+    explicit ConnectionPtr(Connection* c) : m_conn(c) {
+        if (c) {
+            c->AddRef();
+        }
+    }
+
+    ConnectionPtr(const ConnectionPtr& p) : ConnectionPtr(p.m_conn) {}
+    ConnectionPtr(ConnectionPtr&& p) : m_conn(p.m_conn) {
+        p.m_conn = nullptr;
+    }
+
+    ~ConnectionPtr() {
+        reset();
+    }
+
+    ConnectionPtr& operator=(const ConnectionPtr& p) {
+        if (p.m_conn != m_conn) {
+            ConnectionPtr tmp(p);
+            std::swap(m_conn, tmp.m_conn);
+        }
+        return *this;
+    }
+
+    ConnectionPtr& operator=(ConnectionPtr&& p) {
+        if (&p != this) {
+            reset();
+            m_conn = p.m_conn;
+            p.m_conn = nullptr;
+        }
+        return *this;
+    }
+
+    void reset() {
+        if (m_conn) {
+            m_conn->Release();
+            m_conn = nullptr;
+        }
+    }
+
+    Connection* get() const {
+        return m_conn;
+    }
+    Connection* operator->() const {
+        return m_conn;
+    }
+    Connection& operator*() const {
+        return *m_conn;
+    }
+    explicit operator bool() const {
+        return (m_conn != nullptr);
+    }
+
+private:
+    Connection* m_conn = nullptr;
 };
 
 }
@@ -0,0 +1,54 @@
+#ifndef __NETKIT_CONNECTION_HANDLE_H__
+#define __NETKIT_CONNECTION_HANDLE_H__
+
+#include "connection.h"
+#include <functional>
+
+namespace netkit {
+
+class Inbox;
+
+/**
+   @brief a reference to a connection usable in any thread, including threads
+   not created by netkit. it is obtained by `SendContext::GetHandle()`.
+*/
+class ConnectionHandle final {
+public:
+    ConnectionHandle() {}
+
+    /** @brief false if the handle is empty or the connection is closed */
+    bool IsValid() const {
+        return (m_conn && m_conn->IsValid());
+    }
+
+    /**
+       @brief thread-safe. queues data to be sent, and asks the thread which
+       created this handle to start sending if the send queue was empty.
+       returns 0 or -errno like `SendContext::Emit()`. data emitted here is
+       not ordered with responses of requests in ordered mode.
+
+       if the connection is single-threaded, the whole emitting is posted to
+       that thread, and later errors are passed to `on_complete`.
+    */
+    int Emit(Buffer&&, const std::function<void(int err)>& on_complete = {});
+
+    /**
+       @brief thread-safe. if the connection is single-threaded, shutting down
+       is posted to its thread like `Emit()`. returns 0 or -errno.
+    */
+    int ShutDown();
+
+private:
+    friend class SendContext;
+    ConnectionHandle(Connection* c, Inbox* inbox, Logger* l)
+        : m_conn(c), m_inbox(inbox), m_logger(l) {}
+
+private:
+    ConnectionPtr m_conn;
+    Inbox* m_inbox = nullptr;
+    Logger* m_logger = nullptr;
+};
+
+}
+
+#endif
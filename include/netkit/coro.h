@@ -0,0 +1,422 @@
+#ifndef __NETKIT_CORO_H__
+#define __NETKIT_CORO_H__
+
+#include <stddef.h> // size_t
+
+namespace netkit { namespace coro {
+
+/**
+   @brief coroutine frames come from the per-thread caches of the object pool,
+   so frames of coroutines running on one ring are recycled by that ring.
+   returns nullptr if failed.
+*/
+void* AllocFrame(size_t size);
+
+/** @brief `size` is the value passed to `AllocFrame()`. */
+void FreeFrame(void* ptr, size_t size);
+
+}}
+
+/*
+  the coroutine layer is optional and only available in C++20. the library
+  itself does not depend on it.
+*/
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+
+#include "event_handler.h"
+#include <coroutine>
+#include <exception> // std::terminate()
+#include <type_traits>
+#include <utility>
+#include <errno.h>
+
+namespace netkit { namespace coro {
+
+/**
+   @brief base of the awaitables below. an operation lives in the frame of the
+   awaiting coroutine and is the tag of the request, so the completion resumes
+   the coroutine directly in the thread of the ring without allocating
+   anything.
+*/
+class Operation : public EventHandler {
+public:
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept {
+        m_handle = h;
+        int err = Submit();
+        if (err) {
+            m_res = err;
+            return false;
+        }
+        // the coroutine may be resumed in another thread from now on
+        return true;
+    }
+
+    /** @brief see `NotificationQueue::Next()` for the meaning */
+    int await_resume() const noexcept {
+        return m_res;
+    }
+
+    bool Process(EventResult res, NotificationQueue*) override {
+        m_res = (res.err) ? -res.err : (int)res.val;
+        // `this` is gone if the coroutine finishes in `resume()`
+        m_handle.resume();
+        return true;
+    }
+
+    /** @brief owned by the coroutine frame */
+    void DeleteSelf() override {}
+
+protected:
+    Operation(NotificationQueue* nq) : m_nq(nq) {}
+
+    // returns 0 or -errno
+    virtual int Submit() = 0;
+
+protected:
+    NotificationQueue* m_nq;
+
+private:
+    std::coroutine_handle<> m_handle;
+    int m_res = 0;
+};
+
+class ReadOperation final : public Operation {
+public:
+    ReadOperation(NotificationQueue* nq, int fd, void* buf, uint64_t sz)
+        : Operation(nq), m_fd(fd), m_buf(buf), m_size(sz) {}
+
+private:
+    int Submit() override {
+        return m_nq->ReadAsync(m_fd, m_buf, m_size, this);
+    }
+
+private:
+    int m_fd;
+    void* m_buf;
+    uint64_t m_size;
+};
+
+class WriteOperation final : public Operation {
+public:
+    WriteOperation(NotificationQueue* nq, int fd, const void* buf, uint64_t sz)
+        : Operation(nq), m_fd(fd), m_buf(buf), m_size(sz) {}
+
+private:
+    int Submit() override {
+        return m_nq->WriteAsync(m_fd, m_buf, m_size, this);
+    }
+
+private:
+    int m_fd;
+    const void* m_buf;
+    uint64_t m_size;
+};
+
+class AcceptOperation final : public Operation {
+public:
+    AcceptOperation(NotificationQueue* nq, int fd) : Operation(nq), m_fd(fd) {}
+
+private:
+    int Submit() override {
+        return m_nq->AcceptAsync(m_fd, this, false);
+    }
+
+private:
+    int m_fd;
+};
+
+class ConnectOperation final : public Operation {
+public:
+    ConnectOperation(NotificationQueue* nq, int fd,
+                     const struct sockaddr* addr, socklen_t len)
+        : Operation(nq), m_fd(fd), m_addr(addr), m_len(len) {}
+
+private:
+    int Submit() override {
+        return m_nq->ConnectAsync(m_fd, m_addr, m_len, this);
+    }
+
+private:
+    int m_fd;
+    const struct sockaddr* m_addr;
+    socklen_t m_len;
+};
+
+class SleepOperation final : public Operation {
+public:
+    SleepOperation(NotificationQueue* nq, const TimeVal& timeout)
+        : Operation(nq), m_timeout(timeout) {}
+
+    // returns 0 or -errno
+    int await_resume() const noexcept {
+        int res = Operation::await_resume();
+        return (res == -ETIME) ? 0 : res;
+    }
+
+private:
+    int Submit() override {
+        return m_nq->TimeoutAsync(m_timeout, this);
+    }
+
+private:
+    TimeVal m_timeout;
+};
+
+class PostOperation final : public Operation {
+public:
+    PostOperation(NotificationQueue* nq, NotificationQueue* target)
+        : Operation(nq), m_target(target) {}
+
+private:
+    int Submit() override {
+        return m_nq->NotifyAsync(m_target, 0, this);
+    }
+
+private:
+    NotificationQueue* m_target;
+};
+
+/** @brief resumes with the number of bytes read or -errno */
+inline ReadOperation Read(NotificationQueue* nq, int fd, void* buf,
+                          uint64_t sz) {
+    return ReadOperation(nq, fd, buf, sz);
+}
+
+/** @brief resumes with the number of bytes written or -errno */
+inline WriteOperation Write(NotificationQueue* nq, int fd, const void* buf,
+                            uint64_t sz) {
+    return WriteOperation(nq, fd, buf, sz);
+}
+
+/** @brief resumes with the client fd or -errno */
+inline AcceptOperation Accept(NotificationQueue* nq, int svr_fd) {
+    return AcceptOperation(nq, svr_fd);
+}
+
+/**
+   @brief resumes with 0 or -errno. `addr` must be valid until the coroutine
+   resumes.
+*/
+inline ConnectOperation Connect(NotificationQueue* nq, int fd,
+                                const struct sockaddr* addr, socklen_t len) {
+    return ConnectOperation(nq, fd, addr, len);
+}
+
+/** @brief resumes with 0 after `timeout`, or -errno */
+inline SleepOperation Sleep(NotificationQueue* nq, const TimeVal& timeout) {
+    return SleepOperation(nq, timeout);
+}
+
+/**
+   @brief resumes with 0 in the thread of `target`, or with -errno in the
+   current thread. operations after that must be submitted to `target`.
+*/
+inline PostOperation Post(NotificationQueue* nq, NotificationQueue* target) {
+    return PostOperation(nq, target);
+}
+
+/* ------------------------------------------------------------------------- */
+
+class PromiseBase {
+public:
+    std::suspend_always initial_suspend() const noexcept {
+        return {};
+    }
+
+    // transfers to the awaiting coroutine if any
+    class FinalAwaiter final {
+    public:
+        bool await_ready() const noexcept {
+            return false;
+        }
+        template <typename PromiseType>
+        std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<PromiseType> h) const noexcept {
+            auto next = h.promise().m_continuation;
+            return (next) ? next : std::noop_coroutine();
+        }
+        void await_resume() const noexcept {}
+    };
+
+    FinalAwaiter final_suspend() const noexcept {
+        return {};
+    }
+
+    void unhandled_exception() const noexcept {
+        std::terminate();
+    }
+
+    void SetContinuation(std::coroutine_handle<> h) {
+        m_continuation = h;
+    }
+
+    static void* operator new(size_t size) noexcept {
+        return AllocFrame(size);
+    }
+    static void operator delete(void* ptr, size_t size) {
+        FreeFrame(ptr, size);
+    }
+
+private:
+    std::coroutine_handle<> m_continuation;
+};
+
+template <typename T>
+class Promise : public PromiseBase {
+public:
+    template <typename U>
+    void return_value(U&& value) {
+        m_value = std::forward<U>(value);
+    }
+    T& GetValue() {
+        return m_value;
+    }
+
+private:
+    T m_value = T();
+};
+
+template <>
+class Promise<void> : public PromiseBase {
+public:
+    void return_void() const noexcept {}
+};
+
+/**
+   @brief a coroutine which starts when it is awaited and resumes the awaiting
+   one when it finishes. its frame is released with the object.
+
+   an empty object is returned if the frame cannot be allocated. awaiting it
+   gives `T()` immediately.
+*/
+template <typename T = void>
+class Async final {
+public:
+    class promise_type final : public Promise<T> {
+    public:
+        Async get_return_object() noexcept {
+            return Async(
+                std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        static Async get_return_object_on_allocation_failure() noexcept {
+            return Async();
+        }
+    };
+
+public:
+    Async() {}
+    Async(Async&& a) : m_handle(std::exchange(a.m_handle, nullptr)) {}
+    ~Async() {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    Async& operator=(Async&& a) {
+        if (&a != this) {
+            if (m_handle) {
+                m_handle.destroy();
+            }
+            m_handle = std::exchange(a.m_handle, nullptr);
+        }
+        return *this;
+    }
+
+    explicit operator bool() const {
+        return (bool)m_handle;
+    }
+
+    bool await_ready() const noexcept {
+        return !m_handle;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept {
+        m_handle.promise().SetContinuation(h);
+        return m_handle;
+    }
+
+    T await_resume() {
+        if constexpr (std::is_void<T>::value) {
+            return;
+        } else {
+            return (m_handle) ? std::move(m_handle.promise().GetValue()) : T();
+        }
+    }
+
+private:
+    explicit Async(std::coroutine_handle<promise_type> h) : m_handle(h) {}
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+
+private:
+    Async(const Async&) = delete;
+    void operator=(const Async&) = delete;
+};
+
+/** @brief the root coroutine of `Spawn()`, which releases itself */
+class Detached final {
+public:
+    class promise_type final {
+    public:
+        Detached get_return_object() noexcept {
+            return Detached(true);
+        }
+        static Detached get_return_object_on_allocation_failure() noexcept {
+            return Detached(false);
+        }
+        std::suspend_never initial_suspend() const noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() const noexcept {
+            return {};
+        }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept {
+            std::terminate();
+        }
+
+        static void* operator new(size_t size) noexcept {
+            return AllocFrame(size);
+        }
+        static void operator delete(void* ptr, size_t size) {
+            FreeFrame(ptr, size);
+        }
+    };
+
+    bool IsStarted() const {
+        return m_is_started;
+    }
+
+private:
+    explicit Detached(bool is_started) : m_is_started(is_started) {}
+
+private:
+    bool m_is_started;
+};
+
+inline Detached RunDetached(Async<void> a) {
+    co_await std::move(a);
+}
+
+/**
+   @brief runs `a` in the calling thread until its first suspension. it must
+   be the thread of the notification queue used by `a`, e.g. in a closure of
+   `EventManager::Post()`. returns 0 or -ENOMEM.
+*/
+inline int Spawn(Async<void>&& a) {
+    if (!a) {
+        return -ENOMEM;
+    }
+    return (RunDetached(std::move(a)).IsStarted()) ? 0 : -ENOMEM;
+}
+
+}}
+
+#endif
+
+#endif
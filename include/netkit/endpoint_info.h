@@ -2,36 +2,46 @@
 #define __NETKIT_ENDPOINT_INFO_H__
 
 #include <stdint.h>
-#include <string>
+#include <string.h> // memset()
+#include <netinet/in.h> // sockaddr_in/sockaddr_in6
+#include <arpa/inet.h> // INET6_ADDRSTRLEN
 
 namespace netkit {
 
-struct EndpointInfo final {
-    EndpointInfo() {}
-    EndpointInfo(const EndpointInfo&) = default;
-    EndpointInfo& operator=(const EndpointInfo&) = default;
+/** @brief an IPv4 or IPv6 address, kept in binary form */
+struct SocketAddr final {
+    /** @brief buffer size for `ToString()`, like "[ipv6]:port" */
+    static constexpr uint32_t MAX_STR_LEN = INET6_ADDRSTRLEN + 8;
 
-    EndpointInfo(EndpointInfo&& info) {
-        DoMove(std::move(info));
-    }
-    EndpointInfo& operator=(EndpointInfo&& info) {
-        DoMove(std::move(info));
-        return *this;
+    SocketAddr() {
+        memset(&in6, 0, sizeof(in6));
     }
 
-    void DoMove(EndpointInfo&& info) {
-        local_port = info.local_port;
-        remote_port = info.remote_port;
-        local_addr = std::move(info.local_addr);
-        remote_addr = std::move(info.remote_addr);
-        info.local_port = 0;
-        info.remote_port = 0;
+    bool IsEmpty() const {
+        return (sa.sa_family == AF_UNSPEC);
     }
 
-    uint16_t local_port = 0;
-    uint16_t remote_port = 0;
-    std::string local_addr;
-    std::string remote_addr;
+    /** @brief true if it is 0.0.0.0 or :: */
+    bool IsAny() const;
+
+    uint16_t GetPort() const;
+
+    /**
+       @brief formats "ip:port" for IPv4 or "[ip]:port" for IPv6 into `buf`.
+       returns `buf`.
+    */
+    const char* ToString(char* buf, uint32_t sz) const;
+
+    union {
+        struct sockaddr sa;
+        struct sockaddr_in in4;
+        struct sockaddr_in6 in6;
+    };
+};
+
+struct EndpointInfo final {
+    SocketAddr local;
+    SocketAddr remote;
 };
 
 }
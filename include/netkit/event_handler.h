@@ -6,6 +6,14 @@
 
 namespace netkit {
 
+/** @brief counters of events of all rings in this process */
+struct EventStat final {
+    /** @brief events dropped because their handlers were already released */
+    uint64_t nr_stale;
+};
+
+void GetEventStat(EventStat*);
+
 class EventHandler {
 public:
     // true to keep this instance, false otherwise
@@ -2,41 +2,103 @@
 #define __NETKIT_EVENT_MANAGER_H__
 
 #include "tcp_server.h"
+#include "memory_budget.h"
+#include "capture.h"
 #include "logger/logger.h"
+#include <functional>
 #include <memory>
 #include <thread>
 
 namespace netkit {
 
+class Inbox;
+
 class EventManager final {
 public:
     struct Options final {
         uint32_t worker_num = 0;
+
+        /**
+           @brief no worker threads are created, and everything runs in the
+           thread calling `Loop()`. tasks of all clients run inline, see
+           `TcpClient::Options::inline_tasks`.
+        */
+        bool single_thread = false;
+
+        /** @brief worker `i` runs on CPU `i` modulo the number of CPUs */
+        bool pin_workers = false;
+
+        /**
+           @brief queues are `loopback::NotificationQueueImpl`s, servers listen
+           on loopback ports and clients connect to them, ignoring addresses
+           and socket options. it is used to measure netkit without the
+           kernel.
+        */
+        bool loopback = false;
+
+        /** @brief shared by all `EventManager`s in this process */
+        MemoryBudget memory_budget;
     };
 
 public:
-    EventManager(Logger* logger)
-        : m_logger(logger), m_sched(&m_worker_nq_list) {}
-    ~EventManager() {
-        Destroy();
-    }
+    EventManager(Logger* logger);
+    ~EventManager();
 
     /** returns 0 or -errno */
     int Init(const Options&);
     void Destroy();
 
-    /** returns -errno or fd of the server */
-    int AddTcpServer(const char* addr, uint16_t port, TcpServerPtr);
+    /**
+       @brief returns -errno or fd of the server. with
+       `TcpServer::Options::listener_per_worker`, it returns 0 on success
+       because the sockets are owned by the workers. the server accepts on
+       every worker or on none of them, and its `CreateClient()` is called
+       concurrently from all workers.
+    */
+    int AddTcpServer(const char* addr, uint16_t port, TcpServerPtr,
+                     const TcpServer::Options& = TcpServer::Options());
 
     /** returns -errno or fd of the client */
-    int AddTcpClient(const char* addr, uint16_t port, TcpClientPtr);
+    int AddTcpClient(const char* addr, uint16_t port, TcpClientPtr,
+                     const TcpClient::Options& = TcpClient::Options());
 
     void Loop();
 
+    uint32_t GetWorkerNum() const {
+        return m_worker_nq_list.size();
+    }
+
+    /**
+       @brief runs `f` in the thread of worker `worker_idx`, which is the
+       thread calling `Loop()` in single-thread mode. `f` gets the
+       notification queue of that thread, e.g. to start coroutines on it. it
+       can be called in any thread. returns 0 or -errno.
+    */
+    int Post(uint32_t worker_idx,
+             const std::function<void(NotificationQueue*)>& f);
+
+    /**
+       @brief sums counters of all queues into `total`. counters of each
+       worker, followed by those of the queue run by `Loop()`, are put in
+       `queue_stat_list` if it is not nullptr. it can be called in any
+       thread.
+    */
+    void GetQueueStat(
+        NotificationQueue::Stat* total,
+        std::vector<NotificationQueue::Stat>* queue_stat_list = nullptr) const;
+
+private:
+    int AddTcpServerPerWorker(const char* addr, uint16_t port, TcpServerPtr,
+                              const TcpServer::Options&);
+
 private:
     Logger* m_logger;
+    bool m_is_single_thread = false;
+    bool m_is_loopback = false;
     std::unique_ptr<NotificationQueue> m_nq;
     std::vector<std::unique_ptr<NotificationQueue>> m_worker_nq_list;
+    // one for each worker, and the last one is for `m_nq`
+    std::vector<std::unique_ptr<Inbox>> m_inbox_list;
     Scheduler m_sched;
     std::vector<std::thread> m_worker_thread_list;
 
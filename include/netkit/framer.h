@@ -0,0 +1,195 @@
+#ifndef __NETKIT_FRAMER_H__
+#define __NETKIT_FRAMER_H__
+
+#include "buffer.h"
+#include "req_stat.h"
+#include "logger/logger.h"
+#include <errno.h>
+#include <stdint.h>
+#include <string.h> // memcpy()
+
+/*
+  reusable implementations of `TcpClient::Check()`. a framer is meant to be a
+  member of a `TcpClient` and called from its `Check()`:
+
+      ReqStat Check(const Buffer& buf, uint32_t* req_bytes) override {
+          return m_framer.Check(buf, req_bytes);
+      }
+
+  framers with parameters are configured by `Init()` before use, which rejects
+  parameters that would misframe every request.
+
+  framers are incremental: they remember what has been examined since the last
+  `VALID` result, so calling `Check()` again after more data arrives costs
+  only the newly received bytes.
+*/
+
+namespace netkit {
+
+enum class Endian {
+    BIG,
+    LITTLE,
+};
+
+namespace detail {
+
+inline uint8_t ByteSwap(uint8_t v) {
+    return v;
+}
+inline uint16_t ByteSwap(uint16_t v) {
+    return __builtin_bswap16(v);
+}
+inline uint32_t ByteSwap(uint32_t v) {
+    return __builtin_bswap32(v);
+}
+inline uint64_t ByteSwap(uint64_t v) {
+    return __builtin_bswap64(v);
+}
+
+template <typename T, Endian E>
+inline T LoadInteger(const char* p) {
+    T v;
+    memcpy(&v, p, sizeof(T));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return (E == Endian::LITTLE) ? v : ByteSwap(v);
+#else
+    return (E == Endian::BIG) ? v : ByteSwap(v);
+#endif
+}
+
+}
+
+/**
+   @brief frames requests which begin with a fixed-size header containing the
+   length of the request.
+
+   @tparam `T` type of the length field: `uint8_t`, `uint16_t`, `uint32_t` or
+   `uint64_t`.
+   @tparam `E` byte order of the length field.
+*/
+template <typename T, Endian E = Endian::BIG>
+class LengthFieldFramer final {
+public:
+    struct Options final {
+        /** @brief size of the header, including the length field */
+        uint32_t header_size = sizeof(T);
+        /**
+           @brief offset of the length field in the header. the field must
+           lie within the header.
+        */
+        uint32_t field_offset = 0;
+        /** @brief whether the value of the length field includes the header */
+        bool include_header = false;
+        /** @brief requests larger than this are considered invalid */
+        uint32_t max_request_size = 16 * 1024 * 1024;
+    };
+
+public:
+    /**
+       @brief returns 0 or -EINVAL if the length field does not lie within the
+       header, in which case the options in use are left unchanged.
+    */
+    int Init(const Options& options, Logger* logger) {
+        if ((uint64_t)options.field_offset + sizeof(T) > options.header_size) {
+            logger_error(logger,
+                         "length field at [%u] of size [%u] exceeds header "
+                         "size [%u].",
+                         options.field_offset, (uint32_t)sizeof(T),
+                         options.header_size);
+            return -EINVAL;
+        }
+        m_options = options;
+        return 0;
+    }
+
+    ReqStat Check(const Buffer& buf, uint32_t* req_bytes) const {
+        const uint64_t header_size = m_options.header_size;
+        if (buf.size() < header_size) {
+            *req_bytes = header_size - buf.size();
+            return ReqStat::MORE_DATA;
+        }
+
+        uint64_t total = detail::LoadInteger<T, E>(buf.data() +
+                                                   m_options.field_offset);
+        if (!m_options.include_header) {
+            total += header_size;
+        }
+        if (total < header_size || total > m_options.max_request_size) {
+            return ReqStat::INVALID;
+        }
+
+        if (buf.size() < total) {
+            *req_bytes = total - buf.size();
+            return ReqStat::MORE_DATA;
+        }
+
+        *req_bytes = total;
+        return ReqStat::VALID;
+    }
+
+private:
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 ||
+                      sizeof(T) == 8,
+                  "unsupported length field type");
+
+    Options m_options;
+};
+
+/**
+   @brief frames requests which begin with a base-128 varint (as used by
+   protobuf) holding the length of the following body. the varint itself is
+   included in `req_bytes`.
+*/
+class VarintFramer final {
+public:
+    VarintFramer(uint32_t max_request_size = 16 * 1024 * 1024)
+        : m_max_request_size(max_request_size) {}
+
+    ReqStat Check(const Buffer&, uint32_t* req_bytes) const;
+
+private:
+    uint32_t m_max_request_size;
+};
+
+/**
+   @brief frames requests terminated by a delimiter such as "\r\n". the
+   delimiter is included in `req_bytes`.
+
+   scanning uses AVX2 or SSE2 when available and resumes where the previous
+   `Check()` stopped.
+*/
+class DelimiterFramer final {
+public:
+    static constexpr uint32_t MAX_DELIMITER_LEN = 16;
+
+public:
+    /** @brief requests end with "\r\n" unless another delimiter is set */
+    DelimiterFramer() {}
+
+    /**
+       @brief returns 0 or -EINVAL if `delim_len` is 0 or larger than
+       `MAX_DELIMITER_LEN`, in which case the delimiter in use is left
+       unchanged.
+    */
+    int Init(const char* delim, uint32_t delim_len,
+             uint32_t max_request_size, Logger*);
+
+    ReqStat Check(const Buffer&, uint32_t* req_bytes);
+
+    /**
+       @brief returns a pointer to the first occurrence of `delim` in `data`,
+       or nullptr if not found.
+    */
+    static const char* Find(const char* data, uint64_t len, const char* delim,
+                            uint32_t delim_len);
+
+private:
+    char m_delim[MAX_DELIMITER_LEN] = {'\r', '\n'};
+    uint32_t m_delim_len = 2;
+    uint32_t m_max_request_size = 16 * 1024 * 1024;
+    uint64_t m_nr_scanned = 0; // bytes known to contain no delimiter
+};
+
+}
+
+#endif
@@ -2,8 +2,10 @@
 #define __NETKIT_IOURING_NOTIFICATION_QUEUE_IMPL_H__
 
 #include "netkit/notification_queue.h"
+#include "netkit/msg_counter_list.h"
 #include "logger/logger.h"
 #include "liburing.h"
+#include <atomic>
 
 namespace netkit { namespace iouring {
 
@@ -24,17 +26,55 @@ public:
     void Destroy(); // destroy this instance if necessary
 
     int AcceptAsync(uintptr_t svr_fd, void* tag, bool multishot) override;
+    int ConnectAsync(uintptr_t fd, const struct sockaddr* addr, socklen_t len,
+                     void* tag) override;
     int ReadAsync(uintptr_t fd, void* buf, uint64_t sz, void* tag) override;
+    int ReadWithTimeoutAsync(uintptr_t fd, void* buf, uint64_t sz,
+                             const TimeVal& timeout, void* tag) override;
+    int PollAsync(uintptr_t fd, short events, void* tag) override;
+    int TimeoutAsync(const TimeVal& timeout, void* tag) override;
     int WriteAsync(uintptr_t fd, const void* buf, uint64_t sz,
                    void* tag) override;
+    int WritevAsync(uintptr_t fd, const struct iovec* iov, uint32_t nr,
+                    void* tag) override;
     int CloseAsync(uintptr_t fd, void* tag) override;
+    int CancelAsync(void* tag) override;
     int NotifyAsync(NotificationQueue*, int res, void* tag) override;
 
     int Next(EventResult* res, void** tag, const TimeVal* timeout) override;
 
+    void GetStat(Stat*) const override;
+    uint64_t GetNrMsgsSentTo(const NotificationQueue*) const override;
+
+private:
+    // returns 0 or -errno
+    int ReserveSqe(uint32_t nr);
+    int Submit(struct io_uring_sqe** sqe_list, uint32_t nr);
+    int Wait(struct io_uring_cqe** cqe, const TimeVal* timeout);
+    template <typename FuncType>
+    int GenericAsync(const FuncType& func);
+
 private:
     struct io_uring m_ring;
     Logger* m_logger;
+    bool m_has_sync_cancel = true; // cleared if the kernel lacks it
+
+    // written by the thread of this queue only
+    std::atomic<uint64_t> m_nr_sqes = {0};
+    std::atomic<uint64_t> m_nr_submits = {0};
+    std::atomic<uint64_t> m_nr_sq_full = {0};
+    std::atomic<uint64_t> m_nr_cqes = {0};
+    std::atomic<uint64_t> m_nr_cq_overflows = {0};
+    std::atomic<uint64_t> m_nr_msgs_sent = {0};
+    MsgCounterList m_msg_counter_list; // of `m_nr_msgs_sent` per target
+    std::atomic<uint64_t> m_nr_waits = {0};
+    std::atomic<uint64_t> m_nr_peeks = {0};
+    std::atomic<uint64_t> m_blocked_nsec = {0};
+    std::atomic<uint64_t> m_busy_nsec = {0};
+    uint64_t m_last_wakeup_nsec = 0; // 0 before the first block
+
+    // written by senders whose `m_msg_counter_list` is full
+    std::atomic<uint64_t> m_nr_msgs_received = {0};
 
 private:
     NotificationQueueImpl(const NotificationQueueImpl&) = delete;
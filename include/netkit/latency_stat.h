@@ -0,0 +1,74 @@
+#ifndef __NETKIT_LATENCY_STAT_H__
+#define __NETKIT_LATENCY_STAT_H__
+
+#include <stdint.h>
+
+namespace netkit {
+
+/**
+   @brief a log-linear histogram of nanoseconds. values below 16 have buckets
+   of their own, and each power of two above is split into 16 buckets, so a
+   value read back is off by less than 1/16.
+*/
+struct LatencyHistogram final {
+    static constexpr uint32_t SUB_BUCKET_BITS = 4;
+    static constexpr uint32_t SUB_BUCKET_NUM = (1u << SUB_BUCKET_BITS);
+    static constexpr uint32_t BUCKET_NUM =
+        (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_NUM;
+
+    static uint32_t GetBucketIndex(uint64_t nsec) {
+        if (nsec < SUB_BUCKET_NUM) {
+            return nsec;
+        }
+        const uint32_t shift = 63 - __builtin_clzl(nsec) - SUB_BUCKET_BITS;
+        return ((shift + 1) << SUB_BUCKET_BITS) +
+            ((nsec >> shift) & (SUB_BUCKET_NUM - 1));
+    }
+
+    /** @brief the largest value that falls into bucket `idx` */
+    static uint64_t GetBucketLimit(uint32_t idx);
+
+    void Add(uint64_t nsec) {
+        ++bucket_list[GetBucketIndex(nsec)];
+        ++count;
+        sum_nsec += nsec;
+        if (nsec > max_nsec) {
+            max_nsec = nsec;
+        }
+    }
+
+    void Merge(const LatencyHistogram&);
+
+    /**
+       @brief the value which a fraction `q` in [0, 1] of samples are not
+       above, e.g. 0.999 for p99.9. returns 0 if there are no samples.
+    */
+    uint64_t GetPercentile(double q) const;
+
+    uint64_t count = 0;
+    uint64_t sum_nsec = 0;
+    uint64_t max_nsec = 0;
+    uint64_t bucket_list[BUCKET_NUM] = {0};
+};
+
+/**
+   @brief latencies of sampled requests, see
+   `TcpClient::Options::latency_sample_interval`. about 31KB.
+*/
+struct LatencyStat final {
+    /** @brief from a request being parsed to its task starting */
+    LatencyHistogram queue;
+    /** @brief `Task::Run()`, including sending data not flushed in it */
+    LatencyHistogram run;
+    /** @brief from `Emit()` to the data being written entirely */
+    LatencyHistogram send;
+    /** @brief from the read completing a request to each response written */
+    LatencyHistogram total;
+};
+
+/** @brief merges histograms of all threads in this process */
+void GetLatencyStat(LatencyStat*);
+
+}
+
+#endif
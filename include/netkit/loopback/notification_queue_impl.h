@@ -0,0 +1,152 @@
+#ifndef __NETKIT_LOOPBACK_NOTIFICATION_QUEUE_IMPL_H__
+#define __NETKIT_LOOPBACK_NOTIFICATION_QUEUE_IMPL_H__
+
+#include "netkit/notification_queue.h"
+#include "netkit/msg_counter_list.h"
+#include "logger/logger.h"
+#include <atomic>
+#include <utility>
+#include <vector>
+#include <poll.h> // struct pollfd
+
+namespace netkit { namespace loopback {
+
+class NotificationQueueImpl;
+struct Op;
+
+/**
+   @brief completes `op`, which has left the list it waits in. `cur` is the
+   queue of the calling thread, or nullptr if it is not known.
+*/
+void CompleteOp(Op* op, EventResult res, NotificationQueueImpl* cur);
+
+/**
+   @brief passes one result of the multishot `op`, which keeps waiting.
+   returns 0 or -ENOMEM.
+*/
+int PostResult(Op* op, EventResult res, NotificationQueueImpl* cur);
+
+/**
+   @brief a notification queue which keeps the kernel out of the data path,
+   for measuring the overhead of netkit itself. operations on loopback
+   sockets (see socket.h) copy bytes between in-memory buffers, and complete
+   directly if the peer is served by the same queue, or through a lock-free
+   queue otherwise. a queue only makes a syscall to sleep when it has nothing
+   to do.
+
+   operations on other fds, e.g. eventfds and timerfds used internally, are
+   served by `ppoll()` when the queue is idle, or about every millisecond
+   otherwise. `ConnectAsync()` only supports loopback sockets.
+*/
+class NotificationQueueImpl final : public NotificationQueue {
+public:
+    struct Options final {
+        /** @brief initial number of ready events, which grows as needed */
+        uint32_t queue_size = 1024;
+    };
+
+public:
+    NotificationQueueImpl() : m_logger(nullptr) {}
+    ~NotificationQueueImpl() {
+        Destroy();
+    }
+
+    int Init(const Options&, Logger* l);
+    void Destroy(); // destroy this instance if necessary
+
+    int AcceptAsync(uintptr_t svr_fd, void* tag, bool multishot) override;
+    int ConnectAsync(uintptr_t fd, const struct sockaddr* addr, socklen_t len,
+                     void* tag) override;
+    int ReadAsync(uintptr_t fd, void* buf, uint64_t sz, void* tag) override;
+    int ReadWithTimeoutAsync(uintptr_t fd, void* buf, uint64_t sz,
+                             const TimeVal& timeout, void* tag) override;
+    int PollAsync(uintptr_t fd, short events, void* tag) override;
+    int TimeoutAsync(const TimeVal& timeout, void* tag) override;
+    int WriteAsync(uintptr_t fd, const void* buf, uint64_t sz,
+                   void* tag) override;
+    int WritevAsync(uintptr_t fd, const struct iovec* iov, uint32_t nr,
+                    void* tag) override;
+    int CloseAsync(uintptr_t fd, void* tag) override;
+    int CancelAsync(void* tag) override;
+    int NotifyAsync(NotificationQueue*, int res, void* tag) override;
+
+    int Next(EventResult* res, void** tag, const TimeVal* timeout) override;
+
+    void GetStat(Stat*) const override;
+    uint64_t GetNrMsgsSentTo(const NotificationQueue*) const override;
+
+private:
+    friend void CompleteOp(Op*, EventResult, NotificationQueueImpl*);
+    friend int PostResult(Op*, EventResult, NotificationQueueImpl*);
+
+    struct Completion final {
+        EventResult res;
+        void* tag;
+    };
+
+    // returns 0 if `op` completes at once, 1 if it waits, or -errno
+    int Submit(Op*);
+    void PushReady(EventResult res, void* tag);
+    void PushRemote(Op*);
+    void CollectRemote();
+    // releases `op` after its completion is ready
+    void Retire(Op*);
+    void LinkPending(Op*);
+    void UnlinkPending(Op*);
+    void AddTimer(Op*);
+    void ExpireTimers(uint64_t now);
+    void RemoveKernelOp(Op*);
+    // returns true if `op` was waiting and is taken back
+    bool TakeBack(Op*);
+    // returns 0 or -errno. `timeout_nsec` < 0 means no timeout.
+    int PollKernel(int64_t timeout_nsec);
+    void RunKernelOp(Op*, short revents);
+    int Wait(uint64_t deadline_nsec);
+
+private:
+    Logger* m_logger;
+    int m_wake_fd = -1;
+
+    // events ready to be returned, in a ring whose size is a power of 2
+    std::vector<Completion> m_ready_list;
+    uint32_t m_ready_head = 0;
+    uint32_t m_nr_ready = 0;
+    // events returned before remote ones and timers are checked again
+    uint32_t m_nr_until_check = 0;
+
+    Op* m_pending_head = nullptr; // waiting ops that can be cancelled
+    std::vector<Op*> m_timer_heap; // ordered by deadline
+    std::vector<Op*> m_kernel_op_list; // served by `ppoll()`
+    std::vector<struct pollfd> m_pollfd_list;
+    std::vector<std::pair<Op*, short>> m_kernel_ready_list; // with revents
+    uint64_t m_last_poll_nsec = 0;
+
+    // written by the thread of this queue only
+    std::atomic<uint64_t> m_nr_sqes = {0};
+    std::atomic<uint64_t> m_nr_cqes = {0};
+    std::atomic<uint64_t> m_nr_msgs_sent = {0};
+    MsgCounterList m_msg_counter_list; // of `m_nr_msgs_sent` per target
+    std::atomic<uint64_t> m_nr_waits = {0};
+    std::atomic<uint64_t> m_nr_peeks = {0};
+    std::atomic<uint64_t> m_blocked_nsec = {0};
+    std::atomic<uint64_t> m_busy_nsec = {0};
+    uint64_t m_last_wakeup_nsec = 0; // 0 before the first block
+
+    // written by other threads. the padding keeps them off the cache lines
+    // above, since instances are not allocated with extended alignment.
+    char m_padding[64];
+    std::atomic<Op*> m_remote_head = {nullptr}; // completions, newest first
+    std::atomic<bool> m_is_sleeping = {false};
+    // written by senders whose `m_msg_counter_list` is full
+    std::atomic<uint64_t> m_nr_msgs_received = {0};
+
+private:
+    NotificationQueueImpl(const NotificationQueueImpl&) = delete;
+    NotificationQueueImpl(NotificationQueueImpl&&) = delete;
+    void operator=(const NotificationQueueImpl&) = delete;
+    void operator=(NotificationQueueImpl&&) = delete;
+};
+
+}}
+
+#endif
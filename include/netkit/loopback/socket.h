@@ -0,0 +1,64 @@
+#ifndef __NETKIT_LOOPBACK_SOCKET_H__
+#define __NETKIT_LOOPBACK_SOCKET_H__
+
+#include "netkit/endpoint_info.h"
+#include <stdint.h>
+
+namespace netkit { namespace loopback {
+
+/**
+   @brief loopback sockets are byte streams in memory, which are only usable
+   with `loopback::NotificationQueueImpl`. each direction buffers at most
+   64KB, and writes complete with fewer bytes when the buffer is nearly full.
+
+   their fds are not less than `FD_BASE`, which is above any fd the kernel
+   gives out, so they never clash with kernel ones. they must be closed by
+   `Close()` instead of `close()`, see also `utils::CloseSocket()`.
+*/
+static constexpr int FD_BASE = (1 << 30);
+
+inline bool IsSocket(int fd) {
+    return (fd >= FD_BASE);
+}
+
+/**
+   @brief creates a listener identified by `port`, or by a free port if it is
+   0. connections beyond `backlog` that are not accepted yet are refused.
+   @return fd or -errno
+*/
+int Listen(uint16_t port, int backlog = 128);
+
+/**
+   @brief connects to the listener of `port`. the connection is established
+   before it is accepted, like a TCP one.
+   @return fd or -errno
+*/
+int Connect(uint16_t port);
+
+/**
+   @brief creates an unconnected socket for `NotificationQueue::ConnectAsync()`
+   @return fd or -errno
+*/
+int CreateSocket();
+
+/** @return 0 or -errno */
+int CreateSocketPair(int fd_list[2]);
+
+/**
+   @brief shuts down both directions. data not read by this end is dropped,
+   and the peer reads what is buffered before the end of stream. pending
+   writes of both ends fail with -EPIPE.
+   @return 0 or -errno
+*/
+int ShutDown(int fd);
+
+/** @return 0 or -errno */
+int Close(int fd);
+
+/** @brief addresses are 127.0.0.1 with ports. returns 0 or -errno. */
+int GetLocalAddr(int fd, SocketAddr*);
+int GetRemoteAddr(int fd, SocketAddr*);
+
+}}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef __NETKIT_MEMORY_BUDGET_H__
+#define __NETKIT_MEMORY_BUDGET_H__
+
+#include <stdint.h>
+
+namespace netkit {
+
+/*
+  memory of a connection covers its read buffer, queued data to be sent and
+  its timers.
+*/
+
+struct MemoryBudget final {
+    enum Policy {
+        /*
+          connections stop reading until usage drops below the limit, keeping
+          only the data read so far. they are resumed a few at a time, and
+          closed if the peer closes meanwhile.
+        */
+        PAUSE_READ,
+        /*
+          connections using more than the average are closed when they try to
+          read more data
+        */
+        SHED_LARGEST,
+    };
+
+    /** @brief max bytes used by all connections. 0 means unlimited. */
+    uint64_t limit = 0;
+    Policy policy = Policy::PAUSE_READ;
+};
+
+struct MemoryUsage final {
+    uint64_t nr_bytes;
+    uint64_t nr_connections;
+};
+
+/** @brief gets memory used by all connections in this process. */
+void GetMemoryUsage(MemoryUsage*);
+
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef __NETKIT_MSG_COUNTER_LIST_H__
+#define __NETKIT_MSG_COUNTER_LIST_H__
+
+#include <atomic>
+#include <stdint.h>
+
+namespace netkit {
+
+/**
+   @brief numbers of messages sent by one queue, counted per target. it is
+   written by the thread of the sending queue only and read in any thread, so
+   targets do not share a counter written by all of their senders.
+*/
+class MsgCounterList final {
+public:
+    static constexpr uint32_t MAX_TARGET_NUM = 128;
+
+    /** @brief returns false if `target` is new and the list is full */
+    bool Add(const void* target) {
+        const uint32_t nr = m_nr_targets.load(std::memory_order_relaxed);
+        // messages usually go to the same target in a row
+        if (m_last_idx < nr && m_list[m_last_idx].target == target) {
+            Inc(&m_list[m_last_idx].nr_msgs);
+            return true;
+        }
+        for (uint32_t i = 0; i < nr; ++i) {
+            if (m_list[i].target == target) {
+                m_last_idx = i;
+                Inc(&m_list[i].nr_msgs);
+                return true;
+            }
+        }
+
+        if (nr == MAX_TARGET_NUM) {
+            return false;
+        }
+        m_list[nr].target = target;
+        m_list[nr].nr_msgs.store(1, std::memory_order_relaxed);
+        m_nr_targets.store(nr + 1, std::memory_order_release);
+        m_last_idx = nr;
+        return true;
+    }
+
+    /** @brief messages sent to `target`. can be called in any thread. */
+    uint64_t Get(const void* target) const {
+        const uint32_t nr = m_nr_targets.load(std::memory_order_acquire);
+        for (uint32_t i = 0; i < nr; ++i) {
+            if (m_list[i].target == target) {
+                return m_list[i].nr_msgs.load(std::memory_order_relaxed);
+            }
+        }
+        return 0;
+    }
+
+private:
+    struct Counter final {
+        const void* target = nullptr; // set before it is published
+        std::atomic<uint64_t> nr_msgs = {0};
+    };
+
+    static void Inc(std::atomic<uint64_t>* counter) {
+        counter->store(counter->load(std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint32_t> m_nr_targets = {0};
+    uint32_t m_last_idx = 0;
+    Counter m_list[MAX_TARGET_NUM];
+};
+
+}
+
+#endif
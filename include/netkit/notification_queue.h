@@ -3,35 +3,123 @@
 
 #include "timeval.h"
 #include "event_result.h"
+#include <sys/uio.h> // struct iovec
+#include <sys/socket.h> // struct sockaddr
 
 namespace netkit {
 
 class NotificationQueue {
+public:
+    /** @brief counters since the queue is initialized */
+    struct Stat final {
+        /** @brief requests prepared, including internal ones */
+        uint64_t nr_sqes = 0;
+        /** @brief submit syscalls */
+        uint64_t nr_submits = 0;
+        /** @brief times the submission queue is found full */
+        uint64_t nr_sq_full = 0;
+        /** @brief events reaped, including internal ones */
+        uint64_t nr_cqes = 0;
+        /**
+           @brief times events are found held back by the kernel since the
+           completion queue is full
+        */
+        uint64_t nr_cq_overflows = 0;
+        /**
+           @brief `NotifyAsync()` calls made by and targeting this queue.
+           messages are counted by their senders per target, so the latter
+           only includes those of senders with too many targets to count on
+           their own. `EventManager::GetQueueStat()` adds up the rest.
+        */
+        uint64_t nr_msgs_sent = 0;
+        uint64_t nr_msgs_received = 0;
+        /** @brief `Next()` calls that block, and those that do not */
+        uint64_t nr_waits = 0;
+        uint64_t nr_peeks = 0;
+        /**
+           @brief time blocked in `Next()`, and time between returning from a
+           blocking `Next()` and the next block.
+        */
+        uint64_t blocked_nsec = 0;
+        uint64_t busy_nsec = 0;
+    };
+
 public:
     virtual ~NotificationQueue() = default;
 
+    /** @brief can be called in any thread */
+    virtual void GetStat(Stat*) const = 0;
+
+    /**
+       @brief `NotifyAsync()` calls made by this queue targeting `nq`. can be
+       called in any thread.
+    */
+    virtual uint64_t GetNrMsgsSentTo(const NotificationQueue* nq) const = 0;
+
     /**
        @brief accepts one connection. returns 0 or -errno.
     */
     virtual int AcceptAsync(uintptr_t svr_fd, void* tag, bool multishot) = 0;
 
+    /**
+       @brief connects `fd` to `addr`, which must be valid until the event
+       arrives. returns 0 or -errno.
+    */
+    virtual int ConnectAsync(uintptr_t fd, const struct sockaddr* addr,
+                             socklen_t len, void* tag) = 0;
+
     /**
        @brief reads at most `sz` bytes into `buf` from `fd`. returns 0 or
        -errno.
     */
     virtual int ReadAsync(uintptr_t fd, void* buf, uint64_t sz, void* tag) = 0;
 
+    /**
+       @brief like `ReadAsync()`, but the read fails with -ECANCELED if nothing
+       arrives within `timeout`. returns 0 or -errno.
+    */
+    virtual int ReadWithTimeoutAsync(uintptr_t fd, void* buf, uint64_t sz,
+                                     const TimeVal& timeout, void* tag) = 0;
+
+    /**
+       @brief waits until `fd` has any of `events`, e.g. POLLIN, without
+       consuming any data. the events which occur are returned as the value.
+       returns 0 or -errno.
+    */
+    virtual int PollAsync(uintptr_t fd, short events, void* tag) = 0;
+
+    /**
+       @brief notifies after `timeout`. returns 0 or -errno.
+    */
+    virtual int TimeoutAsync(const TimeVal& timeout, void* tag) = 0;
+
     /**
        @brief writes at most `sz` bytes from `buf` to `fd`. returns 0 or -errno.
     */
     virtual int WriteAsync(uintptr_t fd, const void* buf, uint64_t sz,
                            void* tag) = 0;
 
+    /**
+       @brief writes buffers described by `iov` to `fd` in one operation.
+       `iov` must be valid until the event arrives. returns 0 or -errno.
+    */
+    virtual int WritevAsync(uintptr_t fd, const struct iovec* iov,
+                            uint32_t nr, void* tag) = 0;
+
     /**
        @brief closes `fd`. returns 0 or -errno.
     */
     virtual int CloseAsync(uintptr_t fd, void* tag) = 0;
 
+    /**
+       @brief cancels a pending operation started with `tag`, which can be a
+       multishot one. the operation completes with -ECANCELED. returns 0 or
+       -errno, e.g. -ENOENT if no operation of `tag` is pending, or -EALREADY
+       if it is completing and cannot be cancelled. a queue unable to tell
+       may return 0 in these cases.
+    */
+    virtual int CancelAsync(void* tag) = 0;
+
     /**
        @brief notifies another notification queue about an event. returns 0 or
        -errno.
@@ -43,7 +131,10 @@ public:
 
        @param `res` has different meanings according to events:
        - ACCEPT: client fd or -errno.
+       - CONNECT: 0 or -errno.
        - READ: number of bytes read or -errno.
+       - POLL: mask of returned events or -errno.
+       - TIMEOUT: -ETIME or -errno.
        - WRITE: number of bytes written or -errno.
        - CLOSE: return value of `close()` or -errno.
        - NOTIFY: value passed to `NotifyAsync()`.
@@ -0,0 +1,97 @@
+#ifndef __NETKIT_POOL_ALLOCATOR_H__
+#define __NETKIT_POOL_ALLOCATOR_H__
+
+#include "allocator.h"
+#include <mutex>
+#include <vector>
+
+namespace netkit {
+
+namespace detail {
+struct ThreadCache;
+struct ThreadCacheHolder;
+}
+
+/**
+   @brief an allocator with per-thread freelists of power-of-two size classes.
+
+   blocks are carved from slabs owned by the allocating thread. a block freed by
+   another thread is pushed to a lock-free return queue of its owner, which
+   takes the whole queue back the next time its freelist runs empty. caches of
+   exited threads are adopted by new threads.
+
+   requests larger than `MAX_BLOCK_SIZE` fall back to malloc(). memory of slabs
+   is kept until the allocator is destroyed, so the allocator must outlive all
+   threads using it.
+*/
+class PoolAllocator final : public Allocator {
+public:
+    static constexpr uint32_t MIN_BLOCK_SIZE_SHIFT = 6; // 64 bytes
+    static constexpr uint32_t MAX_BLOCK_SIZE_SHIFT = 20; // 1 MiB
+    static constexpr uint64_t MAX_BLOCK_SIZE = (1ul << MAX_BLOCK_SIZE_SHIFT);
+    static constexpr uint32_t NR_CLASSES =
+        MAX_BLOCK_SIZE_SHIFT - MIN_BLOCK_SIZE_SHIFT + 1;
+
+    struct Options final {
+        /**
+           @brief size of memory chunks carved into blocks of the same class.
+           it is rounded up to a power of two, and a slab holds at least 16
+           blocks.
+        */
+        uint64_t slab_size = 2 * 1024 * 1024;
+        /**
+           @brief backs slabs with hugepages. falls back to transparent
+           hugepages if no hugepages are reserved.
+        */
+        bool use_hugepage = false;
+    };
+
+    struct ClassStat final {
+        uint64_t block_size;
+        /** @brief bytes handed out and not returned yet */
+        uint64_t bytes_in_use;
+        /** @brief bytes of slabs mapped for this class */
+        uint64_t bytes_mapped;
+    };
+
+public:
+    PoolAllocator() {}
+    explicit PoolAllocator(const Options&);
+    ~PoolAllocator();
+
+    void* Alloc(uint64_t size, uint64_t* capacity) override;
+    void Free(void* ptr, uint64_t capacity) override;
+
+    /** @brief stat of each class, from the smallest to the largest */
+    void GetStat(std::vector<ClassStat>*) const;
+
+private:
+    friend struct detail::ThreadCacheHolder;
+
+    detail::ThreadCache* GetThreadCache();
+    detail::ThreadCache* AcquireThreadCache();
+    void ReleaseThreadCache(detail::ThreadCache*);
+    char* AllocSlab(uint64_t slab_size);
+
+    uint32_t GetSlabShift(uint32_t cls) const {
+        const uint32_t min_shift = cls + MIN_BLOCK_SIZE_SHIFT + 4;
+        return (m_slab_shift > min_shift) ? m_slab_shift : min_shift;
+    }
+
+private:
+    Options m_options;
+    uint32_t m_slab_shift = 21;
+    mutable std::mutex m_lock; // protects the following members
+    std::vector<detail::ThreadCache*> m_cache_list;
+    std::vector<std::pair<void*, uint64_t>> m_slab_list;
+
+private:
+    PoolAllocator(const PoolAllocator&) = delete;
+    PoolAllocator(PoolAllocator&&) = delete;
+    void operator=(const PoolAllocator&) = delete;
+    void operator=(PoolAllocator&&) = delete;
+};
+
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef __NETKIT_REQ_STAT_H__
+#define __NETKIT_REQ_STAT_H__
+
+namespace netkit {
+
+enum ReqStat {
+    /* invalid request */
+    INVALID = -1,
+
+    /*
+      ok, and `req_bytes` is set to the total size of the request.
+      note that `req_bytes` may be less than the size of buffer.
+    */
+    VALID = 0,
+
+    /*
+      more data required.
+
+      `req_bytes` is set to the number of bytes left at the current stage,
+      or is set to 0 if the number of bytes cannot be determined.
+    */
+    MORE_DATA = 1,
+};
+
+}
+
+#endif
@@ -2,30 +2,120 @@
 #define __NETKIT_SEND_CONTEXT_H__
 
 #include "timer.h"
+#include "connection_handle.h"
 #include <functional>
+#include <stdint.h> // UINT64_MAX
 
 namespace netkit {
 
 class SendContext final {
 public:
-    SendContext(const std::shared_ptr<Connection>& c, NotificationQueue* nq,
-                Logger* l)
-        : m_conn(c), m_nq(nq), m_logger(l) {}
+    /** @brief data emitted is not bound to any request */
+    static constexpr uint64_t NO_SEQ = UINT64_MAX;
+
+    /**
+       @brief `c` is borrowed and must be pinned by the caller. if `owner` is
+       given, its reference is handed over to the sender started by `Emit()`
+       instead of taking a new one, and is given back if the sender fails to
+       start. the sender completes in the thread of `nq`, so `c` stays pinned
+       until the context is gone. in ordered mode, data emitted is sent after
+       responses of requests before `seq`.
+    */
+    SendContext(Connection* c, NotificationQueue* nq, Logger* l,
+                ConnectionPtr* owner = nullptr, uint64_t seq = NO_SEQ)
+        : m_conn(c), m_owner(owner), m_nq(nq), m_logger(l), m_seq(seq) {}
+
+    /**
+       @brief flushes data held back by auto-cork, and marks the request as
+       done in ordered mode.
+    */
+    ~SendContext() {
+        if (m_seq != NO_SEQ) {
+            Commit(true);
+        }
+        Flush();
+    }
 
     const EndpointInfo& GetEndpointInfo() {
         return m_conn->GetEndpointInfo();
     }
 
-    // returns 0 or -errno
+    /** @brief bytes used by this connection */
+    uint64_t GetMemoryUsage() const {
+        return m_conn->GetMemoryUsage();
+    }
+
+    /**
+       @brief queues data to be sent. if auto-cork is enabled, data emitted in
+       the same handler is sent together after the handler returns, or when
+       `Flush()` is called. returns 0 or -errno.
+
+       returns -ENOBUFS and leaves the buffer untouched if the send queue is
+       over its high watermark. see `SetOnWritable()`. returns -ENOTCONN if
+       the connection is closed.
+    */
     int Emit(Buffer&&, const std::function<void(int err)>& on_complete = {});
 
+    /**
+       @brief `f` is called with a new `SendContext` when the send queue drains
+       to its low watermark after `Emit()` returned -ENOBUFS. it may be called
+       in another thread.
+    */
+    void SetOnWritable(const std::function<void(SendContext*)>& f) {
+        m_conn->SetOnWritable(f);
+    }
+
+    /**
+       @brief true if the connection is closed and nothing can be sent
+       anymore. long-running tasks can check it and stop early.
+    */
+    bool IsCancelled() const {
+        return !m_conn->IsValid();
+    }
+
+    /** @brief true if `Emit()` would fail with -ENOBUFS */
+    bool IsBlocked() const {
+        return m_conn->IsSendBlocked();
+    }
+
+    /**
+       @brief a handle to emit data on this connection in other threads. the
+       sending is started in the thread calling this.
+    */
+    ConnectionHandle GetHandle() const;
+
+    /** @brief sends data emitted so far without waiting. returns 0 or -errno */
+    int Flush();
+
     // returns -errno or timer fd
     int AddTimer(const TimeVal& interval, TimerPtr);
 
 private:
-    const std::shared_ptr<Connection>& m_conn;
+    friend class Task;
+
+    // moves data emitted so far to the connection in ordered mode
+    int Commit(bool is_done);
+
+private:
+    Connection* m_conn;
+    ConnectionPtr* m_owner;
     NotificationQueue* m_nq;
     Logger* m_logger;
+    bool m_need_flush = false; // this context should start the sender
+
+    // data emitted for request `m_seq` in ordered mode
+    const uint64_t m_seq;
+    SendItem* m_head = nullptr;
+    SendItem* m_tail = nullptr;
+
+    // when the request was read if it is sampled for latency statistics
+    uint64_t m_read_nsec = 0;
+
+private:
+    SendContext(const SendContext&) = delete;
+    SendContext(SendContext&&) = delete;
+    void operator=(const SendContext&) = delete;
+    void operator=(SendContext&&) = delete;
 };
 
 }
@@ -3,14 +3,24 @@
 
 #include "buffer.h"
 #include <functional>
+#include <stddef.h> // size_t
 
 namespace netkit {
 
 struct SendItem final {
     SendItem(Buffer&& b, const std::function<void(int err)>& f)
         : data(std::move(b)), on_complete(f) {}
+
+    static void* operator new(size_t) noexcept;
+    static void operator delete(void*, size_t);
+
     Buffer data;
     std::function<void(int err)> on_complete;
+    SendItem* next = nullptr; // next item in the send queue
+
+    // set if the request emitting this is sampled for latency statistics
+    uint64_t read_nsec = 0;
+    uint64_t emit_nsec = 0;
 };
 
 }
@@ -0,0 +1,44 @@
+#ifndef __NETKIT_SOCKET_OPTIONS_H__
+#define __NETKIT_SOCKET_OPTIONS_H__
+
+#include <stdint.h>
+
+namespace netkit {
+
+/**
+   @brief options set by `setsockopt()`. 0 or false keeps the system default,
+   so nothing is set by default.
+*/
+struct SocketOptions final {
+    /** @brief TCP_NODELAY. small writes are sent without waiting for acks. */
+    bool tcp_nodelay = false;
+
+    /** @brief SO_SNDBUF and SO_RCVBUF in bytes */
+    int send_buffer_size = 0;
+    int recv_buffer_size = 0;
+
+    /**
+       @brief TCP_DEFER_ACCEPT in seconds. listeners only. connections are
+       accepted after data arrives.
+    */
+    int defer_accept_sec = 0;
+
+    /** @brief TCP_FASTOPEN queue length. listeners only. */
+    int fastopen_queue_len = 0;
+
+    /** @brief SO_BUSY_POLL in microseconds */
+    int busy_poll_usec = 0;
+
+    /**
+       @brief TCP_NOTSENT_LOWAT in bytes. limits data queued in the kernel but
+       not sent yet, so it stays in the send queue of the connection.
+    */
+    int notsent_lowat = 0;
+
+    /** @brief SO_INCOMING_CPU. -1 keeps the system default. */
+    int incoming_cpu = -1;
+};
+
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef __NETKIT_SPIN_LOCK_H__
+#define __NETKIT_SPIN_LOCK_H__
+
+#include <atomic>
+#include <thread>
+
+namespace netkit {
+
+/**
+   @brief a one-byte lock for short critical sections. it can be used with
+   `std::lock_guard`.
+*/
+class SpinLock final {
+public:
+    void lock() {
+        uint32_t nr_spins = 0;
+        while (m_locked.exchange(true, std::memory_order_acquire)) {
+            while (m_locked.load(std::memory_order_relaxed)) {
+                if (++nr_spins < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+                    __builtin_ia32_pause();
+#endif
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+
+    void unlock() {
+        m_locked.store(false, std::memory_order_release);
+    }
+
+private:
+    std::atomic<bool> m_locked = {false};
+};
+
+}
+
+#endif
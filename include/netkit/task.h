@@ -6,10 +6,20 @@
 
 namespace netkit {
 
+/** @brief counters of tasks of all connections in this process */
+struct TaskStat final {
+    /** @brief tasks skipped because their connections were closed */
+    uint64_t nr_dropped;
+};
+
+void GetTaskStat(TaskStat*);
+
+struct ServerLoad;
+
 class Task : public EventHandler {
 protected:
     Task(Logger* l) : m_logger(l) {}
-    virtual ~Task() = default;
+    virtual ~Task();
 
     virtual void Run(SendContext*) = 0;
 
@@ -19,20 +29,26 @@ protected:
 
 private:
     friend class TcpClient;
+    friend class EventDispatcher;
 
-    void Init(Buffer&& b, const std::shared_ptr<Connection>& c) {
+    void Init(Buffer&& b, const ConnectionPtr& c, uint64_t seq) {
         m_buffer = std::move(b);
         m_conn = c;
+        m_seq = seq;
     }
 
-    bool Process(EventResult, NotificationQueue* nq) final {
-        SendContext ctx(m_conn, nq, m_logger);
-        Run(&ctx);
-        return false;
-    }
+    /** @brief skips `Run()` if the connection is already closed */
+    bool Process(EventResult, NotificationQueue*) final;
 
 private:
-    std::shared_ptr<Connection> m_conn;
+    ConnectionPtr m_conn;
+    uint64_t m_seq = SendContext::NO_SEQ; // used in ordered mode
+    ServerLoad* m_load = nullptr; // counts in-flight tasks if set
+
+    // set if the request is sampled for latency statistics
+    uint64_t m_read_nsec = 0; // when the request was read
+    // when the task was scheduled. also set while task probes are traced.
+    uint64_t m_ready_nsec = 0;
 };
 
 using TaskPtr = EventHandlerPtr<Task>;
@@ -3,29 +3,79 @@
 
 #include "task.h"
 #include "scheduler.h"
+#include "req_stat.h"
+#include "latency_stat.h"
+#include "socket_options.h"
 
 namespace netkit {
 
-enum ReqStat {
-    /* invalid request */
-    INVALID = -1,
-
-    /*
-      ok, and `req_bytes` is set to the total size of the request.
-      note that `req_bytes` may be less than the size of buffer.
-    */
-    VALID = 0,
-
-    /*
-      more data required.
-
-      `req_bytes` is set to the number of bytes left at the current stage,
-      or is set to 0 if the number of bytes cannot be determined.
-    */
-    MORE_DATA = 1,
-};
+class HandleTable;
 
 class TcpClient : public EventHandler {
+public:
+    struct Options final {
+        /**
+           @brief number of bytes to read when the size of the request is
+           unknown. it adapts to recent request sizes and bytes per read within
+           [`min_read_size`, `max_read_size`].
+        */
+        uint32_t min_read_size = 1024;
+        uint32_t max_read_size = 64 * 1024;
+
+        /**
+           @brief the read buffer of a connection waiting for a new request is
+           released if nothing arrives within `idle_timeout`, and is allocated
+           again when the connection becomes readable. {0, 0} disables it.
+        */
+        TimeVal idle_timeout = {0, 0};
+
+        /**
+           @brief data emitted in one `Task::Run()`, `Timer::OnExpiration()`
+           or `OnConnected()` is written together after it returns, unless
+           `SendContext::Flush()` is called.
+        */
+        bool auto_cork = false;
+
+        /** @brief limits of the send queue. unlimited by default. */
+        SendWatermark send_watermark;
+
+        /**
+           @brief stops reading requests while the send queue is over its high
+           watermark, so a slow reader does not make the server buffer
+           responses without bound.
+        */
+        bool pause_reading_when_blocked = false;
+
+        /**
+           @brief responses are sent in the order in which requests are
+           received, even if tasks of the same connection run in parallel on
+           different workers. data emitted in `OnConnected()`, timers or
+           `SetOnWritable()` callbacks is not ordered.
+        */
+        bool ordered = false;
+
+        /**
+           @brief tasks run in the thread reading requests right after they
+           are parsed, instead of being sent to workers. the connection is
+           then used in one thread only and is not locked.
+        */
+        bool inline_tasks = false;
+
+        /**
+           @brief one in every `latency_sample_interval` requests is timed at
+           each stage, see `GetLatencyStat()`. 0 disables sampling, and 1
+           times every request. a sample due in the middle of a read is
+           taken from the first request of the next read.
+        */
+        uint32_t latency_sample_interval = 0;
+
+        /**
+           @brief applied to accepted connections, or before connecting if
+           the client is added by `EventManager::AddTcpClient()`.
+        */
+        SocketOptions socket;
+    };
+
 protected:
     TcpClient(Logger* l) : m_logger(l) {}
     virtual ~TcpClient() = default;
@@ -41,20 +91,45 @@ protected:
 private:
     friend class TcpServer;
     friend class EventManager;
+    friend class EventDispatcher;
 
-    void Init(int fd, Scheduler* sched) {
-        m_conn = std::make_shared<Connection>(fd);
-        m_sched = sched;
-    }
-
+    /**
+       returns 0 or -errno. `fd` is closed if failed. `local_addr` is used if
+       it is not empty. `inbox` belongs to the thread of the client.
+    */
+    int Init(int fd, Scheduler*, Inbox* inbox, const Options&,
+             const SocketAddr* local_addr = nullptr);
     int Start(NotificationQueue*);
     bool Process(EventResult, NotificationQueue*) final;
     void DeleteSelf() final;
 
 private:
+    void* GetTag();
     int DoRead(void* buf, uint64_t sz, NotificationQueue*);
     void HandleInvalidRequest();
     int HandleMoreDataRequest(uint32_t req_bytes, NotificationQueue*);
+    uint32_t NextReadSize() const;
+    void UpdateReadStat(uint64_t nr_read);
+    void ChargeReadBuffer();
+    void ReallocReadBuffer(uint64_t capacity);
+    void ShrinkReadBuffer(uint64_t needed);
+    int ReleaseReadBuffer(NotificationQueue*);
+    bool ProcessWakeUp(EventResult, NotificationQueue*);
+    bool ProcessMemoryWakeUp(EventResult, NotificationQueue*);
+
+    // 1: paused
+    // -errno: error
+    int PauseForMemory(NotificationQueue*);
+
+    // 0: ok
+    // 1: reading should be paused
+    // -errno: error
+    int CheckMemoryBudget();
+
+    // 0: ok to read
+    // 1: reading is paused until `Connection::WakeReader()` is called
+    // -errno: error
+    int CheckReadPause(NotificationQueue*);
 
     // -1: error
     // 0: ok and return
@@ -62,10 +137,35 @@ private:
     int HandleValidRequest(uint32_t req_bytes, NotificationQueue*);
 
 private:
+    enum State : uint8_t {
+        READING,
+        POLLING, // read buffer is released and waits for data
+        PAUSED, // waits for the send queue to drain
+        WAITING_FOR_MEMORY, // paused, and polls for the peer closing
+    };
+
+private:
+    State m_state = State::READING;
+    bool m_is_polling = false; // the poll of a paused reader is in flight
+    bool m_is_woken = false; // the paused reader is woken up
     uint64_t m_bytes_needed = 0;
+    uint32_t m_read_size = 0; // size of the last read of unknown size
+    uint32_t m_avg_read_size = 0; // moving average of bytes per read
+    uint32_t m_avg_req_size = 0; // moving average of request sizes
+    uint64_t m_next_seq = 0; // sequence number of the next request
+    // when the last read completed if sampling or tracing
+    uint64_t m_read_nsec = 0;
+    uint32_t m_nr_unsampled = 0; // requests to skip before the next sample
+    Options m_options;
+    uint64_t m_buf_charged = 0; // bytes of `m_buf` charged to `m_conn`
     Buffer m_buf;
     Scheduler* m_sched = nullptr;
-    std::shared_ptr<Connection> m_conn;
+    Inbox* m_inbox = nullptr; // wakes the client up after pausing
+    ConnectionPtr m_conn;
+    ServerLoad* m_load = nullptr; // set if accepted by a server
+    bool m_is_local = false; // tasks run in the thread reading requests
+    uint64_t m_handle = 0; // in `m_handle_table` if set
+    HandleTable* m_handle_table = nullptr;
 };
 
 using TcpClientPtr = EventHandlerPtr<TcpClient>;
@@ -6,6 +6,55 @@
 namespace netkit {
 
 class TcpServer : public EventHandler {
+public:
+    struct Options final {
+        enum OverloadPolicy {
+            /* new connections are reset while the server is overloaded */
+            REJECT,
+            /*
+              accepting is paused and new connections wait in the backlog
+              until the load drops
+            */
+            DEFER,
+        };
+
+        /** @brief max number of connections waiting to be accepted */
+        int backlog = 128;
+
+        /** @brief max number of clients alive. 0 means unlimited. */
+        uint32_t max_connections = 0;
+
+        /**
+           @brief max number of tasks of all clients that are scheduled but
+           not finished. 0 means unlimited.
+        */
+        uint32_t max_inflight_tasks = 0;
+
+        OverloadPolicy overload_policy = OverloadPolicy::DEFER;
+
+        /** @brief applied to the listening socket */
+        SocketOptions socket;
+
+        /**
+           @brief every worker accepts on its own SO_REUSEPORT socket instead
+           of one socket on the acceptor thread, and tasks run on the worker
+           which accepted the connection. `CreateClient()` is then called
+           concurrently from every worker.
+        */
+        bool listener_per_worker = false;
+
+        /**
+           @brief with `listener_per_worker`, a connection goes to the worker
+           whose index equals the CPU that received its packets modulo the
+           number of workers. works best with one worker per CPU and
+           `EventManager::Options::pin_workers`.
+        */
+        bool steer_by_cpu = false;
+
+        /** @brief options of clients accepted by this server */
+        TcpClient::Options client;
+    };
+
 protected:
     TcpServer(Logger* l) : m_logger(l) {}
     virtual ~TcpServer();
@@ -17,18 +66,51 @@ protected:
 
 private:
     friend class EventManager;
+    friend class EventDispatcher;
+    friend class Listener;
 
-    void Init(int fd, Scheduler* sched) {
-        m_fd = fd;
-        m_sched = sched;
-    }
+    /**
+       returns 0 or -errno. if every worker has its own listener, `fd` is one
+       of them and is owned by the listener, and the server is deleted with
+       the last listener.
+    */
+    int Init(int fd, Scheduler*, const Options&);
 
     int Start(NotificationQueue*);
     bool Process(EventResult, NotificationQueue*) final;
 
 private:
-    int m_fd = -1;
+    enum State : uint8_t {
+        ACCEPTING,
+        PAUSING, // accepting is being cancelled
+        PAUSED, // waits for the load to drop, see `ServerLoad::WaitForDrop()`
+    };
+
+    // a listening socket and the tag of its events
+    struct Acceptor final {
+        int fd;
+        State state;
+        void* tag;
+    };
+
+    bool ProcessAccept(Acceptor*, EventResult, NotificationQueue*);
+    void AddClient(int fd, NotificationQueue*);
+    void ReleaseListener();
+
+    // returns 0 or -errno
+    int StartAccepting(Acceptor*, NotificationQueue*);
+    int PauseAccepting(Acceptor*, NotificationQueue*);
+    void WaitForResuming(Acceptor*);
+
+private:
+    Acceptor m_acceptor = {-1, State::ACCEPTING, nullptr};
+    std::atomic<uint32_t> m_nr_listeners = {0}; // alive per-worker listeners
     Scheduler* m_sched = nullptr;
+    ServerLoad* m_load = nullptr;
+    Options m_options;
+
+    // shared by all accepted clients unless the server binds a wildcard address
+    SocketAddr m_local_addr;
 };
 
 using TcpServerPtr = EventHandlerPtr<TcpServer>;
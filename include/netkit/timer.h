@@ -4,11 +4,11 @@
 #include "event_handler_ptr.h"
 #include "connection.h"
 #include "logger/logger.h"
-#include <memory>
 
 namespace netkit {
 
 class SendContext;
+class HandleTable;
 
 class Timer : public EventHandler {
 protected:
@@ -27,15 +27,24 @@ protected:
 
 private:
     friend class SendContext;
+    friend class Connection;
+    friend class EventDispatcher;
 
-    int Init(int fd, const std::shared_ptr<Connection>&);
+    int Init(int fd, Connection*);
     int Start(NotificationQueue*);
     bool Process(EventResult, NotificationQueue*) final;
 
 private:
     int m_fd;
     uint64_t m_nr_expiration;
-    std::shared_ptr<Connection> m_conn;
+    ConnectionPtr m_conn;
+    uint64_t m_handle = 0; // in `m_handle_table` if set
+    HandleTable* m_handle_table = nullptr;
+
+    // links of timers in the same connection, protected by the connection
+    bool m_is_attached = false;
+    Timer* m_prev = nullptr;
+    Timer* m_next = nullptr;
 };
 
 using TimerPtr = EventHandlerPtr<Timer>;
@@ -2,21 +2,63 @@
 #define __NETKIT_UTILS_H__
 
 #include "endpoint_info.h"
+#include "socket_options.h"
 #include "timeval.h"
 #include "logger/logger.h"
 #include <stdint.h>
 
 namespace netkit { namespace utils {
 
-/** @return fd or -errno  */
-int CreateTcpServerFd(const char* host, uint16_t port, Logger*);
+/**
+   @param `backlog` max number of pending connections
+   @param `opts` is applied before `listen()` if not null
+   @return fd or -errno
+*/
+int CreateTcpServerFd(const char* host, uint16_t port, Logger*,
+                      int backlog = 128, const SocketOptions* opts = nullptr);
 
-/** @return fd or -errno  */
-int CreateTcpClientFd(const char* host, uint16_t port, Logger*);
+/**
+   @param `opts` is applied before `connect()` if not null
+   @return fd or -errno
+*/
+int CreateTcpClientFd(const char* host, uint16_t port, Logger*,
+                      const SocketOptions* opts = nullptr);
+
+/**
+   @brief makes the SO_REUSEPORT group of `fd` pass a connection to the
+   socket whose index in the group equals the CPU that received its packets
+   modulo `nr_sockets`.
+   @return 0 or -errno
+*/
+int SteerReuseportByCpu(int fd, uint32_t nr_sockets, Logger*);
+
+/**
+   @brief sets options that are not listener-only.
+   @return 0 or -errno
+*/
+int SetSocketOptions(int fd, const SocketOptions&, Logger*);
 
 /** @return fd or -errno  */
 int CreateTimerFd(const TimeVal& interval, Logger*);
 
+/** @return 0 or -errno */
+int GetLocalAddr(int fd, SocketAddr*);
+
+/** @return 0 or -errno */
+int GetRemoteAddr(int fd, SocketAddr*);
+
+/**
+   @brief closes a socket, which may be a loopback one.
+   @return 0 or -errno
+*/
+int CloseSocket(int fd);
+
+/**
+   @brief shuts down both directions of a socket, which may be a loopback one.
+   @return 0 or -errno
+*/
+int ShutDownSocket(int fd);
+
 void GenEndpointInfo(int fd, EndpointInfo*);
 
 }}
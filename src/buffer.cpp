@@ -0,0 +1,139 @@
+#include "netkit/buffer.h"
+#include <algorithm>
+#include <errno.h>
+#include <stdlib.h> // malloc()/free()
+#include <string.h> // memcpy()
+using namespace std;
+
+namespace netkit {
+
+class MallocAllocator final : public Allocator {
+public:
+    void* Alloc(uint64_t size, uint64_t* capacity) override {
+        void* ptr = malloc(size);
+        if (ptr) {
+            *capacity = size;
+        }
+        return ptr;
+    }
+
+    void Free(void* ptr, uint64_t) override {
+        free(ptr);
+    }
+};
+
+static MallocAllocator g_malloc_allocator;
+static Allocator* g_buffer_allocator = &g_malloc_allocator;
+
+Allocator* GetDefaultAllocator() {
+    return &g_malloc_allocator;
+}
+
+void SetBufferAllocator(Allocator* a) {
+    g_buffer_allocator = (a) ? a : &g_malloc_allocator;
+}
+
+Allocator* GetBufferAllocator() {
+    return g_buffer_allocator;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void Buffer::Destroy() {
+    if (m_data) {
+        g_buffer_allocator->Free(m_data, m_capacity);
+        m_data = nullptr;
+        m_size = 0;
+        m_capacity = 0;
+    }
+}
+
+void Buffer::DoMove(Buffer* b) {
+    m_data = b->m_data;
+    m_size = b->m_size;
+    m_capacity = b->m_capacity;
+    b->m_data = nullptr;
+    b->m_size = 0;
+    b->m_capacity = 0;
+}
+
+int Buffer::Reserve(uint64_t new_size) {
+    if (new_size <= m_capacity) {
+        return 0;
+    }
+
+    uint64_t capacity = 0;
+    auto data = (char*)g_buffer_allocator->Alloc(new_size, &capacity);
+    if (!data) {
+        return -ENOMEM;
+    }
+
+    if (m_data) {
+        memcpy(data, m_data, m_size);
+        g_buffer_allocator->Free(m_data, m_capacity);
+    }
+
+    m_data = data;
+    m_capacity = capacity;
+    return 0;
+}
+
+int Buffer::Resize(uint64_t new_size) {
+    int err = Reserve(new_size);
+    if (err) {
+        return err;
+    }
+    m_size = new_size;
+    return 0;
+}
+
+int Buffer::Assign(const char* data, uint64_t len) {
+    m_size = 0;
+    int err = Reserve(len);
+    if (err) {
+        return err;
+    }
+    memcpy(m_data, data, len);
+    m_size = len;
+    return 0;
+}
+
+int Buffer::Assign(QBuf&& b) {
+    // memory of QBuf is not allocated by `g_buffer_allocator`
+    if (qbuf_empty(&b)) {
+        m_size = 0;
+    } else {
+        int err = Assign((const char*)qbuf_data(&b), qbuf_size(&b));
+        if (err) {
+            return err;
+        }
+    }
+
+    qbuf_destroy(&b);
+    qbuf_init(&b);
+    return 0;
+}
+
+int Buffer::Append(const char* data, uint64_t len) {
+    const uint64_t new_size = m_size + len;
+    if (new_size > m_capacity) {
+        // `data` may point to the memory which is about to be freed
+        const bool is_self = (data >= m_data && data < m_data + m_size);
+        const uint64_t offset = data - m_data;
+
+        // grows geometrically to keep appending amortized O(1)
+        int err = Reserve(max(new_size, m_capacity * 2));
+        if (err) {
+            return err;
+        }
+
+        if (is_self) {
+            data = m_data + offset;
+        }
+    }
+    memcpy(m_data + m_size, data, len);
+    m_size = new_size;
+    return 0;
+}
+
+}
@@ -0,0 +1,332 @@
+#include "capture.h"
+#include "misc.h"
+#include "netkit/spin_lock.h"
+#include <mutex>
+#include <vector>
+#include <stdio.h>
+#include <string.h> // strerror()/memcpy()
+using namespace std;
+
+// records are batched in each thread, so that the file is locked once per
+// batch instead of once per read or write
+#define THREAD_BUFFER_SIZE (256 * 1024)
+// buffered by stdio, so most batches do not cost a syscall
+#define CAPTURE_BUFFER_SIZE (4 * 1024 * 1024)
+// bounds what is lost if the process is killed without `StopCapture()`, for
+// threads still recording
+#define CAPTURE_FLUSH_INTERVAL_NSEC 100000000
+
+namespace netkit {
+
+namespace capture {
+
+/*
+  records made by one thread. they are appended by that thread with `lock`
+  held, which is only contended when they are flushed by another thread in
+  `StopCapture()`. buffers of exited threads are kept with their records
+  until they are adopted by new threads or the capture stops.
+*/
+struct ThreadBuffer final {
+    bool in_use = true; // protected by `g_lock`
+    SpinLock lock; // protects the following members
+    uint64_t epoch = 0; // of the capture `data` is recorded for
+    uint64_t size = 0;
+    char data[THREAD_BUFFER_SIZE];
+};
+
+// gives the buffer of a thread up when it exits
+struct ThreadBufferHolder final {
+    ~ThreadBufferHolder();
+    ThreadBuffer* buf = nullptr;
+};
+
+atomic<bool> g_is_enabled = {false};
+
+static mutex g_lock; // protects the following members
+static FILE* g_fp = nullptr;
+static Logger* g_logger = nullptr;
+static uint32_t g_next_conn_id = 1;
+static uint64_t g_last_flush_nsec = 0;
+static vector<ThreadBuffer*> g_buffer_list;
+// changed by every `StartCapture()`, so records made for a stopped capture
+// are not written to the next one. read without `g_lock`.
+static atomic<uint64_t> g_epoch = {0};
+
+// the trivially destructible ones are used in the fast path
+static thread_local ThreadBuffer* t_buffer = nullptr;
+// of the batch of `t_buffer`
+static thread_local uint64_t t_batch_begin_nsec = 0;
+static thread_local bool t_holder_destroyed = false;
+static thread_local ThreadBufferHolder t_holder;
+
+ThreadBufferHolder::~ThreadBufferHolder() {
+    if (buf) {
+        lock_guard<mutex> _(g_lock);
+        buf->in_use = false;
+    }
+    t_buffer = nullptr;
+    t_holder_destroyed = true;
+}
+
+// called with `g_lock` held. returns 0 or -errno.
+static int FlushBuffer(ThreadBuffer* buf) {
+    lock_guard<SpinLock> _(buf->lock);
+    int err = 0;
+    if (buf->size > 0 && g_fp &&
+        buf->epoch == g_epoch.load(memory_order_relaxed)) {
+        if (fwrite(buf->data, 1, buf->size, g_fp) != buf->size) {
+            err = -errno;
+        }
+    }
+    buf->size = 0;
+    return err;
+}
+
+// called with `g_lock` held
+static void DoStop() {
+    g_is_enabled.store(false, memory_order_relaxed);
+    if (g_fp) {
+        for (auto buf : g_buffer_list) {
+            int err = FlushBuffer(buf);
+            if (err) {
+                logger_error(g_logger, "write capture file failed: [%s].",
+                             strerror(-err));
+                break;
+            }
+        }
+        if (fclose(g_fp) != 0) {
+            logger_error(g_logger, "close capture file failed: [%s].",
+                         strerror(errno));
+        }
+        g_fp = nullptr;
+    }
+
+    // records in buffers of exited threads are written or dropped by now
+    uint32_t nr_kept = 0;
+    for (auto buf : g_buffer_list) {
+        if (buf->in_use) {
+            g_buffer_list[nr_kept] = buf;
+            ++nr_kept;
+        } else {
+            delete buf;
+        }
+    }
+    g_buffer_list.resize(nr_kept);
+}
+
+uint32_t NewConnId() {
+    lock_guard<mutex> _(g_lock);
+    if (!g_fp) {
+        return 0;
+    }
+    return g_next_conn_id++;
+}
+
+// writes records to the file directly. called with `g_lock` held. returns 0
+// or -errno.
+static int WriteRecords(CaptureRecord record, CaptureRecord::Type type,
+                        const struct iovec* iov, uint64_t len) {
+    // data longer than a record can hold is split
+    uint32_t idx = 0;
+    uint64_t off = 0; // in `iov[idx]`
+    do {
+        const uint32_t chunk_len =
+            (len > CaptureRecord::MAX_LEN) ? CaptureRecord::MAX_LEN : len;
+        record.type_len = ((uint32_t)type << CaptureRecord::TYPE_SHIFT) |
+            chunk_len;
+        if (fwrite(&record, sizeof(record), 1, g_fp) != 1) {
+            return -errno;
+        }
+
+        for (uint32_t left = chunk_len; left > 0;) {
+            const uint64_t nr_avail = iov[idx].iov_len - off;
+            const uint64_t nr_write = (left < nr_avail) ? left : nr_avail;
+            if (fwrite((const char*)iov[idx].iov_base + off, 1, nr_write,
+                       g_fp) != nr_write) {
+                return -errno;
+            }
+            left -= nr_write;
+            off += nr_write;
+            if (off == iov[idx].iov_len) {
+                ++idx;
+                off = 0;
+            }
+        }
+
+        len -= chunk_len;
+    } while (len > 0);
+
+    return 0;
+}
+
+// called with `g_lock` held. returns nullptr if failed.
+static ThreadBuffer* AcquireBuffer() {
+    // records left in a buffer of some exited thread are flushed along with
+    // the first batch of its new thread
+    for (auto buf : g_buffer_list) {
+        if (!buf->in_use) {
+            buf->in_use = true;
+            return buf;
+        }
+    }
+
+    auto buf = new ThreadBuffer;
+    if (!buf) {
+        return nullptr;
+    }
+    g_buffer_list.push_back(buf);
+    return buf;
+}
+
+/*
+  appends a record to the batch of the calling thread if it belongs to the
+  same capture and fits in it, and the batch is not due to be flushed.
+*/
+static bool AppendRecord(const CaptureRecord& record, const struct iovec* iov,
+                         uint32_t nr, uint64_t len, uint64_t epoch) {
+    auto buf = t_buffer;
+    if (!buf) {
+        return false;
+    }
+
+    lock_guard<SpinLock> _(buf->lock);
+    if (buf->epoch != epoch ||
+        buf->size + sizeof(record) + len > THREAD_BUFFER_SIZE ||
+        record.nsec >= t_batch_begin_nsec + CAPTURE_FLUSH_INTERVAL_NSEC) {
+        return false;
+    }
+
+    memcpy(buf->data + buf->size, &record, sizeof(record));
+    buf->size += sizeof(record);
+    for (uint32_t i = 0; i < nr; ++i) {
+        memcpy(buf->data + buf->size, iov[i].iov_base, iov[i].iov_len);
+        buf->size += iov[i].iov_len;
+    }
+    return true;
+}
+
+/*
+  flushes the batch of the calling thread and starts a new one with the
+  record, which is written directly if it does not fit. called with `g_lock`
+  held. returns 0 or -errno.
+*/
+static int FlushBatch(const CaptureRecord& record, CaptureRecord::Type type,
+                      const struct iovec* iov, uint32_t nr, uint64_t len,
+                      uint64_t epoch) {
+    // records made while the thread exits are written directly
+    if (!t_buffer && !t_holder_destroyed) {
+        t_buffer = AcquireBuffer();
+        t_holder.buf = t_buffer;
+    }
+
+    if (t_buffer) {
+        int err = FlushBuffer(t_buffer);
+        if (err) {
+            return err;
+        }
+        t_buffer->epoch = epoch;
+        t_batch_begin_nsec = record.nsec;
+    }
+
+    if (!AppendRecord(record, iov, nr, len, epoch) &&
+        epoch == g_epoch.load(memory_order_relaxed)) {
+        int err = WriteRecords(record, type, iov, len);
+        if (err) {
+            return err;
+        }
+    }
+
+    // `record.nsec` may be earlier than the last flush of another thread
+    if (record.nsec >= g_last_flush_nsec + CAPTURE_FLUSH_INTERVAL_NSEC) {
+        if (fflush(g_fp) != 0) {
+            return -errno;
+        }
+        g_last_flush_nsec = record.nsec;
+    }
+
+    return 0;
+}
+
+void RecordIov(CaptureRecord::Type type, uint32_t conn_id,
+               const struct iovec* iov, uint32_t nr) {
+    if (conn_id == 0) {
+        return;
+    }
+
+    // loaded before checking the state, so that records racing with a
+    // restart are dropped instead of going to the new file
+    const uint64_t epoch = g_epoch.load(memory_order_relaxed);
+    if (!IsEnabled()) {
+        return;
+    }
+
+    uint64_t len = 0;
+    for (uint32_t i = 0; i < nr; ++i) {
+        len += iov[i].iov_len;
+    }
+
+    CaptureRecord record;
+    record.nsec = GetNowNsec();
+    record.conn_id = conn_id;
+    // only used as it is if the data fits in a batch
+    record.type_len = ((uint32_t)type << CaptureRecord::TYPE_SHIFT) |
+        (uint32_t)(len & CaptureRecord::MAX_LEN);
+
+    if (AppendRecord(record, iov, nr, len, epoch)) {
+        return;
+    }
+
+    lock_guard<mutex> _(g_lock);
+    if (!g_fp) {
+        return;
+    }
+
+    int err = FlushBatch(record, type, iov, nr, len, epoch);
+    if (err) {
+        logger_error(g_logger,
+                     "write capture file failed: [%s]. capture stops.",
+                     strerror(-err));
+        DoStop();
+    }
+}
+
+}
+
+int StartCapture(const char* path, Logger* logger) {
+    lock_guard<mutex> _(capture::g_lock);
+    if (capture::g_fp) {
+        return -EBUSY;
+    }
+
+    FILE* fp = fopen(path, "we");
+    if (!fp) {
+        int err = errno;
+        logger_error(logger, "open capture file [%s] failed: [%s].", path,
+                     strerror(err));
+        return -err;
+    }
+
+    // a buffer of nullptr is allocated by stdio
+    setvbuf(fp, nullptr, _IOFBF, CAPTURE_BUFFER_SIZE);
+
+    if (fwrite(CAPTURE_MAGIC, CAPTURE_MAGIC_LEN, 1, fp) != 1) {
+        int err = errno;
+        logger_error(logger, "write capture file [%s] failed: [%s].", path,
+                     strerror(err));
+        fclose(fp);
+        return -err;
+    }
+
+    capture::g_fp = fp;
+    capture::g_logger = logger;
+    capture::g_epoch.fetch_add(1, memory_order_relaxed);
+    capture::g_is_enabled.store(true, memory_order_relaxed);
+    return 0;
+}
+
+void StopCapture() {
+    lock_guard<mutex> _(capture::g_lock);
+    capture::DoStop();
+}
+
+}
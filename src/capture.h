@@ -0,0 +1,36 @@
+#ifndef __NETKIT_SRC_CAPTURE_H__
+#define __NETKIT_SRC_CAPTURE_H__
+
+#include "netkit/capture.h"
+#include <atomic>
+#include <sys/uio.h> // struct iovec
+
+namespace netkit { namespace capture {
+
+extern std::atomic<bool> g_is_enabled;
+
+inline bool IsEnabled() {
+    return g_is_enabled.load(std::memory_order_relaxed);
+}
+
+/** @brief returns 0 if capturing is not enabled */
+uint32_t NewConnId();
+
+/** @brief does nothing if `conn_id` is 0 or capturing is stopped */
+void RecordIov(CaptureRecord::Type, uint32_t conn_id, const struct iovec*,
+               uint32_t nr);
+
+inline void Record(CaptureRecord::Type type, uint32_t conn_id,
+                   const void* data, uint64_t len) {
+    const struct iovec iov = {(void*)data, len};
+    RecordIov(type, conn_id, &iov, 1);
+}
+
+/** @brief records an event without data */
+inline void Record(CaptureRecord::Type type, uint32_t conn_id) {
+    RecordIov(type, conn_id, nullptr, 0);
+}
+
+}}
+
+#endif
@@ -1,25 +1,387 @@
 #include "netkit/utils.h"
 #include "netkit/connection.h"
+#include "netkit/timer.h"
+#include "memory_budget.h"
+#include "object_pool.h"
+#include "inbox.h"
+#include "event_dispatcher.h"
+#include "probe.h"
 #include <string.h> // strerror()
-#include <unistd.h> // close()
 #include <sys/timerfd.h> // timerfd_settime()
-#include <sys/socket.h> // shutdown()
+#include <thread> // this_thread::yield()
 using namespace std;
 
 namespace netkit {
 
+void* Connection::operator new(size_t size) noexcept {
+    return object_pool::Alloc(size);
+}
+
+void Connection::operator delete(void* ptr, size_t size) {
+    object_pool::Free(ptr, size);
+}
+
+void* SendItem::operator new(size_t size) noexcept {
+    return object_pool::Alloc(size);
+}
+
+void SendItem::operator delete(void* ptr, size_t size) {
+    object_pool::Free(ptr, size);
+}
+
+// locks `m_lock` unless the connection is used in one thread only
+class Connection::LockGuard final {
+public:
+    LockGuard(Connection* c)
+        : m_lock((c->m_is_single_thread) ? nullptr : &c->m_lock) {
+        if (m_lock) {
+            m_lock->lock();
+        }
+    }
+    ~LockGuard() {
+        if (m_lock) {
+            m_lock->unlock();
+        }
+    }
+
+private:
+    SpinLock* m_lock;
+};
+
+/** @brief responses of a request which is not yet the next one to send */
+struct Connection::PendingResponse final {
+    static void* operator new(size_t size) noexcept {
+        return object_pool::Alloc(size);
+    }
+    static void operator delete(void* ptr, size_t size) {
+        object_pool::Free(ptr, size);
+    }
+
+    uint64_t seq;
+    bool is_done = false;
+    SendItem* head = nullptr;
+    SendItem* tail = nullptr;
+    PendingResponse* next = nullptr;
+};
+
+static void DeleteSendItems(SendItem* item) {
+    while (item) {
+        auto next = item->next;
+        delete item;
+        item = next;
+    }
+}
+
+ConnectionPtr Connection::Create(int fd) {
+    auto conn = new Connection(fd);
+    if (!conn) {
+        return ConnectionPtr();
+    }
+
+    memory::AddConnection(1);
+    return ConnectionPtr(conn);
+}
+
 Connection::~Connection() {
     if (fd >= 0) {
-        close(fd);
+        utils::CloseSocket(fd);
+    }
+
+    // releases what is left in send queue and reorder buffer
+    DeleteSendItems(m_send_head);
+    while (m_pending_list) {
+        auto pending = m_pending_list;
+        m_pending_list = pending->next;
+        DeleteSendItems(pending->head);
+        delete pending;
     }
+
+    memory::Charge(-(int64_t)m_mem_usage.load(memory_order_relaxed));
+    memory::AddConnection(-1);
 }
 
-const EndpointInfo& Connection::GetEndpointInfo() {
-    if (m_info.remote_port == 0) {
-        lock_guard<mutex> _l(timer_lock); // use timer lock
-        if (m_info.remote_port == 0) {
-            utils::GenEndpointInfo(fd, &m_info);
+void Connection::ChargeMemory(int64_t nr_bytes) {
+    m_mem_usage.fetch_add(nr_bytes, memory_order_relaxed);
+    memory::Charge(nr_bytes);
+}
+
+void Connection::SetSendWatermark(const SendWatermark& watermark) {
+    m_watermark = watermark;
+    if (m_watermark.low_bytes == 0 ||
+        m_watermark.low_bytes > m_watermark.high_bytes) {
+        m_watermark.low_bytes = m_watermark.high_bytes / 2;
+    }
+    if (m_watermark.low_items == 0 ||
+        m_watermark.low_items > m_watermark.high_items) {
+        m_watermark.low_items = m_watermark.high_items / 2;
+    }
+}
+
+int Connection::PushSendItem(SendItem* item, bool* is_first) {
+    LockGuard _l(this);
+    if (m_is_send_blocked.load(memory_order_relaxed)) {
+        return -ENOBUFS;
+    }
+
+    m_send_bytes += item->data.size();
+    ++m_send_items;
+    if ((m_watermark.high_bytes > 0 &&
+         m_send_bytes >= m_watermark.high_bytes) ||
+        (m_watermark.high_items > 0 &&
+         m_send_items >= m_watermark.high_items)) {
+        m_is_send_blocked.store(true, memory_order_relaxed);
+    }
+
+    if (m_send_tail) {
+        m_send_tail->next = item;
+        m_send_tail = item;
+        *is_first = false;
+    } else {
+        m_send_head = item;
+        m_send_tail = item;
+        *is_first = true;
+    }
+
+    return 0;
+}
+
+void Connection::AppendSendItems(SendItem* head, SendItem* tail) {
+    if (!head) {
+        return;
+    }
+
+    for (auto item = head; item; item = item->next) {
+        m_send_bytes += item->data.size();
+        ++m_send_items;
+    }
+    if ((m_watermark.high_bytes > 0 &&
+         m_send_bytes >= m_watermark.high_bytes) ||
+        (m_watermark.high_items > 0 &&
+         m_send_items >= m_watermark.high_items)) {
+        m_is_send_blocked.store(true, memory_order_relaxed);
+    }
+
+    if (m_send_tail) {
+        m_send_tail->next = head;
+    } else {
+        m_send_head = head;
+    }
+    m_send_tail = tail;
+}
+
+int Connection::CommitSendItems(uint64_t seq, SendItem* head, SendItem* tail,
+                                bool is_done, bool* is_first) {
+    LockGuard _l(this);
+    const bool is_empty = (m_send_head == nullptr);
+
+    if (seq != m_commit_seq) {
+        // finds or inserts the pending response of `seq`
+        auto cur = &m_pending_list;
+        while (*cur && (*cur)->seq < seq) {
+            cur = &(*cur)->next;
+        }
+        auto pending = *cur;
+        if (!pending || pending->seq != seq) {
+            pending = new PendingResponse();
+            if (!pending) {
+                return -ENOMEM;
+            }
+            pending->seq = seq;
+            pending->next = *cur;
+            *cur = pending;
+        }
+
+        if (head) {
+            if (pending->tail) {
+                pending->tail->next = head;
+            } else {
+                pending->head = head;
+            }
+            pending->tail = tail;
         }
+        pending->is_done = is_done;
+
+        *is_first = false;
+        return 0;
+    }
+
+    AppendSendItems(head, tail);
+    if (is_done) {
+        ++m_commit_seq;
+
+        // releases responses of the following requests that are ready
+        while (m_pending_list && m_pending_list->seq == m_commit_seq) {
+            auto pending = m_pending_list;
+            m_pending_list = pending->next;
+            AppendSendItems(pending->head, pending->tail);
+            const bool is_pending_done = pending->is_done;
+            delete pending;
+            if (!is_pending_done) {
+                break;
+            }
+            ++m_commit_seq;
+        }
+    }
+
+    *is_first = (is_empty && m_send_head);
+    return 0;
+}
+
+SendItem* Connection::GetFrontSendItem() {
+    LockGuard _l(this);
+    return m_send_head;
+}
+
+uint32_t Connection::GetFrontSendItems(SendItem** item_list, uint32_t max) {
+    uint32_t nr = 0;
+    LockGuard _l(this);
+    for (auto item = m_send_head; item && nr < max; item = item->next) {
+        item_list[nr] = item;
+        ++nr;
+    }
+    return nr;
+}
+
+SendItem* Connection::PopSendItem(bool* is_writable) {
+    SendItem *item, *next;
+    bool is_unblocked = false;
+    {
+        LockGuard _l(this);
+        item = m_send_head;
+        next = item->next;
+        m_send_head = next;
+        if (!next) {
+            m_send_tail = nullptr;
+        }
+
+        m_send_bytes -= item->data.size();
+        --m_send_items;
+        if (m_is_send_blocked.load(memory_order_relaxed) &&
+            (m_watermark.high_bytes == 0 ||
+             m_send_bytes <= m_watermark.low_bytes) &&
+            (m_watermark.high_items == 0 ||
+             m_send_items <= m_watermark.low_items)) {
+            m_is_send_blocked.store(false, memory_order_relaxed);
+            is_unblocked = true;
+        }
+    }
+
+    if (is_writable) {
+        *is_writable = is_unblocked;
+    }
+
+    delete item;
+    return next;
+}
+
+void Connection::SetOnWritable(const function<void(SendContext*)>& f) {
+    LockGuard _l(this);
+    m_on_writable = f;
+}
+
+void Connection::NotifyWritable(SendContext* ctx) {
+    function<void(SendContext*)> f;
+    {
+        LockGuard _l(this);
+        f = m_on_writable;
+    }
+    if (f) {
+        f(ctx);
+    }
+}
+
+void Connection::PauseReader(Inbox* inbox, void* tag) {
+    m_reader_inbox = inbox;
+    m_reader_tag.store(tag, memory_order_release);
+    // pairs with `WakeReader()`, so the reader sees the condition it waits
+    // for changed, or the tag is seen there
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+int Connection::WakeReader() {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!m_reader_tag.load(memory_order_relaxed)) {
+        return 0;
+    }
+
+    void* tag = m_reader_tag.exchange(nullptr, memory_order_acq_rel);
+    if (!tag) {
+        return 0;
+    }
+
+    return m_reader_inbox->Post([tag](NotificationQueue* nq) -> void {
+        EventDispatcher::Dispatch(tag, EventResult{0, 0}, nq);
+    });
+}
+
+int Connection::AttachTimer(Timer* timer) {
+    LockGuard _l(this);
+    if (!IsValid()) {
+        return -ENOTCONN;
+    }
+
+    timer->m_prev = nullptr;
+    timer->m_next = m_timer_list;
+    if (m_timer_list) {
+        m_timer_list->m_prev = timer;
+    }
+    m_timer_list = timer;
+    timer->m_is_attached = true;
+
+    return 0;
+}
+
+void Connection::DetachTimer(Timer* timer) {
+    while (true) {
+        {
+            LockGuard _l(this);
+            if (!timer->m_is_attached) {
+                return;
+            }
+
+            // the fd of `timer` may be being armed by `ShutDown()`
+            if (!m_is_waking_timers) {
+                if (timer->m_prev) {
+                    timer->m_prev->m_next = timer->m_next;
+                } else {
+                    m_timer_list = timer->m_next;
+                }
+                if (timer->m_next) {
+                    timer->m_next->m_prev = timer->m_prev;
+                }
+                timer->m_is_attached = false;
+                return;
+            }
+        }
+        this_thread::yield();
+    }
+}
+
+const EndpointInfo& Connection::GetEndpointInfo() {
+    if (m_has_info.load(memory_order_acquire)) {
+        return m_info;
+    }
+
+    // looked up out of the lock. `m_info` is only written when publishing.
+    static thread_local EndpointInfo t_info;
+    t_info = EndpointInfo();
+    if (m_has_local_addr) {
+        t_info.local = m_info.local;
+    }
+    int err = utils::GetRemoteAddr(fd, &t_info.remote);
+    if (err == 0 && !m_has_local_addr) {
+        err = utils::GetLocalAddr(fd, &t_info.local);
+    }
+    if (err) {
+        // not cached, e.g. -ENOTCONN after the peer is gone
+        t_info.remote = SocketAddr();
+        return t_info;
+    }
+
+    LockGuard _l(this);
+    if (!m_has_info.load(memory_order_relaxed)) {
+        m_info = t_info;
+        m_has_info.store(true, memory_order_release);
     }
     return m_info;
 }
@@ -29,16 +391,36 @@ void Connection::ShutDown(Logger* logger) {
         return;
     }
 
-    shutdown(fd, SHUT_RDWR);
+    NETKIT_PROBE1(shutdown, fd);
+    utils::ShutDownSocket(fd);
+
+    int err = WakeReader();
+    if (err) {
+        logger_error(logger, "waking paused reader failed: [%s].",
+                     strerror(-err));
+    }
+
+    // no timers are attached after the connection is invalid, and none are
+    // detached while `m_is_waking_timers` is set. the list is then walked
+    // without the lock, so others do not spin through the syscalls.
+    {
+        LockGuard _l(this);
+        if (!m_timer_list) {
+            return;
+        }
+        m_is_waking_timers = true;
+    }
 
     const struct itimerspec ts = {{0, 0}, {0, 1}};
-    lock_guard<mutex> _l(timer_lock);
-    for (auto fd : timer_fds) {
-        int err = timerfd_settime(fd, 0, &ts, nullptr);
+    for (auto timer = m_timer_list; timer; timer = timer->m_next) {
+        err = timerfd_settime(timer->m_fd, 0, &ts, nullptr);
         if (err) {
             logger_error(logger, "waking timer failed: [%s].", strerror(errno));
         }
     }
+
+    LockGuard _l(this);
+    m_is_waking_timers = false;
 }
 
 }
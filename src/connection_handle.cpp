@@ -0,0 +1,127 @@
+#include "netkit/connection_handle.h"
+#include "inbox.h"
+#include "sender.h"
+#include "probe.h"
+#include <string.h> // strerror()
+using namespace std;
+
+namespace netkit {
+
+static void DummyCallback(int) {}
+
+// called in the thread of the connection
+static void PushAndLaunch(const ConnectionPtr& conn, SendItem* item,
+                          NotificationQueue* nq, Logger* logger) {
+    const int64_t nr_bytes = item->data.capacity() + sizeof(SendItem);
+    bool is_empty_before_adding;
+    int err = (conn->IsValid())
+        ? conn->PushSendItem(item, &is_empty_before_adding)
+        : -ENOTCONN;
+    if (err) {
+        item->on_complete(err);
+        delete item;
+        return;
+    }
+    conn->ChargeMemory(nr_bytes);
+
+    if (is_empty_before_adding) {
+        Sender::Launch(ConnectionPtr(conn), nq, logger);
+    }
+}
+
+int ConnectionHandle::Emit(Buffer&& b,
+                           const function<void(int err)>& on_complete) {
+    if (!m_conn || !m_inbox) {
+        return -EINVAL;
+    }
+    if (!m_conn->IsValid()) {
+        return -ENOTCONN;
+    }
+    if (m_conn->IsSendBlocked()) {
+        return -ENOBUFS;
+    }
+
+    auto item = new SendItem(std::move(b), (on_complete) ?: DummyCallback);
+    if (!item) {
+        logger_error(m_logger, "allocate send item failed: [%s].",
+                     strerror(ENOMEM));
+        return -ENOMEM;
+    }
+    // emitted outside of any request
+    NETKIT_PROBE3(emit, m_conn->fd, item->data.size(), 0);
+
+    ConnectionPtr conn = m_conn;
+    Logger* logger = m_logger;
+    int err;
+
+    // the send queue is not locked, so the whole emitting is done in the
+    // thread of the connection. errors after posting go to `on_complete`.
+    if (m_conn->IsSingleThread()) {
+        err = m_inbox->Post(
+            [conn, item, logger](NotificationQueue* nq) -> void {
+                PushAndLaunch(conn, item, nq, logger);
+            });
+        if (err) {
+            logger_error(m_logger, "post emitting to inbox failed: [%s].",
+                         strerror(-err));
+            b = std::move(item->data);
+            delete item;
+        }
+        return err;
+    }
+
+    const int64_t nr_bytes = item->data.capacity() + sizeof(SendItem);
+    bool is_empty_before_adding;
+    err = m_conn->PushSendItem(item, &is_empty_before_adding);
+    if (err) {
+        b = std::move(item->data);
+        delete item;
+        return err;
+    }
+    m_conn->ChargeMemory(nr_bytes);
+
+    if (!is_empty_before_adding) {
+        return 0;
+    }
+
+    // the sender is started in a thread with a notification queue
+    err = m_inbox->Post([conn, logger](NotificationQueue* nq) -> void {
+        Sender::Launch(ConnectionPtr(conn), nq, logger);
+    });
+    if (err) {
+        logger_error(m_logger, "post sending to inbox failed: [%s].",
+                     strerror(-err));
+        m_conn->ShutDown(m_logger);
+    }
+
+    return err;
+}
+
+int ConnectionHandle::ShutDown() {
+    if (!m_conn) {
+        return -EINVAL;
+    }
+
+    // the connection is not locked either, like emitting
+    if (m_conn->IsSingleThread()) {
+        if (!m_inbox) {
+            return -EINVAL;
+        }
+
+        ConnectionPtr conn = m_conn;
+        Logger* logger = m_logger;
+        int err = m_inbox->Post([conn, logger](NotificationQueue*) -> void {
+            conn->ShutDown(logger);
+        });
+        if (err) {
+            logger_error(m_logger, "post shutting down to inbox failed: [%s].",
+                         strerror(-err));
+        }
+        return err;
+    }
+
+    m_conn->ShutDown(m_logger);
+    return 0;
+}
+
+}
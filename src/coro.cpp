@@ -0,0 +1,14 @@
+#include "netkit/coro.h"
+#include "object_pool.h"
+
+namespace netkit { namespace coro {
+
+void* AllocFrame(size_t size) {
+    return object_pool::Alloc(size);
+}
+
+void FreeFrame(void* ptr, size_t size) {
+    object_pool::Free(ptr, size);
+}
+
+}}
@@ -0,0 +1,49 @@
+#include "netkit/endpoint_info.h"
+#include <stdio.h> // snprintf()
+using namespace std;
+
+namespace netkit {
+
+bool SocketAddr::IsAny() const {
+    if (sa.sa_family == AF_INET) {
+        return (in4.sin_addr.s_addr == htonl(INADDR_ANY));
+    }
+    if (sa.sa_family == AF_INET6) {
+        return IN6_IS_ADDR_UNSPECIFIED(&in6.sin6_addr);
+    }
+    return false;
+}
+
+uint16_t SocketAddr::GetPort() const {
+    if (sa.sa_family == AF_INET) {
+        return ntohs(in4.sin_port);
+    }
+    if (sa.sa_family == AF_INET6) {
+        return ntohs(in6.sin6_port);
+    }
+    return 0;
+}
+
+const char* SocketAddr::ToString(char* buf, uint32_t sz) const {
+    if (sz == 0) {
+        return buf;
+    }
+
+    char addr[INET6_ADDRSTRLEN];
+    if (sa.sa_family == AF_INET) {
+        if (inet_ntop(AF_INET, &in4.sin_addr, addr, sizeof(addr))) {
+            snprintf(buf, sz, "%s:%u", addr, ntohs(in4.sin_port));
+            return buf;
+        }
+    } else if (sa.sa_family == AF_INET6) {
+        if (inet_ntop(AF_INET6, &in6.sin6_addr, addr, sizeof(addr))) {
+            snprintf(buf, sz, "[%s]:%u", addr, ntohs(in6.sin6_port));
+            return buf;
+        }
+    }
+
+    snprintf(buf, sz, "unknown");
+    return buf;
+}
+
+}
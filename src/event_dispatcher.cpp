@@ -0,0 +1,64 @@
+#include "event_dispatcher.h"
+#include "netkit/tcp_server.h"
+#include "netkit/timer.h"
+#include "sender.h"
+#include <atomic>
+using namespace std;
+
+namespace netkit {
+
+static atomic<uint64_t> g_nr_stale = {0};
+
+void GetEventStat(EventStat* stat) {
+    stat->nr_stale = g_nr_stale.load(memory_order_relaxed);
+}
+
+/*
+  `Process()` of known types is final, so calls below are direct. so is
+  `DeleteSelf()` of `TcpClient` and `Sender`, which are deleted most often.
+*/
+template <typename HandlerType>
+inline void EventDispatcher::DoDispatch(HandlerType* h, EventResult res,
+                                        NotificationQueue* nq) {
+    if (!h->Process(res, nq)) {
+        h->DeleteSelf();
+    }
+}
+
+void EventDispatcher::Dispatch(void* tag, EventResult res,
+                               NotificationQueue* nq) {
+    EventHandler* handler;
+    if ((uintptr_t)tag & HANDLE_FLAG) {
+        const uint64_t handle = ((uintptr_t)tag & ~HANDLE_FLAG) >> KIND_BITS;
+        handler = HandleTable::Current()->Lookup(handle);
+        if (!handler) {
+            g_nr_stale.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+    } else {
+        handler = (EventHandler*)((uintptr_t)tag & ~KIND_MASK);
+    }
+
+    switch ((uintptr_t)tag & KIND_MASK) {
+        case TCP_SERVER:
+            DoDispatch(static_cast<TcpServer*>(handler), res, nq);
+            break;
+        case TCP_CLIENT:
+            DoDispatch(static_cast<TcpClient*>(handler), res, nq);
+            break;
+        case SENDER:
+            DoDispatch(static_cast<Sender*>(handler), res, nq);
+            break;
+        case TIMER:
+            DoDispatch(static_cast<Timer*>(handler), res, nq);
+            break;
+        case TASK:
+            DoDispatch(static_cast<Task*>(handler), res, nq);
+            break;
+        default:
+            DoDispatch(handler, res, nq);
+            break;
+    }
+}
+
+}
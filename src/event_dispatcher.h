@@ -0,0 +1,90 @@
+#ifndef __NETKIT_SRC_EVENT_DISPATCHER_H__
+#define __NETKIT_SRC_EVENT_DISPATCHER_H__
+
+#include "handle_table.h"
+
+namespace netkit {
+
+/**
+   @brief tags of events carry the kind of their handlers in the low bits, so
+   handlers of the types below are called directly instead of through virtual
+   functions. other handlers, e.g. those defined by users, are of kind
+   `GENERIC` and tagged with plain pointers.
+
+   the rest of a tag is either the address of the handler, or its handle in
+   the `HandleTable` of the ring with the highest bit set, which user space
+   addresses never have.
+*/
+class EventDispatcher final {
+public:
+    enum Kind : uintptr_t {
+        GENERIC = 0,
+        TCP_SERVER,
+        TCP_CLIENT,
+        SENDER,
+        TIMER,
+        TASK,
+    };
+
+    static void* MakeTag(EventHandler* h, Kind kind) {
+        return (void*)((uintptr_t)h | kind);
+    }
+
+    /**
+       @brief registers `h` in the table of the calling thread if `*handle` is
+       not set yet, and keeps that table in `*table`. falls back to the
+       address if the thread runs no ring. handlers are registered and
+       released in the thread of their ring.
+    */
+    static void* MakeTag(EventHandler* h, Kind kind, uint64_t* handle,
+                         HandleTable** table) {
+        if (*handle == HandleTable::INVALID_HANDLE) {
+            auto current = HandleTable::Current();
+            if (!current) {
+                return MakeTag(h, kind);
+            }
+            *handle = current->Register(h);
+            if (*handle == HandleTable::INVALID_HANDLE) {
+                return MakeTag(h, kind);
+            }
+            *table = current;
+        }
+        return (void*)(HANDLE_FLAG | (*handle << KIND_BITS) | kind);
+    }
+
+    /**
+       @brief called before the handler registered with `handle` in `table`
+       is gone. the table is the one the handle is made by, not that of the
+       calling thread.
+    */
+    static void ReleaseHandle(uint64_t handle, HandleTable* table) {
+        if (handle != HandleTable::INVALID_HANDLE && table) {
+            table->Unregister(handle);
+        }
+    }
+
+    /**
+       @brief calls the handler of `tag`, and deletes it if not kept. events
+       of released handles are dropped.
+    */
+    static void Dispatch(void* tag, EventResult, NotificationQueue*);
+
+private:
+    template <typename HandlerType>
+    static void DoDispatch(HandlerType*, EventResult, NotificationQueue*);
+
+private:
+    // handlers are at least 8-byte aligned for their vtable pointers
+    static constexpr uint32_t KIND_BITS = 3;
+    static constexpr uintptr_t KIND_MASK = (1ul << KIND_BITS) - 1;
+    static_assert(alignof(EventHandler) > KIND_MASK,
+                  "no spare bits in handler pointers");
+
+    static constexpr uintptr_t HANDLE_FLAG = (1ul << 63);
+    static_assert(HandleTable::HANDLE_BITS + KIND_BITS < 64,
+                  "handles overlap the flag");
+};
+
+}
+
+#endif
@@ -1,15 +1,45 @@
 #include "misc.h"
+#include "memory_budget.h"
+#include "listener.h"
+#include "inbox.h"
+#include "event_dispatcher.h"
 #include "netkit/utils.h"
 #include "netkit/event_manager.h"
 #include "netkit/iouring/notification_queue_impl.h"
+#include "netkit/loopback/notification_queue_impl.h"
+#include "netkit/loopback/socket.h"
 #include <string.h>
+#include <unistd.h> // close(), dup()
+#include <sys/socket.h> // shutdown()
+#include <pthread.h> // pthread_setaffinity_np()
 using namespace std;
 
 namespace netkit {
 
-using namespace iouring;
+// returns 0 or -errno
+static int CreateQueue(bool is_loopback, Logger* logger,
+                       unique_ptr<NotificationQueue>* nq) {
+    if (is_loopback) {
+        auto impl = new loopback::NotificationQueueImpl();
+        if (!impl) {
+            return -ENOMEM;
+        }
+        nq->reset(impl);
+        return impl->Init(loopback::NotificationQueueImpl::Options(), logger);
+    }
+
+    auto impl = new iouring::NotificationQueueImpl();
+    if (!impl) {
+        return -ENOMEM;
+    }
+    nq->reset(impl);
+    return impl->Init(iouring::NotificationQueueImpl::Options(), logger);
+}
 
-static void WorkLoop(NotificationQueue* nq, Logger* logger) {
+static void WorkLoop(NotificationQueue* nq, Inbox* inbox, Logger* logger) {
+    HandleTable table;
+    HandleTable::SetCurrent(&table);
+    Inbox::SetCurrent(inbox);
     while (true) {
         EventResult res;
         void* tag = nullptr;
@@ -22,16 +52,23 @@ static void WorkLoop(NotificationQueue* nq, Logger* logger) {
             break;
         }
 
-        auto handler = static_cast<EventHandler*>(tag);
-        bool keep = handler->Process(res, nq);
-        if (!keep) {
-            handler->DeleteSelf();
-        }
+        EventDispatcher::Dispatch(tag, res, nq);
     }
+
+    // `table` is gone, and `inbox` is released along with the manager
+    HandleTable::SetCurrent(nullptr);
+    Inbox::SetCurrent(nullptr);
+}
+
+EventManager::EventManager(Logger* logger)
+    : m_logger(logger), m_sched(&m_worker_nq_list) {}
+
+EventManager::~EventManager() {
+    Destroy();
 }
 
 void EventManager::Destroy() {
-    if (m_worker_thread_list.empty()) {
+    if (!m_nq) {
         return;
     }
 
@@ -48,32 +85,31 @@ void EventManager::Destroy() {
     m_worker_thread_list.clear();
     m_worker_nq_list.clear();
     m_nq.reset();
+    // after notification queues, which may be reading their eventfds
+    m_inbox_list.clear();
     m_logger = nullptr;
 }
 
 int EventManager::Init(const Options& options) {
-    if (!m_worker_thread_list.empty()) {
+    if (m_nq) {
         return 0;
     }
 
     uint32_t worker_num = 0;
-    if (options.worker_num > 0) {
+    if (options.single_thread) {
+        m_is_single_thread = true;
+    } else if (options.worker_num > 0) {
         worker_num = options.worker_num;
     } else {
         worker_num = max(thread::hardware_concurrency(), 2u) - 1;
     }
 
+    memory::SetBudget(options.memory_budget);
+    m_is_loopback = options.loopback;
+
     m_worker_nq_list.resize(worker_num);
     for (uint32_t i = 0; i < worker_num; ++i) {
-        auto impl = new NotificationQueueImpl();
-        if (!impl) {
-            logger_error(m_logger, "allocate notification queue failed: [%s].",
-                         strerror(ENOMEM));
-            return -ENOMEM;
-        }
-        m_worker_nq_list[i].reset(impl);
-
-        int err = impl->Init(NotificationQueueImpl::Options(), m_logger);
+        int err = CreateQueue(m_is_loopback, m_logger, &m_worker_nq_list[i]);
         if (err) {
             logger_error(m_logger, "init notification queue failed: [%s].",
                          strerror(-err));
@@ -81,25 +117,60 @@ int EventManager::Init(const Options& options) {
         }
     }
 
-    auto impl = new NotificationQueueImpl();
-    if (!impl) {
-        logger_error(m_logger, "allocate notification queue failed: [%s].",
-                     strerror(ENOMEM));
-        return -ENOMEM;
-    }
-    m_nq.reset(impl);
-
-    int err = impl->Init(NotificationQueueImpl::Options(), m_logger);
+    int err = CreateQueue(m_is_loopback, m_logger, &m_nq);
     if (err) {
         logger_error(m_logger, "init notification queue failed: [%s].",
                      strerror(-err));
         return err;
     }
 
+    // inboxes start waiting before the threads of their queues
+    m_inbox_list.resize(worker_num + 1);
+    for (uint32_t i = 0; i <= worker_num; ++i) {
+        auto inbox = new Inbox(m_logger);
+        if (!inbox) {
+            logger_error(m_logger, "allocate inbox failed: [%s].",
+                         strerror(ENOMEM));
+            return -ENOMEM;
+        }
+        m_inbox_list[i].reset(inbox);
+
+        err = inbox->Init();
+        if (err) {
+            logger_error(m_logger, "init inbox failed: [%s].", strerror(-err));
+            return err;
+        }
+
+        auto nq = (i < worker_num) ? m_worker_nq_list[i].get() : m_nq.get();
+        err = inbox->Start(nq);
+        if (err) {
+            logger_error(m_logger, "start inbox failed: [%s].",
+                         strerror(-err));
+            return err;
+        }
+    }
+
     m_worker_thread_list.reserve(worker_num);
     for (uint32_t i = 0; i < worker_num; ++i) {
         m_worker_thread_list.emplace_back(WorkLoop, m_worker_nq_list[i].get(),
-                                          m_logger);
+                                          m_inbox_list[i].get(), m_logger);
+    }
+
+    if (options.pin_workers) {
+        const uint32_t nr_cpus = max(thread::hardware_concurrency(), 1u);
+        for (uint32_t i = 0; i < worker_num; ++i) {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(i % nr_cpus, &cpu_set);
+            err = pthread_setaffinity_np(
+                m_worker_thread_list[i].native_handle(), sizeof(cpu_set),
+                &cpu_set);
+            if (err) {
+                // not fatal
+                logger_error(m_logger, "pin worker [%u] failed: [%s].", i,
+                             strerror(err));
+            }
+        }
     }
 
     signal(SIGPIPE, SIG_IGN);
@@ -107,12 +178,30 @@ int EventManager::Init(const Options& options) {
 }
 
 int EventManager::AddTcpServer(const char* addr, uint16_t port,
-                               TcpServerPtr ptr) {
+                               TcpServerPtr ptr,
+                               const TcpServer::Options& _options) {
     if (!ptr) {
         return -EINVAL;
     }
 
-    int fd = utils::CreateTcpServerFd(addr, port, m_logger);
+    TcpServer::Options options = _options;
+    if (m_is_single_thread) {
+        options.listener_per_worker = false;
+        options.client.inline_tasks = true;
+    }
+    if (m_is_loopback) {
+        // there is no SO_REUSEPORT for loopback listeners
+        options.listener_per_worker = false;
+    }
+
+    if (options.listener_per_worker) {
+        return AddTcpServerPerWorker(addr, port, std::move(ptr), options);
+    }
+
+    int fd = (m_is_loopback)
+        ? loopback::Listen(port, options.backlog)
+        : utils::CreateTcpServerFd(addr, port, m_logger, options.backlog,
+                                   &options.socket);
     if (fd < 0) {
         logger_error(m_logger, "create server for [%s:%u] failed: [%s].", addr,
                      port, strerror(-fd));
@@ -120,9 +209,14 @@ int EventManager::AddTcpServer(const char* addr, uint16_t port,
     }
 
     TcpServer* svr = ptr.release();
-    svr->Init(fd, &m_sched);
+    int err = svr->Init(fd, &m_sched, options);
+    if (err) {
+        logger_error(m_logger, "init server failed: [%s].", strerror(-err));
+        svr->DeleteSelf();
+        return err;
+    }
 
-    int err = svr->Start(m_nq.get());
+    err = svr->Start(m_nq.get());
     if (err) {
         logger_error(m_logger, "start server failed: [%s].", strerror(-err));
         svr->DeleteSelf();
@@ -132,13 +226,128 @@ int EventManager::AddTcpServer(const char* addr, uint16_t port,
     return fd;
 }
 
+int EventManager::AddTcpServerPerWorker(const char* addr, uint16_t port,
+                                        TcpServerPtr ptr,
+                                        const TcpServer::Options& options) {
+    const uint32_t nr_workers = m_worker_nq_list.size();
+    vector<int> fd_list(nr_workers, -1);
+    vector<int> pin_fd_list(nr_workers, -1);
+    vector<Listener*> listener_list(nr_workers, nullptr);
+    TcpServer* svr = nullptr;
+
+    int err = 0;
+    for (uint32_t i = 0; i < nr_workers; ++i) {
+        // sockets join the SO_REUSEPORT group in this order
+        int fd = utils::CreateTcpServerFd(addr, port, m_logger,
+                                          options.backlog, &options.socket);
+        if (fd < 0) {
+            logger_error(m_logger, "create server for [%s:%u] failed: [%s].",
+                         addr, port, strerror(-fd));
+            err = fd;
+            goto end;
+        }
+        fd_list[i] = fd;
+    }
+
+    if (options.steer_by_cpu) {
+        err = utils::SteerReuseportByCpu(fd_list[0], nr_workers, m_logger);
+        if (err) {
+            goto end;
+        }
+    }
+
+    svr = ptr.release();
+    err = svr->Init(fd_list[0], &m_sched, options);
+    if (err) {
+        logger_error(m_logger, "init server failed: [%s].", strerror(-err));
+        svr->DeleteSelf();
+        goto end;
+    }
+
+    // keeps the server alive until all listeners are sent
+    svr->m_nr_listeners.fetch_add(1, memory_order_relaxed);
+
+    // listeners are allocated before any of them is sent, so that the server
+    // accepts either on every worker or on none of them. sockets are pinned
+    // by duplicates in case a sent listener quits and closes its socket
+    // before it is rolled back.
+    for (uint32_t i = 0; i < nr_workers; ++i) {
+        int pin_fd = dup(fd_list[i]);
+        if (pin_fd < 0) {
+            err = -errno;
+            logger_error(m_logger, "dup() failed: [%s].", strerror(-err));
+            break;
+        }
+        pin_fd_list[i] = pin_fd;
+
+        auto listener = new Listener(fd_list[i], svr);
+        if (!listener) {
+            logger_error(m_logger, "allocate listener failed: [%s].",
+                         strerror(ENOMEM));
+            err = -ENOMEM;
+            break;
+        }
+        listener_list[i] = listener;
+        fd_list[i] = -1; // owned by `listener`
+    }
+
+    for (uint32_t i = 0; !err && i < nr_workers; ++i) {
+    retry:
+        err = m_nq->NotifyAsync(m_worker_nq_list[i].get(), 0,
+                                static_cast<EventHandler*>(listener_list[i]));
+        if (ShouldRetry(err)) {
+            goto retry;
+        }
+        if (err) {
+            logger_error(m_logger, "start listener failed: [%s].",
+                         strerror(-err));
+            // listeners already sent fail to accept and quit
+            for (uint32_t j = 0; j < i; ++j) {
+                shutdown(pin_fd_list[j], SHUT_RDWR);
+            }
+            break;
+        }
+        listener_list[i] = nullptr; // deleted by itself in its worker
+    }
+
+    // listeners not sent close their sockets and release the server
+    for (auto listener : listener_list) {
+        if (listener) {
+            listener->DeleteSelf();
+        }
+    }
+
+    svr->ReleaseListener();
+
+end:
+    for (auto fd : fd_list) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    for (auto fd : pin_fd_list) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    return err;
+}
+
 int EventManager::AddTcpClient(const char* addr, uint16_t port,
-                               TcpClientPtr ptr) {
+                               TcpClientPtr ptr,
+                               const TcpClient::Options& _options) {
     if (!ptr) {
         return -EINVAL;
     }
 
-    int fd = utils::CreateTcpClientFd(addr, port, m_logger);
+    TcpClient::Options options = _options;
+    if (m_is_single_thread) {
+        options.inline_tasks = true;
+    }
+
+    int fd = (m_is_loopback)
+        ? loopback::Connect(port)
+        : utils::CreateTcpClientFd(addr, port, m_logger, &options.socket);
     if (fd < 0) {
         logger_error(m_logger, "connect to [%s:%u] failed: [%s].", addr, port,
                      strerror(-fd));
@@ -146,9 +355,15 @@ int EventManager::AddTcpClient(const char* addr, uint16_t port,
     }
 
     TcpClient* client = ptr.release();
-    client->Init(fd, &m_sched);
+    // started here, but runs in the thread calling `Loop()`
+    int err = client->Init(fd, &m_sched, m_inbox_list.back().get(), options);
+    if (err) {
+        logger_error(m_logger, "init client failed: [%s].", strerror(-err));
+        client->DeleteSelf();
+        return err;
+    }
 
-    int err = client->Start(m_nq.get());
+    err = client->Start(m_nq.get());
     if (err) {
         logger_error(m_logger, "TcpClient start failed: [%s].", strerror(-err));
         client->DeleteSelf();
@@ -158,8 +373,67 @@ int EventManager::AddTcpClient(const char* addr, uint16_t port,
     return fd;
 }
 
+int EventManager::Post(uint32_t worker_idx,
+                       const function<void(NotificationQueue*)>& f) {
+    // the thread calling `Loop()` is the only worker in single-thread mode
+    if (m_is_single_thread && worker_idx == 0) {
+        worker_idx = m_inbox_list.size() - 1;
+    } else if (worker_idx >= m_worker_nq_list.size()) {
+        return -EINVAL;
+    }
+
+    return m_inbox_list[worker_idx]->Post(f);
+}
+
+void EventManager::GetQueueStat(
+    NotificationQueue::Stat* total,
+    vector<NotificationQueue::Stat>* queue_stat_list) const {
+    *total = NotificationQueue::Stat();
+    if (queue_stat_list) {
+        queue_stat_list->clear();
+    }
+    if (!m_nq) {
+        return;
+    }
+
+    vector<const NotificationQueue*> nq_list;
+    nq_list.reserve(m_worker_nq_list.size() + 1);
+    for (auto& nq : m_worker_nq_list) {
+        nq_list.push_back(nq.get());
+    }
+    nq_list.push_back(m_nq.get());
+
+    auto add = [total, queue_stat_list,
+                &nq_list](const NotificationQueue* nq) -> void {
+        NotificationQueue::Stat stat;
+        nq->GetStat(&stat);
+        // messages are counted by their senders
+        for (auto sender : nq_list) {
+            stat.nr_msgs_received += sender->GetNrMsgsSentTo(nq);
+        }
+        total->nr_sqes += stat.nr_sqes;
+        total->nr_submits += stat.nr_submits;
+        total->nr_sq_full += stat.nr_sq_full;
+        total->nr_cqes += stat.nr_cqes;
+        total->nr_cq_overflows += stat.nr_cq_overflows;
+        total->nr_msgs_sent += stat.nr_msgs_sent;
+        total->nr_msgs_received += stat.nr_msgs_received;
+        total->nr_waits += stat.nr_waits;
+        total->nr_peeks += stat.nr_peeks;
+        total->blocked_nsec += stat.blocked_nsec;
+        total->busy_nsec += stat.busy_nsec;
+        if (queue_stat_list) {
+            queue_stat_list->push_back(stat);
+        }
+    };
+
+    for (auto nq : nq_list) {
+        add(nq);
+    }
+}
+
 void EventManager::Loop() {
-    WorkLoop(m_nq.get(), m_logger);
+    WorkLoop(m_nq.get(), m_inbox_list.back().get(), m_logger);
 }
 
 }
@@ -0,0 +1,209 @@
+#include "netkit/framer.h"
+#include <string.h> // memchr()/memcmp()
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+using namespace std;
+
+namespace netkit {
+
+/* ------------------------------------------------------------------------- */
+
+ReqStat VarintFramer::Check(const Buffer& buf, uint32_t* req_bytes) const {
+    auto data = (const uint8_t*)buf.data();
+    const uint64_t size = buf.size();
+
+    // a 32-bit length takes at most 5 bytes
+    uint64_t len = 0;
+    for (uint32_t i = 0; i < 5; ++i) {
+        if (i == size) {
+            *req_bytes = 0;
+            return ReqStat::MORE_DATA;
+        }
+
+        len |= (uint64_t)(data[i] & 0x7f) << (7 * i);
+        if ((data[i] & 0x80) == 0) {
+            const uint64_t total = len + i + 1;
+            if (total > m_max_request_size) {
+                return ReqStat::INVALID;
+            }
+            if (size < total) {
+                *req_bytes = total - size;
+                return ReqStat::MORE_DATA;
+            }
+            *req_bytes = total;
+            return ReqStat::VALID;
+        }
+    }
+
+    return ReqStat::INVALID;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static const char* FindScalar(const char* data, uint64_t len,
+                              const char* delim, uint32_t delim_len) {
+    if (len < delim_len) {
+        return nullptr;
+    }
+
+    const char* end = data + len - delim_len + 1;
+    while (data < end) {
+        auto p = (const char*)memchr(data, delim[0], end - data);
+        if (!p) {
+            return nullptr;
+        }
+        if (memcmp(p + 1, delim + 1, delim_len - 1) == 0) {
+            return p;
+        }
+        data = p + 1;
+    }
+
+    return nullptr;
+}
+
+/*
+  both SIMD versions compare the first and the last byte of the delimiter with
+  a whole block at once, and only candidates matching both are verified with
+  memcmp(). for "\r\n" this leaves almost no false positives.
+*/
+
+#ifdef __SSE2__
+static const char* FindSSE2(const char* data, uint64_t len, const char* delim,
+                            uint32_t delim_len) {
+    if (len < delim_len) {
+        return nullptr;
+    }
+
+    const __m128i first = _mm_set1_epi8(delim[0]);
+    const __m128i last = _mm_set1_epi8(delim[delim_len - 1]);
+    const uint64_t nr_candidates = len - delim_len + 1;
+
+    uint64_t i = 0;
+    for (; i + 16 <= nr_candidates; i += 16) {
+        const __m128i b0 = _mm_loadu_si128((const __m128i*)(data + i));
+        const __m128i b1 =
+            _mm_loadu_si128((const __m128i*)(data + i + delim_len - 1));
+        uint32_t mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(b0, first), _mm_cmpeq_epi8(b1, last)));
+        while (mask) {
+            const uint32_t pos = __builtin_ctz(mask);
+            if (memcmp(data + i + pos + 1, delim + 1, delim_len - 1) == 0) {
+                return data + i + pos;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return FindScalar(data + i, len - i, delim, delim_len);
+}
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("avx2"))) static const char*
+FindAVX2(const char* data, uint64_t len, const char* delim,
+         uint32_t delim_len) {
+    if (len < delim_len) {
+        return nullptr;
+    }
+
+    const __m256i first = _mm256_set1_epi8(delim[0]);
+    const __m256i last = _mm256_set1_epi8(delim[delim_len - 1]);
+    const uint64_t nr_candidates = len - delim_len + 1;
+
+    uint64_t i = 0;
+    for (; i + 32 <= nr_candidates; i += 32) {
+        const __m256i b0 = _mm256_loadu_si256((const __m256i*)(data + i));
+        const __m256i b1 =
+            _mm256_loadu_si256((const __m256i*)(data + i + delim_len - 1));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(b0, first), _mm256_cmpeq_epi8(b1, last)));
+        while (mask) {
+            const uint32_t pos = __builtin_ctz(mask);
+            if (memcmp(data + i + pos + 1, delim + 1, delim_len - 1) == 0) {
+                return data + i + pos;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return FindSSE2(data + i, len - i, delim, delim_len);
+}
+#endif
+
+typedef const char* (*FindFunc)(const char*, uint64_t, const char*, uint32_t);
+
+static FindFunc SelectFindFunc() {
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (__builtin_cpu_supports("avx2")) {
+        return FindAVX2;
+    }
+#endif
+#ifdef __SSE2__
+    return FindSSE2;
+#else
+    return FindScalar;
+#endif
+}
+
+static const FindFunc g_find_func = SelectFindFunc();
+
+const char* DelimiterFramer::Find(const char* data, uint64_t len,
+                                  const char* delim, uint32_t delim_len) {
+    if (delim_len == 1) {
+        return (const char*)memchr(data, delim[0], len);
+    }
+    return g_find_func(data, len, delim, delim_len);
+}
+
+int DelimiterFramer::Init(const char* delim, uint32_t delim_len,
+                          uint32_t max_request_size, Logger* logger) {
+    // a truncated delimiter would match the wrong sequence
+    if (delim_len == 0 || delim_len > MAX_DELIMITER_LEN) {
+        logger_error(logger,
+                     "invalid delimiter length [%u], should be in [1, %u].",
+                     delim_len, MAX_DELIMITER_LEN);
+        return -EINVAL;
+    }
+
+    memcpy(m_delim, delim, delim_len);
+    m_delim_len = delim_len;
+    m_max_request_size = max_request_size;
+    m_nr_scanned = 0;
+    return 0;
+}
+
+ReqStat DelimiterFramer::Check(const Buffer& buf, uint32_t* req_bytes) {
+    const uint64_t size = buf.size();
+
+    // a delimiter may straddle the boundary of the previous scan
+    uint64_t offset = 0;
+    if (m_nr_scanned >= m_delim_len) {
+        offset = m_nr_scanned - m_delim_len + 1;
+    }
+    if (offset > size) {
+        offset = 0;
+    }
+
+    const char* p =
+        Find(buf.data() + offset, size - offset, m_delim, m_delim_len);
+    if (!p) {
+        if (size > m_max_request_size) {
+            return ReqStat::INVALID;
+        }
+        m_nr_scanned = size;
+        *req_bytes = 0;
+        return ReqStat::MORE_DATA;
+    }
+
+    const uint64_t total = (p - buf.data()) + m_delim_len;
+    if (total > m_max_request_size) {
+        return ReqStat::INVALID;
+    }
+
+    m_nr_scanned = 0;
+    *req_bytes = total;
+    return ReqStat::VALID;
+}
+
+}
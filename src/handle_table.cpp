@@ -0,0 +1,66 @@
+#include "handle_table.h"
+using namespace std;
+
+// slots reserved for each ring
+#define INITIAL_SLOT_NUM 1024
+
+// generations wrap around within the bits left in a handle
+#define GENERATION_MASK ((1ul << (HandleTable::HANDLE_BITS - 32)) - 1)
+
+#define NO_FREE_SLOT UINT32_MAX
+
+namespace netkit {
+
+static thread_local HandleTable* t_current = nullptr;
+
+HandleTable* HandleTable::Current() {
+    return t_current;
+}
+
+void HandleTable::SetCurrent(HandleTable* table) {
+    t_current = table;
+}
+
+HandleTable::HandleTable() : m_free_head(NO_FREE_SLOT) {
+    m_slot_list.reserve(INITIAL_SLOT_NUM);
+}
+
+uint64_t HandleTable::Register(EventHandler* h) {
+    uint32_t idx = m_free_head;
+    if (idx != NO_FREE_SLOT) {
+        m_free_head = m_slot_list[idx].next_free;
+    } else {
+        if (m_slot_list.size() >= NO_FREE_SLOT) {
+            return INVALID_HANDLE;
+        }
+        idx = m_slot_list.size();
+        m_slot_list.push_back(Slot{nullptr, 1, NO_FREE_SLOT});
+    }
+
+    auto& slot = m_slot_list[idx];
+    slot.handler = h;
+    return ((uint64_t)slot.generation << 32) | idx;
+}
+
+void HandleTable::Unregister(uint64_t handle) {
+    const uint32_t idx = (uint32_t)handle;
+    // stale or foreign handles must not free a slot in use
+    if (idx >= m_slot_list.size()) {
+        return;
+    }
+    auto& slot = m_slot_list[idx];
+    if (!slot.handler || slot.generation != (handle >> 32)) {
+        return;
+    }
+
+    slot.handler = nullptr;
+    slot.generation = (slot.generation + 1) & GENERATION_MASK;
+    if (slot.generation == 0) {
+        slot.generation = 1;
+    }
+
+    slot.next_free = m_free_head;
+    m_free_head = idx;
+}
+
+}
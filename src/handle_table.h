@@ -0,0 +1,69 @@
+#ifndef __NETKIT_SRC_HANDLE_TABLE_H__
+#define __NETKIT_SRC_HANDLE_TABLE_H__
+
+#include "netkit/event_handler.h"
+#include <stdint.h>
+#include <vector>
+
+namespace netkit {
+
+/**
+   @brief handlers of one ring, identified by handles made of a slot index and
+   the generation of the slot. the generation changes when a handler is
+   unregistered, so completions arriving after that are told apart from those
+   of whatever reuses the memory. used in the thread of the ring only.
+*/
+class HandleTable final {
+public:
+    /** @brief bits of a handle */
+    static constexpr uint32_t HANDLE_BITS = 60;
+
+    /** @brief never returned by `Register()` */
+    static constexpr uint64_t INVALID_HANDLE = 0;
+
+    HandleTable();
+
+    /** @brief returns a handle of `h`, or `INVALID_HANDLE` if failed */
+    uint64_t Register(EventHandler* h);
+
+    /**
+       @brief completions with `handle` are stale after this. stale handles
+       are ignored.
+    */
+    void Unregister(uint64_t handle);
+
+    /** @brief returns nullptr if `handle` is stale */
+    EventHandler* Lookup(uint64_t handle) const {
+        const uint32_t idx = (uint32_t)handle;
+        if (idx >= m_slot_list.size()) {
+            return nullptr;
+        }
+        const Slot& slot = m_slot_list[idx];
+        return (slot.generation == (handle >> 32)) ? slot.handler : nullptr;
+    }
+
+    /** @brief the table of the ring run by the calling thread, or nullptr */
+    static HandleTable* Current();
+    static void SetCurrent(HandleTable*);
+
+private:
+    // 16 bytes, so 4 slots share a cache line
+    struct Slot final {
+        EventHandler* handler;
+        uint32_t generation; // never 0
+        uint32_t next_free; // valid if `handler` is nullptr
+    };
+
+    std::vector<Slot> m_slot_list;
+    uint32_t m_free_head;
+
+private:
+    HandleTable(const HandleTable&) = delete;
+    HandleTable(HandleTable&&) = delete;
+    void operator=(const HandleTable&) = delete;
+    void operator=(HandleTable&&) = delete;
+};
+
+}
+
+#endif
@@ -0,0 +1,155 @@
+#include "inbox.h"
+#include "misc.h"
+#include "object_pool.h"
+#include <string.h> // strerror()
+#include <unistd.h> // write()/close()
+#include <sys/eventfd.h>
+using namespace std;
+
+namespace netkit {
+
+struct Inbox::Item final {
+    Item(const function<void(NotificationQueue*)>& _f) : f(_f) {}
+
+    static void* operator new(size_t size) noexcept {
+        return object_pool::Alloc(size);
+    }
+    static void operator delete(void* ptr, size_t size) {
+        object_pool::Free(ptr, size);
+    }
+
+    function<void(NotificationQueue*)> f;
+    Item* next = nullptr;
+};
+
+static thread_local Inbox* t_current = nullptr;
+
+Inbox* Inbox::Current() {
+    return t_current;
+}
+
+void Inbox::SetCurrent(Inbox* inbox) {
+    t_current = inbox;
+}
+
+Inbox::~Inbox() {
+    auto item = m_head.exchange(nullptr, memory_order_acquire);
+    while (item) {
+        auto next = item->next;
+        delete item;
+        item = next;
+    }
+
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+int Inbox::Init() {
+    m_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_fd < 0) {
+        logger_error(m_logger, "create eventfd failed: [%s].", strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
+int Inbox::WaitForItems(NotificationQueue* nq) {
+loop:
+    int err = nq->ReadAsync(m_fd, &m_value, sizeof(m_value),
+                            static_cast<EventHandler*>(this));
+    if (ShouldRetry(err)) {
+        goto loop;
+    }
+
+    if (err) {
+        logger_error(m_logger, "wait for inbox items failed: [%s].",
+                     strerror(-err));
+        // fall through
+    }
+
+    return err;
+}
+
+int Inbox::Start(NotificationQueue* nq) {
+    return WaitForItems(nq);
+}
+
+int Inbox::Post(const function<void(NotificationQueue*)>& f) {
+    auto item = new Item(f);
+    if (!item) {
+        return -ENOMEM;
+    }
+
+    auto head = m_head.load(memory_order_relaxed);
+    do {
+        item->next = head;
+    } while (!m_head.compare_exchange_weak(head, item, memory_order_release,
+                                           memory_order_relaxed));
+
+    // the consumer is already woken up by the one before
+    if (head) {
+        return 0;
+    }
+
+    const uint64_t value = 1;
+loop:
+    if (write(m_fd, &value, sizeof(value)) != sizeof(value)) {
+        int err = -errno;
+        if (err == -EINTR) {
+            goto loop;
+        }
+        // the counter is full, so the consumer is woken up anyway
+        if (err == -EAGAIN) {
+            return 0;
+        }
+        logger_error(m_logger, "wake inbox up failed: [%s].", strerror(-err));
+
+        // takes the item back. it stays queued if others are pushed after it,
+        // as they count on this wakeup too.
+        auto expected = item;
+        if (m_head.compare_exchange_strong(expected, nullptr,
+                                           memory_order_acquire,
+                                           memory_order_relaxed)) {
+            delete item;
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+bool Inbox::Process(EventResult res, NotificationQueue* nq) {
+    bool is_ok = true;
+    if (res.err) {
+        logger_error(m_logger, "read inbox eventfd failed: [%s].",
+                     strerror(res.err));
+        is_ok = ShouldRetry(-res.err);
+    }
+
+    // items are pushed in reverse order
+    auto item = m_head.exchange(nullptr, memory_order_acquire);
+    Item* list = nullptr;
+    while (item) {
+        auto next = item->next;
+        item->next = list;
+        list = item;
+        item = next;
+    }
+
+    while (list) {
+        auto next = list->next;
+        list->f(nq);
+        delete list;
+        list = next;
+    }
+
+    // the inbox is owned by `EventManager`. the eventfd is not read again
+    // if it is broken, or every read would fail at once.
+    if (is_ok) {
+        WaitForItems(nq);
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,56 @@
+#ifndef __NETKIT_SRC_INBOX_H__
+#define __NETKIT_SRC_INBOX_H__
+
+#include "netkit/event_handler.h"
+#include "logger/logger.h"
+#include <atomic>
+#include <functional>
+
+namespace netkit {
+
+/**
+   @brief closures posted by any thread and run in the thread of one
+   notification queue. producers push to a lock-free stack, and only the one
+   making it non-empty wakes the consumer up through an eventfd.
+*/
+class Inbox final : public EventHandler {
+public:
+    Inbox(Logger* l) : m_logger(l) {}
+    ~Inbox();
+
+    // returns 0 or -errno
+    int Init();
+
+    /** @brief must be called before the thread of `nq` starts */
+    int Start(NotificationQueue* nq);
+
+    /** @brief thread-safe. returns 0 or -errno. */
+    int Post(const std::function<void(NotificationQueue*)>& f);
+
+    bool Process(EventResult, NotificationQueue*) override;
+
+    /** @brief the inbox of the calling thread, or nullptr */
+    static Inbox* Current();
+    static void SetCurrent(Inbox*);
+
+private:
+    struct Item;
+
+    int WaitForItems(NotificationQueue*);
+
+private:
+    std::atomic<Item*> m_head = {nullptr};
+    int m_fd = -1;
+    uint64_t m_value = 0; // read from `m_fd`
+    Logger* m_logger;
+
+private:
+    Inbox(const Inbox&) = delete;
+    Inbox(Inbox&&) = delete;
+    void operator=(const Inbox&) = delete;
+    void operator=(Inbox&&) = delete;
+};
+
+}
+
+#endif
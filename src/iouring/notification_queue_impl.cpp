@@ -1,6 +1,7 @@
 #include "netkit/iouring/notification_queue_impl.h"
-#include <string.h> // strerror()
-#include <functional>
+#include "../misc.h"
+#include <string.h> // strerror()/memset()
+#include <poll.h> // POLLIN
 using namespace std;
 
 namespace netkit { namespace iouring {
@@ -28,46 +29,78 @@ void NotificationQueueImpl::Destroy() {
     }
 }
 
+/*
+  completions carrying this tag are consumed internally, e.g. those of linked
+  timeouts and of failed submissions.
+*/
+static char g_ignored_tag;
+
+int NotificationQueueImpl::Wait(struct io_uring_cqe** cqe,
+                                const TimeVal* timeout) {
+    // clocks are read only when blocking, which is rare under load
+    const uint64_t begin = GetNowNsec();
+    if (m_last_wakeup_nsec > 0) {
+        AddCounter(&m_busy_nsec, begin - m_last_wakeup_nsec);
+    }
+    AddCounter(&m_nr_waits, 1);
+
+    int ret;
+    if (timeout) {
+        struct __kernel_timespec kts = {
+            .tv_sec = timeout->tv_sec,
+            .tv_nsec = timeout->tv_usec * 1000,
+        };
+        ret = io_uring_wait_cqe_timeout(&m_ring, cqe, &kts);
+        if (ret < 0 && ret != -EAGAIN && ret != -EINTR) {
+            logger_error(m_logger, "wait cqe with timeout failed: [%s].",
+                         strerror(-ret));
+        }
+    } else {
+        ret = io_uring_wait_cqe(&m_ring, cqe);
+        if (ret < 0 && ret != -EAGAIN && ret != -EINTR) {
+            logger_error(m_logger, "wait cqe failed: [%s].", strerror(-ret));
+        }
+    }
+
+    m_last_wakeup_nsec = GetNowNsec();
+    AddCounter(&m_blocked_nsec, m_last_wakeup_nsec - begin);
+    return ret;
+}
+
 int NotificationQueueImpl::Next(EventResult* res, void** tag,
                                 const TimeVal* timeout) {
     struct io_uring_cqe* cqe = nullptr;
 
-    if (timeout) {
-        if (timeout->tv_sec == 0 && timeout->tv_usec == 0) {
-            int ret = io_uring_peek_cqe(&m_ring, &cqe);
-            if (ret < 0) {
-                if (ret != -EAGAIN && ret != -EINTR) {
-                    logger_error(m_logger, "peek cqe failed: [%s].",
-                                 strerror(-ret));
-                }
-                return ret;
-            }
-        } else {
-            struct __kernel_timespec kts = {
-                .tv_sec = timeout->tv_sec,
-                .tv_nsec = timeout->tv_usec * 1000,
-            };
-            int ret = io_uring_wait_cqe_timeout(&m_ring, &cqe, &kts);
-            if (ret < 0) {
-                if (ret != -EAGAIN && ret != -EINTR) {
-                    logger_error(m_logger,
-                                 "wait cqe with timeout failed: [%s].",
-                                 strerror(-ret));
-                }
-                return ret;
-            }
+again:
+
+    if (io_uring_cq_has_overflow(&m_ring)) {
+        AddCounter(&m_nr_cq_overflows, 1);
+    }
+
+    // events that are ready are taken without blocking
+    int ret = io_uring_peek_cqe(&m_ring, &cqe);
+    if (ret == 0) {
+        AddCounter(&m_nr_peeks, 1);
+    } else if (timeout && timeout->tv_sec == 0 && timeout->tv_usec == 0) {
+        AddCounter(&m_nr_peeks, 1);
+        if (ret != -EAGAIN && ret != -EINTR) {
+            logger_error(m_logger, "peek cqe failed: [%s].", strerror(-ret));
         }
+        return ret;
     } else {
-        int ret = io_uring_wait_cqe(&m_ring, &cqe);
+        ret = Wait(&cqe, timeout);
         if (ret < 0) {
-            if (ret != -EAGAIN && ret != -EINTR) {
-                logger_error(m_logger, "wait cqe failed: [%s].",
-                             strerror(-ret));
-            }
             return ret;
         }
     }
 
+    AddCounter(&m_nr_cqes, 1);
+
+    if (io_uring_cqe_get_data(cqe) == &g_ignored_tag) {
+        io_uring_cqe_seen(&m_ring, cqe);
+        goto again;
+    }
+
     if (cqe->res < 0) {
         res->val = 0;
         res->err = -cqe->res;
@@ -82,95 +115,231 @@ int NotificationQueueImpl::Next(EventResult* res, void** tag,
     return 0;
 }
 
-static int GenericAsync(struct io_uring* ring, Logger* logger,
-                        const function<void(struct io_uring_sqe*)>& func) {
+void NotificationQueueImpl::GetStat(Stat* stat) const {
+    stat->nr_sqes = m_nr_sqes.load(memory_order_relaxed);
+    stat->nr_submits = m_nr_submits.load(memory_order_relaxed);
+    stat->nr_sq_full = m_nr_sq_full.load(memory_order_relaxed);
+    stat->nr_cqes = m_nr_cqes.load(memory_order_relaxed);
+    stat->nr_cq_overflows = m_nr_cq_overflows.load(memory_order_relaxed);
+    stat->nr_msgs_sent = m_nr_msgs_sent.load(memory_order_relaxed);
+    stat->nr_msgs_received = m_nr_msgs_received.load(memory_order_relaxed);
+    stat->nr_waits = m_nr_waits.load(memory_order_relaxed);
+    stat->nr_peeks = m_nr_peeks.load(memory_order_relaxed);
+    stat->blocked_nsec = m_blocked_nsec.load(memory_order_relaxed);
+    stat->busy_nsec = m_busy_nsec.load(memory_order_relaxed);
+}
+
+uint64_t NotificationQueueImpl::GetNrMsgsSentTo(
+    const NotificationQueue* nq) const {
+    return m_msg_counter_list.Get(nq);
+}
+
+// makes sure that there are at least `nr` free sqes
+int NotificationQueueImpl::ReserveSqe(uint32_t nr) {
+    if (io_uring_sq_space_left(&m_ring) >= nr) {
+        return 0;
+    }
+
+    AddCounter(&m_nr_sq_full, 1);
+
     int ret;
-    auto sqe = io_uring_get_sqe(ring);
-    if (!sqe) {
-        do {
-            ret = io_uring_submit(ring);
-        } while (ret == -EAGAIN || ret == -EINTR);
-        if (ret < 0) {
-            logger_error(logger, "io_uring_submit failed: [%s].",
-                         strerror(-ret));
-            return ret;
-        }
+    do {
+        AddCounter(&m_nr_submits, 1);
+        ret = io_uring_submit(&m_ring);
+    } while (ret == -EAGAIN || ret == -EINTR);
+    if (ret < 0) {
+        logger_error(m_logger, "io_uring_submit failed: [%s].",
+                     strerror(-ret));
+        return ret;
+    }
 
-        sqe = io_uring_get_sqe(ring);
-        if (!sqe) {
-            return -EAGAIN;
-        }
+    if (io_uring_sq_space_left(&m_ring) < nr) {
+        return -EAGAIN;
     }
+    return 0;
+}
 
-    func(sqe);
+int NotificationQueueImpl::Submit(struct io_uring_sqe** sqe_list,
+                                  uint32_t nr) {
+    AddCounter(&m_nr_sqes, nr);
 
+    int ret;
     do {
-        ret = io_uring_submit(ring);
+        AddCounter(&m_nr_submits, 1);
+        ret = io_uring_submit(&m_ring);
     } while (ret == -EINTR);
     if (ret < 0) {
-        logger_error(logger, "io_uring_submit failed: [%s].", strerror(-ret));
-        // clear sqe's content that are set in func()
-        io_uring_prep_nop(sqe);
-        io_uring_sqe_set_data(sqe, nullptr);
+        logger_error(m_logger, "io_uring_submit failed: [%s].",
+                     strerror(-ret));
+        // clear sqes' content that are set by callers
+        for (uint32_t i = 0; i < nr; ++i) {
+            io_uring_prep_nop(sqe_list[i]);
+            io_uring_sqe_set_data(sqe_list[i], &g_ignored_tag);
+        }
         return ret;
     }
 
     return 0;
 }
 
+// `func` is not wrapped in `std::function`, which may allocate for captures
+template <typename FuncType>
+int NotificationQueueImpl::GenericAsync(const FuncType& func) {
+    int ret = ReserveSqe(1);
+    if (ret) {
+        return ret;
+    }
+
+    auto sqe = io_uring_get_sqe(&m_ring);
+    func(sqe);
+
+    return Submit(&sqe, 1);
+}
+
 int NotificationQueueImpl::AcceptAsync(uintptr_t fd, void* tag,
                                        bool multishot) {
     if (multishot) {
-        return GenericAsync(
-            &m_ring, m_logger, [fd, tag](struct io_uring_sqe* sqe) -> void {
-                io_uring_prep_multishot_accept(sqe, fd, nullptr, nullptr, 0);
-                io_uring_sqe_set_data(sqe, tag);
-            });
+        return GenericAsync([fd, tag](struct io_uring_sqe* sqe) -> void {
+            io_uring_prep_multishot_accept(sqe, fd, nullptr, nullptr, 0);
+            io_uring_sqe_set_data(sqe, tag);
+        });
     }
 
-    return GenericAsync(&m_ring, m_logger,
-                        [fd, tag](struct io_uring_sqe* sqe) -> void {
-                            io_uring_prep_accept(sqe, fd, nullptr, nullptr, 0);
-                            io_uring_sqe_set_data(sqe, tag);
-                        });
+    return GenericAsync([fd, tag](struct io_uring_sqe* sqe) -> void {
+        io_uring_prep_accept(sqe, fd, nullptr, nullptr, 0);
+        io_uring_sqe_set_data(sqe, tag);
+    });
+}
+
+int NotificationQueueImpl::ConnectAsync(uintptr_t fd,
+                                        const struct sockaddr* addr,
+                                        socklen_t len, void* tag) {
+    return GenericAsync([fd, addr, len, tag](struct io_uring_sqe* sqe) -> void {
+        io_uring_prep_connect(sqe, fd, addr, len);
+        io_uring_sqe_set_data(sqe, tag);
+    });
 }
 
 int NotificationQueueImpl::ReadAsync(uintptr_t fd, void* buf, uint64_t sz,
                                      void* tag) {
-    return GenericAsync(&m_ring, m_logger,
-                        [fd, buf, sz, tag](struct io_uring_sqe* sqe) -> void {
-                            io_uring_prep_read(sqe, fd, buf, sz, -1);
-                            io_uring_sqe_set_data(sqe, tag);
-                        });
+    return GenericAsync([fd, buf, sz, tag](struct io_uring_sqe* sqe) -> void {
+        io_uring_prep_read(sqe, fd, buf, sz, -1);
+        io_uring_sqe_set_data(sqe, tag);
+    });
+}
+
+int NotificationQueueImpl::ReadWithTimeoutAsync(uintptr_t fd, void* buf,
+                                                uint64_t sz,
+                                                const TimeVal& timeout,
+                                                void* tag) {
+    int ret = ReserveSqe(2);
+    if (ret) {
+        return ret;
+    }
+
+    struct io_uring_sqe* sqe_list[2];
+    sqe_list[0] = io_uring_get_sqe(&m_ring);
+    io_uring_prep_read(sqe_list[0], fd, buf, sz, -1);
+    io_uring_sqe_set_data(sqe_list[0], tag);
+    io_uring_sqe_set_flags(sqe_list[0], IOSQE_IO_LINK);
+
+    // timespec is copied when the request is submitted
+    struct __kernel_timespec kts = {
+        .tv_sec = timeout.tv_sec,
+        .tv_nsec = timeout.tv_usec * 1000,
+    };
+    sqe_list[1] = io_uring_get_sqe(&m_ring);
+    io_uring_prep_link_timeout(sqe_list[1], &kts, 0);
+    io_uring_sqe_set_data(sqe_list[1], &g_ignored_tag);
+
+    return Submit(sqe_list, 2);
+}
+
+int NotificationQueueImpl::PollAsync(uintptr_t fd, short events, void* tag) {
+    return GenericAsync([fd, events, tag](struct io_uring_sqe* sqe) -> void {
+        io_uring_prep_poll_add(sqe, fd, events);
+        io_uring_sqe_set_data(sqe, tag);
+    });
+}
+
+int NotificationQueueImpl::TimeoutAsync(const TimeVal& timeout, void* tag) {
+    // timespec is copied when the request is submitted
+    struct __kernel_timespec kts = {
+        .tv_sec = timeout.tv_sec,
+        .tv_nsec = timeout.tv_usec * 1000,
+    };
+    return GenericAsync([&kts, tag](struct io_uring_sqe* sqe) -> void {
+        io_uring_prep_timeout(sqe, &kts, 0, 0);
+        io_uring_sqe_set_data(sqe, tag);
+    });
 }
 
 int NotificationQueueImpl::WriteAsync(uintptr_t fd, const void* buf,
                                       uint64_t sz, void* tag) {
-    return GenericAsync(&m_ring, m_logger,
-                        [fd, buf, sz, tag](struct io_uring_sqe* sqe) -> void {
-                            io_uring_prep_write(sqe, fd, buf, sz, -1);
-                            io_uring_sqe_set_data(sqe, tag);
-                        });
+    return GenericAsync([fd, buf, sz, tag](struct io_uring_sqe* sqe) -> void {
+        io_uring_prep_write(sqe, fd, buf, sz, -1);
+        io_uring_sqe_set_data(sqe, tag);
+    });
+}
+
+int NotificationQueueImpl::WritevAsync(uintptr_t fd, const struct iovec* iov,
+                                       uint32_t nr, void* tag) {
+    return GenericAsync([fd, iov, nr, tag](struct io_uring_sqe* sqe) -> void {
+        io_uring_prep_writev(sqe, fd, iov, nr, -1);
+        io_uring_sqe_set_data(sqe, tag);
+    });
 }
 
 int NotificationQueueImpl::CloseAsync(uintptr_t fd, void* tag) {
-    return GenericAsync(&m_ring, m_logger,
-                        [fd, tag](struct io_uring_sqe* sqe) -> void {
-                            io_uring_prep_close(sqe, fd);
-                            io_uring_sqe_set_data(sqe, tag);
-                        });
+    return GenericAsync([fd, tag](struct io_uring_sqe* sqe) -> void {
+        io_uring_prep_close(sqe, fd);
+        io_uring_sqe_set_data(sqe, tag);
+    });
+}
+
+int NotificationQueueImpl::CancelAsync(void* tag) {
+    // cancels at once to tell whether anything is cancelled, if the kernel
+    // supports it
+    if (m_has_sync_cancel) {
+        struct io_uring_sync_cancel_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.addr = (uint64_t)(uintptr_t)tag;
+        reg.timeout.tv_sec = -1;
+        reg.timeout.tv_nsec = -1;
+        int ret = io_uring_register_sync_cancel(&m_ring, &reg);
+        if (ret != -EINVAL) {
+            return ret;
+        }
+        m_has_sync_cancel = false;
+    }
+
+    return GenericAsync([tag](struct io_uring_sqe* sqe) -> void {
+        io_uring_prep_cancel(sqe, tag, 0);
+        // the result of cancelling itself is not reported
+        io_uring_sqe_set_data(sqe, &g_ignored_tag);
+    });
 }
 
 int NotificationQueueImpl::NotifyAsync(NotificationQueue* nq, int res,
                                        void* tag) {
     auto impl = static_cast<NotificationQueueImpl*>(nq);
-    return GenericAsync(&m_ring, m_logger,
-                        [impl, res, tag](struct io_uring_sqe* sqe) -> void {
-                            io_uring_prep_msg_ring(sqe, impl->m_ring.ring_fd,
-                                                   res, (uint64_t)tag, 0);
-                            // skips the successful notification for this ring
-                            io_uring_sqe_set_flags(sqe, IOSQE_CQE_SKIP_SUCCESS);
-                        });
+    int err = GenericAsync([impl, res, tag](struct io_uring_sqe* sqe) -> void {
+        io_uring_prep_msg_ring(sqe, impl->m_ring.ring_fd, res, (uint64_t)tag,
+                               0);
+        // skips the successful notification for this ring
+        io_uring_sqe_set_flags(sqe, IOSQE_CQE_SKIP_SUCCESS);
+    });
+    if (err) {
+        return err;
+    }
+
+    AddCounter(&m_nr_msgs_sent, 1);
+    // the receiver cannot tell messages from other events, so it is counted
+    // by the sender
+    if (!m_msg_counter_list.Add(impl)) {
+        impl->m_nr_msgs_received.fetch_add(1, memory_order_relaxed);
+    }
+    return 0;
 }
 
 }}
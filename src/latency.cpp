@@ -0,0 +1,135 @@
+#include "latency.h"
+#include "misc.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+namespace netkit {
+
+uint64_t LatencyHistogram::GetBucketLimit(uint32_t idx) {
+    if (idx < SUB_BUCKET_NUM) {
+        return idx;
+    }
+    const uint32_t shift = (idx >> SUB_BUCKET_BITS) - 1;
+    const uint64_t sub = idx & (SUB_BUCKET_NUM - 1);
+    return ((SUB_BUCKET_NUM + sub) << shift) + ((1ul << shift) - 1);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& h) {
+    count += h.count;
+    sum_nsec += h.sum_nsec;
+    if (h.max_nsec > max_nsec) {
+        max_nsec = h.max_nsec;
+    }
+    for (uint32_t i = 0; i < BUCKET_NUM; ++i) {
+        bucket_list[i] += h.bucket_list[i];
+    }
+}
+
+uint64_t LatencyHistogram::GetPercentile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = q * count;
+    if (rank < q * count || rank == 0) {
+        ++rank;
+    }
+
+    uint64_t nr = 0;
+    for (uint32_t i = 0; i < BUCKET_NUM; ++i) {
+        nr += bucket_list[i];
+        if (nr >= rank) {
+            const uint64_t limit = GetBucketLimit(i);
+            return (limit < max_nsec) ? limit : max_nsec;
+        }
+    }
+    return max_nsec;
+}
+
+namespace latency {
+
+// written by the owner thread only, and read by any thread
+struct ThreadHistograms final {
+    struct Histogram final {
+        atomic<uint64_t> sum_nsec;
+        atomic<uint64_t> max_nsec;
+        atomic<uint64_t> bucket_list[LatencyHistogram::BUCKET_NUM];
+    };
+    Histogram histogram_list[STAGE_NUM];
+};
+
+/*
+  histograms of exited threads are kept, so that their samples are not lost.
+  there are only a few threads in a process using netkit.
+*/
+static mutex g_lock;
+static vector<ThreadHistograms*> g_histograms_list;
+
+static thread_local ThreadHistograms* t_histograms = nullptr;
+
+static ThreadHistograms* GetThreadHistograms() {
+    if (!t_histograms) {
+        // value-initialized, so all counters are zero
+        auto histograms = new ThreadHistograms();
+        if (!histograms) {
+            return nullptr;
+        }
+
+        lock_guard<mutex> _(g_lock);
+        g_histograms_list.push_back(histograms);
+        t_histograms = histograms;
+    }
+    return t_histograms;
+}
+
+void Record(Stage stage, uint64_t nsec) {
+    auto histograms = GetThreadHistograms();
+    if (!histograms) {
+        return;
+    }
+
+    auto h = &histograms->histogram_list[stage];
+    AddCounter(&h->bucket_list[LatencyHistogram::GetBucketIndex(nsec)], 1);
+    AddCounter(&h->sum_nsec, nsec);
+    if (nsec > h->max_nsec.load(memory_order_relaxed)) {
+        h->max_nsec.store(nsec, memory_order_relaxed);
+    }
+}
+
+static void Merge(const ThreadHistograms::Histogram& src,
+                  LatencyHistogram* dst) {
+    dst->sum_nsec += src.sum_nsec.load(memory_order_relaxed);
+    const uint64_t max_nsec = src.max_nsec.load(memory_order_relaxed);
+    if (max_nsec > dst->max_nsec) {
+        dst->max_nsec = max_nsec;
+    }
+    for (uint32_t i = 0; i < LatencyHistogram::BUCKET_NUM; ++i) {
+        const uint64_t nr = src.bucket_list[i].load(memory_order_relaxed);
+        dst->bucket_list[i] += nr;
+        dst->count += nr;
+    }
+}
+
+}
+
+void GetLatencyStat(LatencyStat* stat) {
+    *stat = LatencyStat();
+
+    LatencyHistogram* dst_list[latency::STAGE_NUM] = {
+        &stat->queue,
+        &stat->run,
+        &stat->send,
+        &stat->total,
+    };
+
+    lock_guard<mutex> _(latency::g_lock);
+    for (auto histograms : latency::g_histograms_list) {
+        for (uint32_t i = 0; i < latency::STAGE_NUM; ++i) {
+            latency::Merge(histograms->histogram_list[i], dst_list[i]);
+        }
+    }
+}
+
+}
@@ -0,0 +1,21 @@
+#ifndef __NETKIT_SRC_LATENCY_H__
+#define __NETKIT_SRC_LATENCY_H__
+
+#include "netkit/latency_stat.h"
+
+namespace netkit { namespace latency {
+
+enum Stage {
+    QUEUE,
+    RUN,
+    SEND,
+    TOTAL,
+    STAGE_NUM,
+};
+
+/** @brief adds a sample to the histogram of `stage` in the calling thread */
+void Record(Stage stage, uint64_t nsec);
+
+}}
+
+#endif
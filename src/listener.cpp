@@ -0,0 +1,25 @@
+#include "listener.h"
+#include "server_load.h"
+#include "netkit/utils.h"
+
+namespace netkit {
+
+Listener::~Listener() {
+    if (m_acceptor.state == TcpServer::State::PAUSED) {
+        m_server->m_load->CancelWait(m_acceptor.tag);
+    }
+    utils::CloseSocket(m_acceptor.fd);
+    m_server->ReleaseListener();
+}
+
+bool Listener::Process(EventResult res, NotificationQueue* nq) {
+    // the first event is the one sending this listener to its worker
+    if (!m_is_started) {
+        m_is_started = true;
+        return (m_server->StartAccepting(&m_acceptor, nq) == 0);
+    }
+
+    return m_server->ProcessAccept(&m_acceptor, res, nq);
+}
+
+}
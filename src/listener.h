@@ -0,0 +1,35 @@
+#ifndef __NETKIT_SRC_LISTENER_H__
+#define __NETKIT_SRC_LISTENER_H__
+
+#include "netkit/tcp_server.h"
+
+namespace netkit {
+
+/**
+   @brief accepts on one of the SO_REUSEPORT sockets of a server, in the
+   thread of the worker it is sent to.
+*/
+class Listener final : public EventHandler {
+public:
+    /** @brief takes `fd`, and a reference of `svr` */
+    Listener(int fd, TcpServer* svr) : m_server(svr) {
+        m_acceptor.fd = fd;
+        m_acceptor.state = TcpServer::State::ACCEPTING;
+        m_acceptor.tag = static_cast<EventHandler*>(this);
+        svr->m_nr_listeners.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool Process(EventResult, NotificationQueue*) override;
+
+private:
+    ~Listener();
+
+private:
+    bool m_is_started = false;
+    TcpServer::Acceptor m_acceptor;
+    TcpServer* m_server;
+};
+
+}
+
+#endif
@@ -0,0 +1,691 @@
+#include "netkit/loopback/notification_queue_impl.h"
+#include "netkit/loopback/socket.h"
+#include "socket_impl.h"
+#include "../object_pool.h"
+#include "../misc.h"
+#include <algorithm>
+#include <netinet/in.h> // struct sockaddr_in
+#include <string.h> // strerror()
+#include <sys/eventfd.h>
+#include <sys/socket.h> // accept4()
+#include <unistd.h> // read()/close()
+using namespace std;
+
+// events returned before remote completions and timers are checked again
+#define CHECK_INTERVAL 64
+
+// how often fds of the kernel are checked while the queue is busy
+#define KERNEL_POLL_INTERVAL_NSEC 1000000
+
+namespace netkit { namespace loopback {
+
+void* Op::operator new(size_t size) noexcept {
+    return object_pool::Alloc(size);
+}
+
+void Op::operator delete(void* ptr, size_t size) {
+    object_pool::Free(ptr, size);
+}
+
+static inline uint64_t ToNsec(const TimeVal& tv) {
+    return (uint64_t)tv.tv_sec * 1000000000 + (uint64_t)tv.tv_usec * 1000;
+}
+
+static inline EventResult MakeResult(int64_t ret) {
+    if (ret < 0) {
+        return {0, (int32_t)-ret};
+    }
+    return {(uintptr_t)ret, 0};
+}
+
+int NotificationQueueImpl::Init(const Options& options, Logger* l) {
+    if (m_logger) {
+        return 0;
+    }
+
+    m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wake_fd < 0) {
+        int err = -errno;
+        logger_error(l, "create eventfd failed: [%s].", strerror(-err));
+        return err;
+    }
+
+    uint32_t size = 1;
+    while (size < options.queue_size) {
+        size <<= 1;
+    }
+    m_ready_list.resize(size);
+    m_ready_head = 0;
+    m_nr_ready = 0;
+    m_nr_until_check = 0;
+
+    m_logger = l;
+
+    return 0;
+}
+
+void NotificationQueueImpl::Destroy() {
+    if (!m_logger) {
+        return;
+    }
+
+    // ops are taken back from loopback objects, where peers may complete them
+    vector<Op*> op_list;
+    for (auto op = m_pending_head; op; op = op->next_pending) {
+        if (op->waiter_list) {
+            RemoveWaiter(op);
+        }
+        op_list.push_back(op);
+    }
+    for (auto op = m_remote_head.exchange(nullptr, memory_order_acquire); op;
+         op = op->next) {
+        op_list.push_back(op);
+    }
+    op_list.insert(op_list.end(), m_timer_heap.begin(), m_timer_heap.end());
+
+    // an op may be in both the pending list and the timer heap
+    sort(op_list.begin(), op_list.end());
+    auto end = unique(op_list.begin(), op_list.end());
+    for (auto it = op_list.begin(); it != end; ++it) {
+        delete *it;
+    }
+
+    m_pending_head = nullptr;
+    m_timer_heap.clear();
+    m_kernel_op_list.clear();
+    m_ready_list.clear();
+    m_nr_ready = 0;
+
+    close(m_wake_fd);
+    m_wake_fd = -1;
+    m_logger = nullptr;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void CompleteOp(Op* op, EventResult res, NotificationQueueImpl* cur) {
+    auto nq = op->nq;
+    if (nq == cur) {
+        nq->PushReady(res, op->tag);
+        nq->Retire(op);
+        return;
+    }
+
+    // `op` belongs to `nq` once it is pushed
+    op->res = res;
+    op->state.store(Op::COMPLETING, memory_order_release);
+    nq->PushRemote(op);
+}
+
+int PostResult(Op* op, EventResult res, NotificationQueueImpl* cur) {
+    auto nq = op->nq;
+    if (nq == cur) {
+        nq->PushReady(res, op->tag);
+        return 0;
+    }
+
+    auto msg = new Op(Op::NOTIFY, -1, nq, op->tag);
+    if (!msg) {
+        return -ENOMEM;
+    }
+    msg->res = res;
+    msg->state.store(Op::COMPLETING, memory_order_relaxed);
+    nq->PushRemote(msg);
+    return 0;
+}
+
+void NotificationQueueImpl::PushReady(EventResult res, void* tag) {
+    const uint32_t size = m_ready_list.size();
+    if (m_nr_ready == size) {
+        // grows and keeps the order
+        vector<Completion> new_list(size * 2);
+        for (uint32_t i = 0; i < m_nr_ready; ++i) {
+            new_list[i] = m_ready_list[(m_ready_head + i) & (size - 1)];
+        }
+        m_ready_list.swap(new_list);
+        m_ready_head = 0;
+    }
+
+    const uint32_t mask = m_ready_list.size() - 1;
+    m_ready_list[(m_ready_head + m_nr_ready) & mask] = {res, tag};
+    ++m_nr_ready;
+}
+
+void NotificationQueueImpl::PushRemote(Op* op) {
+    auto head = m_remote_head.load(memory_order_relaxed);
+    do {
+        op->next = head;
+    } while (!m_remote_head.compare_exchange_weak(head, op,
+                                                  memory_order_seq_cst,
+                                                  memory_order_relaxed));
+
+    // only the first pusher after the queue falls asleep wakes it up
+    if (m_is_sleeping.load(memory_order_seq_cst) &&
+        m_is_sleeping.exchange(false, memory_order_seq_cst)) {
+        const uint64_t val = 1;
+        if (write(m_wake_fd, &val, sizeof(val)) < 0) {
+            logger_error(m_logger, "wake up queue failed: [%s].",
+                         strerror(errno));
+        }
+    }
+}
+
+void NotificationQueueImpl::CollectRemote() {
+    auto head = m_remote_head.exchange(nullptr, memory_order_acquire);
+
+    // the stack is reversed to keep the order of completions
+    Op* list = nullptr;
+    while (head) {
+        auto next = head->next;
+        head->next = list;
+        list = head;
+        head = next;
+    }
+
+    while (list) {
+        auto op = list;
+        list = list->next;
+        PushReady(op->res, op->tag);
+        Retire(op);
+    }
+}
+
+void NotificationQueueImpl::Retire(Op* op) {
+    if (op->is_pending) {
+        UnlinkPending(op);
+    }
+    if (op->has_timer) {
+        // released when the timer expires
+        op->state.store(Op::DONE, memory_order_relaxed);
+    } else {
+        delete op;
+    }
+}
+
+void NotificationQueueImpl::LinkPending(Op* op) {
+    op->is_pending = true;
+    op->prev_pending = nullptr;
+    op->next_pending = m_pending_head;
+    if (m_pending_head) {
+        m_pending_head->prev_pending = op;
+    }
+    m_pending_head = op;
+}
+
+void NotificationQueueImpl::UnlinkPending(Op* op) {
+    if (op->prev_pending) {
+        op->prev_pending->next_pending = op->next_pending;
+    } else {
+        m_pending_head = op->next_pending;
+    }
+    if (op->next_pending) {
+        op->next_pending->prev_pending = op->prev_pending;
+    }
+    op->is_pending = false;
+}
+
+static bool HasLaterDeadline(const Op* a, const Op* b) {
+    return (a->deadline_nsec > b->deadline_nsec);
+}
+
+void NotificationQueueImpl::AddTimer(Op* op) {
+    op->has_timer = true;
+    m_timer_heap.push_back(op);
+    push_heap(m_timer_heap.begin(), m_timer_heap.end(), HasLaterDeadline);
+}
+
+void NotificationQueueImpl::ExpireTimers(uint64_t now) {
+    while (!m_timer_heap.empty() &&
+           m_timer_heap.front()->deadline_nsec <= now) {
+        pop_heap(m_timer_heap.begin(), m_timer_heap.end(), HasLaterDeadline);
+        auto op = m_timer_heap.back();
+        m_timer_heap.pop_back();
+
+        if (op->state.load(memory_order_acquire) == Op::DONE) {
+            delete op;
+            continue;
+        }
+
+        // released by `Retire()` if it is completing
+        op->has_timer = false;
+        if (TakeBack(op)) {
+            const int32_t err = (op->type == Op::TIMEOUT) ? ETIME : ECANCELED;
+            CompleteOp(op, {0, err}, this);
+        }
+    }
+}
+
+void NotificationQueueImpl::RemoveKernelOp(Op* op) {
+    auto last = m_kernel_op_list.back();
+    last->kernel_idx = op->kernel_idx;
+    m_kernel_op_list[op->kernel_idx] = last;
+    m_kernel_op_list.pop_back();
+    op->is_kernel = false;
+}
+
+bool NotificationQueueImpl::TakeBack(Op* op) {
+    if (op->state.load(memory_order_acquire) != Op::WAITING) {
+        return false;
+    }
+    if (op->is_kernel) {
+        RemoveKernelOp(op);
+        return true;
+    }
+    if (op->waiter_list) {
+        return RemoveWaiter(op);
+    }
+    return true; // TIMEOUT
+}
+
+int NotificationQueueImpl::Submit(Op* op) {
+    AddCounter(&m_nr_sqes, 1);
+
+    // other fds are checked by `ppoll()`
+    if (!IsSocket(op->fd)) {
+        op->is_kernel = true;
+        op->kernel_idx = m_kernel_op_list.size();
+        m_kernel_op_list.push_back(op);
+        LinkPending(op);
+        return 1;
+    }
+
+    int ret;
+    switch (op->type) {
+        case Op::READ:
+        case Op::POLL:
+            ret = SubmitRead(op, this);
+            break;
+        case Op::WRITE:
+            ret = SubmitWrite(op, this);
+            break;
+        case Op::ACCEPT:
+            ret = SubmitAccept(op, this);
+            break;
+        default:
+            ret = -EINVAL;
+    }
+
+    // it may be completed by another thread at any time
+    if (ret == 1) {
+        LinkPending(op);
+        return 1;
+    }
+
+    // errors are reported as events, like those of io_uring
+    if (ret < 0) {
+        op->res = {0, -ret};
+    }
+    PushReady(op->res, op->tag);
+    delete op;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void NotificationQueueImpl::RunKernelOp(Op* op, short revents) {
+    int64_t ret;
+    switch (op->type) {
+        case Op::READ:
+            ret = read(op->fd, op->buf, op->sz);
+            break;
+        case Op::WRITE:
+            ret = writev(op->fd, op->iov, op->nr_iov);
+            break;
+        case Op::ACCEPT:
+            ret = accept4(op->fd, nullptr, nullptr, SOCK_CLOEXEC);
+            break;
+        default:
+            ret = revents;
+    }
+
+    if (ret < 0) {
+        ret = -errno;
+        if (ret == -EAGAIN || ret == -EINTR) {
+            return;
+        }
+    }
+
+    if (op->is_multishot && ret >= 0) {
+        PushReady(MakeResult(ret), op->tag);
+        return;
+    }
+
+    RemoveKernelOp(op);
+    CompleteOp(op, MakeResult(ret), this);
+}
+
+int NotificationQueueImpl::PollKernel(int64_t timeout_nsec) {
+    m_pollfd_list.clear();
+    m_pollfd_list.push_back({m_wake_fd, POLLIN, 0});
+    for (auto op : m_kernel_op_list) {
+        short events = POLLIN;
+        if (op->type == Op::WRITE) {
+            events = POLLOUT;
+        } else if (op->type == Op::POLL) {
+            events = op->poll_events;
+        }
+        m_pollfd_list.push_back({op->fd, events, 0});
+    }
+
+    struct timespec ts;
+    struct timespec* pts = nullptr;
+    if (timeout_nsec >= 0) {
+        ts.tv_sec = timeout_nsec / 1000000000;
+        ts.tv_nsec = timeout_nsec % 1000000000;
+        pts = &ts;
+    }
+
+    int ret = ppoll(m_pollfd_list.data(), m_pollfd_list.size(), pts, nullptr);
+    m_last_poll_nsec = GetNowNsec();
+    if (ret < 0) {
+        ret = -errno;
+        if (ret != -EINTR) {
+            logger_error(m_logger, "ppoll failed: [%s].", strerror(-ret));
+        }
+        return ret;
+    }
+    if (ret == 0) {
+        return 0;
+    }
+
+    if (m_pollfd_list[0].revents) {
+        uint64_t val;
+        if (read(m_wake_fd, &val, sizeof(val)) < 0 && errno != EAGAIN) {
+            logger_error(m_logger, "read eventfd failed: [%s].",
+                         strerror(errno));
+        }
+    }
+
+    // ops are collected first since running them changes the list
+    m_kernel_ready_list.clear();
+    for (uint32_t i = 1; i < m_pollfd_list.size(); ++i) {
+        const short revents = m_pollfd_list[i].revents;
+        if (revents) {
+            m_kernel_ready_list.push_back(
+                make_pair(m_kernel_op_list[i - 1], revents));
+        }
+    }
+    for (auto& item : m_kernel_ready_list) {
+        RunKernelOp(item.first, item.second);
+    }
+
+    return 0;
+}
+
+int NotificationQueueImpl::Wait(uint64_t deadline_nsec) {
+    const uint64_t begin = GetNowNsec();
+    if (m_last_wakeup_nsec > 0) {
+        AddCounter(&m_busy_nsec, begin - m_last_wakeup_nsec);
+    }
+    AddCounter(&m_nr_waits, 1);
+
+    int ret = 0;
+    // a completion pushed after this store wakes the queue up
+    m_is_sleeping.store(true, memory_order_seq_cst);
+    if (!m_remote_head.load(memory_order_seq_cst)) {
+        if (!m_timer_heap.empty()) {
+            deadline_nsec = min(deadline_nsec,
+                                m_timer_heap.front()->deadline_nsec);
+        }
+        int64_t timeout_nsec = -1;
+        if (deadline_nsec != UINT64_MAX) {
+            timeout_nsec = (deadline_nsec > begin) ? deadline_nsec - begin : 0;
+        }
+        ret = PollKernel(timeout_nsec);
+    }
+    m_is_sleeping.store(false, memory_order_relaxed);
+
+    m_last_wakeup_nsec = GetNowNsec();
+    AddCounter(&m_blocked_nsec, m_last_wakeup_nsec - begin);
+    return ret;
+}
+
+int NotificationQueueImpl::Next(EventResult* res, void** tag,
+                                const TimeVal* timeout) {
+    uint64_t deadline_nsec = UINT64_MAX;
+    if (timeout) {
+        deadline_nsec = GetNowNsec() + ToNsec(*timeout);
+    }
+    bool has_waited = false;
+
+again:
+
+    if (m_nr_ready > 0 && m_nr_until_check > 0) {
+        --m_nr_until_check;
+
+        const auto& c = m_ready_list[m_ready_head];
+        *res = c.res;
+        *tag = c.tag;
+        m_ready_head = (m_ready_head + 1) & (m_ready_list.size() - 1);
+        --m_nr_ready;
+
+        AddCounter(&m_nr_cqes, 1);
+        if (!has_waited) {
+            AddCounter(&m_nr_peeks, 1);
+        }
+        return 0;
+    }
+
+    // remote completions and timers are checked periodically, so that they
+    // are not starved by local events
+    m_nr_until_check = CHECK_INTERVAL;
+    CollectRemote();
+
+    uint64_t now = 0;
+    if (!m_timer_heap.empty() || !m_kernel_op_list.empty() || timeout) {
+        now = GetNowNsec();
+    }
+    if (!m_timer_heap.empty()) {
+        ExpireTimers(now);
+    }
+    if (!m_kernel_op_list.empty() &&
+        now - m_last_poll_nsec >= KERNEL_POLL_INTERVAL_NSEC) {
+        int ret = PollKernel(0);
+        if (ret < 0 && ret != -EINTR) {
+            return ret;
+        }
+    }
+
+    if (m_nr_ready > 0) {
+        goto again;
+    }
+
+    if (timeout && timeout->tv_sec == 0 && timeout->tv_usec == 0) {
+        AddCounter(&m_nr_peeks, 1);
+        return -EAGAIN;
+    }
+    if (now >= deadline_nsec) {
+        return -ETIME;
+    }
+
+    int ret = Wait(deadline_nsec);
+    if (ret < 0 && ret != -EINTR) {
+        return ret;
+    }
+    has_waited = true;
+    goto again;
+}
+
+void NotificationQueueImpl::GetStat(Stat* stat) const {
+    stat->nr_sqes = m_nr_sqes.load(memory_order_relaxed);
+    stat->nr_cqes = m_nr_cqes.load(memory_order_relaxed);
+    stat->nr_msgs_sent = m_nr_msgs_sent.load(memory_order_relaxed);
+    stat->nr_msgs_received = m_nr_msgs_received.load(memory_order_relaxed);
+    stat->nr_waits = m_nr_waits.load(memory_order_relaxed);
+    stat->nr_peeks = m_nr_peeks.load(memory_order_relaxed);
+    stat->blocked_nsec = m_blocked_nsec.load(memory_order_relaxed);
+    stat->busy_nsec = m_busy_nsec.load(memory_order_relaxed);
+}
+
+uint64_t NotificationQueueImpl::GetNrMsgsSentTo(
+    const NotificationQueue* nq) const {
+    return m_msg_counter_list.Get(nq);
+}
+
+/* ------------------------------------------------------------------------- */
+
+int NotificationQueueImpl::AcceptAsync(uintptr_t fd, void* tag,
+                                       bool multishot) {
+    auto op = new Op(Op::ACCEPT, fd, this, tag);
+    if (!op) {
+        return -ENOMEM;
+    }
+    op->is_multishot = multishot;
+    Submit(op);
+    return 0;
+}
+
+int NotificationQueueImpl::ConnectAsync(uintptr_t fd,
+                                        const struct sockaddr* addr,
+                                        socklen_t len, void* tag) {
+    AddCounter(&m_nr_sqes, 1);
+
+    int err;
+    if (!IsSocket(fd)) {
+        err = -EOPNOTSUPP;
+    } else if (addr->sa_family == AF_INET && len >= sizeof(sockaddr_in)) {
+        auto in4 = (const struct sockaddr_in*)addr;
+        err = ConnectSocket(fd, ntohs(in4->sin_port), this);
+    } else if (addr->sa_family == AF_INET6 && len >= sizeof(sockaddr_in6)) {
+        auto in6 = (const struct sockaddr_in6*)addr;
+        err = ConnectSocket(fd, ntohs(in6->sin6_port), this);
+    } else {
+        err = -EAFNOSUPPORT;
+    }
+
+    // connections are established at once
+    PushReady(MakeResult(err), tag);
+    return 0;
+}
+
+int NotificationQueueImpl::ReadAsync(uintptr_t fd, void* buf, uint64_t sz,
+                                     void* tag) {
+    auto op = new Op(Op::READ, fd, this, tag);
+    if (!op) {
+        return -ENOMEM;
+    }
+    op->buf = buf;
+    op->sz = sz;
+    Submit(op);
+    return 0;
+}
+
+int NotificationQueueImpl::ReadWithTimeoutAsync(uintptr_t fd, void* buf,
+                                                uint64_t sz,
+                                                const TimeVal& timeout,
+                                                void* tag) {
+    auto op = new Op(Op::READ, fd, this, tag);
+    if (!op) {
+        return -ENOMEM;
+    }
+    op->buf = buf;
+    op->sz = sz;
+    op->deadline_nsec = GetNowNsec() + ToNsec(timeout);
+    if (Submit(op) == 1) {
+        AddTimer(op);
+    }
+    return 0;
+}
+
+int NotificationQueueImpl::PollAsync(uintptr_t fd, short events, void* tag) {
+    auto op = new Op(Op::POLL, fd, this, tag);
+    if (!op) {
+        return -ENOMEM;
+    }
+    op->poll_events = events;
+    Submit(op);
+    return 0;
+}
+
+int NotificationQueueImpl::TimeoutAsync(const TimeVal& timeout, void* tag) {
+    auto op = new Op(Op::TIMEOUT, -1, this, tag);
+    if (!op) {
+        return -ENOMEM;
+    }
+    AddCounter(&m_nr_sqes, 1);
+    op->deadline_nsec = GetNowNsec() + ToNsec(timeout);
+    LinkPending(op);
+    AddTimer(op);
+    return 0;
+}
+
+int NotificationQueueImpl::WriteAsync(uintptr_t fd, const void* buf,
+                                      uint64_t sz, void* tag) {
+    auto op = new Op(Op::WRITE, fd, this, tag);
+    if (!op) {
+        return -ENOMEM;
+    }
+    op->one_iov.iov_base = const_cast<void*>(buf);
+    op->one_iov.iov_len = sz;
+    op->iov = &op->one_iov;
+    op->nr_iov = 1;
+    Submit(op);
+    return 0;
+}
+
+int NotificationQueueImpl::WritevAsync(uintptr_t fd, const struct iovec* iov,
+                                       uint32_t nr, void* tag) {
+    auto op = new Op(Op::WRITE, fd, this, tag);
+    if (!op) {
+        return -ENOMEM;
+    }
+    op->iov = iov;
+    op->nr_iov = nr;
+    Submit(op);
+    return 0;
+}
+
+int NotificationQueueImpl::CloseAsync(uintptr_t fd, void* tag) {
+    AddCounter(&m_nr_sqes, 1);
+
+    int err;
+    if (IsSocket(fd)) {
+        err = CloseSocket(fd, this);
+    } else {
+        err = (close(fd) == 0) ? 0 : -errno;
+    }
+
+    PushReady(MakeResult(err), tag);
+    return 0;
+}
+
+int NotificationQueueImpl::CancelAsync(void* tag) {
+    AddCounter(&m_nr_sqes, 1);
+
+    // the result of cancelling itself is not reported
+    for (auto op = m_pending_head; op; op = op->next_pending) {
+        if (op->tag == tag) {
+            if (!TakeBack(op)) {
+                return -EALREADY;
+            }
+            CompleteOp(op, {0, ECANCELED}, this);
+            return 0;
+        }
+    }
+    return -ENOENT;
+}
+
+int NotificationQueueImpl::NotifyAsync(NotificationQueue* nq, int res,
+                                       void* tag) {
+    auto impl = static_cast<NotificationQueueImpl*>(nq);
+    if (impl == this) {
+        PushReady(MakeResult(res), tag);
+    } else {
+        auto op = new Op(Op::NOTIFY, -1, impl, tag);
+        if (!op) {
+            return -ENOMEM;
+        }
+        op->res = MakeResult(res);
+        op->state.store(Op::COMPLETING, memory_order_relaxed);
+        impl->PushRemote(op);
+    }
+
+    AddCounter(&m_nr_sqes, 1);
+    AddCounter(&m_nr_msgs_sent, 1);
+    if (!m_msg_counter_list.Add(impl)) {
+        impl->m_nr_msgs_received.fetch_add(1, memory_order_relaxed);
+    }
+    return 0;
+}
+
+}}
@@ -0,0 +1,745 @@
+#include "socket_impl.h"
+#include "netkit/loopback/socket.h"
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <string.h> // memcpy()
+using namespace std;
+
+// bytes buffered in each direction, a power of 2
+#define BUFFER_SIZE (64 * 1024)
+
+// fds are indices in a table of chunks, which are never released
+#define CHUNK_SHIFT 12
+#define CHUNK_SIZE (1u << CHUNK_SHIFT)
+#define MAX_CHUNKS 1024
+
+// like the default of `ip_local_port_range`
+#define EPHEMERAL_PORT_MIN 32768
+#define EPHEMERAL_PORT_MAX 60999
+
+namespace netkit { namespace loopback {
+
+struct Object {
+    enum Kind : uint8_t {
+        SOCKET,
+        LISTENER,
+    };
+
+    Object(Kind k) : kind(k) {}
+
+    const Kind kind;
+    int fd = -1;
+};
+
+/** @brief one direction of a connection */
+struct Channel final {
+    SpinLock lock; // protects the following members
+    bool is_eof = false; // the writing end is shut down
+    bool is_broken = false; // the reading end is shut down
+    char* buf = nullptr; // allocated when it is first needed
+    uint64_t head = 0; // offset of the next byte to read
+    uint64_t tail = 0; // offset of the next byte to write
+    WaiterList reader_list; // reads and polls
+    WaiterList writer_list;
+};
+
+struct Pair final {
+    ~Pair() {
+        delete[] channel[0].buf;
+        delete[] channel[1].buf;
+    }
+
+    Channel channel[2];
+    atomic<uint32_t> refcount = {2}; // one for each end
+};
+
+struct Socket final : public Object {
+    Socket() : Object(SOCKET) {}
+
+    // not connected if it is nullptr. set before the socket is shared.
+    Pair* pair = nullptr;
+    uint32_t side = 0; // writes to `pair->channel[side]`
+    uint16_t local_port = 0;
+    uint16_t remote_port = 0;
+    atomic<bool> is_shut_down = {false};
+};
+
+struct Listener final : public Object {
+    Listener() : Object(LISTENER) {}
+
+    uint16_t port = 0;
+    uint32_t backlog = 0;
+    SpinLock lock; // protects the following members
+    bool is_closed = false;
+    deque<int> pending_fd_list; // connections not accepted yet
+    WaiterList accept_list;
+};
+
+static mutex g_mutex; // protects the following variables
+static vector<uint32_t> g_free_idx_list;
+static uint32_t g_nr_idx = 0;
+static map<uint16_t, Listener*> g_listener_map;
+static uint16_t g_next_listen_port = EPHEMERAL_PORT_MIN;
+
+static atomic<atomic<Object*>*> g_chunk_list[MAX_CHUNKS];
+static atomic<uint32_t> g_next_connect_port = {0};
+
+/* ------------------------------------------------------------------------- */
+
+// returns fd or -errno. called with `g_mutex` held.
+static int AllocFdLocked(Object* obj) {
+    uint32_t idx;
+    if (!g_free_idx_list.empty()) {
+        idx = g_free_idx_list.back();
+        g_free_idx_list.pop_back();
+    } else {
+        if (g_nr_idx == MAX_CHUNKS * CHUNK_SIZE) {
+            return -EMFILE;
+        }
+        idx = g_nr_idx;
+
+        auto& chunk = g_chunk_list[idx >> CHUNK_SHIFT];
+        if (!chunk.load(memory_order_relaxed)) {
+            auto list = new atomic<Object*>[CHUNK_SIZE]();
+            if (!list) {
+                return -ENOMEM;
+            }
+            chunk.store(list, memory_order_release);
+        }
+        ++g_nr_idx;
+    }
+
+    obj->fd = FD_BASE + idx;
+    g_chunk_list[idx >> CHUNK_SHIFT]
+        .load(memory_order_relaxed)[idx & (CHUNK_SIZE - 1)]
+        .store(obj, memory_order_release);
+    return obj->fd;
+}
+
+static int AllocFd(Object* obj) {
+    lock_guard<mutex> _l(g_mutex);
+    return AllocFdLocked(obj);
+}
+
+// called with `g_mutex` held
+static void FreeFdLocked(int fd) {
+    const uint32_t idx = fd - FD_BASE;
+    g_chunk_list[idx >> CHUNK_SHIFT]
+        .load(memory_order_relaxed)[idx & (CHUNK_SIZE - 1)]
+        .store(nullptr, memory_order_relaxed);
+    g_free_idx_list.push_back(idx);
+}
+
+static Object* Find(int fd) {
+    if (!IsSocket(fd)) {
+        return nullptr;
+    }
+    const uint32_t idx = fd - FD_BASE;
+    if (idx >= MAX_CHUNKS * CHUNK_SIZE) {
+        return nullptr;
+    }
+    auto chunk = g_chunk_list[idx >> CHUNK_SHIFT].load(memory_order_acquire);
+    if (!chunk) {
+        return nullptr;
+    }
+    return chunk[idx & (CHUNK_SIZE - 1)].load(memory_order_acquire);
+}
+
+static Socket* FindSocket(int fd) {
+    auto obj = Find(fd);
+    return (obj && obj->kind == Object::SOCKET) ? static_cast<Socket*>(obj)
+                                                : nullptr;
+}
+
+static uint16_t NewConnectPort() {
+    const uint32_t range = EPHEMERAL_PORT_MAX - EPHEMERAL_PORT_MIN + 1;
+    return EPHEMERAL_PORT_MIN +
+        g_next_connect_port.fetch_add(1, memory_order_relaxed) % range;
+}
+
+/* ------------------------------------------------------------------------- */
+
+// copies bytes described by an iovec array piece by piece
+class IovReader final {
+public:
+    IovReader(const struct iovec* iov, uint32_t nr) : m_iov(iov), m_nr(nr) {}
+
+    // returns the number of bytes copied to `dst`
+    uint64_t Read(char* dst, uint64_t sz) {
+        uint64_t nr_bytes = 0;
+        while (sz > 0 && m_idx < m_nr) {
+            const auto& iov = m_iov[m_idx];
+            const uint64_t n = min<uint64_t>(sz, iov.iov_len - m_offset);
+            memcpy(dst, (const char*)iov.iov_base + m_offset, n);
+            dst += n;
+            sz -= n;
+            nr_bytes += n;
+            m_offset += n;
+            if (m_offset == iov.iov_len) {
+                ++m_idx;
+                m_offset = 0;
+            }
+        }
+        return nr_bytes;
+    }
+
+private:
+    const struct iovec* m_iov;
+    uint32_t m_nr;
+    uint32_t m_idx = 0;
+    uint64_t m_offset = 0;
+};
+
+static inline uint64_t GetDataSize(const Channel* c) {
+    return c->tail - c->head;
+}
+
+// events of `c` a poll waits for, or 0 if none occurs. hangups are always
+// reported, as by `poll()`.
+static short GetPollEvents(const Channel* c, const Op* op) {
+    short revents = 0;
+    if (GetDataSize(c) > 0) {
+        revents |= POLLIN;
+    }
+    if (c->is_eof || c->is_broken) {
+        revents |= (POLLIN | POLLRDHUP | POLLHUP);
+    }
+    return revents & (op->poll_events | POLLHUP);
+}
+
+static uint64_t ReadRing(Channel* c, char* dst, uint64_t sz) {
+    sz = min(sz, GetDataSize(c));
+    const uint64_t off = c->head & (BUFFER_SIZE - 1);
+    const uint64_t n = min<uint64_t>(sz, BUFFER_SIZE - off);
+    memcpy(dst, c->buf + off, n);
+    memcpy(dst + n, c->buf, sz - n);
+    c->head += sz;
+    return sz;
+}
+
+// returns the number of bytes written, or 0 if the buffer is full
+static uint64_t WriteRing(Channel* c, IovReader* src) {
+    const uint64_t space = BUFFER_SIZE - GetDataSize(c);
+    if (space == 0) {
+        return 0;
+    }
+    if (!c->buf) {
+        c->buf = new char[BUFFER_SIZE];
+        if (!c->buf) {
+            return 0;
+        }
+    }
+
+    const uint64_t off = c->tail & (BUFFER_SIZE - 1);
+    const uint64_t first = min<uint64_t>(space, BUFFER_SIZE - off);
+    uint64_t n = src->Read(c->buf + off, first);
+    if (n == first && space > first) {
+        n += src->Read(c->buf, space - first);
+    }
+    c->tail += n;
+    return n;
+}
+
+// called with `c->lock` held after data arrives or the channel is shut down
+static void WakeReaders(Channel* c, NotificationQueueImpl* cur) {
+    while (c->reader_list.head) {
+        auto op = c->reader_list.head;
+        const uint64_t data_size = GetDataSize(c);
+        const bool is_closed = (c->is_eof || c->is_broken);
+        if (op->type == Op::POLL) {
+            const short revents = GetPollEvents(c, op);
+            if (revents == 0) {
+                break;
+            }
+            c->reader_list.PopFront();
+            CompleteOp(op, {(uintptr_t)revents, 0}, cur);
+        } else if (data_size > 0) {
+            c->reader_list.PopFront();
+            const uint64_t n = ReadRing(c, (char*)op->buf, op->sz);
+            CompleteOp(op, {n, 0}, cur);
+        } else if (is_closed) {
+            c->reader_list.PopFront();
+            CompleteOp(op, {0, 0}, cur);
+        } else {
+            break;
+        }
+    }
+}
+
+// called with `c->lock` held after space is freed or the channel is shut down
+static void WakeWriters(Channel* c, NotificationQueueImpl* cur) {
+    while (c->writer_list.head) {
+        auto op = c->writer_list.head;
+        if (c->is_eof || c->is_broken) {
+            c->writer_list.PopFront();
+            CompleteOp(op, {0, EPIPE}, cur);
+            continue;
+        }
+
+        IovReader src(op->iov, op->nr_iov);
+        const uint64_t n = WriteRing(c, &src);
+        if (n == 0) {
+            break;
+        }
+        c->writer_list.PopFront();
+        CompleteOp(op, {n, 0}, cur);
+    }
+}
+
+static void Park(Op* op, WaiterList* list, SpinLock* lock) {
+    op->waiter_list = list;
+    op->lock = lock;
+    list->PushBack(op);
+}
+
+int SubmitRead(Op* op, NotificationQueueImpl* cur) {
+    auto s = FindSocket(op->fd);
+    if (!s) {
+        return -EBADF;
+    }
+    if (!s->pair) {
+        return -ENOTCONN;
+    }
+    if (op->type == Op::READ && op->sz == 0) {
+        op->res = {0, 0};
+        return 0;
+    }
+
+    Channel* c = &s->pair->channel[1 - s->side];
+    lock_guard<SpinLock> _l(c->lock);
+
+    // readers are served in order
+    if (!c->reader_list.head) {
+        const uint64_t data_size = GetDataSize(c);
+        const bool is_closed = (c->is_eof || c->is_broken);
+        if (op->type == Op::POLL) {
+            const short revents = GetPollEvents(c, op);
+            if (revents != 0) {
+                op->res = {(uintptr_t)revents, 0};
+                return 0;
+            }
+        } else if (data_size > 0) {
+            op->res = {ReadRing(c, (char*)op->buf, op->sz), 0};
+            WakeWriters(c, cur);
+            return 0;
+        } else if (is_closed) {
+            op->res = {0, 0};
+            return 0;
+        }
+    }
+
+    Park(op, &c->reader_list, &c->lock);
+    return 1;
+}
+
+int SubmitWrite(Op* op, NotificationQueueImpl* cur) {
+    auto s = FindSocket(op->fd);
+    if (!s) {
+        return -EBADF;
+    }
+    if (!s->pair) {
+        return -ENOTCONN;
+    }
+
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < op->nr_iov; ++i) {
+        total += op->iov[i].iov_len;
+    }
+
+    Channel* c = &s->pair->channel[s->side];
+    lock_guard<SpinLock> _l(c->lock);
+
+    if (c->is_eof || c->is_broken) {
+        op->res = {0, EPIPE};
+        return 0;
+    }
+    if (total == 0) {
+        op->res = {0, 0};
+        return 0;
+    }
+
+    // writers are served in order
+    if (c->writer_list.head) {
+        Park(op, &c->writer_list, &c->lock);
+        return 1;
+    }
+
+    // data goes straight to waiting reads if nothing is buffered before it
+    IovReader src(op->iov, op->nr_iov);
+    uint64_t nr_bytes = 0;
+    while (nr_bytes < total && GetDataSize(c) == 0 && c->reader_list.head &&
+           c->reader_list.head->type == Op::READ) {
+        auto reader = c->reader_list.PopFront();
+        const uint64_t n = src.Read((char*)reader->buf, reader->sz);
+        nr_bytes += n;
+        CompleteOp(reader, {n, 0}, cur);
+    }
+
+    if (nr_bytes < total) {
+        nr_bytes += WriteRing(c, &src);
+        WakeReaders(c, cur);
+    }
+
+    if (nr_bytes == 0) {
+        Park(op, &c->writer_list, &c->lock);
+        return 1;
+    }
+
+    op->res = {nr_bytes, 0};
+    return 0;
+}
+
+int SubmitAccept(Op* op, NotificationQueueImpl* cur) {
+    auto obj = Find(op->fd);
+    if (!obj || obj->kind != Object::LISTENER) {
+        return (obj) ? -EINVAL : -EBADF;
+    }
+    auto l = static_cast<Listener*>(obj);
+
+    lock_guard<SpinLock> _l(l->lock);
+    if (l->is_closed) {
+        return -EBADF;
+    }
+
+    if (!l->accept_list.head) {
+        while (!l->pending_fd_list.empty()) {
+            const int fd = l->pending_fd_list.front();
+            if (!op->is_multishot) {
+                l->pending_fd_list.pop_front();
+                op->res = {(uintptr_t)fd, 0};
+                return 0;
+            }
+            int err = PostResult(op, {(uintptr_t)fd, 0}, cur);
+            if (err) {
+                // the rest is accepted later
+                return err;
+            }
+            l->pending_fd_list.pop_front();
+        }
+    }
+
+    Park(op, &l->accept_list, &l->lock);
+    return 1;
+}
+
+bool RemoveWaiter(Op* op) {
+    // the object may be gone with `op` completed
+    if (op->state.load(memory_order_acquire) != Op::WAITING) {
+        return false;
+    }
+
+    lock_guard<SpinLock> _l(*op->lock);
+    if (op->state.load(memory_order_relaxed) != Op::WAITING) {
+        return false;
+    }
+    op->waiter_list->Remove(op);
+    return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void ShutDownSocket(Socket* s, NotificationQueueImpl* cur) {
+    if (!s->pair || s->is_shut_down.exchange(true, memory_order_acq_rel)) {
+        return;
+    }
+
+    Channel* tx = &s->pair->channel[s->side];
+    {
+        lock_guard<SpinLock> _l(tx->lock);
+        tx->is_eof = true;
+        WakeReaders(tx, cur);
+        WakeWriters(tx, cur);
+    }
+
+    Channel* rx = &s->pair->channel[1 - s->side];
+    {
+        lock_guard<SpinLock> _l(rx->lock);
+        rx->is_broken = true;
+        rx->head = rx->tail; // discards data not read
+        WakeReaders(rx, cur);
+        WakeWriters(rx, cur);
+    }
+}
+
+static void CloseListener(Listener* l, NotificationQueueImpl* cur) {
+    deque<int> fd_list;
+    {
+        lock_guard<SpinLock> _l(l->lock);
+        l->is_closed = true;
+        fd_list.swap(l->pending_fd_list);
+        while (l->accept_list.head) {
+            auto op = l->accept_list.PopFront();
+            CompleteOp(op, {0, ECANCELED}, cur);
+        }
+    }
+
+    // connections not accepted are reset
+    for (auto fd : fd_list) {
+        CloseSocket(fd, cur);
+    }
+    delete l;
+}
+
+int CloseSocket(int fd, NotificationQueueImpl* cur) {
+    Object* obj;
+    {
+        lock_guard<mutex> _l(g_mutex);
+        obj = Find(fd);
+        if (!obj) {
+            return -EBADF;
+        }
+        FreeFdLocked(fd);
+
+        if (obj->kind == Object::LISTENER) {
+            auto l = static_cast<Listener*>(obj);
+            g_listener_map.erase(l->port);
+        }
+    }
+
+    if (obj->kind == Object::LISTENER) {
+        CloseListener(static_cast<Listener*>(obj), cur);
+        return 0;
+    }
+
+    auto s = static_cast<Socket*>(obj);
+    ShutDownSocket(s, cur);
+    if (s->pair && s->pair->refcount.fetch_sub(1, memory_order_acq_rel) == 1) {
+        delete s->pair;
+    }
+    delete s;
+    return 0;
+}
+
+int ConnectSocket(int fd, uint16_t port, NotificationQueueImpl* cur) {
+    auto client = FindSocket(fd);
+    if (!client) {
+        return (Find(fd)) ? -ENOTSOCK : -EBADF;
+    }
+    if (client->pair) {
+        return -EISCONN;
+    }
+
+    auto pair = new Pair();
+    if (!pair) {
+        return -ENOMEM;
+    }
+    auto server = new Socket();
+    if (!server) {
+        delete pair;
+        return -ENOMEM;
+    }
+
+    server->pair = pair;
+    server->side = 1;
+    server->local_port = port;
+    server->remote_port = NewConnectPort();
+
+    Op* acceptor = nullptr;
+    int err = 0;
+    {
+        lock_guard<mutex> _l(g_mutex);
+        auto it = g_listener_map.find(port);
+        if (it == g_listener_map.end()) {
+            err = -ECONNREFUSED;
+            goto end;
+        }
+        Listener* l = it->second;
+
+        lock_guard<SpinLock> _ll(l->lock);
+        acceptor = l->accept_list.head;
+        if (!acceptor && l->pending_fd_list.size() >= l->backlog) {
+            err = -ECONNREFUSED;
+            goto end;
+        }
+
+        int server_fd = AllocFdLocked(server);
+        if (server_fd < 0) {
+            err = server_fd;
+            goto end;
+        }
+
+        client->pair = pair;
+        client->side = 0;
+        client->local_port = server->remote_port;
+        client->remote_port = port;
+
+        if (!acceptor) {
+            l->pending_fd_list.push_back(server_fd);
+        } else if (acceptor->is_multishot) {
+            err = PostResult(acceptor, {(uintptr_t)server_fd, 0}, cur);
+            if (err) {
+                // waits for the next accept
+                l->pending_fd_list.push_back(server_fd);
+                err = 0;
+            }
+        } else {
+            l->accept_list.PopFront();
+            CompleteOp(acceptor, {(uintptr_t)server_fd, 0}, cur);
+        }
+    }
+
+end:
+    if (err) {
+        delete server;
+        delete pair;
+    }
+    return err;
+}
+
+/* ------------------------------------------------------------------------- */
+
+int Listen(uint16_t port, int backlog) {
+    auto l = new Listener();
+    if (!l) {
+        return -ENOMEM;
+    }
+    l->backlog = max(backlog, 1);
+
+    lock_guard<mutex> _l(g_mutex);
+    if (port == 0) {
+        const uint32_t range = EPHEMERAL_PORT_MAX - EPHEMERAL_PORT_MIN + 1;
+        for (uint32_t i = 0; i < range; ++i) {
+            const uint16_t p = g_next_listen_port;
+            g_next_listen_port = (p == EPHEMERAL_PORT_MAX)
+                ? EPHEMERAL_PORT_MIN
+                : p + 1;
+            if (g_listener_map.find(p) == g_listener_map.end()) {
+                port = p;
+                break;
+            }
+        }
+        if (port == 0) {
+            delete l;
+            return -EADDRINUSE;
+        }
+    } else if (g_listener_map.find(port) != g_listener_map.end()) {
+        delete l;
+        return -EADDRINUSE;
+    }
+    l->port = port;
+
+    int fd = AllocFdLocked(l);
+    if (fd < 0) {
+        delete l;
+        return fd;
+    }
+    g_listener_map.insert(make_pair(port, l));
+    return fd;
+}
+
+int Connect(uint16_t port) {
+    int fd = CreateSocket();
+    if (fd < 0) {
+        return fd;
+    }
+
+    int err = ConnectSocket(fd, port, nullptr);
+    if (err) {
+        CloseSocket(fd, nullptr);
+        return err;
+    }
+    return fd;
+}
+
+int CreateSocket() {
+    auto s = new Socket();
+    if (!s) {
+        return -ENOMEM;
+    }
+
+    int fd = AllocFd(s);
+    if (fd < 0) {
+        delete s;
+    }
+    return fd;
+}
+
+int CreateSocketPair(int fd_list[2]) {
+    auto pair = new Pair();
+    if (!pair) {
+        return -ENOMEM;
+    }
+
+    Socket* s[2] = {new Socket(), new Socket()};
+    if (!s[0] || !s[1]) {
+        delete s[0];
+        delete s[1];
+        delete pair;
+        return -ENOMEM;
+    }
+    for (uint32_t i = 0; i < 2; ++i) {
+        s[i]->pair = pair;
+        s[i]->side = i;
+        s[i]->local_port = NewConnectPort();
+    }
+    s[0]->remote_port = s[1]->local_port;
+    s[1]->remote_port = s[0]->local_port;
+
+    lock_guard<mutex> _l(g_mutex);
+    fd_list[0] = AllocFdLocked(s[0]);
+    if (fd_list[0] < 0) {
+        delete s[0];
+        delete s[1];
+        delete pair;
+        return fd_list[0];
+    }
+    fd_list[1] = AllocFdLocked(s[1]);
+    if (fd_list[1] < 0) {
+        FreeFdLocked(fd_list[0]);
+        delete s[0];
+        delete s[1];
+        delete pair;
+        return fd_list[1];
+    }
+    return 0;
+}
+
+int ShutDown(int fd) {
+    auto s = FindSocket(fd);
+    if (!s) {
+        return (Find(fd)) ? -ENOTSOCK : -EBADF;
+    }
+    if (!s->pair) {
+        return -ENOTCONN;
+    }
+    ShutDownSocket(s, nullptr);
+    return 0;
+}
+
+int Close(int fd) {
+    return CloseSocket(fd, nullptr);
+}
+
+static void MakeAddr(uint16_t port, SocketAddr* addr) {
+    *addr = SocketAddr();
+    addr->in4.sin_family = AF_INET;
+    addr->in4.sin_port = htons(port);
+    addr->in4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+int GetLocalAddr(int fd, SocketAddr* addr) {
+    auto obj = Find(fd);
+    if (!obj) {
+        return -EBADF;
+    }
+    if (obj->kind == Object::LISTENER) {
+        MakeAddr(static_cast<Listener*>(obj)->port, addr);
+    } else {
+        MakeAddr(static_cast<Socket*>(obj)->local_port, addr);
+    }
+    return 0;
+}
+
+int GetRemoteAddr(int fd, SocketAddr* addr) {
+    auto s = FindSocket(fd);
+    if (!s || !s->pair) {
+        return (s || Find(fd)) ? -ENOTCONN : -EBADF;
+    }
+    MakeAddr(s->remote_port, addr);
+    return 0;
+}
+
+}}
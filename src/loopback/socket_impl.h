@@ -0,0 +1,138 @@
+#ifndef __NETKIT_SRC_LOOPBACK_SOCKET_IMPL_H__
+#define __NETKIT_SRC_LOOPBACK_SOCKET_IMPL_H__
+
+#include "netkit/loopback/notification_queue_impl.h"
+#include "netkit/spin_lock.h"
+#include <atomic>
+#include <stddef.h> // size_t
+#include <sys/uio.h> // struct iovec
+
+namespace netkit { namespace loopback {
+
+struct WaiterList;
+
+/**
+   @brief an operation of a queue. it waits in a loopback socket or listener,
+   the timer heap or the `ppoll()` list of its queue, and is handed to its
+   queue when it completes.
+*/
+struct Op final {
+    enum Type : uint8_t {
+        READ,
+        POLL,
+        WRITE,
+        ACCEPT,
+        TIMEOUT,
+        NOTIFY, // carries a result only
+    };
+
+    enum State : uint8_t {
+        WAITING,
+        COMPLETING, // taken by another thread and on the way to `nq`
+        DONE, // completed but still in the timer heap
+    };
+
+    static void* operator new(size_t) noexcept;
+    static void operator delete(void*, size_t);
+
+    Op(Type t, int _fd, NotificationQueueImpl* _nq, void* _tag)
+        : type(t), fd(_fd), nq(_nq), tag(_tag) {}
+
+    const Type type;
+    bool is_multishot = false;
+    bool has_timer = false; // also in the timer heap
+    bool is_kernel = false; // in the `ppoll()` list
+    bool is_pending = false; // in the pending list of `nq`
+    // changed with `lock` held if the op waits in a loopback object
+    std::atomic<State> state = {WAITING};
+    const int fd;
+    NotificationQueueImpl* const nq;
+    void* const tag;
+    EventResult res = {0, 0};
+
+    void* buf = nullptr; // READ
+    uint64_t sz = 0; // READ
+    const struct iovec* iov = nullptr; // WRITE
+    uint32_t nr_iov = 0; // WRITE
+    short poll_events = 0; // POLL
+    struct iovec one_iov; // used as `iov` by `WriteAsync()`
+
+    uint64_t deadline_nsec = 0; // if `has_timer` is true
+    uint32_t kernel_idx = 0; // in the `ppoll()` list
+
+    // the list this op waits in and the lock protecting it
+    WaiterList* waiter_list = nullptr;
+    SpinLock* lock = nullptr;
+
+    Op* next = nullptr; // in `waiter_list` or the completion stack
+    Op* prev_pending = nullptr;
+    Op* next_pending = nullptr;
+};
+
+/** @brief ops waiting in a loopback object, in FIFO order */
+struct WaiterList final {
+    Op* head = nullptr;
+    Op* tail = nullptr;
+
+    void PushBack(Op* op) {
+        op->next = nullptr;
+        if (tail) {
+            tail->next = op;
+        } else {
+            head = op;
+        }
+        tail = op;
+    }
+
+    Op* PopFront() {
+        auto op = head;
+        head = op->next;
+        if (!head) {
+            tail = nullptr;
+        }
+        op->next = nullptr;
+        return op;
+    }
+
+    void Remove(Op* op) {
+        Op* prev = nullptr;
+        for (auto cur = head; cur; prev = cur, cur = cur->next) {
+            if (cur == op) {
+                if (prev) {
+                    prev->next = op->next;
+                } else {
+                    head = op->next;
+                }
+                if (tail == op) {
+                    tail = prev;
+                }
+                op->next = nullptr;
+                return;
+            }
+        }
+    }
+};
+
+/*
+  the following functions serve ops on loopback fds. they return 0 if `op`
+  completes at once with `op->res` set, 1 if it waits, or -errno. `cur` is
+  the queue calling them.
+*/
+
+int SubmitRead(Op* op, NotificationQueueImpl* cur); // READ or POLL
+int SubmitWrite(Op* op, NotificationQueueImpl* cur);
+int SubmitAccept(Op* op, NotificationQueueImpl* cur);
+
+// returns 0 or -errno
+int ConnectSocket(int fd, uint16_t port, NotificationQueueImpl* cur);
+int CloseSocket(int fd, NotificationQueueImpl* cur);
+
+/**
+   @brief removes `op` from the list it waits in if it is still waiting.
+   returns true if it is removed.
+*/
+bool RemoveWaiter(Op* op);
+
+}}
+
+#endif
@@ -0,0 +1,181 @@
+#include "memory_budget.h"
+#include "netkit/spin_lock.h"
+#include <atomic>
+#include <deque>
+#include <mutex> // lock_guard
+using namespace std;
+
+#define NR_SHARDS 16
+
+// readers woken up at a time when memory is released
+#define MAX_WAKEUPS 8
+
+namespace netkit { namespace memory {
+
+// counters are sharded by threads to avoid contention
+struct Shard final {
+    atomic<int64_t> nr_bytes = {0};
+    atomic<int64_t> nr_connections = {0};
+    char padding[48];
+};
+
+// readers paused by the threads of a shard
+struct WaiterList final {
+    SpinLock lock; // protects `conn_list`
+    deque<ConnectionPtr> conn_list; // in FIFO order
+};
+
+static Shard g_shard_list[NR_SHARDS];
+static WaiterList g_waiter_list[NR_SHARDS];
+static atomic<uint32_t> g_next_shard_idx = {0};
+static atomic<uint32_t> g_next_wake_idx = {0}; // shard to wake first
+static atomic<uint32_t> g_nr_waiters = {0};
+static MemoryBudget g_budget;
+
+static inline uint32_t GetShardIdx() {
+    static thread_local uint32_t t_shard_idx = UINT32_MAX;
+    if (t_shard_idx == UINT32_MAX) {
+        t_shard_idx = g_next_shard_idx.fetch_add(1, memory_order_relaxed) %
+            NR_SHARDS;
+    }
+    return t_shard_idx;
+}
+
+static inline Shard* GetShard() {
+    return &g_shard_list[GetShardIdx()];
+}
+
+void SetBudget(const MemoryBudget& budget) {
+    g_budget = budget;
+}
+
+const MemoryBudget& GetBudget() {
+    return g_budget;
+}
+
+void Charge(int64_t nr_bytes) {
+    if (nr_bytes >= 0) {
+        GetShard()->nr_bytes.fetch_add(nr_bytes, memory_order_relaxed);
+        return;
+    }
+
+    // pairs with `WaitForBudget()`: either the waiter sees this release or
+    // it is seen here
+    GetShard()->nr_bytes.fetch_add(nr_bytes, memory_order_seq_cst);
+    if (g_nr_waiters.load(memory_order_seq_cst) > 0) {
+        WakeWaiters(MAX_WAKEUPS);
+    }
+}
+
+void AddConnection(int64_t nr) {
+    GetShard()->nr_connections.fetch_add(nr, memory_order_relaxed);
+}
+
+static void SumUp(int64_t* nr_bytes, int64_t* nr_connections) {
+    *nr_bytes = 0;
+    *nr_connections = 0;
+    for (uint32_t i = 0; i < NR_SHARDS; ++i) {
+        *nr_bytes += g_shard_list[i].nr_bytes.load(memory_order_relaxed);
+        *nr_connections +=
+            g_shard_list[i].nr_connections.load(memory_order_relaxed);
+    }
+}
+
+bool IsOverBudget() {
+    if (g_budget.limit == 0) {
+        return false;
+    }
+
+    int64_t nr_bytes, nr_connections;
+    SumUp(&nr_bytes, &nr_connections);
+    return (nr_bytes > 0 && (uint64_t)nr_bytes > g_budget.limit);
+}
+
+void WakeWaiters(uint32_t max_nr) {
+    if (g_nr_waiters.load(memory_order_seq_cst) == 0 || IsOverBudget()) {
+        return;
+    }
+
+    if (max_nr > MAX_WAKEUPS) {
+        max_nr = MAX_WAKEUPS;
+    }
+    ConnectionPtr conn_list[MAX_WAKEUPS];
+    uint32_t nr = 0;
+    // shards take turns to be served first
+    const uint32_t begin = g_next_wake_idx.fetch_add(1, memory_order_relaxed);
+    for (uint32_t i = 0; i < NR_SHARDS && nr < max_nr; ++i) {
+        auto waiter_list = &g_waiter_list[(begin + i) % NR_SHARDS];
+        lock_guard<SpinLock> _l(waiter_list->lock);
+        auto& list = waiter_list->conn_list;
+        while (!list.empty() && nr < max_nr) {
+            conn_list[nr] = std::move(list.front());
+            list.pop_front();
+            ++nr;
+        }
+    }
+    if (nr == 0) {
+        return;
+    }
+
+    g_nr_waiters.fetch_sub(nr, memory_order_relaxed);
+    // connections may be released here, outside of the lock
+    for (uint32_t i = 0; i < nr; ++i) {
+        conn_list[i]->WakeReader();
+    }
+}
+
+void WaitForBudget(const ConnectionPtr& conn) {
+    auto waiter_list = &g_waiter_list[GetShardIdx()];
+    {
+        lock_guard<SpinLock> _l(waiter_list->lock);
+        waiter_list->conn_list.push_back(conn);
+    }
+
+    g_nr_waiters.fetch_add(1, memory_order_seq_cst);
+    // memory may be released before the waiter is visible
+    atomic_thread_fence(memory_order_seq_cst);
+    WakeWaiters(MAX_WAKEUPS);
+}
+
+void CancelWait(const ConnectionPtr& conn) {
+    // the reader may be started in another thread before it runs in its own
+    for (uint32_t i = 0; i < NR_SHARDS; ++i) {
+        ConnectionPtr removed; // released outside of the lock
+        auto waiter_list = &g_waiter_list[i];
+        {
+            lock_guard<SpinLock> _l(waiter_list->lock);
+            auto& list = waiter_list->conn_list;
+            auto it = list.begin();
+            while (it != list.end() && it->get() != conn.get()) {
+                ++it;
+            }
+            if (it == list.end()) {
+                continue;
+            }
+            removed = std::move(*it);
+            list.erase(it);
+        }
+        g_nr_waiters.fetch_sub(1, memory_order_relaxed);
+        return;
+    }
+}
+
+uint64_t GetAverageUsage() {
+    int64_t nr_bytes, nr_connections;
+    SumUp(&nr_bytes, &nr_connections);
+    if (nr_bytes <= 0 || nr_connections <= 0) {
+        return 0;
+    }
+    return nr_bytes / nr_connections;
+}
+
+}
+
+void GetMemoryUsage(MemoryUsage* usage) {
+    int64_t nr_bytes, nr_connections;
+    memory::SumUp(&nr_bytes, &nr_connections);
+    usage->nr_bytes = (nr_bytes > 0) ? nr_bytes : 0;
+    usage->nr_connections = (nr_connections > 0) ? nr_connections : 0;
+}
+
+}
@@ -0,0 +1,38 @@
+#ifndef __NETKIT_SRC_MEMORY_BUDGET_H__
+#define __NETKIT_SRC_MEMORY_BUDGET_H__
+
+#include "netkit/memory_budget.h"
+#include "netkit/connection.h"
+
+namespace netkit { namespace memory {
+
+void SetBudget(const MemoryBudget&);
+const MemoryBudget& GetBudget();
+
+void Charge(int64_t nr_bytes);
+void AddConnection(int64_t nr);
+
+bool IsOverBudget();
+
+/**
+   @brief `Connection::WakeReader()` of `conn` is called when the usage drops
+   below the limit, which may be at once. waiters are woken up a few at a
+   time.
+*/
+void WaitForBudget(const ConnectionPtr& conn);
+
+/**
+   @brief wakes up at most `max_nr` waiters, in the order they wait within a
+   thread, if the usage is below the limit.
+*/
+void WakeWaiters(uint32_t max_nr);
+
+/** @brief removes `conn` if it is still waiting */
+void CancelWait(const ConnectionPtr& conn);
+
+/** @brief average bytes used by one connection */
+uint64_t GetAverageUsage();
+
+}}
+
+#endif
@@ -1,10 +1,28 @@
 #ifndef __NETKIT_MISC_H__
 #define __NETKIT_MISC_H__
 
+#include <atomic>
 #include <errno.h>
+#include <stdint.h>
+#include <time.h> // clock_gettime()
 
 inline bool ShouldRetry(int err) {
     return (err == -EAGAIN || err == -EINTR);
 }
 
+/**
+   @brief for counters written by one thread and read by others, which need no
+   atomic read-modify-write.
+*/
+inline void AddCounter(std::atomic<uint64_t>* counter, uint64_t val) {
+    counter->store(counter->load(std::memory_order_relaxed) + val,
+                   std::memory_order_relaxed);
+}
+
+inline uint64_t GetNowNsec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 #endif
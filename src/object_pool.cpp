@@ -0,0 +1,38 @@
+#include "object_pool.h"
+#include "netkit/pool_allocator.h"
+using namespace std;
+
+namespace netkit { namespace object_pool {
+
+static PoolAllocator* GetAllocator() {
+    static PoolAllocator allocator([]() -> PoolAllocator::Options {
+        PoolAllocator::Options options;
+        // most objects are smaller than 256 bytes
+        options.slab_size = 64 * 1024;
+        return options;
+    }());
+    return &allocator;
+}
+
+void* Alloc(uint64_t size) {
+    uint64_t capacity;
+    return GetAllocator()->Alloc(size, &capacity);
+}
+
+void Free(void* ptr, uint64_t size) {
+    if (!ptr) {
+        return;
+    }
+
+    // the capacity returned by `Alloc()` is the size rounded up to a power of
+    // two, and at least the minimum block size
+    uint64_t capacity = (1ul << PoolAllocator::MIN_BLOCK_SIZE_SHIFT);
+    if (size > capacity && size <= PoolAllocator::MAX_BLOCK_SIZE) {
+        capacity = (1ul << (64 - __builtin_clzl(size - 1)));
+    } else if (size > PoolAllocator::MAX_BLOCK_SIZE) {
+        capacity = size;
+    }
+    GetAllocator()->Free(ptr, capacity);
+}
+
+}}
@@ -0,0 +1,20 @@
+#ifndef __NETKIT_OBJECT_POOL_H__
+#define __NETKIT_OBJECT_POOL_H__
+
+#include <stdint.h>
+
+namespace netkit { namespace object_pool {
+
+/**
+   @brief allocates small objects that are created and destroyed at a high
+   rate, e.g. `Connection`s, `SendItem`s and `Sender`s. returns nullptr if
+   failed.
+*/
+void* Alloc(uint64_t size);
+
+/** @brief `size` is the value passed to `Alloc()`. */
+void Free(void* ptr, uint64_t size);
+
+}}
+
+#endif
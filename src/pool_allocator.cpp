@@ -0,0 +1,322 @@
+#include "netkit/pool_allocator.h"
+#include "misc.h"
+#include <atomic>
+#include <stdlib.h> // malloc()/free()
+#include <sys/mman.h> // mmap()/munmap()
+using namespace std;
+
+namespace netkit {
+
+namespace detail {
+
+struct FreeBlock final {
+    FreeBlock* next;
+};
+
+// stored in the first block of every slab
+struct SlabHeader final {
+    ThreadCache* owner;
+};
+
+struct ThreadCache final {
+    struct Class final {
+        FreeBlock* free_list = nullptr;
+        char* cursor = nullptr; // unused part of the current slab
+        char* end = nullptr;
+        atomic<uint64_t> bytes_alloc = {0};
+        atomic<uint64_t> bytes_freed = {0}; // including blocks of other threads
+        atomic<uint64_t> bytes_mapped = {0};
+    };
+
+    Class cls_list[PoolAllocator::NR_CLASSES];
+
+    // keeps blocks returned by other threads away from the private part
+    char padding[64];
+    atomic<FreeBlock*> remote_list[PoolAllocator::NR_CLASSES];
+
+    bool in_use = true; // protected by `PoolAllocator::m_lock`
+
+    ThreadCache() {
+        for (uint32_t i = 0; i < PoolAllocator::NR_CLASSES; ++i) {
+            remote_list[i].store(nullptr, memory_order_relaxed);
+        }
+    }
+};
+
+struct ThreadCacheEntry final {
+    PoolAllocator* allocator;
+    ThreadCache* cache;
+};
+
+// returns caches to their allocators when a thread exits
+struct ThreadCacheHolder final {
+    ~ThreadCacheHolder();
+    vector<ThreadCacheEntry> entry_list;
+};
+
+}
+
+using namespace detail;
+
+// the trivially destructible ones are used in the fast path and after
+// `t_holder` is destroyed
+static thread_local ThreadCacheEntry t_last_entry = {nullptr, nullptr};
+static thread_local bool t_holder_destroyed = false;
+static thread_local ThreadCacheHolder t_holder;
+
+ThreadCacheHolder::~ThreadCacheHolder() {
+    for (auto& entry : entry_list) {
+        entry.allocator->ReleaseThreadCache(entry.cache);
+    }
+    t_last_entry = {nullptr, nullptr};
+    t_holder_destroyed = true;
+}
+
+static inline uint32_t GetClass(uint64_t size) {
+    if (size <= (1ul << PoolAllocator::MIN_BLOCK_SIZE_SHIFT)) {
+        return 0;
+    }
+    // index of the highest bit of (size - 1), plus 1
+    return 64 - __builtin_clzl(size - 1) - PoolAllocator::MIN_BLOCK_SIZE_SHIFT;
+}
+
+static inline uint64_t GetBlockSize(uint32_t cls) {
+    return (1ul << (cls + PoolAllocator::MIN_BLOCK_SIZE_SHIFT));
+}
+
+PoolAllocator::PoolAllocator(const Options& options) : m_options(options) {
+    uint64_t slab_size = options.slab_size;
+    if (options.use_hugepage && slab_size < 2 * 1024 * 1024) {
+        slab_size = 2 * 1024 * 1024;
+    }
+
+    m_slab_shift = MIN_BLOCK_SIZE_SHIFT;
+    while ((1ul << m_slab_shift) < slab_size) {
+        ++m_slab_shift;
+    }
+}
+
+PoolAllocator::~PoolAllocator() {
+    // the current thread may still hold a cache of this allocator
+    if (t_last_entry.allocator == this) {
+        t_last_entry = {nullptr, nullptr};
+    }
+    if (!t_holder_destroyed) {
+        auto& entry_list = t_holder.entry_list;
+        for (auto it = entry_list.begin(); it != entry_list.end(); ++it) {
+            if (it->allocator == this) {
+                entry_list.erase(it);
+                break;
+            }
+        }
+    }
+
+    for (auto cache : m_cache_list) {
+        delete cache;
+    }
+    for (auto& slab : m_slab_list) {
+        munmap(slab.first, slab.second);
+    }
+}
+
+ThreadCache* PoolAllocator::AcquireThreadCache() {
+    lock_guard<mutex> _l(m_lock);
+
+    // adopts a cache of some exited thread
+    for (auto cache : m_cache_list) {
+        if (!cache->in_use) {
+            cache->in_use = true;
+            return cache;
+        }
+    }
+
+    auto cache = new ThreadCache();
+    if (cache) {
+        m_cache_list.push_back(cache);
+    }
+    return cache;
+}
+
+void PoolAllocator::ReleaseThreadCache(ThreadCache* cache) {
+    lock_guard<mutex> _l(m_lock);
+    cache->in_use = false;
+}
+
+ThreadCache* PoolAllocator::GetThreadCache() {
+    if (t_last_entry.allocator == this) {
+        return t_last_entry.cache;
+    }
+
+    // the thread is exiting and uses a cache which is never returned
+    if (t_holder_destroyed) {
+        auto cache = AcquireThreadCache();
+        if (cache) {
+            t_last_entry = {this, cache};
+        }
+        return cache;
+    }
+
+    for (auto& entry : t_holder.entry_list) {
+        if (entry.allocator == this) {
+            t_last_entry = entry;
+            return entry.cache;
+        }
+    }
+
+    auto cache = AcquireThreadCache();
+    if (cache) {
+        t_last_entry = {this, cache};
+        t_holder.entry_list.push_back(t_last_entry);
+    }
+    return cache;
+}
+
+// returns memory aligned to `size`, which is a power of two
+static char* MapAligned(uint64_t size, int flags) {
+    const uint64_t len = size * 2;
+    auto base = (char*)mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+
+    auto aligned = (char*)(((uintptr_t)base + size - 1) & ~(size - 1));
+    const uint64_t head = aligned - base;
+    if (head > 0) {
+        munmap(base, head);
+    }
+    const uint64_t tail = len - head - size;
+    if (tail > 0) {
+        munmap(aligned + size, tail);
+    }
+
+    return aligned;
+}
+
+char* PoolAllocator::AllocSlab(uint64_t slab_size) {
+    char* slab = nullptr;
+    if (m_options.use_hugepage) {
+        slab = MapAligned(slab_size, MAP_HUGETLB);
+        if (!slab) {
+            slab = MapAligned(slab_size, 0);
+            if (slab) {
+                madvise(slab, slab_size, MADV_HUGEPAGE);
+            }
+        }
+    } else {
+        slab = MapAligned(slab_size, 0);
+    }
+
+    if (slab) {
+        lock_guard<mutex> _l(m_lock);
+        m_slab_list.emplace_back(slab, slab_size);
+    }
+
+    return slab;
+}
+
+void* PoolAllocator::Alloc(uint64_t size, uint64_t* capacity) {
+    if (size > MAX_BLOCK_SIZE) {
+        void* ptr = malloc(size);
+        if (ptr) {
+            *capacity = size;
+        }
+        return ptr;
+    }
+
+    auto cache = GetThreadCache();
+    if (!cache) {
+        return nullptr;
+    }
+
+    const uint32_t cls = GetClass(size);
+    const uint64_t block_size = GetBlockSize(cls);
+    auto c = &cache->cls_list[cls];
+
+    FreeBlock* block = c->free_list;
+    if (!block) {
+        block = cache->remote_list[cls].exchange(nullptr, memory_order_acquire);
+    }
+
+    if (block) {
+        c->free_list = block->next;
+    } else {
+        if (c->cursor == c->end) {
+            const uint64_t slab_size = (1ul << GetSlabShift(cls));
+            char* slab = AllocSlab(slab_size);
+            if (!slab) {
+                return nullptr;
+            }
+
+            auto header = (SlabHeader*)slab;
+            header->owner = cache;
+            c->cursor = slab + block_size;
+            c->end = slab + slab_size;
+            AddCounter(&c->bytes_mapped, slab_size);
+        }
+
+        block = (FreeBlock*)c->cursor;
+        c->cursor += block_size;
+    }
+
+    AddCounter(&c->bytes_alloc, block_size);
+    *capacity = block_size;
+    return block;
+}
+
+void PoolAllocator::Free(void* ptr, uint64_t capacity) {
+    if (capacity > MAX_BLOCK_SIZE) {
+        free(ptr);
+        return;
+    }
+
+    const uint32_t cls = GetClass(capacity);
+    const uint64_t slab_mask = (1ul << GetSlabShift(cls)) - 1;
+    auto header = (SlabHeader*)((uintptr_t)ptr & ~slab_mask);
+    auto owner = header->owner;
+    auto block = (FreeBlock*)ptr;
+
+    auto cache = GetThreadCache();
+    if (cache) {
+        AddCounter(&cache->cls_list[cls].bytes_freed, capacity);
+    }
+
+    if (owner == cache) {
+        auto c = &cache->cls_list[cls];
+        block->next = c->free_list;
+        c->free_list = block;
+        return;
+    }
+
+    // the owner takes the whole list at once, so there is no ABA problem here
+    auto remote_list = &owner->remote_list[cls];
+    block->next = remote_list->load(memory_order_relaxed);
+    while (!remote_list->compare_exchange_weak(block->next, block,
+                                               memory_order_release,
+                                               memory_order_relaxed))
+        ;
+}
+
+void PoolAllocator::GetStat(vector<ClassStat>* stat_list) const {
+    stat_list->resize(NR_CLASSES);
+    for (uint32_t i = 0; i < NR_CLASSES; ++i) {
+        auto stat = &stat_list->at(i);
+        stat->block_size = GetBlockSize(i);
+        stat->bytes_in_use = 0;
+        stat->bytes_mapped = 0;
+    }
+
+    lock_guard<mutex> _l(m_lock);
+    for (auto cache : m_cache_list) {
+        for (uint32_t i = 0; i < NR_CLASSES; ++i) {
+            auto c = &cache->cls_list[i];
+            auto stat = &stat_list->at(i);
+            // a block may be freed by a thread that did not allocate it
+            stat->bytes_in_use += c->bytes_alloc.load(memory_order_relaxed);
+            stat->bytes_in_use -= c->bytes_freed.load(memory_order_relaxed);
+            stat->bytes_mapped += c->bytes_mapped.load(memory_order_relaxed);
+        }
+    }
+}
+
+}
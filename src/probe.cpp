@@ -0,0 +1,12 @@
+#include "probe.h"
+
+#ifdef NETKIT_ENABLE_USDT
+
+// in the section where tracers look for semaphores
+#define NETKIT_DEFINE_PROBE_SEMAPHORE(name)     \
+    unsigned short netkit_##name##_semaphore \
+        __attribute__((section(".probes")));
+NETKIT_PROBE_LIST(NETKIT_DEFINE_PROBE_SEMAPHORE)
+#undef NETKIT_DEFINE_PROBE_SEMAPHORE
+
+#endif
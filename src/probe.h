@@ -0,0 +1,107 @@
+#ifndef __NETKIT_SRC_PROBE_H__
+#define __NETKIT_SRC_PROBE_H__
+
+/*
+  USDT probes of provider `netkit`, which can be listed by
+  `bpftrace -l 'usdt:<binary>:netkit:*'`. a probe costs a test of its
+  semaphore until a tracer attaches to it, and its arguments are evaluated
+  only after that. values computed beforehand only for probes, e.g.
+  timestamps, are guarded by `NETKIT_PROBE_ENABLED()`. without
+  `NETKIT_ENABLE_USDT` everything here compiles to nothing.
+
+  probes and their arguments:
+  - accept: listener fd, client fd.
+  - read: fd, bytes read, errno.
+  - check: fd, `ReqStat`, `req_bytes` set by `Check()`, bytes buffered.
+  - task_schedule: fd, request size, nsec from the last read of the request.
+  - task_run: fd, request size, nsec waiting to run, nsec of `Run()`.
+  - emit: fd, bytes, nsec from the read of the request, or 0 if the request
+    is not sampled for latency statistics.
+  - write: fd, bytes written, errno, nsec from submitting the write.
+  - timer: timer fd, number of expirations, errno.
+  - shutdown: fd.
+*/
+
+#ifdef NETKIT_ENABLE_USDT
+
+// counts tracers attached to each probe
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define NETKIT_PROBE_LIST(X) \
+    X(accept)                \
+    X(read)                  \
+    X(check)                 \
+    X(task_schedule)         \
+    X(task_run)              \
+    X(emit)                  \
+    X(write)                 \
+    X(timer)                 \
+    X(shutdown)
+
+// set by tracers attached to probes. defined in probe.cpp.
+#define NETKIT_DECLARE_PROBE_SEMAPHORE(name) \
+    extern unsigned short netkit_##name##_semaphore;
+NETKIT_PROBE_LIST(NETKIT_DECLARE_PROBE_SEMAPHORE)
+#undef NETKIT_DECLARE_PROBE_SEMAPHORE
+
+#define NETKIT_PROBE_ENABLED(name) \
+    __builtin_expect(netkit_##name##_semaphore != 0, 0)
+
+// `STAP_PROBE*()` always evaluate arguments
+#define NETKIT_PROBE1(name, a1)             \
+    do {                                    \
+        if (NETKIT_PROBE_ENABLED(name)) {   \
+            STAP_PROBE1(netkit, name, a1);  \
+        }                                   \
+    } while (0)
+#define NETKIT_PROBE2(name, a1, a2)             \
+    do {                                        \
+        if (NETKIT_PROBE_ENABLED(name)) {       \
+            STAP_PROBE2(netkit, name, a1, a2);  \
+        }                                       \
+    } while (0)
+#define NETKIT_PROBE3(name, a1, a2, a3)             \
+    do {                                            \
+        if (NETKIT_PROBE_ENABLED(name)) {           \
+            STAP_PROBE3(netkit, name, a1, a2, a3);  \
+        }                                           \
+    } while (0)
+#define NETKIT_PROBE4(name, a1, a2, a3, a4)             \
+    do {                                                \
+        if (NETKIT_PROBE_ENABLED(name)) {               \
+            STAP_PROBE4(netkit, name, a1, a2, a3, a4);  \
+        }                                               \
+    } while (0)
+
+#else
+
+#define NETKIT_PROBE_ENABLED(name) false
+
+// arguments are not evaluated, but still count as used
+#define NETKIT_PROBE1(name, a1) \
+    do {                        \
+        (void)sizeof(a1);       \
+    } while (0)
+#define NETKIT_PROBE2(name, a1, a2) \
+    do {                            \
+        (void)sizeof(a1);           \
+        (void)sizeof(a2);           \
+    } while (0)
+#define NETKIT_PROBE3(name, a1, a2, a3) \
+    do {                                \
+        (void)sizeof(a1);               \
+        (void)sizeof(a2);               \
+        (void)sizeof(a3);               \
+    } while (0)
+#define NETKIT_PROBE4(name, a1, a2, a3, a4) \
+    do {                                    \
+        (void)sizeof(a1);                   \
+        (void)sizeof(a2);                   \
+        (void)sizeof(a3);                   \
+        (void)sizeof(a4);                   \
+    } while (0)
+
+#endif
+
+#endif
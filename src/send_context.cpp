@@ -1,7 +1,11 @@
 #include "netkit/send_context.h"
+#include "misc.h"
 #include "netkit/timer.h"
 #include "netkit/utils.h"
 #include "sender.h"
+#include "inbox.h"
+#include "latency.h"
+#include "probe.h"
 #include <string.h> // strerror()
 using namespace std;
 
@@ -10,31 +14,112 @@ namespace netkit {
 static void DummyCallback(int) {}
 
 int SendContext::Emit(Buffer&& b, const function<void(int err)>& on_complete) {
+    // fails early without allocating anything
+    if (!m_conn->IsValid()) {
+        return -ENOTCONN;
+    }
+    if (m_conn->IsSendBlocked()) {
+        return -ENOBUFS;
+    }
+
+    const int64_t nr_bytes = b.capacity() + sizeof(SendItem);
+    auto item = new SendItem(move(b), (on_complete) ?: DummyCallback);
+    if (!item) {
+        logger_error(m_logger, "allocate send item failed: [%s].",
+                     strerror(ENOMEM));
+        return -ENOMEM;
+    }
+    if (m_read_nsec > 0) {
+        item->read_nsec = m_read_nsec;
+        item->emit_nsec = GetNowNsec();
+    }
+    NETKIT_PROBE3(emit, m_conn->fd, item->data.size(),
+                  item->emit_nsec - item->read_nsec);
+
+    if (m_seq != NO_SEQ) {
+        // held until `Commit()`, so the queue is not touched here
+        if (m_tail) {
+            m_tail->next = item;
+        } else {
+            m_head = item;
+        }
+        m_tail = item;
+        m_conn->ChargeMemory(nr_bytes);
+        return (m_conn->auto_cork) ? 0 : Flush();
+    }
+
     bool is_empty_before_adding;
-    {
-        lock_guard<mutex> _l(m_conn->send_lock);
-        is_empty_before_adding = m_conn->send_queue.empty();
-        m_conn->send_queue.emplace(move(b), (on_complete) ?: DummyCallback);
+    int err = m_conn->PushSendItem(item, &is_empty_before_adding);
+    if (err) {
+        // gives the data back to the caller
+        b = move(item->data);
+        delete item;
+        return err;
     }
+    m_conn->ChargeMemory(nr_bytes);
 
     if (is_empty_before_adding) {
-        auto sender = new Sender(m_conn, m_logger);
-        if (!sender) {
-            logger_error(m_logger, "allocate sender failed: [%s].",
-                         strerror(ENOMEM));
-            return -ENOMEM;
+        m_need_flush = true;
+        if (!m_conn->auto_cork) {
+            return Flush();
+        }
+    }
+
+    return 0;
+}
+
+int SendContext::Commit(bool is_done) {
+    bool is_empty_before_adding;
+    int err = m_conn->CommitSendItems(m_seq, m_head, m_tail, is_done,
+                                      &is_empty_before_adding);
+    if (err) {
+        logger_error(m_logger, "commit responses failed: [%s].",
+                     strerror(-err));
+        for (auto item = m_head; item;) {
+            auto next = item->next;
+            m_conn->ChargeMemory(
+                -(int64_t)(item->data.capacity() + sizeof(SendItem)));
+            delete item;
+            item = next;
         }
+        m_head = nullptr;
+        m_tail = nullptr;
+        // responses of the following requests can not be sent in order
+        m_conn->ShutDown(m_logger);
+        return err;
+    }
+
+    m_head = nullptr;
+    m_tail = nullptr;
+    if (is_empty_before_adding) {
+        m_need_flush = true;
+    }
+    return 0;
+}
 
-        int err = sender->Start(m_nq);
+int SendContext::Flush() {
+    if (m_head) {
+        int err = Commit(false);
         if (err) {
-            logger_error(m_logger, "about to send data failed: [%s].",
-                         strerror(-err));
-            sender->DeleteSelf();
             return err;
         }
     }
 
-    return 0;
+    if (!m_need_flush) {
+        return 0;
+    }
+    m_need_flush = false;
+
+    // the connection is pinned by the sender from now on, or by the owner
+    // again if the sender fails to start
+    if (m_owner && *m_owner) {
+        return Sender::Launch(std::move(*m_owner), m_nq, m_logger);
+    }
+    return Sender::Launch(ConnectionPtr(m_conn), m_nq, m_logger);
+}
+
+ConnectionHandle SendContext::GetHandle() const {
+    return ConnectionHandle(m_conn, Inbox::Current(), m_logger);
 }
 
 int SendContext::AddTimer(const TimeVal& interval, TimerPtr ptr) {
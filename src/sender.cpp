@@ -1,14 +1,54 @@
 #include "misc.h"
 #include "sender.h"
+#include "netkit/send_context.h"
+#include "object_pool.h"
+#include "event_dispatcher.h"
+#include "latency.h"
+#include "capture.h"
+#include "probe.h"
+#include <algorithm>
 #include <string.h> // strerror()
 using namespace std;
 
 namespace netkit {
 
-int Sender::DoWrite(const void* buf, uint64_t sz, NotificationQueue* nq) {
+void* Sender::operator new(size_t size) noexcept {
+    return object_pool::Alloc(size);
+}
+
+void Sender::operator delete(void* ptr, size_t size) {
+    object_pool::Free(ptr, size);
+}
+
+Sender::~Sender() {
+    EventDispatcher::ReleaseHandle(m_handle, m_handle_table);
+}
+
+int Sender::DoWrite(NotificationQueue* nq) {
+    SendItem* item_list[MAX_IOV_NUM];
+    m_nr_iov = m_conn->GetFrontSendItems(item_list, MAX_IOV_NUM);
+
+    uint32_t offset = m_conn->send_offset;
+    for (uint32_t i = 0; i < m_nr_iov; ++i) {
+        auto item = item_list[i];
+        m_iov[i].iov_base = item->data.data() + offset;
+        m_iov[i].iov_len = item->data.size() - offset;
+        offset = 0;
+    }
+
+    m_write_nsec = (NETKIT_PROBE_ENABLED(write)) ? GetNowNsec() : 0;
+
 loop:
-    int err =
-        nq->WriteAsync(m_conn->fd, buf, sz, static_cast<EventHandler*>(this));
+    int err;
+    void* tag =
+        EventDispatcher::MakeTag(this, EventDispatcher::SENDER, &m_handle,
+                                 &m_handle_table);
+    if (m_nr_iov == 1) {
+        err = nq->WriteAsync(m_conn->fd, m_iov[0].iov_base, m_iov[0].iov_len,
+                             tag);
+    } else {
+        err = nq->WritevAsync(m_conn->fd, m_iov, m_nr_iov, tag);
+    }
     if (ShouldRetry(err)) {
         goto loop;
     }
@@ -22,25 +62,54 @@ loop:
 }
 
 int Sender::Start(NotificationQueue* nq) {
-    SendItem* item;
-    {
-        lock_guard<mutex> _l(m_conn->send_lock);
-        item = &m_conn->send_queue.front();
+    return DoWrite(nq);
+}
+
+int Sender::Launch(ConnectionPtr&& c, NotificationQueue* nq, Logger* logger) {
+    auto sender = new Sender(std::move(c), logger);
+    if (!sender) {
+        logger_error(logger, "allocate sender failed: [%s].",
+                     strerror(ENOMEM));
+        c->ShutDown(logger);
+        return -ENOMEM;
+    }
+
+    int err = sender->Start(nq);
+    if (err) {
+        logger_error(logger, "about to send data failed: [%s].",
+                     strerror(-err));
+        sender->m_conn->ShutDown(logger);
+        // the caller may still use the connection
+        c = std::move(sender->m_conn);
+        sender->DeleteSelf();
+        return err;
     }
 
-    return DoWrite(item->data.data(), item->data.size(), nq);
+    return 0;
 }
 
-bool Sender::Process(EventResult res, NotificationQueue* nq) {
-    SendItem* item;
-    {
-        lock_guard<mutex> _l(m_conn->send_lock);
-        item = &m_conn->send_queue.front();
+void Sender::CaptureWritten(uint64_t nr_bytes) {
+    struct iovec iov[MAX_IOV_NUM];
+    uint32_t nr = 0;
+    for (; nr < m_nr_iov && nr_bytes > 0; ++nr) {
+        iov[nr].iov_base = m_iov[nr].iov_base;
+        iov[nr].iov_len = min<uint64_t>(m_iov[nr].iov_len, nr_bytes);
+        nr_bytes -= iov[nr].iov_len;
     }
+    capture::RecordIov(CaptureRecord::OUT, m_conn->capture_id, iov, nr);
+}
 
+bool Sender::Process(EventResult res, NotificationQueue* nq) {
+    NETKIT_PROBE4(write, m_conn->fd, res.val, res.err,
+                  (m_write_nsec > 0) ? GetNowNsec() - m_write_nsec
+                                     : 0);
     if (res.err) {
         logger_error(m_logger, "send data failed: [%s].", strerror(res.err));
-        item->on_complete(-res.err);
+        SendItem* item_list[MAX_IOV_NUM];
+        uint32_t nr = m_conn->GetFrontSendItems(item_list, m_nr_iov);
+        for (uint32_t i = 0; i < nr; ++i) {
+            item_list[i]->on_complete(-res.err);
+        }
         m_conn->ShutDown(m_logger);
         return false;
     }
@@ -49,20 +118,58 @@ bool Sender::Process(EventResult res, NotificationQueue* nq) {
         return false;
     }
 
-    m_conn->send_offset += res.val;
-    if (m_conn->send_offset == item->data.size()) {
+    if (m_conn->capture_id != 0) {
+        CaptureWritten(res.val);
+    }
+
+    // completes items which are sent entirely
+    uint64_t nr_sent = res.val;
+    uint64_t now_nsec = 0; // read once for all sampled items
+    bool is_writable = false;
+    SendItem* item = m_conn->GetFrontSendItem();
+    while (item) {
+        const uint64_t nr_left = item->data.size() - m_conn->send_offset;
+        if (nr_sent < nr_left) {
+            m_conn->send_offset += nr_sent;
+            break;
+        }
+
+        nr_sent -= nr_left;
+        if (item->emit_nsec > 0) {
+            if (now_nsec == 0) {
+                now_nsec = GetNowNsec();
+            }
+            latency::Record(latency::SEND, now_nsec - item->emit_nsec);
+            latency::Record(latency::TOTAL, now_nsec - item->read_nsec);
+        }
         item->on_complete(0);
         m_conn->send_offset = 0;
-        lock_guard<mutex> _l(m_conn->send_lock);
-        m_conn->send_queue.pop();
-        if (m_conn->send_queue.empty()) {
-            return false;
+        m_conn->ChargeMemory(
+            -(int64_t)(item->data.capacity() + sizeof(SendItem)));
+        bool unblocked = false;
+        item = m_conn->PopSendItem(&unblocked);
+        is_writable = is_writable || unblocked;
+    }
+
+    if (is_writable) {
+        // resumes reading paused by `pause_reading_when_blocked`
+        int err = m_conn->WakeReader();
+        if (err) {
+            logger_error(m_logger, "waking paused reader failed: [%s].",
+                         strerror(-err));
         }
-        item = &m_conn->send_queue.front();
+
+        // data emitted here is appended to the queue, or is sent by a new
+        // sender if the queue is empty
+        SendContext ctx(m_conn.get(), nq, m_logger);
+        m_conn->NotifyWritable(&ctx);
+    }
+
+    if (!item) {
+        return false;
     }
 
-    int err = DoWrite(item->data.data() + m_conn->send_offset,
-                      item->data.size() - m_conn->send_offset, nq);
+    int err = DoWrite(nq);
     return (err == 0);
 }
 
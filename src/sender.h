@@ -3,27 +3,51 @@
 
 #include "netkit/event_handler.h"
 #include "netkit/connection.h"
-#include <memory>
 
 namespace netkit {
 
+class HandleTable;
+
 class Sender final : public EventHandler {
+public:
+    /**
+       @brief starts a sender owning `c` for the non-empty send queue. the
+       connection is shut down if it fails, since no one else starts a sender
+       while the send queue is not empty, and the reference is given back to
+       `c`. returns 0 or -errno.
+    */
+    static int Launch(ConnectionPtr&& c, NotificationQueue*, Logger*);
+
 protected:
-    ~Sender() = default;
+    ~Sender();
 
 private:
-    friend class SendContext;
+    friend class EventDispatcher;
 
-    Sender(const std::shared_ptr<Connection>& c, Logger* l)
-        : m_conn(c), m_logger(l) {}
+    Sender(ConnectionPtr&& c, Logger* l) : m_conn(std::move(c)), m_logger(l) {}
     int Start(NotificationQueue*);
     bool Process(EventResult, NotificationQueue*) override;
 
-    int DoWrite(const void* buf, uint64_t sz, NotificationQueue*);
+    // writes items in the send queue, starting from `send_offset`
+    int DoWrite(NotificationQueue*);
+
+    // records the first `nr_bytes` bytes of `m_iov`
+    void CaptureWritten(uint64_t nr_bytes);
+
+    static void* operator new(size_t) noexcept;
+    static void operator delete(void*, size_t);
 
 private:
-    std::shared_ptr<Connection> m_conn;
+    // max number of items written at once
+    static constexpr uint32_t MAX_IOV_NUM = 16;
+
+    ConnectionPtr m_conn;
     Logger* m_logger;
+    uint64_t m_handle = 0; // in `m_handle_table` if set
+    HandleTable* m_handle_table = nullptr;
+    uint64_t m_write_nsec = 0; // when the write is submitted, for probes
+    uint32_t m_nr_iov = 0;
+    struct iovec m_iov[MAX_IOV_NUM];
 };
 
 }
@@ -0,0 +1,61 @@
+#include "server_load.h"
+#include "event_dispatcher.h"
+#include "inbox.h"
+#include <mutex> // lock_guard
+using namespace std;
+
+namespace netkit {
+
+void ServerLoad::WaitForDrop(Inbox* inbox, void* tag) {
+    {
+        lock_guard<SpinLock> _l(m_lock);
+        m_waiter_list.push_back(Waiter{inbox, tag});
+    }
+
+    m_nr_waiters.fetch_add(1, memory_order_seq_cst);
+    // the load may drop before the waiter is visible
+    atomic_thread_fence(memory_order_seq_cst);
+    WakeWaiters();
+}
+
+void ServerLoad::CancelWait(void* tag) {
+    lock_guard<SpinLock> _l(m_lock);
+    for (auto it = m_waiter_list.begin(); it != m_waiter_list.end(); ++it) {
+        if (it->tag == tag) {
+            m_waiter_list.erase(it);
+            m_nr_waiters.fetch_sub(1, memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+void ServerLoad::WakeWaiters() {
+    if (IsOverloaded()) {
+        return;
+    }
+
+    vector<Waiter> waiter_list;
+    {
+        lock_guard<SpinLock> _l(m_lock);
+        waiter_list.swap(m_waiter_list);
+    }
+    if (waiter_list.empty()) {
+        return;
+    }
+    m_nr_waiters.fetch_sub(waiter_list.size(), memory_order_relaxed);
+
+    for (auto& waiter : waiter_list) {
+        void* tag = waiter.tag;
+        int err = waiter.inbox->Post([tag](NotificationQueue* nq) -> void {
+            EventDispatcher::Dispatch(tag, EventResult{0, 0}, nq);
+        });
+        if (err) {
+            // woken up by the next drop
+            lock_guard<SpinLock> _l(m_lock);
+            m_waiter_list.push_back(waiter);
+            m_nr_waiters.fetch_add(1, memory_order_relaxed);
+        }
+    }
+}
+
+}
@@ -0,0 +1,91 @@
+#ifndef __NETKIT_SRC_SERVER_LOAD_H__
+#define __NETKIT_SRC_SERVER_LOAD_H__
+
+#include "netkit/spin_lock.h"
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+
+namespace netkit {
+
+class Inbox;
+
+/**
+   @brief counters shared by a server, its clients and their tasks. it is
+   released by the last one of them.
+*/
+struct ServerLoad final {
+    ServerLoad(uint32_t _max_connections, uint32_t _max_inflight_tasks)
+        : max_connections(_max_connections),
+          max_inflight_tasks(_max_inflight_tasks) {}
+
+    void AddRef() {
+        refcount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Release() {
+        if (refcount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    bool IsOverloaded() const {
+        return (max_connections > 0 &&
+                nr_connections.load(std::memory_order_relaxed) >=
+                    max_connections) ||
+            (max_inflight_tasks > 0 &&
+             nr_inflight_tasks.load(std::memory_order_relaxed) >=
+                 max_inflight_tasks);
+    }
+
+    void RemoveConnection() {
+        // pairs with `WaitForDrop()`: either the waiter sees this drop or the
+        // waiter is seen here
+        nr_connections.fetch_sub(1, std::memory_order_seq_cst);
+        if (m_nr_waiters.load(std::memory_order_seq_cst) > 0) {
+            WakeWaiters();
+        }
+    }
+
+    void FinishTask() {
+        nr_inflight_tasks.fetch_sub(1, std::memory_order_seq_cst);
+        if (m_nr_waiters.load(std::memory_order_seq_cst) > 0) {
+            WakeWaiters();
+        }
+    }
+
+    /**
+       @brief `tag` is dispatched with a zero result in the thread of `inbox`
+       when the load drops below the limits, which may be at once.
+    */
+    void WaitForDrop(Inbox* inbox, void* tag);
+
+    /** @brief removes the wait of `tag` if it is not woken up yet */
+    void CancelWait(void* tag);
+
+    // 0 means unlimited
+    const uint32_t max_connections;
+    // tasks are counted only if it is not 0
+    const uint32_t max_inflight_tasks;
+
+    std::atomic<uint32_t> refcount = {1};
+    std::atomic<uint32_t> nr_connections = {0};
+    std::atomic<uint32_t> nr_inflight_tasks = {0};
+
+private:
+    struct Waiter final {
+        Inbox* inbox;
+        void* tag;
+    };
+
+    void WakeWaiters();
+
+private:
+    std::atomic<uint32_t> m_nr_waiters = {0};
+    SpinLock m_lock; // protects `m_waiter_list`
+    std::vector<Waiter> m_waiter_list; // acceptors paused by the load
+};
+
+}
+
+#endif
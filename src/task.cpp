@@ -0,0 +1,64 @@
+#include "netkit/task.h"
+#include "misc.h"
+#include "server_load.h"
+#include "latency.h"
+#include "probe.h"
+#include <atomic>
+using namespace std;
+
+namespace netkit {
+
+static atomic<uint64_t> g_nr_dropped = {0};
+
+void GetTaskStat(TaskStat* stat) {
+    stat->nr_dropped = g_nr_dropped.load(memory_order_relaxed);
+}
+
+Task::~Task() {
+    if (m_load) {
+        m_load->FinishTask();
+        m_load->Release();
+    }
+}
+
+bool Task::Process(EventResult, NotificationQueue* nq) {
+    // the peer may be gone while the task is waiting in the queue. no
+    // responses are committed in ordered mode since nothing is sent anymore.
+    if (!m_conn->IsValid()) {
+        g_nr_dropped.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+
+    // `m_ready_nsec` is also set for probes when the request is not sampled.
+    // `m_conn` may be handed over in `Run()`.
+    const int fd = m_conn->fd;
+    const uint64_t req_bytes = m_buffer.size();
+    uint64_t begin_nsec = 0;
+    if (m_read_nsec > 0 ||
+        (m_ready_nsec > 0 && NETKIT_PROBE_ENABLED(task_run))) {
+        begin_nsec = GetNowNsec();
+    }
+    if (m_read_nsec > 0) {
+        latency::Record(latency::QUEUE, begin_nsec - m_ready_nsec);
+    }
+
+    {
+        // the task is deleted after `Run()`, so its reference can be handed
+        // over to the sender
+        SendContext ctx(m_conn.get(), nq, m_logger, &m_conn, m_seq);
+        ctx.m_read_nsec = m_read_nsec;
+        Run(&ctx);
+    }
+
+    if (begin_nsec > 0) {
+        const uint64_t end_nsec = GetNowNsec();
+        if (m_read_nsec > 0) {
+            latency::Record(latency::RUN, end_nsec - begin_nsec);
+        }
+        NETKIT_PROBE4(task_run, fd, req_bytes,
+                      begin_nsec - m_ready_nsec, end_nsec - begin_nsec);
+    }
+    return false;
+}
+
+}
@@ -1,27 +1,87 @@
 #include "misc.h"
+#include "memory_budget.h"
+#include "server_load.h"
+#include "event_dispatcher.h"
+#include "latency.h"
+#include "capture.h"
+#include "probe.h"
+#include "inbox.h"
 #include "netkit/tcp_client.h"
+#include "netkit/utils.h"
+#include <poll.h> // POLLIN
 #include <string.h> // strerror()
 using namespace std;
 
-#define REQ_BUF_EXPAND_SIZE 1024
+// the read buffer is reallocated if its capacity exceeds this many times of
+// what the next read needs
+#define READ_BUFFER_SHRINK_RATIO 4
 
 namespace netkit {
 
+int TcpClient::Init(int fd, Scheduler* sched, Inbox* inbox,
+                    const Options& options, const SocketAddr* local_addr) {
+    m_conn = Connection::Create(fd);
+    if (!m_conn) {
+        logger_error(m_logger, "allocate connection failed: [%s].",
+                     strerror(ENOMEM));
+        utils::CloseSocket(fd);
+        return -ENOMEM;
+    }
+    if (local_addr && !local_addr->IsEmpty()) {
+        m_conn->SetLocalAddr(*local_addr);
+    }
+    m_conn->auto_cork = options.auto_cork;
+    m_conn->SetSendWatermark(options.send_watermark);
+    if (options.inline_tasks) {
+        m_conn->SetSingleThread();
+    }
+    if (capture::IsEnabled()) {
+        m_conn->capture_id = capture::NewConnId();
+        capture::Record(CaptureRecord::OPEN, m_conn->capture_id);
+    }
+
+    m_sched = sched;
+    m_inbox = inbox;
+    m_options = options;
+    if (m_options.min_read_size == 0) {
+        m_options.min_read_size = Options().min_read_size;
+    }
+    if (m_options.max_read_size < m_options.min_read_size) {
+        m_options.max_read_size = m_options.min_read_size;
+    }
+    m_read_size = m_options.min_read_size;
+
+    return 0;
+}
+
 void TcpClient::DeleteSelf() {
     if (m_conn) {
+        if (m_conn->capture_id != 0) {
+            capture::Record(CaptureRecord::CLOSE, m_conn->capture_id);
+        }
+        m_conn->ChargeMemory(-(int64_t)m_buf_charged);
         bool connected = (m_conn->fd >= 0);
         m_conn->ShutDown(m_logger);
         if (connected) {
             OnDisconnected();
         }
     }
+    if (m_load) {
+        m_load->RemoveConnection();
+        m_load->Release();
+    }
+    EventDispatcher::ReleaseHandle(m_handle, m_handle_table);
     delete this;
 }
 
+void* TcpClient::GetTag() {
+    return EventDispatcher::MakeTag(this, EventDispatcher::TCP_CLIENT,
+                                    &m_handle, &m_handle_table);
+}
+
 int TcpClient::DoRead(void* buf, uint64_t sz, NotificationQueue* nq) {
 loop:
-    int err =
-        nq->ReadAsync(m_conn->fd, buf, sz, static_cast<EventHandler*>(this));
+    int err = nq->ReadAsync(m_conn->fd, buf, sz, GetTag());
     if (ShouldRetry(err)) {
         goto loop;
     }
@@ -34,45 +94,286 @@ loop:
     return err;
 }
 
-int TcpClient::Start(NotificationQueue* nq) {
-    int err = m_buf.Reserve(REQ_BUF_EXPAND_SIZE);
+// exponentially weighted moving average with weight 1/8
+static inline uint32_t UpdateAverage(uint32_t avg, uint64_t val) {
+    if (val > UINT32_MAX) {
+        val = UINT32_MAX;
+    }
+    return (uint32_t)(((uint64_t)avg * 7 + val) / 8);
+}
+
+uint32_t TcpClient::NextReadSize() const {
+    uint64_t sz = m_read_size;
+
+    // try to read the rest of a typical request at once
+    if (m_avg_req_size > m_buf.size()) {
+        sz = max(sz, m_avg_req_size - m_buf.size());
+    }
+
+    if (sz < m_options.min_read_size) {
+        return m_options.min_read_size;
+    }
+    if (sz > m_options.max_read_size) {
+        return m_options.max_read_size;
+    }
+    return sz;
+}
+
+void TcpClient::UpdateReadStat(uint64_t nr_read) {
+    m_avg_read_size = UpdateAverage(m_avg_read_size, nr_read);
+
+    if (nr_read == m_read_size) {
+        // the buffer is filled up and there may be more data in the socket
+        m_read_size = min(m_read_size * 2, m_options.max_read_size);
+    } else {
+        // shrinks to twice the usual amount of data per read
+        m_read_size = max(min(m_avg_read_size * 2, m_options.max_read_size),
+                          m_options.min_read_size);
+    }
+}
+
+void TcpClient::ChargeReadBuffer() {
+    const int64_t delta = (int64_t)m_buf.capacity() - (int64_t)m_buf_charged;
+    if (delta != 0) {
+        m_conn->ChargeMemory(delta);
+        m_buf_charged = m_buf.capacity();
+    }
+}
+
+// keeps the current buffer if failed
+void TcpClient::ReallocReadBuffer(uint64_t capacity) {
+    Buffer buf;
+    if (!m_buf.IsEmpty()) {
+        if (buf.Reserve(capacity) != 0 ||
+            buf.Assign(m_buf.data(), m_buf.size()) != 0) {
+            return;
+        }
+    }
+    std::swap(buf, m_buf);
+}
+
+// gives back memory of a buffer grown for data larger than usual
+void TcpClient::ShrinkReadBuffer(uint64_t needed) {
+    needed = max(needed, (uint64_t)m_options.min_read_size);
+    if (m_buf.capacity() > needed * READ_BUFFER_SHRINK_RATIO) {
+        ReallocReadBuffer(needed);
+    }
+}
+
+int TcpClient::CheckMemoryBudget() {
+    if (!memory::IsOverBudget()) {
+        return 0;
+    }
+
+    const MemoryBudget& budget = memory::GetBudget();
+    if (budget.policy == MemoryBudget::SHED_LARGEST) {
+        const uint64_t usage = m_conn->GetMemoryUsage();
+        if (usage > memory::GetAverageUsage()) {
+            logger_error(m_logger,
+                         "memory budget [%lu] exceeded. close connection "
+                         "using [%lu] bytes.",
+                         budget.limit, usage);
+            return -ENOMEM;
+        }
+        return 0;
+    }
+
+    return 1;
+}
+
+// keeps only the data read so far while waiting for memory, and watches the
+// peer closing meanwhile
+int TcpClient::PauseForMemory(NotificationQueue* nq) {
+    if (m_buf.capacity() / 2 > m_buf.size()) {
+        ReallocReadBuffer(m_buf.size());
+        ChargeReadBuffer();
+    }
+
+loop:
+    int err = nq->PollAsync(m_conn->fd, POLLRDHUP, GetTag());
+    if (ShouldRetry(err)) {
+        goto loop;
+    }
+    if (err) {
+        logger_error(m_logger, "poll paused connection failed: [%s].",
+                     strerror(-err));
+        return err;
+    }
+
+    m_state = State::WAITING_FOR_MEMORY;
+    m_is_polling = true;
+    m_is_woken = false;
+    m_conn->PauseReader(m_inbox, GetTag());
+    memory::WaitForBudget(m_conn);
+    return 1;
+}
+
+int TcpClient::CheckReadPause(NotificationQueue* nq) {
+    // waits for the peer to consume responses
+    if (m_options.pause_reading_when_blocked && m_conn->IsSendBlocked()) {
+        m_conn->PauseReader(m_inbox, GetTag());
+        // the queue may drain before the pause is visible to the sender
+        if (m_conn->IsSendBlocked() || !m_conn->ResumeReader()) {
+            m_state = State::PAUSED;
+            return 1;
+        }
+    }
+
+    int err = CheckMemoryBudget();
+    if (err > 0) {
+        return PauseForMemory(nq);
+    }
+    return err;
+}
+
+// releases the read buffer of an idle connection and waits for new data
+int TcpClient::ReleaseReadBuffer(NotificationQueue* nq) {
+    m_buf = Buffer();
+    ChargeReadBuffer();
+
+loop:
+    int err = nq->PollAsync(m_conn->fd, POLLIN, GetTag());
+    if (ShouldRetry(err)) {
+        goto loop;
+    }
     if (err) {
-        logger_error(m_logger, "reserve [%lu] bytes for request failed: [%s].",
-                     REQ_BUF_EXPAND_SIZE, strerror(-err));
+        logger_error(m_logger, "poll idle connection failed: [%s].",
+                     strerror(-err));
         return err;
     }
 
-    SendContext ctx(m_conn, nq, m_logger);
-    err = OnConnected(&ctx);
+    m_state = State::POLLING;
+    return 0;
+}
+
+bool TcpClient::ProcessWakeUp(EventResult res, NotificationQueue* nq) {
+    m_state = State::READING;
+
+    if (res.err) {
+        logger_error(m_logger, "wait for connection failed: [%s].",
+                     strerror(res.err));
+        m_conn->ShutDown(m_logger);
+        return false;
+    }
+    // paused readers are woken up when the connection is shut down
+    if (!m_conn->IsValid()) {
+        return false;
+    }
+
+    return (HandleMoreDataRequest(m_bytes_needed, nq) == 0);
+}
+
+// both the wakeup from `WaitForBudget()` and the poll of `PauseForMemory()`
+// come back before reading again
+bool TcpClient::ProcessMemoryWakeUp(EventResult res, NotificationQueue* nq) {
+    if (res.val == 0 && res.err == 0) {
+        m_is_woken = true;
+        if (m_is_polling) {
+            int err = nq->CancelAsync(GetTag());
+            // otherwise the poll is already on its way back
+            if (err && err != -ENOENT && err != -EALREADY) {
+                logger_error(m_logger, "cancel poll failed: [%s].",
+                             strerror(-err));
+                // the poll returns when the socket is shut down
+                m_conn->ShutDown(m_logger);
+            }
+            return true;
+        }
+    } else {
+        m_is_polling = false;
+        if (res.err != ECANCELED) {
+            // the peer closed or the connection failed while paused
+            if (res.err) {
+                logger_error(m_logger, "poll paused connection failed: [%s].",
+                             strerror(res.err));
+            }
+            const bool is_woken = (m_is_woken || !m_conn->ResumeReader());
+            m_conn->ShutDown(m_logger);
+            if (!is_woken) {
+                memory::CancelWait(m_conn);
+                return false;
+            }
+        }
+        if (!m_is_woken) {
+            return true;
+        }
+    }
+
+    m_state = State::READING;
+    if (!m_conn->IsValid()) {
+        memory::CancelWait(m_conn);
+        return false;
+    }
+    // readers are woken up a few at a time, and each one resumed passes it on
+    memory::WakeWaiters(1);
+    return (HandleMoreDataRequest(m_bytes_needed, nq) == 0);
+}
+
+int TcpClient::Start(NotificationQueue* nq) {
+    SendContext ctx(m_conn.get(), nq, m_logger);
+    int err = OnConnected(&ctx);
     if (err) {
         logger_error(m_logger, "client OnConnected failed: [%s].",
                      strerror(-err));
         return err;
     }
 
-    return DoRead(m_buf.data(), REQ_BUF_EXPAND_SIZE, nq);
+    err = ctx.Flush();
+    if (err) {
+        return err;
+    }
+
+    return HandleMoreDataRequest(0, nq);
 }
 
 void TcpClient::HandleInvalidRequest() {
+    char buf[SocketAddr::MAX_STR_LEN];
     const EndpointInfo& info = m_conn->GetEndpointInfo();
-    logger_error(m_logger, "invalid request from [%s:%u].",
-                 info.remote_addr.c_str(), info.remote_port);
+    logger_error(m_logger, "invalid request from [%s].",
+                 info.remote.ToString(buf, sizeof(buf)));
 }
 
 int TcpClient::HandleMoreDataRequest(uint32_t req_bytes,
                                      NotificationQueue* nq) {
+    int err = CheckReadPause(nq);
+    if (err) {
+        if (err > 0) {
+            m_bytes_needed = req_bytes;
+            return 0;
+        }
+        return err;
+    }
+
     if (req_bytes == 0) {
-        req_bytes = REQ_BUF_EXPAND_SIZE;
+        m_read_size = NextReadSize();
+        req_bytes = m_read_size;
     } else {
         m_bytes_needed = req_bytes;
     }
 
-    int err = m_buf.Reserve(m_buf.size() + req_bytes);
+    ShrinkReadBuffer(m_buf.size() + req_bytes);
+    err = m_buf.Reserve(m_buf.size() + req_bytes);
     if (err) {
         logger_error(m_logger, "reserve [%lu] bytes failed: [%s].",
-                     strerror(ENOMEM));
+                     m_buf.size() + req_bytes, strerror(ENOMEM));
         return -ENOMEM;
     }
+    ChargeReadBuffer();
+
+    const TimeVal& timeout = m_options.idle_timeout;
+    if (m_buf.IsEmpty() && (timeout.tv_sec > 0 || timeout.tv_usec > 0)) {
+    loop:
+        err = nq->ReadWithTimeoutAsync(m_conn->fd, m_buf.data(), req_bytes,
+                                       timeout, GetTag());
+        if (ShouldRetry(err)) {
+            goto loop;
+        }
+        if (err) {
+            logger_error(m_logger, "reading data failed: [%s].",
+                         strerror(-err));
+        }
+        return err;
+    }
 
     return DoRead(m_buf.data() + m_buf.size(), req_bytes, nq);
 }
@@ -80,6 +381,8 @@ int TcpClient::HandleMoreDataRequest(uint32_t req_bytes,
 int TcpClient::HandleValidRequest(uint32_t req_bytes, NotificationQueue* nq) {
     int err;
 
+    m_avg_req_size = UpdateAverage(m_avg_req_size, req_bytes);
+
     Buffer req;
     if (req_bytes < m_buf.size()) {
         err = req.Assign(m_buf.data() + req_bytes, m_buf.size() - req_bytes);
@@ -91,6 +394,7 @@ int TcpClient::HandleValidRequest(uint32_t req_bytes, NotificationQueue* nq) {
         m_buf.Resize(req_bytes);
     }
     std::swap(req, m_buf);
+    ChargeReadBuffer();
 
     TaskPtr ptr = CreateTask();
     if (!ptr) {
@@ -98,10 +402,56 @@ int TcpClient::HandleValidRequest(uint32_t req_bytes, NotificationQueue* nq) {
         return -1;
     }
 
+    uint64_t seq = SendContext::NO_SEQ;
+    if (m_options.ordered) {
+        seq = m_next_seq;
+        ++m_next_seq;
+    }
+
     Task* task = ptr.release();
-    task->Init(move(req), m_conn);
+    task->Init(move(req), m_conn, seq);
+    if (m_options.latency_sample_interval > 0) {
+        if (m_nr_unsampled > 0) {
+            --m_nr_unsampled;
+        } else if (m_read_nsec > 0) {
+            task->m_read_nsec = m_read_nsec;
+            task->m_ready_nsec = GetNowNsec();
+            m_nr_unsampled = m_options.latency_sample_interval - 1;
+        }
+        // otherwise the read time is unknown, and the sample is taken from
+        // the first request of the next read
+    }
+    if (NETKIT_PROBE_ENABLED(task_schedule) ||
+        NETKIT_PROBE_ENABLED(task_run)) {
+        // tasks not sampled are only timed for probes
+        if (task->m_ready_nsec == 0) {
+            task->m_ready_nsec = GetNowNsec();
+        }
+        NETKIT_PROBE3(task_schedule, m_conn->fd, req_bytes,
+                      (m_read_nsec > 0) ? task->m_ready_nsec - m_read_nsec
+                                        : 0);
+    }
+    if (m_load && m_load->max_inflight_tasks > 0) {
+        m_load->AddRef();
+        m_load->nr_inflight_tasks.fetch_add(1, memory_order_relaxed);
+        task->m_load = m_load;
+    }
 
-    err = m_sched->Schedule(0, static_cast<EventHandler*>(task), nq);
+    if (m_options.inline_tasks) {
+        // processed as if it were sent to this thread
+        const EventResult res = {0, 0};
+        if (!task->Process(res, nq)) {
+            task->DeleteSelf();
+        }
+        err = 0;
+    } else {
+        void* tag = EventDispatcher::MakeTag(task, EventDispatcher::TASK);
+        if (m_is_local) {
+            err = nq->NotifyAsync(nq, 0, tag);
+        } else {
+            err = m_sched->Schedule(0, tag, nq);
+        }
+    }
     if (err) {
         logger_error(m_logger, "assign task to worker thread failed: [%s].",
                      strerror(-err));
@@ -121,11 +471,24 @@ int TcpClient::HandleValidRequest(uint32_t req_bytes, NotificationQueue* nq) {
 }
 
 bool TcpClient::Process(EventResult res, NotificationQueue* nq) {
+    if (m_state == State::WAITING_FOR_MEMORY) {
+        return ProcessMemoryWakeUp(res, nq);
+    }
+    if (m_state != State::READING) {
+        return ProcessWakeUp(res, nq);
+    }
+
+    NETKIT_PROBE3(read, m_conn->fd, res.val, res.err);
     if (res.err) {
         if (ShouldRetry(-res.err)) {
             goto read_again;
         }
 
+        // no new request arrives within `idle_timeout`
+        if (res.err == ECANCELED && m_buf.IsEmpty()) {
+            return (ReleaseReadBuffer(nq) == 0);
+        }
+
         logger_error(m_logger, "read data failed: [%s].", strerror(res.err));
         m_conn->ShutDown(m_logger);
         return false;
@@ -135,14 +498,27 @@ bool TcpClient::Process(EventResult res, NotificationQueue* nq) {
     }
 
     m_buf.Resize(m_buf.size() + res.val);
+    if (m_conn->capture_id != 0) {
+        capture::Record(CaptureRecord::IN, m_conn->capture_id,
+                        m_buf.data() + m_buf.size() - res.val, res.val);
+    }
+    // the clock is only read if the next request is sampled or probed
+    if ((m_options.latency_sample_interval > 0 && m_nr_unsampled == 0) ||
+        NETKIT_PROBE_ENABLED(task_schedule)) {
+        m_read_nsec = GetNowNsec();
+    } else {
+        m_read_nsec = 0;
+    }
+    if (m_bytes_needed == 0) {
+        UpdateReadStat(res.val);
+    }
 
 read_again:
     if (m_bytes_needed > 0) {
         m_bytes_needed -= res.val;
         if (m_bytes_needed > 0) {
-            int err =
-                nq->ReadAsync(m_conn->fd, m_buf.data() + m_buf.size(),
-                              m_bytes_needed, static_cast<EventHandler*>(this));
+            int err = nq->ReadAsync(m_conn->fd, m_buf.data() + m_buf.size(),
+                                    m_bytes_needed, GetTag());
             if (err) {
                 logger_error(m_logger, "launch read request failed: [%s].",
                              strerror(-err));
@@ -155,6 +531,8 @@ read_again:
     while (true) {
         uint32_t req_bytes = 0;
         auto req_stat = Check(m_buf, &req_bytes);
+        NETKIT_PROBE4(check, m_conn->fd, (int)req_stat, req_bytes,
+                      m_buf.size());
 
         if (req_stat == ReqStat::INVALID) {
             HandleInvalidRequest();
@@ -1,20 +1,61 @@
 #include "netkit/tcp_server.h"
+#include "netkit/utils.h"
+#include "netkit/loopback/socket.h"
+#include "server_load.h"
+#include "event_dispatcher.h"
+#include "inbox.h"
 #include "misc.h"
-#include <unistd.h> // close()
+#include "probe.h"
 #include <string.h> // strerror()
+#include <sys/socket.h> // setsockopt()
 using namespace std;
 
 namespace netkit {
 
 TcpServer::~TcpServer() {
-    if (m_fd >= 0) {
-        close(m_fd);
+    if (m_acceptor.fd >= 0) {
+        utils::CloseSocket(m_acceptor.fd);
     }
+    if (m_load) {
+        if (m_acceptor.state == State::PAUSED) {
+            m_load->CancelWait(m_acceptor.tag);
+        }
+        m_load->Release();
+    }
+}
+
+int TcpServer::Init(int fd, Scheduler* sched, const Options& options) {
+    // listeners own their sockets if every worker has one
+    m_acceptor.fd = (options.listener_per_worker) ? -1 : fd;
+    m_acceptor.tag =
+        EventDispatcher::MakeTag(this, EventDispatcher::TCP_SERVER);
+    m_sched = sched;
+    m_options = options;
+
+    m_load = new ServerLoad(options.max_connections,
+                            options.max_inflight_tasks);
+    if (!m_load) {
+        logger_error(m_logger, "allocate server load failed: [%s].",
+                     strerror(ENOMEM));
+        return -ENOMEM;
+    }
+
+    // local addresses of clients are the same as the server's, so they are
+    // retrieved once here
+    if (utils::GetLocalAddr(fd, &m_local_addr) != 0 || m_local_addr.IsAny()) {
+        m_local_addr = SocketAddr();
+    }
+
+    return 0;
 }
 
 int TcpServer::Start(NotificationQueue* nq) {
+    return StartAccepting(&m_acceptor, nq);
+}
+
+int TcpServer::StartAccepting(Acceptor* acceptor, NotificationQueue* nq) {
 loop:
-    int err = nq->AcceptAsync(m_fd, static_cast<EventHandler*>(this), true);
+    int err = nq->AcceptAsync(acceptor->fd, acceptor->tag, true);
     if (ShouldRetry(err)) {
         goto loop;
     }
@@ -22,34 +63,141 @@ loop:
     if (err) {
         logger_error(m_logger, "add server to notification queue failed: [%s].",
                      strerror(-err));
-        // fall through
+        return err;
     }
 
-    return err;
+    acceptor->state = State::ACCEPTING;
+    return 0;
 }
 
-bool TcpServer::Process(EventResult res, NotificationQueue* nq) {
-    if (res.err) {
-        logger_error(m_logger, "server down: [%s].", strerror(res.err));
-        return false;
+void TcpServer::ReleaseListener() {
+    if (m_nr_listeners.fetch_sub(1, memory_order_acq_rel) == 1) {
+        DeleteSelf();
+    }
+}
+
+// closes `fd` with a RST instead of a FIN
+static void ResetConnection(int fd) {
+    if (!loopback::IsSocket(fd)) {
+        const struct linger l = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+    }
+    utils::CloseSocket(fd);
+}
+
+void TcpServer::AddClient(int fd, NotificationQueue* nq) {
+    int err = utils::SetSocketOptions(fd, m_options.client.socket, m_logger);
+    if (err) {
+        utils::CloseSocket(fd);
+        return;
     }
 
-    int fd = res.val;
     TcpClientPtr ptr = CreateClient();
     if (!ptr) {
-        close(fd);
+        utils::CloseSocket(fd);
         logger_error(m_logger, "create client failed.");
-        return true;
+        return;
     }
 
     TcpClient* client = ptr.release();
-    client->Init(fd, m_sched);
+    err = client->Init(fd, m_sched, Inbox::Current(), m_options.client,
+                       &m_local_addr);
+    if (err) {
+        logger_error(m_logger, "init client failed: [%s].", strerror(-err));
+        client->DeleteSelf();
+        return;
+    }
 
-    int err = client->Start(nq);
+    m_load->AddRef();
+    m_load->nr_connections.fetch_add(1, memory_order_relaxed);
+    client->m_load = m_load;
+    // keeps the connection on the worker that accepted it
+    client->m_is_local = m_options.listener_per_worker;
+
+    err = client->Start(nq);
     if (err) {
         logger_error(m_logger, "TcpClient start failed: [%s].", strerror(-err));
         client->DeleteSelf();
-        // fall through
+    }
+}
+
+int TcpServer::PauseAccepting(Acceptor* acceptor, NotificationQueue* nq) {
+loop:
+    int err = nq->CancelAsync(acceptor->tag);
+    if (ShouldRetry(err)) {
+        goto loop;
+    }
+
+    // the accept goes on, and pausing is tried again after the next one
+    if (err == -EALREADY) {
+        return 0;
+    }
+    // no -ECANCELED comes back if nothing is accepting
+    if (err == -ENOENT) {
+        WaitForResuming(acceptor);
+        return 0;
+    }
+    if (err) {
+        logger_error(m_logger, "cancel accepting failed: [%s].",
+                     strerror(-err));
+        return err;
+    }
+
+    acceptor->state = State::PAUSING;
+    return 0;
+}
+
+// woken up by clients or tasks finishing in any thread
+void TcpServer::WaitForResuming(Acceptor* acceptor) {
+    acceptor->state = State::PAUSED;
+    m_load->WaitForDrop(Inbox::Current(), acceptor->tag);
+}
+
+bool TcpServer::Process(EventResult res, NotificationQueue* nq) {
+    return ProcessAccept(&m_acceptor, res, nq);
+}
+
+bool TcpServer::ProcessAccept(Acceptor* acceptor, EventResult res,
+                              NotificationQueue* nq) {
+    if (acceptor->state == State::PAUSED) {
+        if (res.err) {
+            logger_error(m_logger, "server down: [%s].", strerror(res.err));
+            return false;
+        }
+
+        // the load may rise again before the wakeup arrives
+        if (m_load->IsOverloaded()) {
+            WaitForResuming(acceptor);
+            return true;
+        }
+
+        return (StartAccepting(acceptor, nq) == 0);
+    }
+
+    if (res.err) {
+        if (res.err == ECANCELED && acceptor->state == State::PAUSING) {
+            WaitForResuming(acceptor);
+            return true;
+        }
+        logger_error(m_logger, "server down: [%s].", strerror(res.err));
+        return false;
+    }
+
+    int fd = res.val;
+    NETKIT_PROBE2(accept, acceptor->fd, fd);
+    if (m_options.overload_policy == Options::REJECT) {
+        if (m_load->IsOverloaded()) {
+            ResetConnection(fd);
+            return true;
+        }
+        AddClient(fd, nq);
+        return true;
+    }
+
+    // connections accepted before cancelling takes effect are still served
+    AddClient(fd, nq);
+    if (acceptor->state == State::ACCEPTING && m_load->IsOverloaded()) {
+        return (PauseAccepting(acceptor, nq) == 0);
     }
 
     return true;
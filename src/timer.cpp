@@ -1,6 +1,8 @@
 #include "netkit/timer.h"
 #include "netkit/send_context.h"
 #include "misc.h"
+#include "event_dispatcher.h"
+#include "probe.h"
 #include <string.h> // strerror()
 #include <unistd.h> // close()
 using namespace std;
@@ -8,32 +10,38 @@ using namespace std;
 namespace netkit {
 
 Timer::~Timer() {
+    EventDispatcher::ReleaseHandle(m_handle, m_handle_table);
+
     // m_conn is empty if CreateTimerFd() fails
     if (m_conn) {
-        lock_guard<mutex> _l(m_conn->timer_lock);
-        m_conn->timer_fds.erase(m_fd);
+        if (m_is_attached) {
+            m_conn->DetachTimer(this);
+            m_conn->ChargeMemory(-(int64_t)sizeof(Timer));
+        }
         close(m_fd);
     }
 }
 
-int Timer::Init(int fd, const shared_ptr<Connection>& conn) {
+int Timer::Init(int fd, Connection* conn) {
     m_fd = fd;
-    m_conn = conn;
+    m_conn = ConnectionPtr(conn);
 
-    lock_guard<mutex> _l(conn->timer_lock);
-    if (!conn->IsValid()) {
-        return -ENOTCONN;
+    int err = conn->AttachTimer(this);
+    if (err) {
+        return err;
     }
 
-    conn->timer_fds.insert(fd);
-
+    conn->ChargeMemory(sizeof(Timer));
     return 0;
 }
 
 int Timer::Start(NotificationQueue* nq) {
+    void* tag =
+        EventDispatcher::MakeTag(this, EventDispatcher::TIMER, &m_handle,
+                                 &m_handle_table);
 loop:
     int err = nq->ReadAsync(m_fd, &m_nr_expiration, sizeof(m_nr_expiration),
-                            static_cast<EventHandler*>(this));
+                            tag);
     if (ShouldRetry(err)) {
         goto loop;
     }
@@ -47,11 +55,12 @@ loop:
 }
 
 bool Timer::Process(EventResult res, NotificationQueue* nq) {
+    NETKIT_PROBE3(timer, m_fd, (res.err) ? 0 : m_nr_expiration, res.err);
     if (!m_conn->IsValid()) {
         return false;
     }
 
-    SendContext ctx(m_conn, nq, m_logger);
+    SendContext ctx(m_conn.get(), nq, m_logger);
     if (res.err) {
         logger_error(m_logger, "read timer expirations failed: [%s].",
                      strerror(res.err));
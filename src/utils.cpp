@@ -1,9 +1,12 @@
 #include "netkit/utils.h"
+#include "netkit/loopback/socket.h"
+#include <cerrno>
 #include <cstring> // memset()
 #include <cstdio> // snprintf()
 #include <netdb.h>
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <linux/filter.h> // struct sock_filter
 #include <unistd.h> // close()
-#include <arpa/inet.h>
 #include <sys/timerfd.h>
 using namespace std;
 
@@ -42,7 +45,99 @@ static int SetReuse(int fd, Logger* logger) {
     return 0;
 }
 
-int CreateTcpServerFd(const char* host, uint16_t port, Logger* logger) {
+static int SetIntOption(int fd, int level, int name, int value,
+                        const char* name_str, Logger* logger) {
+    if (setsockopt(fd, level, name, &value, sizeof(value)) != 0) {
+        int err = errno; // logging may overwrite errno
+        logger_error(logger, "set [%s] to [%d] failed: %s.", name_str, value,
+                     strerror(err));
+        return -err;
+    }
+    return 0;
+}
+
+#define SET_INT_OPTION(fd, level, name, value, logger)                   \
+    do {                                                                 \
+        int _err = SetIntOption(fd, level, name, value, #name, logger); \
+        if (_err) {                                                     \
+            return _err;                                                \
+        }                                                                \
+    } while (0)
+
+int SetSocketOptions(int fd, const SocketOptions& opts, Logger* logger) {
+    // loopback sockets have no options
+    if (loopback::IsSocket(fd)) {
+        return 0;
+    }
+
+    if (opts.tcp_nodelay) {
+        SET_INT_OPTION(fd, IPPROTO_TCP, TCP_NODELAY, 1, logger);
+    }
+    if (opts.send_buffer_size > 0) {
+        SET_INT_OPTION(fd, SOL_SOCKET, SO_SNDBUF, opts.send_buffer_size,
+                       logger);
+    }
+    if (opts.recv_buffer_size > 0) {
+        SET_INT_OPTION(fd, SOL_SOCKET, SO_RCVBUF, opts.recv_buffer_size,
+                       logger);
+    }
+    if (opts.busy_poll_usec > 0) {
+        SET_INT_OPTION(fd, SOL_SOCKET, SO_BUSY_POLL, opts.busy_poll_usec,
+                       logger);
+    }
+    if (opts.notsent_lowat > 0) {
+        SET_INT_OPTION(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, opts.notsent_lowat,
+                       logger);
+    }
+    if (opts.incoming_cpu >= 0) {
+        SET_INT_OPTION(fd, SOL_SOCKET, SO_INCOMING_CPU, opts.incoming_cpu,
+                       logger);
+    }
+    return 0;
+}
+
+static int SetListenerOptions(int fd, const SocketOptions& opts,
+                              Logger* logger) {
+    int err = SetSocketOptions(fd, opts, logger);
+    if (err) {
+        return err;
+    }
+    if (opts.defer_accept_sec > 0) {
+        SET_INT_OPTION(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, opts.defer_accept_sec,
+                       logger);
+    }
+    if (opts.fastopen_queue_len > 0) {
+        SET_INT_OPTION(fd, IPPROTO_TCP, TCP_FASTOPEN, opts.fastopen_queue_len,
+                       logger);
+    }
+    return 0;
+}
+
+int SteerReuseportByCpu(int fd, uint32_t nr_sockets, Logger* logger) {
+    struct sock_filter code[] = {
+        // A = the current cpu
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU)),
+        // A = A % nr_sockets
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, nr_sockets),
+        // returns A as the index of the socket
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                   sizeof(prog)) != 0) {
+        int err = errno;
+        logger_error(logger, "attach reuseport cbpf failed: %s.",
+                     strerror(err));
+        return -err;
+    }
+    return 0;
+}
+
+int CreateTcpServerFd(const char* host, uint16_t port, Logger* logger,
+                      int backlog, const SocketOptions* opts) {
     int fd;
     int sc = 0;
     struct addrinfo* info = nullptr;
@@ -63,12 +158,18 @@ int CreateTcpServerFd(const char* host, uint16_t port, Logger* logger) {
         goto err1;
     }
 
+    // buffer sizes must be set before `listen()` to take effect on the window
+    // scale of accepted connections
+    if (opts && SetListenerOptions(fd, *opts, logger) != 0) {
+        goto err1;
+    }
+
     if (bind(fd, info->ai_addr, info->ai_addrlen) != 0) {
         logger_error(logger, "bind failed: %s.", strerror(errno));
         goto err1;
     }
 
-    if (listen(fd, 128) == -1) {
+    if (listen(fd, backlog) == -1) {
         logger_error(logger, "listen failed: %s.", strerror(errno));
         goto err1;
     }
@@ -83,7 +184,8 @@ err:
     return -errno;
 }
 
-int CreateTcpClientFd(const char* host, uint16_t port, Logger* logger) {
+int CreateTcpClientFd(const char* host, uint16_t port, Logger* logger,
+                      const SocketOptions* opts) {
     struct addrinfo* info = nullptr;
     auto ret = GetHostInfo(host, port, &info, logger);
     if (ret != 0) {
@@ -98,6 +200,13 @@ int CreateTcpClientFd(const char* host, uint16_t port, Logger* logger) {
         goto err;
     }
 
+    if (opts) {
+        ret = SetSocketOptions(fd, *opts, logger);
+        if (ret) {
+            goto err1;
+        }
+    }
+
     if (connect(fd, info->ai_addr, info->ai_addrlen) != 0) {
         logger_error(logger, "connect() failed: %s", strerror(errno));
         ret = -errno;
@@ -149,21 +258,47 @@ int CreateTimerFd(const TimeVal& interval, Logger* logger) {
     return fd;
 }
 
-void GenEndpointInfo(int fd, EndpointInfo* info) {
-    struct sockaddr_in addr;
-    socklen_t len = sizeof(addr);
-    int ret = getpeername(fd, (struct sockaddr*)&addr, &len);
-    if (ret == 0) {
-        info->remote_addr = inet_ntoa(addr.sin_addr);
-        info->remote_port = ntohs(addr.sin_port);
+int GetLocalAddr(int fd, SocketAddr* addr) {
+    if (loopback::IsSocket(fd)) {
+        return loopback::GetLocalAddr(fd, addr);
     }
 
-    len = sizeof(addr);
-    ret = getsockname(fd, (struct sockaddr*)&addr, &len);
-    if (ret == 0) {
-        info->local_addr = inet_ntoa(addr.sin_addr);
-        info->local_port = ntohs(addr.sin_port);
+    socklen_t len = sizeof(addr->in6);
+    if (getsockname(fd, &addr->sa, &len) != 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+int GetRemoteAddr(int fd, SocketAddr* addr) {
+    if (loopback::IsSocket(fd)) {
+        return loopback::GetRemoteAddr(fd, addr);
     }
+
+    socklen_t len = sizeof(addr->in6);
+    if (getpeername(fd, &addr->sa, &len) != 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+int CloseSocket(int fd) {
+    if (loopback::IsSocket(fd)) {
+        return loopback::Close(fd);
+    }
+    return (close(fd) == 0) ? 0 : -errno;
+}
+
+int ShutDownSocket(int fd) {
+    if (loopback::IsSocket(fd)) {
+        return loopback::ShutDown(fd);
+    }
+    return (shutdown(fd, SHUT_RDWR) == 0) ? 0 : -errno;
+}
+
+void GenEndpointInfo(int fd, EndpointInfo* info) {
+    GetRemoteAddr(fd, &info->remote);
+    GetLocalAddr(fd, &info->local);
 }
 
 }}
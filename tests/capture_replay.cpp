@@ -0,0 +1,681 @@
+#include "netkit/iouring/notification_queue_impl.h"
+#include "netkit/capture.h"
+#include "netkit/latency_stat.h"
+#include "netkit/utils.h"
+using namespace netkit;
+using namespace netkit::iouring;
+
+#include "logger/stdout_logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring> // strerror()
+#include <memory>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <time.h> // clock_gettime()
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h> // shutdown()
+#include <sys/stat.h>
+using namespace std;
+
+/*
+  replays a file written by `StartCapture()` against a server.
+
+  bytes read by the captured server are sent at the same pace, scaled by the
+  speed, over a connection for each captured one. bytes the captured server
+  wrote after a read are taken as the response to it, and the latency of a
+  response is measured from when its request is due until as many bytes have
+  come back. contents of responses are not checked since they may differ
+  between runs.
+*/
+
+#define READ_BUF_SIZE (64 * 1024)
+// time to wait for responses in flight after the last request is sent
+#define DRAIN_NSEC 2000000000ul
+
+static uint64_t GetNowNsec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* ------------------------------------------------------------------------- */
+
+// a read of the captured server
+struct Step final {
+    const char* data; // in the mapped file
+    uint32_t len;
+    uint64_t nsec; // since the first record
+    uint64_t out_bytes; // written by the server after this step, cumulative
+};
+
+// steps of a captured connection
+struct Session final {
+    vector<Step> step_list;
+    uint64_t out_bytes = 0;
+};
+
+class CaptureFile final {
+public:
+    ~CaptureFile() {
+        if (m_data) {
+            munmap((void*)m_data, m_size);
+        }
+    }
+
+    // returns 0 or -errno
+    int Load(const char* path, Logger*);
+
+    const vector<Session>& GetSessionList() const {
+        return m_session_list;
+    }
+
+private:
+    const char* m_data = nullptr;
+    uint64_t m_size = 0;
+    vector<Session> m_session_list;
+};
+
+int CaptureFile::Load(const char* path, Logger* logger) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        logger_error(logger, "open [%s] failed: [%s].", path, strerror(errno));
+        return -errno;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+    m_size = st.st_size;
+    if (m_size < CAPTURE_MAGIC_LEN) {
+        close(fd);
+        return -EINVAL;
+    }
+
+    auto data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        logger_error(logger, "mmap [%s] failed: [%s].", path, strerror(errno));
+        return -errno;
+    }
+    m_data = (const char*)data;
+    madvise(data, m_size, MADV_SEQUENTIAL);
+
+    if (memcmp(m_data, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN) != 0) {
+        logger_error(logger, "[%s] is not a capture file.", path);
+        return -EINVAL;
+    }
+
+    // batches of different threads are merged by time. the sort is stable to
+    // keep records of the same time in order.
+    vector<pair<CaptureRecord, const char*>> record_list;
+    uint64_t off = CAPTURE_MAGIC_LEN;
+    while (off + sizeof(CaptureRecord) <= m_size) {
+        CaptureRecord record;
+        memcpy(&record, m_data + off, sizeof(record));
+        off += sizeof(record);
+        const uint32_t len = record.GetLen();
+        if (off + len > m_size) {
+            // the last record may be cut off if the server was killed
+            break;
+        }
+        record_list.push_back(make_pair(record, m_data + off));
+        off += len;
+    }
+    stable_sort(record_list.begin(), record_list.end(),
+                [](const pair<CaptureRecord, const char*>& a,
+                   const pair<CaptureRecord, const char*>& b) -> bool {
+                    return a.first.nsec < b.first.nsec;
+                });
+
+    unordered_map<uint32_t, uint32_t> conn_idx; // id => index of session
+    const uint64_t first_nsec =
+        (record_list.empty()) ? 0 : record_list.front().first.nsec;
+    for (auto& it : record_list) {
+        const CaptureRecord& record = it.first;
+        const uint32_t len = record.GetLen();
+
+        auto ret = conn_idx.insert(
+            make_pair(record.conn_id, (uint32_t)m_session_list.size()));
+        if (ret.second) {
+            m_session_list.emplace_back();
+        }
+        Session& session = m_session_list[ret.first->second];
+
+        switch (record.GetType()) {
+            case CaptureRecord::IN:
+                session.step_list.push_back(
+                    {it.second, len, record.nsec - first_nsec,
+                     session.out_bytes});
+                break;
+            case CaptureRecord::OUT:
+                session.out_bytes += len;
+                if (!session.step_list.empty()) {
+                    session.step_list.back().out_bytes = session.out_bytes;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct Config final {
+    const char* host = nullptr;
+    uint16_t port = 0;
+    const char* path = nullptr;
+    uint32_t nr_copies = 1; // connections replayed for each captured one
+    uint32_t nr_threads = 1;
+    double speed = 1; // 0: as fast as possible
+    const char* json_path = nullptr;
+};
+
+struct Result final {
+    uint64_t nr_steps = 0; // sent entirely
+    uint64_t nr_bytes_sent = 0;
+    uint64_t nr_bytes_received = 0;
+    uint64_t nr_bytes_expected = 0;
+    uint64_t nr_incomplete = 0; // connections not getting all bytes expected
+    uint64_t nr_conn_errors = 0;
+    uint64_t last_nsec = 0; // of the last event
+    LatencyHistogram latency;
+};
+
+class Worker final {
+public:
+    Worker(const Config& c, Logger* l) : m_config(c), m_logger(l) {}
+
+    // returns 0 or -errno
+    int Init(const vector<const Session*>& session_list);
+
+    void Run(uint64_t start_nsec);
+
+    const Result& GetResult() const {
+        return m_result;
+    }
+
+private:
+    struct Conn;
+
+    struct Op final {
+        Conn* conn;
+        bool is_read;
+    };
+
+    struct Conn final {
+        const Session* session;
+        int fd = -1;
+        bool is_writing = false;
+        bool is_scheduled = false; // waiting in `m_due_queue`
+        bool is_closed = false;
+        uint32_t next_step = 0; // to send
+        uint32_t send_off = 0; // in `next_step`
+        uint32_t wait_step = 0; // whose response is not complete
+        uint64_t recv_bytes = 0;
+        Op read_op;
+        Op write_op;
+        char recv_buf[READ_BUF_SIZE];
+    };
+
+    typedef pair<uint64_t, Conn*> DueItem; // when the next step is due
+
+private:
+    uint64_t GetIntendedNsec(const Step& step) const {
+        return (m_config.speed > 0)
+            ? m_start_nsec + (uint64_t)(step.nsec / m_config.speed)
+            : m_start_nsec;
+    }
+
+    bool HasResponse(const Conn* conn, uint32_t idx) const {
+        const auto& l = conn->session->step_list;
+        return l[idx].out_bytes > ((idx > 0) ? l[idx - 1].out_bytes : 0);
+    }
+
+    void TrySend(Conn*, uint64_t now);
+    void UpdateLatency(Conn*, uint64_t now);
+    int DoRead(Conn*);
+    void HandleWrite(Conn*, EventResult);
+    void HandleRead(Conn*, EventResult);
+    void CloseConn(Conn*);
+    bool IsDone(const Conn*) const;
+
+private:
+    const Config& m_config;
+    Logger* m_logger;
+    NotificationQueueImpl m_nq;
+    uint64_t m_start_nsec = 0;
+    bool m_is_tick_pending = false;
+    uint64_t m_tick_nsec = 0; // when the pending tick fires
+    char m_tick_tag;
+    vector<unique_ptr<Conn>> m_conn_list;
+    priority_queue<DueItem, vector<DueItem>, greater<DueItem>> m_due_queue;
+    Result m_result;
+};
+
+int Worker::Init(const vector<const Session*>& session_list) {
+    int err = m_nq.Init(NotificationQueueImpl::Options(), m_logger);
+    if (err) {
+        logger_error(m_logger, "init queue failed: [%s].", strerror(-err));
+        return err;
+    }
+
+    SocketOptions opts;
+    opts.tcp_nodelay = true;
+
+    for (auto session : session_list) {
+        auto conn = new Conn();
+        if (!conn) {
+            return -ENOMEM;
+        }
+        m_conn_list.emplace_back(conn);
+
+        conn->session = session;
+        conn->read_op = {conn, true};
+        conn->write_op = {conn, false};
+        m_result.nr_bytes_expected += session->out_bytes;
+
+        int fd = utils::CreateTcpClientFd(m_config.host, m_config.port,
+                                          m_logger, &opts);
+        if (fd < 0) {
+            logger_error(m_logger, "connect to [%s:%u] failed: [%s].",
+                         m_config.host, m_config.port, strerror(-fd));
+            return fd;
+        }
+        conn->fd = fd;
+    }
+
+    return 0;
+}
+
+void Worker::CloseConn(Conn* conn) {
+    if (conn->is_closed) {
+        return;
+    }
+    conn->is_closed = true;
+    ++m_result.nr_conn_errors;
+    // pending operations fail and are ignored
+    shutdown(conn->fd, SHUT_RDWR);
+}
+
+bool Worker::IsDone(const Conn* conn) const {
+    return conn->is_closed ||
+        (conn->next_step == conn->session->step_list.size() &&
+         !conn->is_writing && conn->recv_bytes >= conn->session->out_bytes);
+}
+
+// sends the next step if it is due, or waits for it in `m_due_queue`
+void Worker::TrySend(Conn* conn, uint64_t now) {
+    if (conn->is_writing || conn->is_scheduled || conn->is_closed) {
+        return;
+    }
+    const auto& step_list = conn->session->step_list;
+    if (conn->next_step == step_list.size()) {
+        return;
+    }
+
+    const Step& step = step_list[conn->next_step];
+    const uint64_t due = GetIntendedNsec(step);
+    if (due > now) {
+        conn->is_scheduled = true;
+        m_due_queue.push(make_pair(due, conn));
+        return;
+    }
+
+    int err = m_nq.WriteAsync(conn->fd, step.data + conn->send_off,
+                              step.len - conn->send_off, &conn->write_op);
+    if (err) {
+        logger_error(m_logger, "write request failed: [%s].", strerror(-err));
+        CloseConn(conn);
+        return;
+    }
+    conn->is_writing = true;
+}
+
+void Worker::HandleWrite(Conn* conn, EventResult res) {
+    conn->is_writing = false;
+    if (conn->is_closed) {
+        return;
+    }
+    if (res.err || res.val == 0) {
+        logger_error(m_logger, "write request failed: [%s].",
+                     strerror(res.err));
+        CloseConn(conn);
+        return;
+    }
+
+    m_result.nr_bytes_sent += res.val;
+    conn->send_off += res.val;
+    if (conn->send_off == conn->session->step_list[conn->next_step].len) {
+        conn->send_off = 0;
+        ++conn->next_step;
+        ++m_result.nr_steps;
+    }
+    TrySend(conn, GetNowNsec());
+}
+
+// records responses completed by bytes received so far
+void Worker::UpdateLatency(Conn* conn, uint64_t now) {
+    const auto& step_list = conn->session->step_list;
+    while (conn->wait_step < conn->next_step) {
+        const Step& step = step_list[conn->wait_step];
+        if (conn->recv_bytes < step.out_bytes) {
+            break;
+        }
+        if (HasResponse(conn, conn->wait_step)) {
+            m_result.latency.Add(now - GetIntendedNsec(step));
+        }
+        ++conn->wait_step;
+    }
+}
+
+int Worker::DoRead(Conn* conn) {
+    int err = m_nq.ReadAsync(conn->fd, conn->recv_buf, READ_BUF_SIZE,
+                             &conn->read_op);
+    if (err) {
+        logger_error(m_logger, "read response failed: [%s].", strerror(-err));
+    }
+    return err;
+}
+
+void Worker::HandleRead(Conn* conn, EventResult res) {
+    if (conn->is_closed) {
+        return;
+    }
+    if (res.err || res.val == 0) {
+        logger_error(m_logger, "read response failed: [%s].",
+                     (res.err) ? strerror(res.err) : "peer closed");
+        CloseConn(conn);
+        return;
+    }
+
+    m_result.nr_bytes_received += res.val;
+    conn->recv_bytes += res.val;
+    UpdateLatency(conn, GetNowNsec());
+
+    if (DoRead(conn) != 0) {
+        CloseConn(conn);
+    }
+}
+
+void Worker::Run(uint64_t start_nsec) {
+    m_start_nsec = start_nsec;
+
+    uint64_t last_due_nsec = start_nsec;
+    for (auto& conn : m_conn_list) {
+        const auto& step_list = conn->session->step_list;
+        if (!step_list.empty()) {
+            last_due_nsec =
+                max(last_due_nsec, GetIntendedNsec(step_list.back()));
+        }
+        if (DoRead(conn.get()) != 0) {
+            CloseConn(conn.get());
+        }
+    }
+    const uint64_t drain_nsec = last_due_nsec + DRAIN_NSEC;
+
+    uint64_t now = GetNowNsec();
+    for (auto& conn : m_conn_list) {
+        TrySend(conn.get(), now);
+    }
+
+    while (true) {
+        now = GetNowNsec();
+        while (!m_due_queue.empty() && m_due_queue.top().first <= now) {
+            auto conn = m_due_queue.top().second;
+            m_due_queue.pop();
+            conn->is_scheduled = false;
+            TrySend(conn, now);
+        }
+
+        bool is_done = true;
+        for (auto& conn : m_conn_list) {
+            if (!IsDone(conn.get())) {
+                is_done = false;
+                break;
+            }
+        }
+        if (is_done || now >= drain_nsec) {
+            break;
+        }
+
+        const uint64_t wakeup_nsec =
+            (m_due_queue.empty()) ? drain_nsec : m_due_queue.top().first;
+        if (!m_is_tick_pending || wakeup_nsec < m_tick_nsec) {
+            // rounded up, or the tick may fire before `m_tick_nsec`
+            const uint64_t usec =
+                (wakeup_nsec > now) ? (wakeup_nsec - now + 999) / 1000 : 0;
+            const TimeVal timeout = {(time_t)(usec / 1000000),
+                                     (suseconds_t)(usec % 1000000)};
+            int err = m_nq.TimeoutAsync(timeout, &m_tick_tag);
+            if (err) {
+                logger_error(m_logger, "add timeout failed: [%s].",
+                             strerror(-err));
+                break;
+            }
+            // an earlier tick replaces a later one, which fires uselessly
+            m_is_tick_pending = true;
+            m_tick_nsec = wakeup_nsec;
+        }
+
+        EventResult res;
+        void* tag = nullptr;
+        int err = m_nq.Next(&res, &tag, nullptr);
+        if (err) {
+            logger_error(m_logger, "get event failed: [%s].", strerror(-err));
+            break;
+        }
+
+        if (tag == &m_tick_tag) {
+            if (GetNowNsec() >= m_tick_nsec) {
+                m_is_tick_pending = false;
+            }
+            continue;
+        }
+
+        auto op = static_cast<Op*>(tag);
+        if (op->is_read) {
+            HandleRead(op->conn, res);
+        } else {
+            HandleWrite(op->conn, res);
+        }
+    }
+    m_result.last_nsec = GetNowNsec();
+
+    for (auto& conn : m_conn_list) {
+        if (!conn->is_closed && conn->recv_bytes < conn->session->out_bytes) {
+            ++m_result.nr_incomplete;
+        }
+        shutdown(conn->fd, SHUT_RDWR);
+    }
+
+    // pending operations are gone with the queue before buffers are freed
+    m_nq.Destroy();
+    for (auto& conn : m_conn_list) {
+        close(conn->fd);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void PrintUsage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [options] capture_file host port\n"
+            "  -n  connections replayed for each captured one, default 1\n"
+            "  -t  number of threads, default 1\n"
+            "  -x  speed relative to the capture. 0 sends everything as fast\n"
+            "      as possible, default 1\n"
+            "  -j  writes a JSON summary to the file\n",
+            prog);
+}
+
+// returns 0 or -EINVAL
+static int ParseArgs(int argc, char* argv[], Config* config) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:x:j:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                config->nr_copies = atoi(optarg);
+                break;
+            case 't':
+                config->nr_threads = atoi(optarg);
+                break;
+            case 'x':
+                config->speed = atof(optarg);
+                break;
+            case 'j':
+                config->json_path = optarg;
+                break;
+            default:
+                return -EINVAL;
+        }
+    }
+
+    if (argc - optind != 3) {
+        return -EINVAL;
+    }
+    config->path = argv[optind];
+    config->host = argv[optind + 1];
+    config->port = atoi(argv[optind + 2]);
+
+    if (config->nr_copies == 0 || config->nr_threads == 0 ||
+        config->speed < 0) {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static string FormatJson(const Config& config, uint32_t nr_conns,
+                         const Result& r, double sec) {
+    const LatencyHistogram& h = r.latency;
+    const double mean_usec =
+        (h.count > 0) ? (double)h.sum_nsec / h.count / 1000 : 0;
+
+    char buf[1024];
+    snprintf(buf, sizeof(buf),
+             "{\"speed\":%.2f,\"connections\":%u,\"threads\":%u,"
+             "\"duration_sec\":%.3f,\"requests\":%lu,\"responses\":%lu,"
+             "\"bytes_sent\":%lu,\"bytes_received\":%lu,"
+             "\"bytes_expected\":%lu,\"incomplete\":%lu,\"conn_errors\":%lu,"
+             "\"requests_per_sec\":%.0f,\"latency_usec\":{\"mean\":%.2f,"
+             "\"p50\":%.2f,\"p90\":%.2f,\"p99\":%.2f,\"p99.9\":%.2f,"
+             "\"p99.99\":%.2f,\"max\":%.2f}}",
+             config.speed, nr_conns, config.nr_threads, sec, r.nr_steps,
+             h.count, r.nr_bytes_sent, r.nr_bytes_received,
+             r.nr_bytes_expected, r.nr_incomplete, r.nr_conn_errors,
+             r.nr_steps / sec, mean_usec, h.GetPercentile(0.5) / 1000.0,
+             h.GetPercentile(0.9) / 1000.0, h.GetPercentile(0.99) / 1000.0,
+             h.GetPercentile(0.999) / 1000.0,
+             h.GetPercentile(0.9999) / 1000.0, h.max_nsec / 1000.0);
+    return string(buf);
+}
+
+int main(int argc, char* argv[]) {
+    Config config;
+    if (ParseArgs(argc, argv, &config) != 0) {
+        PrintUsage(argv[0]);
+        return -1;
+    }
+
+    StdoutLogger logger;
+    stdout_logger_init(&logger);
+
+    CaptureFile file;
+    int err = file.Load(config.path, &logger.l);
+    if (err) {
+        logger_error(&logger.l, "load [%s] failed: [%s].", config.path,
+                     strerror(-err));
+        return -1;
+    }
+
+    // copies of sessions are assigned to workers in turn
+    vector<vector<const Session*>> session_lists(config.nr_threads);
+    uint32_t nr_conns = 0;
+    for (uint32_t i = 0; i < config.nr_copies; ++i) {
+        for (auto& session : file.GetSessionList()) {
+            session_lists[nr_conns % config.nr_threads].push_back(&session);
+            ++nr_conns;
+        }
+    }
+    if (nr_conns == 0) {
+        logger_error(&logger.l, "no connections in [%s].", config.path);
+        return -1;
+    }
+
+    vector<unique_ptr<Worker>> worker_list;
+    for (auto& l : session_lists) {
+        auto worker = new Worker(config, &logger.l);
+        worker_list.emplace_back(worker);
+        err = worker->Init(l);
+        if (err) {
+            logger_error(&logger.l, "init worker failed: [%s].",
+                         strerror(-err));
+            return -1;
+        }
+    }
+
+    // workers start at the same time
+    const uint64_t start_nsec = GetNowNsec() + 10000000;
+    vector<thread> thread_list;
+    for (auto& worker : worker_list) {
+        thread_list.emplace_back(&Worker::Run, worker.get(), start_nsec);
+    }
+    for (auto& t : thread_list) {
+        t.join();
+    }
+
+    Result total;
+    for (auto& worker : worker_list) {
+        const Result& r = worker->GetResult();
+        total.nr_steps += r.nr_steps;
+        total.nr_bytes_sent += r.nr_bytes_sent;
+        total.nr_bytes_received += r.nr_bytes_received;
+        total.nr_bytes_expected += r.nr_bytes_expected;
+        total.nr_incomplete += r.nr_incomplete;
+        total.nr_conn_errors += r.nr_conn_errors;
+        total.last_nsec = max(total.last_nsec, r.last_nsec);
+        total.latency.Merge(r.latency);
+    }
+
+    const double sec = (total.last_nsec - start_nsec) / 1e9;
+    const LatencyHistogram& h = total.latency;
+    printf("replayed %lu requests over %u connections in %.3f s, %.0f req/s, "
+           "%lu/%lu bytes received, %lu incomplete, %lu connection errors\n",
+           total.nr_steps, nr_conns, sec, total.nr_steps / sec,
+           total.nr_bytes_received, total.nr_bytes_expected,
+           total.nr_incomplete, total.nr_conn_errors);
+    printf("latency (us) p50 %.2f p90 %.2f p99 %.2f p99.9 %.2f p99.99 %.2f "
+           "max %.2f\n",
+           h.GetPercentile(0.5) / 1000.0, h.GetPercentile(0.9) / 1000.0,
+           h.GetPercentile(0.99) / 1000.0, h.GetPercentile(0.999) / 1000.0,
+           h.GetPercentile(0.9999) / 1000.0, h.max_nsec / 1000.0);
+
+    const string json = FormatJson(config, nr_conns, total, sec);
+    if (config.json_path) {
+        FILE* fp = fopen(config.json_path, "w");
+        if (!fp) {
+            logger_error(&logger.l, "open [%s] failed: [%s].",
+                         config.json_path, strerror(errno));
+            return -1;
+        }
+        fprintf(fp, "%s\n", json.c_str());
+        fclose(fp);
+    } else {
+        printf("%s\n", json.c_str());
+    }
+
+    stdout_logger_destroy(&logger);
+    return (total.nr_incomplete > 0 || total.nr_conn_errors > 0) ? -1 : 0;
+}
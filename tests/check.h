@@ -0,0 +1,30 @@
+#ifndef __NETKIT_TESTS_CHECK_H__
+#define __NETKIT_TESTS_CHECK_H__
+
+#include <cstdio>
+
+/*
+  unit tests are plain programs run by `ctest`. a test function returns 0 if
+  it passes, and `CHECK()` returns 1 from it after printing the failed
+  condition.
+*/
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: check `%s` failed.\n", __FILE__,    \
+                    __LINE__, #cond);                                   \
+            return 1;                                                   \
+        }                                                               \
+    } while (0)
+
+// runs `f` and counts it in `nr_failed` if it fails
+#define RUN_TEST(f, nr_failed)                                          \
+    do {                                                                \
+        if (f() != 0) {                                                 \
+            fprintf(stderr, "[%s] failed.\n", #f);                      \
+            ++(nr_failed);                                              \
+        }                                                               \
+    } while (0)
+
+#endif
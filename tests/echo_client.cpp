@@ -2,6 +2,7 @@
 #include "netkit/utils.h"
 #include "logger/stdout_logger.h"
 #include <string.h> // strerror()
+#include <stdio.h> // sprintf()
 using namespace netkit;
 using namespace netkit::iouring;
 using namespace std;
@@ -26,13 +27,14 @@ struct EchoClient final {
 static State Process(EventResult res, EchoClient* client, NotificationQueue* nq,
                      Logger* logger) {
     int rc;
+    char laddr[SocketAddr::MAX_STR_LEN], raddr[SocketAddr::MAX_STR_LEN];
 
     switch (client->state) {
         case State::CLIENT_SEND_REQ: {
             if (res.val == 0) {
                 const EndpointInfo& info = client->endpoint_info;
-                logger_info(logger, "[client] server [%s:%u] down.",
-                            info.remote_addr.c_str(), info.remote_port);
+                logger_info(logger, "[client] server [%s] down.",
+                            info.remote.ToString(raddr, sizeof(raddr)));
                 client->state = State::CLIENT_DISCONNECTED;
                 rc = nq->CloseAsync(client->fd, client);
                 if (rc != 0) {
@@ -52,8 +54,8 @@ static State Process(EventResult res, EchoClient* client, NotificationQueue* nq,
         case State::CLIENT_GET_RES: {
             const EndpointInfo& info = client->endpoint_info;
             if (res.val == 0) {
-                logger_info(logger, "[client] server [%s:%u] down.",
-                            info.remote_addr.c_str(), info.remote_port);
+                logger_info(logger, "[client] server [%s] down.",
+                            info.remote.ToString(raddr, sizeof(raddr)));
                 client->state = State::CLIENT_DISCONNECTED;
                 rc = nq->CloseAsync(client->fd, client);
                 if (rc != 0) {
@@ -64,9 +66,10 @@ static State Process(EventResult res, EchoClient* client, NotificationQueue* nq,
 
             logger_info(
                 logger,
-                "[client] server [%s:%u] ==> client [%s:%u] data [%.*s]",
-                info.remote_addr.c_str(), info.remote_port,
-                info.local_addr.c_str(), info.local_port, res.val, client->buf);
+                "[client] server [%s] ==> client [%s] data [%.*s]",
+                info.remote.ToString(raddr, sizeof(raddr)),
+                info.local.ToString(laddr, sizeof(laddr)), res.val,
+                client->buf);
             sleep(1);
 
             if (res.val < ECHO_BUFFER_SIZE) {
@@ -94,9 +97,9 @@ static State Process(EventResult res, EchoClient* client, NotificationQueue* nq,
             break;
         }
         case State::CLIENT_DISCONNECTED: {
-            logger_info(logger, "[client] client [%s:%u] closed.",
-                        client->endpoint_info.local_addr.c_str(),
-                        client->endpoint_info.local_port);
+            logger_info(logger, "[client] client [%s] closed.",
+                        client->endpoint_info.local.ToString(laddr,
+                                                             sizeof(laddr)));
             client->state = State::CLIENT_END_LOOP;
             break;
         }
@@ -121,6 +124,7 @@ int main(int argc, char* argv[]) {
     const uint16_t port = atol(argv[2]);
 
     StdoutLogger logger;
+    char laddr[SocketAddr::MAX_STR_LEN], raddr[SocketAddr::MAX_STR_LEN];
     stdout_logger_init(&logger);
 
     NotificationQueueImpl nq;
@@ -140,9 +144,9 @@ int main(int argc, char* argv[]) {
 
     utils::GenEndpointInfo(client.fd, &client.endpoint_info);
     const EndpointInfo& info = client.endpoint_info;
-    logger_info(&logger.l, "[client] client [%s:%u] connect to server [%s:%u].",
-                info.local_addr.c_str(), info.local_port,
-                info.remote_addr.c_str(), info.remote_port);
+    logger_info(&logger.l, "[client] client [%s] connect to server [%s].",
+                info.local.ToString(laddr, sizeof(laddr)),
+                info.remote.ToString(raddr, sizeof(raddr)));
 
     client.state = State::CLIENT_SEND_REQ;
     rc = nq.WriteAsync(client.fd, "0", 1, &client);
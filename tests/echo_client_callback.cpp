@@ -4,6 +4,8 @@ using namespace netkit;
 #include "logger/stdout_logger.h"
 
 #include <string.h> // strerror()
+#include <stdio.h> // snprintf()
+#include <stdlib.h> // atol()
 #include <unistd.h>
 using namespace std;
 
@@ -11,11 +13,13 @@ class EchoTask final : public Task {
 public:
     EchoTask(Logger* l) : Task(l) {}
     void Run(SendContext* ctx) override {
+        char laddr[SocketAddr::MAX_STR_LEN], raddr[SocketAddr::MAX_STR_LEN];
         auto& info = ctx->GetEndpointInfo();
         logger_info(
-            m_logger, "[client] server [%s:%u] ==> client [%s:%u] data [%.*s]",
-            info.remote_addr.c_str(), info.remote_port, info.local_addr.c_str(),
-            info.local_port, m_buffer.size(), m_buffer.data());
+            m_logger, "[client] server [%s] ==> client [%s] data [%.*s]",
+            info.remote.ToString(raddr, sizeof(raddr)),
+            info.local.ToString(laddr, sizeof(laddr)), m_buffer.size(),
+            m_buffer.data());
 
         int err = m_buffer.Reserve(10);
         if (err) {
@@ -46,10 +50,10 @@ public:
     }
 
     int OnConnected(SendContext* ctx) override {
+        char laddr[SocketAddr::MAX_STR_LEN], raddr[SocketAddr::MAX_STR_LEN];
         m_endpoint_info = ctx->GetEndpointInfo();
-        logger_info(m_logger, "[client] connect to server [%s:%u].",
-                    m_endpoint_info.remote_addr.c_str(),
-                    m_endpoint_info.remote_port);
+        logger_info(m_logger, "[client] connect to server [%s].",
+                    m_endpoint_info.remote.ToString(raddr, sizeof(raddr)));
 
         Buffer buf;
         int err = buf.Append("0", 1);
@@ -60,9 +64,9 @@ public:
         }
 
         logger_info(
-            m_logger, "[client] client [%s:%u] ==> server [%s:%u] data [%.*s]",
-            m_endpoint_info.local_addr.c_str(), m_endpoint_info.local_port,
-            m_endpoint_info.remote_addr.c_str(), m_endpoint_info.remote_port,
+            m_logger, "[client] client [%s] ==> server [%s] data [%.*s]",
+            m_endpoint_info.local.ToString(laddr, sizeof(laddr)),
+            m_endpoint_info.remote.ToString(raddr, sizeof(raddr)),
             buf.size(), buf.data());
 
         err = ctx->Emit(move(buf));
@@ -76,9 +80,9 @@ public:
     }
 
     void OnDisconnected() override {
-        logger_info(m_logger, "[client] client [%s:%u] disconnected.",
-                    m_endpoint_info.local_addr.c_str(),
-                    m_endpoint_info.local_port);
+        char laddr[SocketAddr::MAX_STR_LEN];
+        logger_info(m_logger, "[client] client [%s] disconnected.",
+                    m_endpoint_info.local.ToString(laddr, sizeof(laddr)));
     }
 
     ReqStat Check(const Buffer& req, uint32_t* size) override {
@@ -0,0 +1,697 @@
+#include "netkit/iouring/notification_queue_impl.h"
+#include "netkit/latency_stat.h"
+#include "netkit/utils.h"
+using namespace netkit;
+using namespace netkit::iouring;
+
+#include "logger/stdout_logger.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring> // strerror()
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <time.h> // clock_gettime()
+#include <unistd.h>
+#include <sys/socket.h> // shutdown()
+using namespace std;
+
+/*
+  a load generator for echo servers.
+
+  in open-loop mode, requests are due at a constant rate no matter how fast
+  responses come back, and latency is measured from when a request is due
+  instead of when it is written. requests that have to wait for a free slot
+  in the pipeline are thus counted as late, which closed-loop clients hide
+  (coordinated omission). closed-loop mode keeps the pipeline of every
+  connection full, and measures from when requests are written.
+
+  every byte echoed back is checked against the request it belongs to.
+*/
+
+#define MAX_MSG_SIZE (64 * 1024)
+#define READ_BUF_SIZE (64 * 1024)
+// time to wait for responses in flight after the run
+#define DRAIN_NSEC 2000000000ul
+
+static uint64_t GetNowNsec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t SplitMix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ul;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ul;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebul;
+    return x ^ (x >> 31);
+}
+
+// byte `off` of request `seq` of connection `conn_id`
+static inline char GetPatternByte(uint32_t conn_id, uint64_t seq,
+                                  uint32_t off) {
+    return (char)(off * 7 + seq * 131 + conn_id * 17 + 1);
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct SizeDist final {
+    enum Type {
+        FIXED,
+        UNIFORM,
+        EXP,
+    };
+
+    Type type = FIXED;
+    uint32_t min = 64;
+    uint32_t max = 64;
+    uint32_t mean = 64;
+
+    // returns 0 or -EINVAL. accepts "N", "MIN-MAX" and "exp:MEAN".
+    int Parse(const char* s) {
+        unsigned a = 0, b = 0;
+        if (sscanf(s, "exp:%u", &a) == 1) {
+            type = EXP;
+            mean = a;
+            min = 1;
+            max = MAX_MSG_SIZE;
+        } else if (sscanf(s, "%u-%u", &a, &b) == 2) {
+            type = UNIFORM;
+            min = a;
+            max = b;
+        } else if (sscanf(s, "%u", &a) == 1) {
+            type = FIXED;
+            min = a;
+            max = a;
+        } else {
+            return -EINVAL;
+        }
+        if (min == 0 || min > max || max > MAX_MSG_SIZE ||
+            (type == EXP && mean == 0)) {
+            return -EINVAL;
+        }
+        return 0;
+    }
+
+    // `rnd` is uniformly distributed
+    uint32_t Get(uint64_t rnd) const {
+        switch (type) {
+            case UNIFORM:
+                return min + rnd % (max - min + 1);
+            case EXP: {
+                // (0, 1]
+                const double u = (double)((rnd >> 11) + 1) / (1ul << 53);
+                const double v = -log(u) * mean;
+                return (v < min) ? min : (v > max) ? max : (uint32_t)v;
+            }
+            default:
+                return min;
+        }
+    }
+};
+
+struct Config final {
+    const char* host = nullptr;
+    uint16_t port = 0;
+    uint32_t nr_conns = 16;
+    uint32_t nr_threads = 1;
+    double rate = 0; // requests per second of all connections. 0: closed-loop
+    uint32_t depth = 1; // max requests in flight per connection
+    const char* size_str = "64";
+    SizeDist size;
+    double duration_sec = 10;
+    uint64_t seed = 0;
+    const char* json_path = nullptr;
+};
+
+struct Result final {
+    uint64_t nr_sent = 0; // requests written entirely
+    uint64_t nr_done = 0; // responses received and verified
+    uint64_t nr_unsent = 0; // requests due but never written
+    uint64_t nr_mismatches = 0; // connections closed by bad responses
+    uint64_t nr_conn_errors = 0; // connections closed by errors
+    uint64_t last_done_nsec = 0;
+    LatencyHistogram latency; // about 8KB
+};
+
+/* ------------------------------------------------------------------------- */
+
+class Worker final {
+public:
+    Worker(const Config& c, Logger* l) : m_config(c), m_logger(l) {}
+
+    // connections [`first_conn_id`, `first_conn_id` + `nr_conns`)
+    // returns 0 or -errno
+    int Init(uint32_t first_conn_id, uint32_t nr_conns, double rate);
+
+    void Run(uint64_t start_nsec);
+
+    const Result& GetResult() const {
+        return m_result;
+    }
+
+private:
+    struct Conn;
+
+    // a tag of the operations of one direction of a connection
+    struct Op final {
+        Conn* conn;
+        bool is_read;
+    };
+
+    struct Conn final {
+        uint32_t id; // of all workers
+        uint32_t idx; // in `m_conn_list`
+        int fd = -1;
+        bool is_writing = false;
+        bool is_closed = false;
+        uint64_t nr_due = 0; // open-loop only
+        uint64_t nr_sent = 0;
+        uint64_t nr_done = 0;
+        uint32_t send_off = 0;
+        uint32_t send_size = 0;
+        uint32_t recv_off = 0; // of response `nr_done`
+        Op read_op;
+        Op write_op;
+        vector<uint64_t> start_list; // of requests in flight, by seq % depth
+        char send_buf[MAX_MSG_SIZE];
+        char recv_buf[READ_BUF_SIZE];
+    };
+
+private:
+    bool IsOpenLoop() const {
+        return (m_rate > 0);
+    }
+
+    // when request `seq` of the `idx`-th connection is due in open-loop mode
+    uint64_t GetIntendedNsec(uint32_t idx, uint64_t seq) const {
+        return m_start_nsec +
+            (uint64_t)((seq * m_conn_list.size() + idx) * 1e9 / m_rate);
+    }
+
+    uint32_t GetRequestSize(const Conn* conn, uint64_t seq) const {
+        return m_config.size.Get(
+            SplitMix64(m_config.seed ^ ((uint64_t)conn->id << 40) ^ seq));
+    }
+
+    // marks requests due until `now`, and returns when the next one is due
+    uint64_t Generate(uint64_t now);
+
+    void TrySend(Conn*, uint64_t now);
+    int DoWrite(Conn*);
+    int DoRead(Conn*);
+    void HandleWrite(Conn*, EventResult);
+    void HandleRead(Conn*, EventResult);
+    void CloseConn(Conn*, bool is_mismatch);
+    bool IsDrained() const;
+
+private:
+    const Config& m_config;
+    Logger* m_logger;
+    NotificationQueueImpl m_nq;
+    double m_rate = 0; // of this worker
+    uint64_t m_start_nsec = 0;
+    uint64_t m_end_nsec = 0;
+    bool m_is_stopping = false;
+    uint64_t m_nr_generated = 0; // requests due of all connections
+    bool m_is_tick_pending = false;
+    char m_tick_tag;
+    vector<unique_ptr<Conn>> m_conn_list;
+    Result m_result;
+};
+
+int Worker::Init(uint32_t first_conn_id, uint32_t nr_conns, double rate) {
+    int err = m_nq.Init(NotificationQueueImpl::Options(), m_logger);
+    if (err) {
+        logger_error(m_logger, "init queue failed: [%s].", strerror(-err));
+        return err;
+    }
+
+    SocketOptions opts;
+    opts.tcp_nodelay = true;
+
+    m_rate = rate;
+    for (uint32_t i = 0; i < nr_conns; ++i) {
+        auto conn = new Conn();
+        if (!conn) {
+            return -ENOMEM;
+        }
+        m_conn_list.emplace_back(conn);
+
+        conn->id = first_conn_id + i;
+        conn->idx = i;
+        conn->read_op = {conn, true};
+        conn->write_op = {conn, false};
+        conn->start_list.resize(m_config.depth);
+
+        int fd = utils::CreateTcpClientFd(m_config.host, m_config.port,
+                                          m_logger, &opts);
+        if (fd < 0) {
+            logger_error(m_logger, "connect to [%s:%u] failed: [%s].",
+                         m_config.host, m_config.port, strerror(-fd));
+            return fd;
+        }
+        conn->fd = fd;
+    }
+
+    return 0;
+}
+
+uint64_t Worker::Generate(uint64_t now) {
+    const uint32_t nr_conns = m_conn_list.size();
+    while (true) {
+        const uint64_t idx = m_nr_generated % nr_conns;
+        const uint64_t seq = m_nr_generated / nr_conns;
+        const uint64_t due = GetIntendedNsec(idx, seq);
+        if (due >= m_end_nsec) {
+            m_is_stopping = true;
+            return 0;
+        }
+        if (due > now) {
+            return due;
+        }
+
+        auto conn = m_conn_list[idx].get();
+        ++conn->nr_due;
+        ++m_nr_generated;
+        TrySend(conn, now);
+    }
+}
+
+void Worker::TrySend(Conn* conn, uint64_t now) {
+    if (conn->is_writing || conn->is_closed) {
+        return;
+    }
+    if (conn->nr_sent - conn->nr_done >= m_config.depth) {
+        return;
+    }
+    if (IsOpenLoop()) {
+        if (conn->nr_sent >= conn->nr_due) {
+            return;
+        }
+    } else if (m_is_stopping) {
+        return;
+    }
+
+    const uint64_t seq = conn->nr_sent;
+    const uint32_t size = GetRequestSize(conn, seq);
+    for (uint32_t i = 0; i < size; ++i) {
+        conn->send_buf[i] = GetPatternByte(conn->id, seq, i);
+    }
+
+    conn->start_list[seq % m_config.depth] =
+        (IsOpenLoop()) ? GetIntendedNsec(conn->idx, seq) : now;
+    conn->send_off = 0;
+    conn->send_size = size;
+    conn->is_writing = true;
+
+    int err = DoWrite(conn);
+    if (err) {
+        CloseConn(conn, false);
+    }
+}
+
+int Worker::DoWrite(Conn* conn) {
+    int err = m_nq.WriteAsync(conn->fd, conn->send_buf + conn->send_off,
+                              conn->send_size - conn->send_off,
+                              &conn->write_op);
+    if (err) {
+        logger_error(m_logger, "write request failed: [%s].", strerror(-err));
+    }
+    return err;
+}
+
+int Worker::DoRead(Conn* conn) {
+    int err = m_nq.ReadAsync(conn->fd, conn->recv_buf, READ_BUF_SIZE,
+                             &conn->read_op);
+    if (err) {
+        logger_error(m_logger, "read response failed: [%s].", strerror(-err));
+    }
+    return err;
+}
+
+void Worker::CloseConn(Conn* conn, bool is_mismatch) {
+    if (conn->is_closed) {
+        return;
+    }
+    conn->is_closed = true;
+    if (is_mismatch) {
+        ++m_result.nr_mismatches;
+    } else {
+        ++m_result.nr_conn_errors;
+    }
+    // pending operations fail and are ignored
+    shutdown(conn->fd, SHUT_RDWR);
+}
+
+void Worker::HandleWrite(Conn* conn, EventResult res) {
+    if (conn->is_closed) {
+        return;
+    }
+    if (res.err || res.val == 0) {
+        logger_error(m_logger, "write request failed: [%s].",
+                     strerror(res.err));
+        CloseConn(conn, false);
+        return;
+    }
+
+    conn->send_off += res.val;
+    if (conn->send_off < conn->send_size) {
+        if (DoWrite(conn) != 0) {
+            CloseConn(conn, false);
+        }
+        return;
+    }
+
+    conn->is_writing = false;
+    ++conn->nr_sent;
+    ++m_result.nr_sent;
+    TrySend(conn, GetNowNsec());
+}
+
+void Worker::HandleRead(Conn* conn, EventResult res) {
+    if (conn->is_closed) {
+        return;
+    }
+    if (res.err || res.val == 0) {
+        logger_error(m_logger, "read response failed: [%s].",
+                     (res.err) ? strerror(res.err) : "peer closed");
+        CloseConn(conn, false);
+        return;
+    }
+
+    const uint64_t now = GetNowNsec();
+    const char* data = conn->recv_buf;
+    uint64_t left = res.val;
+    while (left > 0) {
+        const uint64_t seq = conn->nr_done;
+        // only requests written so far can be echoed
+        if (seq > conn->nr_sent || (seq == conn->nr_sent && !conn->is_writing)) {
+            logger_error(m_logger, "unexpected data of conn [%u].", conn->id);
+            CloseConn(conn, true);
+            return;
+        }
+
+        const uint32_t size = GetRequestSize(conn, seq);
+        const uint32_t nr = min<uint64_t>(size - conn->recv_off, left);
+        for (uint32_t i = 0; i < nr; ++i) {
+            if (data[i] != GetPatternByte(conn->id, seq, conn->recv_off + i)) {
+                logger_error(m_logger,
+                             "response [%lu] of conn [%u] mismatches at [%u].",
+                             seq, conn->id, conn->recv_off + i);
+                CloseConn(conn, true);
+                return;
+            }
+        }
+        data += nr;
+        left -= nr;
+        conn->recv_off += nr;
+
+        if (conn->recv_off == size) {
+            m_result.latency.Add(now - conn->start_list[seq % m_config.depth]);
+            m_result.last_done_nsec = now;
+            ++m_result.nr_done;
+            ++conn->nr_done;
+            conn->recv_off = 0;
+        }
+    }
+
+    if (DoRead(conn) != 0) {
+        CloseConn(conn, false);
+        return;
+    }
+    TrySend(conn, now);
+}
+
+bool Worker::IsDrained() const {
+    for (auto& conn : m_conn_list) {
+        if (conn->is_closed) {
+            continue;
+        }
+        if (conn->is_writing || conn->nr_done < conn->nr_sent) {
+            return false;
+        }
+        if (IsOpenLoop() && conn->nr_sent < conn->nr_due) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Worker::Run(uint64_t start_nsec) {
+    m_start_nsec = start_nsec;
+    m_end_nsec = start_nsec + (uint64_t)(m_config.duration_sec * 1e9);
+    const uint64_t drain_nsec = m_end_nsec + DRAIN_NSEC;
+
+    for (auto& conn : m_conn_list) {
+        if (DoRead(conn.get()) != 0) {
+            CloseConn(conn.get(), false);
+        }
+    }
+
+    while (true) {
+        const uint64_t now = GetNowNsec();
+        uint64_t wakeup_nsec = drain_nsec;
+        if (!m_is_stopping) {
+            if (now >= m_end_nsec) {
+                m_is_stopping = true;
+            } else if (IsOpenLoop()) {
+                const uint64_t next = Generate(now);
+                if (next > 0) {
+                    wakeup_nsec = next;
+                }
+            } else {
+                for (auto& conn : m_conn_list) {
+                    TrySend(conn.get(), now);
+                }
+                wakeup_nsec = m_end_nsec;
+            }
+        }
+        if (m_is_stopping && (now >= drain_nsec || IsDrained())) {
+            break;
+        }
+
+        if (!m_is_tick_pending) {
+            const uint64_t usec =
+                (wakeup_nsec > now) ? (wakeup_nsec - now) / 1000 : 0;
+            const TimeVal timeout = {(time_t)(usec / 1000000),
+                                     (suseconds_t)(usec % 1000000)};
+            int err = m_nq.TimeoutAsync(timeout, &m_tick_tag);
+            if (err) {
+                logger_error(m_logger, "add timeout failed: [%s].",
+                             strerror(-err));
+                break;
+            }
+            m_is_tick_pending = true;
+        }
+
+        EventResult res;
+        void* tag = nullptr;
+        int err = m_nq.Next(&res, &tag, nullptr);
+        if (err) {
+            logger_error(m_logger, "get event failed: [%s].", strerror(-err));
+            break;
+        }
+
+        if (tag == &m_tick_tag) {
+            m_is_tick_pending = false;
+            continue;
+        }
+
+        auto op = static_cast<Op*>(tag);
+        if (op->is_read) {
+            HandleRead(op->conn, res);
+        } else {
+            HandleWrite(op->conn, res);
+        }
+    }
+
+    for (auto& conn : m_conn_list) {
+        if (IsOpenLoop() && conn->nr_due > conn->nr_sent) {
+            m_result.nr_unsent += conn->nr_due - conn->nr_sent;
+        }
+        shutdown(conn->fd, SHUT_RDWR);
+    }
+
+    // pending operations are gone with the queue before buffers are freed
+    m_nq.Destroy();
+    for (auto& conn : m_conn_list) {
+        close(conn->fd);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void PrintUsage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [options] host port\n"
+            "  -c  number of connections, default 16\n"
+            "  -t  number of threads, default 1\n"
+            "  -r  requests per second of all connections. 0 keeps pipelines\n"
+            "      full (closed-loop), default 0\n"
+            "  -p  max requests in flight per connection, default 1\n"
+            "  -s  request size: N, MIN-MAX (uniform) or exp:MEAN, default 64\n"
+            "  -d  duration in seconds, default 10\n"
+            "  -S  seed of request sizes, default 0\n"
+            "  -j  writes a JSON summary to the file\n",
+            prog);
+}
+
+// returns 0 or -EINVAL
+static int ParseArgs(int argc, char* argv[], Config* config) {
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:r:p:s:d:S:j:h")) != -1) {
+        switch (opt) {
+            case 'c':
+                config->nr_conns = atoi(optarg);
+                break;
+            case 't':
+                config->nr_threads = atoi(optarg);
+                break;
+            case 'r':
+                config->rate = atof(optarg);
+                break;
+            case 'p':
+                config->depth = atoi(optarg);
+                break;
+            case 's':
+                config->size_str = optarg;
+                break;
+            case 'd':
+                config->duration_sec = atof(optarg);
+                break;
+            case 'S':
+                config->seed = strtoull(optarg, nullptr, 0);
+                break;
+            case 'j':
+                config->json_path = optarg;
+                break;
+            default:
+                return -EINVAL;
+        }
+    }
+
+    if (argc - optind != 2) {
+        return -EINVAL;
+    }
+    config->host = argv[optind];
+    config->port = atoi(argv[optind + 1]);
+
+    if (config->nr_conns == 0 || config->nr_threads == 0 ||
+        config->depth == 0 || config->rate < 0 || config->duration_sec <= 0) {
+        return -EINVAL;
+    }
+    if (config->nr_threads > config->nr_conns) {
+        config->nr_threads = config->nr_conns;
+    }
+    return config->size.Parse(config->size_str);
+}
+
+static string FormatJson(const Config& config, const Result& r, double sec) {
+    const LatencyHistogram& h = r.latency;
+    const double mean_usec =
+        (h.count > 0) ? (double)h.sum_nsec / h.count / 1000 : 0;
+
+    char buf[1024];
+    snprintf(buf, sizeof(buf),
+             "{\"mode\":\"%s\",\"target_rate\":%.0f,\"connections\":%u,"
+             "\"threads\":%u,\"pipeline\":%u,\"size\":\"%s\","
+             "\"duration_sec\":%.3f,\"sent\":%lu,\"completed\":%lu,"
+             "\"unsent\":%lu,\"mismatches\":%lu,\"conn_errors\":%lu,"
+             "\"throughput\":%.0f,\"latency_usec\":{\"mean\":%.2f,"
+             "\"p50\":%.2f,\"p90\":%.2f,\"p99\":%.2f,\"p99.9\":%.2f,"
+             "\"p99.99\":%.2f,\"max\":%.2f}}",
+             (config.rate > 0) ? "open" : "closed", config.rate,
+             config.nr_conns, config.nr_threads, config.depth,
+             config.size_str, sec, r.nr_sent, r.nr_done, r.nr_unsent,
+             r.nr_mismatches, r.nr_conn_errors, r.nr_done / sec, mean_usec,
+             h.GetPercentile(0.5) / 1000.0, h.GetPercentile(0.9) / 1000.0,
+             h.GetPercentile(0.99) / 1000.0, h.GetPercentile(0.999) / 1000.0,
+             h.GetPercentile(0.9999) / 1000.0, h.max_nsec / 1000.0);
+    return string(buf);
+}
+
+int main(int argc, char* argv[]) {
+    Config config;
+    if (ParseArgs(argc, argv, &config) != 0) {
+        PrintUsage(argv[0]);
+        return -1;
+    }
+
+    StdoutLogger logger;
+    stdout_logger_init(&logger);
+
+    // connections and the rate are split evenly among workers
+    vector<unique_ptr<Worker>> worker_list;
+    uint32_t first_conn_id = 0;
+    for (uint32_t i = 0; i < config.nr_threads; ++i) {
+        const uint32_t nr_conns = config.nr_conns / config.nr_threads +
+            ((i < config.nr_conns % config.nr_threads) ? 1 : 0);
+        const double rate = config.rate * nr_conns / config.nr_conns;
+
+        auto worker = new Worker(config, &logger.l);
+        worker_list.emplace_back(worker);
+        int err = worker->Init(first_conn_id, nr_conns, rate);
+        if (err) {
+            logger_error(&logger.l, "init worker [%u] failed: [%s].", i,
+                         strerror(-err));
+            return -1;
+        }
+        first_conn_id += nr_conns;
+    }
+
+    // workers start at the same time
+    const uint64_t start_nsec = GetNowNsec() + 10000000;
+    vector<thread> thread_list;
+    for (auto& worker : worker_list) {
+        thread_list.emplace_back(&Worker::Run, worker.get(), start_nsec);
+    }
+    for (auto& t : thread_list) {
+        t.join();
+    }
+
+    Result total;
+    for (auto& worker : worker_list) {
+        const Result& r = worker->GetResult();
+        total.nr_sent += r.nr_sent;
+        total.nr_done += r.nr_done;
+        total.nr_unsent += r.nr_unsent;
+        total.nr_mismatches += r.nr_mismatches;
+        total.nr_conn_errors += r.nr_conn_errors;
+        total.last_done_nsec = max(total.last_done_nsec, r.last_done_nsec);
+        total.latency.Merge(r.latency);
+    }
+
+    const double sec = (total.last_done_nsec > start_nsec)
+        ? (total.last_done_nsec - start_nsec) / 1e9
+        : config.duration_sec;
+    const LatencyHistogram& h = total.latency;
+    printf("completed %lu of %lu requests in %.3f s, %.0f req/s, "
+           "%lu unsent, %lu mismatches, %lu connection errors\n",
+           total.nr_done, total.nr_sent, sec, total.nr_done / sec,
+           total.nr_unsent, total.nr_mismatches, total.nr_conn_errors);
+    printf("latency (us) p50 %.2f p90 %.2f p99 %.2f p99.9 %.2f p99.99 %.2f "
+           "max %.2f\n",
+           h.GetPercentile(0.5) / 1000.0, h.GetPercentile(0.9) / 1000.0,
+           h.GetPercentile(0.99) / 1000.0, h.GetPercentile(0.999) / 1000.0,
+           h.GetPercentile(0.9999) / 1000.0, h.max_nsec / 1000.0);
+
+    const string json = FormatJson(config, total, sec);
+    if (config.json_path) {
+        FILE* fp = fopen(config.json_path, "w");
+        if (!fp) {
+            logger_error(&logger.l, "open [%s] failed: [%s].",
+                         config.json_path, strerror(errno));
+            return -1;
+        }
+        fprintf(fp, "%s\n", json.c_str());
+        fclose(fp);
+    } else {
+        printf("%s\n", json.c_str());
+    }
+
+    stdout_logger_destroy(&logger);
+    return (total.nr_mismatches > 0 || total.nr_conn_errors > 0) ? -1 : 0;
+}
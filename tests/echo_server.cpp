@@ -41,6 +41,7 @@ struct EchoSession final : public State {
 static State::Value Process(EchoServer* svr, EventResult res, void* tag,
                             NotificationQueue* nq, Logger* logger) {
     int rc;
+    char laddr[SocketAddr::MAX_STR_LEN], raddr[SocketAddr::MAX_STR_LEN];
 
     auto state = static_cast<State*>(tag);
     auto ret_state = state->value;
@@ -55,9 +56,9 @@ static State::Value Process(EchoServer* svr, EventResult res, void* tag,
             auto session = new EchoSession();
             session->fd = res.val;
             utils::GenEndpointInfo(res.val, &session->endpoint_info);
-            logger_info(logger, "[server] accepts client [%s:%u].",
-                        session->endpoint_info.remote_addr.c_str(),
-                        session->endpoint_info.remote_port);
+            logger_info(logger, "[server] accepts client [%s].",
+                        session->endpoint_info.remote.ToString(
+                            raddr, sizeof(raddr)));
 
             session->value = State::RECV_REQ;
             rc = nq->ReadAsync(res.val, session->buf, ECHO_BUFFER_SIZE,
@@ -75,8 +76,8 @@ static State::Value Process(EchoServer* svr, EventResult res, void* tag,
                              strerror(res.err));
                 delete session;
             } else if (res.val == 0) {
-                logger_info(logger, "[server] client [%s:%u] disconnected.",
-                            info.remote_addr.c_str(), info.remote_port);
+                logger_info(logger, "[server] client [%s] disconnected.",
+                            info.remote.ToString(raddr, sizeof(raddr)));
                 delete session;
                 svr->value = State::CLOSED;
                 rc = nq->CloseAsync(svr->fd, static_cast<State*>(svr));
@@ -86,9 +87,9 @@ static State::Value Process(EchoServer* svr, EventResult res, void* tag,
             } else {
                 logger_info(
                     logger,
-                    "[server] client [%s:%u] ==> server [%s:%u] data [%.*s]",
-                    info.remote_addr.c_str(), info.remote_port,
-                    info.local_addr.c_str(), info.local_port, res.val,
+                    "[server] client [%s] ==> server [%s] data [%.*s]",
+                    info.remote.ToString(raddr, sizeof(raddr)),
+                    info.local.ToString(laddr, sizeof(laddr)), res.val,
                     session->buf);
                 session->value = State::SEND_RES;
                 rc = nq->WriteAsync(session->fd, session->buf, res.val, tag);
@@ -106,8 +107,8 @@ static State::Value Process(EchoServer* svr, EventResult res, void* tag,
                 delete session;
             } else if (res.val == 0) {
                 const EndpointInfo& info = session->endpoint_info;
-                logger_info(logger, "[server] client [%s:%u] disconnected.",
-                            info.remote_addr.c_str(), info.remote_port);
+                logger_info(logger, "[server] client [%s] disconnected.",
+                            info.remote.ToString(raddr, sizeof(raddr)));
                 delete session;
             } else {
                 session->value = State::RECV_REQ;
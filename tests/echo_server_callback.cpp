@@ -3,17 +3,20 @@ using namespace netkit;
 
 #include "logger/stdout_logger.h"
 #include <cstring> // strerror()
+#include <cstdlib> // atol()
 using namespace std;
 
 class EchoTask final : public Task {
 public:
     EchoTask(Logger* l) : Task(l) {}
     void Run(SendContext* ctx) override {
+        char laddr[SocketAddr::MAX_STR_LEN], raddr[SocketAddr::MAX_STR_LEN];
         auto& info = ctx->GetEndpointInfo();
         logger_info(
-            m_logger, "[server] client[%s:%u] ==> server[%s:%u] data[%.*s]",
-            info.local_addr.c_str(), info.local_port, info.remote_addr.c_str(),
-            info.remote_port, m_buffer.size(), m_buffer.data());
+            m_logger, "[server] client[%s] ==> server[%s] data[%.*s]",
+            info.local.ToString(laddr, sizeof(laddr)),
+            info.remote.ToString(raddr, sizeof(raddr)), m_buffer.size(),
+            m_buffer.data());
         int err = ctx->Emit(move(m_buffer));
         if (err) {
             logger_error(m_logger, "send data failed: [%s].", strerror(-err));
@@ -29,17 +32,17 @@ public:
     }
 
     int OnConnected(SendContext* ctx) override {
+        char raddr[SocketAddr::MAX_STR_LEN];
         m_endpoint_info = ctx->GetEndpointInfo();
-        logger_info(m_logger, "[server] client [%s:%u] connected.",
-                    m_endpoint_info.remote_addr.c_str(),
-                    m_endpoint_info.remote_port);
+        logger_info(m_logger, "[server] client [%s] connected.",
+                    m_endpoint_info.remote.ToString(raddr, sizeof(raddr)));
         return 0;
     }
 
     void OnDisconnected() override {
-        logger_info(m_logger, "[server] client [%s:%u] disconnected.",
-                    m_endpoint_info.remote_addr.c_str(),
-                    m_endpoint_info.remote_port);
+        char raddr[SocketAddr::MAX_STR_LEN];
+        logger_info(m_logger, "[server] client [%s] disconnected.",
+                    m_endpoint_info.remote.ToString(raddr, sizeof(raddr)));
     }
 
     ReqStat Check(const Buffer& req, uint32_t* size) override {
@@ -67,14 +70,25 @@ int main(int argc, char* argv[]) {
     StdoutLogger logger;
     stdout_logger_init(&logger);
 
-    if (argc != 3) {
-        logger_error(&logger.l, "usage: %s host port.", argv[0]);
+    if (argc != 3 && argc != 4) {
+        logger_error(&logger.l, "usage: %s host port [capture_file].",
+                     argv[0]);
         return -1;
     }
 
     const char* host = argv[1];
     const uint16_t port = atol(argv[2]);
 
+    // traffic can be replayed by `capture_replay`
+    if (argc == 4) {
+        int err = StartCapture(argv[3], &logger.l);
+        if (err) {
+            logger_error(&logger.l, "start capture failed: [%s].",
+                         strerror(-err));
+            return -1;
+        }
+    }
+
     EventManager mgr(&logger.l);
     int err = mgr.Init(EventManager::Options());
     if (err) {
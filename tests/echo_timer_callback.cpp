@@ -13,11 +13,12 @@ class EchoTask final : public Task {
 public:
     EchoTask(Logger* l) : Task(l) {}
     void Run(SendContext* ctx) override {
+        char laddr[SocketAddr::MAX_STR_LEN], raddr[SocketAddr::MAX_STR_LEN];
         const auto& info = ctx->GetEndpointInfo();
         logger_info(m_logger,
-                    "[client] server [%s:%u] ==> client [%s:%u] data [%.*s]",
-                    info.remote_addr.c_str(), info.remote_port,
-                    info.local_addr.c_str(), info.local_port,
+                    "[client] server [%s] ==> client [%s] data [%.*s]",
+                    info.remote.ToString(raddr, sizeof(raddr)),
+                    info.local.ToString(laddr, sizeof(laddr)),
                     static_cast<int>(m_buffer.size()), m_buffer.data());
     }
 };
@@ -28,6 +29,7 @@ public:
 
 private:
     bool OnExpiration(int val, SendContext* ctx) override {
+        char laddr[SocketAddr::MAX_STR_LEN], raddr[SocketAddr::MAX_STR_LEN];
         if (val < 0) {
             logger_error(m_logger, "timer failed: [%s].", strerror(-val));
             return false;
@@ -44,9 +46,10 @@ private:
 
         const auto& info = ctx->GetEndpointInfo();
         logger_info(
-            m_logger, "[client] client [%s:%u] ==> server [%s:%u] data [%.*s]",
-            info.local_addr.c_str(), info.local_port, info.remote_addr.c_str(),
-            info.remote_port, static_cast<int>(buf.size()), buf.data());
+            m_logger, "[client] client [%s] ==> server [%s] data [%.*s]",
+            info.local.ToString(laddr, sizeof(laddr)),
+            info.remote.ToString(raddr, sizeof(raddr)),
+            static_cast<int>(buf.size()), buf.data());
 
         err = ctx->Emit(move(buf));
         if (err) {
@@ -69,10 +72,10 @@ public:
     }
 
     int OnConnected(SendContext* ctx) override {
+        char raddr[SocketAddr::MAX_STR_LEN];
         m_endpoint_info = ctx->GetEndpointInfo();
-        logger_info(m_logger, "[client] connect to server [%s:%u].",
-                    m_endpoint_info.remote_addr.c_str(),
-                    m_endpoint_info.remote_port);
+        logger_info(m_logger, "[client] connect to server [%s].",
+                    m_endpoint_info.remote.ToString(raddr, sizeof(raddr)));
 
         TimerPtr timer(new EchoTimer(m_logger));
         if (!timer) {
@@ -93,9 +96,9 @@ public:
     }
 
     void OnDisconnected() override {
-        logger_info(m_logger, "[client] client [%s:%u] disconnected.",
-                    m_endpoint_info.local_addr.c_str(),
-                    m_endpoint_info.local_port);
+        char laddr[SocketAddr::MAX_STR_LEN];
+        logger_info(m_logger, "[client] client [%s] disconnected.",
+                    m_endpoint_info.local.ToString(laddr, sizeof(laddr)));
     }
 
     ReqStat Check(const Buffer& req, uint32_t* size) override {
@@ -0,0 +1,126 @@
+#include "check.h"
+#include "event_dispatcher.h"
+#include "handle_table.h"
+using namespace netkit;
+
+using namespace std;
+
+// counts the events it gets
+class CountingHandler final : public EventHandler {
+public:
+    bool Process(EventResult, NotificationQueue*) override {
+        ++nr_events;
+        return true; // kept by the test
+    }
+
+public:
+    uint32_t nr_events = 0;
+};
+
+static int TestStaleGeneration() {
+    HandleTable table;
+    CountingHandler h1, h2;
+
+    const uint64_t handle = table.Register(&h1);
+    CHECK(handle != HandleTable::INVALID_HANDLE);
+    CHECK(table.Lookup(handle) == &h1);
+
+    table.Unregister(handle);
+    CHECK(table.Lookup(handle) == nullptr);
+
+    // the slot is reused with another generation
+    const uint64_t new_handle = table.Register(&h2);
+    CHECK(new_handle != handle);
+    CHECK((uint32_t)new_handle == (uint32_t)handle);
+    CHECK(table.Lookup(handle) == nullptr);
+    CHECK(table.Lookup(new_handle) == &h2);
+
+    // indices out of the table
+    CHECK(table.Lookup(new_handle + 1) == nullptr);
+
+    // releasing a stale or unknown handle leaves the slot to its new owner
+    table.Unregister(handle);
+    table.Unregister(new_handle + 1);
+    CHECK(table.Lookup(new_handle) == &h2);
+
+    table.Unregister(new_handle);
+    return 0;
+}
+
+static int TestReuse() {
+    HandleTable table;
+    CountingHandler h_list[3];
+    uint64_t handle_list[3];
+
+    for (int i = 0; i < 3; ++i) {
+        handle_list[i] = table.Register(&h_list[i]);
+        CHECK(handle_list[i] != HandleTable::INVALID_HANDLE);
+        CHECK((uint32_t)handle_list[i] == (uint32_t)i);
+    }
+
+    // freed slots are reused before the table grows, the last freed first
+    table.Unregister(handle_list[0]);
+    table.Unregister(handle_list[1]);
+
+    CountingHandler h;
+    uint64_t handle = table.Register(&h);
+    CHECK((uint32_t)handle == 1);
+    CHECK(table.Lookup(handle) == &h);
+    table.Unregister(handle);
+
+    // the generation keeps changing as a slot is reused
+    for (int i = 0; i < 1000; ++i) {
+        const uint64_t last = handle;
+        handle = table.Register(&h);
+        CHECK((uint32_t)handle == 1);
+        CHECK(handle != last);
+        CHECK(table.Lookup(last) == nullptr);
+        table.Unregister(handle);
+    }
+
+    handle = table.Register(&h);
+    CHECK((uint32_t)handle == 1);
+    handle = table.Register(&h);
+    CHECK((uint32_t)handle == 0);
+    handle = table.Register(&h);
+    CHECK((uint32_t)handle == 3);
+
+    CHECK(table.Lookup(handle_list[2]) == &h_list[2]);
+    return 0;
+}
+
+static int TestDispatchStale() {
+    HandleTable table;
+    HandleTable::SetCurrent(&table);
+
+    CountingHandler h;
+    uint64_t handle = HandleTable::INVALID_HANDLE;
+    HandleTable* owner = nullptr;
+    void* tag = EventDispatcher::MakeTag(&h, EventDispatcher::GENERIC,
+                                         &handle, &owner);
+    CHECK(owner == &table);
+
+    EventDispatcher::Dispatch(tag, EventResult{0, 0}, nullptr);
+    CHECK(h.nr_events == 1);
+
+    // events arriving after the handler is released are dropped, even if
+    // its slot is taken by another one
+    EventDispatcher::ReleaseHandle(handle, owner);
+    CountingHandler other;
+    CHECK((uint32_t)table.Register(&other) == (uint32_t)handle);
+
+    EventDispatcher::Dispatch(tag, EventResult{0, 0}, nullptr);
+    CHECK(h.nr_events == 1);
+    CHECK(other.nr_events == 0);
+
+    HandleTable::SetCurrent(nullptr);
+    return 0;
+}
+
+int main(void) {
+    int nr_failed = 0;
+    RUN_TEST(TestStaleGeneration, nr_failed);
+    RUN_TEST(TestReuse, nr_failed);
+    RUN_TEST(TestDispatchStale, nr_failed);
+    return (nr_failed == 0) ? 0 : 1;
+}
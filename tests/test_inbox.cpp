@@ -0,0 +1,91 @@
+#include "check.h"
+#include "event_dispatcher.h"
+#include "inbox.h"
+#include "netkit/loopback/notification_queue_impl.h"
+using namespace netkit;
+
+#include "logger/stdout_logger.h"
+#include <thread>
+#include <vector>
+using namespace std;
+
+#define PRODUCER_NUM 8
+#define ITEM_NUM_PER_PRODUCER 20000
+
+/*
+  producers post closures concurrently, which are run in this thread as the
+  eventfd of the inbox wakes the queue up. closures of one producer run in
+  the order they are posted.
+*/
+static int TestConcurrentPost() {
+    StdoutLogger logger;
+    stdout_logger_init(&logger);
+
+    loopback::NotificationQueueImpl nq;
+    CHECK(nq.Init(loopback::NotificationQueueImpl::Options(), &logger.l) == 0);
+
+    Inbox inbox(&logger.l);
+    CHECK(inbox.Init() == 0);
+    CHECK(inbox.Start(&nq) == 0);
+
+    // written by closures only, which run in this thread
+    vector<uint32_t> next_seq_list(PRODUCER_NUM, 0);
+    uint32_t nr_out_of_order = 0;
+    uint32_t nr_done = 0;
+
+    vector<int> err_list(PRODUCER_NUM, 0);
+    vector<thread> producer_list;
+    for (uint32_t i = 0; i < PRODUCER_NUM; ++i) {
+        producer_list.emplace_back([&, i]() -> void {
+            for (uint32_t seq = 0; seq < ITEM_NUM_PER_PRODUCER; ++seq) {
+                int err = inbox.Post([&, i, seq](NotificationQueue*) -> void {
+                    if (next_seq_list[i] != seq) {
+                        ++nr_out_of_order;
+                    }
+                    next_seq_list[i] = seq + 1;
+                    ++nr_done;
+                });
+                if (err) {
+                    err_list[i] = err;
+                    return;
+                }
+            }
+        });
+    }
+
+    const uint32_t nr_expected = PRODUCER_NUM * ITEM_NUM_PER_PRODUCER;
+    uint32_t nr_wakeups = 0;
+    const TimeVal timeout = {1, 0};
+    while (nr_done < nr_expected) {
+        EventResult res;
+        void* tag = nullptr;
+        // a lost wakeup leaves the queue idle until it times out
+        int err = nq.Next(&res, &tag, &timeout);
+        if (err) {
+            break;
+        }
+        ++nr_wakeups;
+        EventDispatcher::Dispatch(tag, res, &nq);
+    }
+
+    for (auto& t : producer_list) {
+        t.join();
+    }
+    for (auto err : err_list) {
+        CHECK(err == 0);
+    }
+
+    CHECK(nr_done == nr_expected);
+    CHECK(nr_out_of_order == 0);
+    // producers pushing to a non-empty inbox do not write the eventfd
+    CHECK(nr_wakeups > 0 && nr_wakeups <= nr_expected);
+
+    stdout_logger_destroy(&logger);
+    return 0;
+}
+
+int main(void) {
+    int nr_failed = 0;
+    RUN_TEST(TestConcurrentPost, nr_failed);
+    return (nr_failed == 0) ? 0 : 1;
+}
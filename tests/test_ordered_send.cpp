@@ -0,0 +1,169 @@
+#include "check.h"
+#include "netkit/connection.h"
+#include "object_pool.h"
+using namespace netkit;
+
+#include <cstdlib> // malloc()/free()
+#include <string>
+#include <errno.h>
+using namespace std;
+
+/*
+  replaces the object pool of the library, which is then not linked in, so
+  that allocations can be made to fail.
+*/
+static bool g_fail_alloc = false;
+
+namespace netkit { namespace object_pool {
+
+void* Alloc(uint64_t size) {
+    return (g_fail_alloc) ? nullptr : malloc(size);
+}
+
+void Free(void* ptr, uint64_t) {
+    free(ptr);
+}
+
+}}
+
+/* ------------------------------------------------------------------------- */
+
+// a list of one-byte items holding the characters of `s`
+static void NewItems(const char* s, SendItem** head, SendItem** tail) {
+    *head = nullptr;
+    *tail = nullptr;
+    for (; *s; ++s) {
+        Buffer b;
+        b.Assign(s, 1);
+        auto item = new SendItem(std::move(b), {});
+        if (*tail) {
+            (*tail)->next = item;
+        } else {
+            *head = item;
+        }
+        *tail = item;
+    }
+}
+
+// commits the items of `s`, which can be empty
+static int Commit(Connection* conn, uint64_t seq, const char* s, bool is_done,
+                  bool* is_first) {
+    SendItem *head, *tail;
+    NewItems(s, &head, &tail);
+    return conn->CommitSendItems(seq, head, tail, is_done, is_first);
+}
+
+// characters of the items in the send queue, in order
+static string GetSendQueue(Connection* conn) {
+    SendItem* item_list[64];
+    const uint32_t nr = conn->GetFrontSendItems(item_list, 64);
+    string s;
+    for (uint32_t i = 0; i < nr; ++i) {
+        s.append(item_list[i]->data.data(), item_list[i]->data.size());
+    }
+    return s;
+}
+
+static int TestOutOfOrder() {
+    ConnectionPtr conn = Connection::Create(-1);
+    CHECK(conn);
+
+    bool is_first = false;
+    CHECK(Commit(conn.get(), 2, "c", true, &is_first) == 0);
+    CHECK(!is_first);
+    CHECK(Commit(conn.get(), 1, "b", true, &is_first) == 0);
+    CHECK(!is_first);
+    CHECK(GetSendQueue(conn.get()).empty());
+
+    CHECK(Commit(conn.get(), 0, "a", true, &is_first) == 0);
+    CHECK(is_first);
+    CHECK(GetSendQueue(conn.get()) == "abc");
+
+    // the next request goes straight to the queue
+    CHECK(Commit(conn.get(), 3, "d", true, &is_first) == 0);
+    CHECK(!is_first);
+    CHECK(GetSendQueue(conn.get()) == "abcd");
+    return 0;
+}
+
+static int TestPartialCommits() {
+    ConnectionPtr conn = Connection::Create(-1);
+    CHECK(conn);
+
+    bool is_first = false;
+    // data of the current request is sent before it is done
+    CHECK(Commit(conn.get(), 0, "a", false, &is_first) == 0);
+    CHECK(is_first);
+    CHECK(Commit(conn.get(), 1, "b", false, &is_first) == 0);
+    CHECK(Commit(conn.get(), 2, "c", true, &is_first) == 0);
+    CHECK(Commit(conn.get(), 1, "B", false, &is_first) == 0);
+    CHECK(GetSendQueue(conn.get()) == "a");
+
+    // request 1 is released up to what it has emitted, and holds request 2
+    CHECK(Commit(conn.get(), 0, "A", true, &is_first) == 0);
+    CHECK(!is_first);
+    CHECK(GetSendQueue(conn.get()) == "aAbB");
+
+    CHECK(Commit(conn.get(), 1, "", true, &is_first) == 0);
+    CHECK(GetSendQueue(conn.get()) == "aAbBc");
+    return 0;
+}
+
+static int TestEmptyDoneCommits() {
+    ConnectionPtr conn = Connection::Create(-1);
+    CHECK(conn);
+
+    bool is_first = true;
+    // requests emitting nothing do not hold later ones
+    CHECK(Commit(conn.get(), 0, "", true, &is_first) == 0);
+    CHECK(!is_first);
+    CHECK(Commit(conn.get(), 2, "", true, &is_first) == 0);
+    CHECK(Commit(conn.get(), 3, "d", true, &is_first) == 0);
+    CHECK(GetSendQueue(conn.get()).empty());
+
+    CHECK(Commit(conn.get(), 1, "", true, &is_first) == 0);
+    CHECK(is_first);
+    CHECK(GetSendQueue(conn.get()) == "d");
+
+    CHECK(Commit(conn.get(), 4, "e", true, &is_first) == 0);
+    CHECK(GetSendQueue(conn.get()) == "de");
+    return 0;
+}
+
+static int TestOutOfMemory() {
+    ConnectionPtr conn = Connection::Create(-1);
+    CHECK(conn);
+
+    SendItem *head, *tail;
+    NewItems("b", &head, &tail);
+
+    // holding a later request needs memory
+    g_fail_alloc = true;
+    bool is_first = false;
+    int err = conn->CommitSendItems(1, head, tail, true, &is_first);
+    g_fail_alloc = false;
+    CHECK(err == -ENOMEM);
+
+    // the list is not taken and can be committed again
+    CHECK(conn->CommitSendItems(1, head, tail, true, &is_first) == 0);
+    CHECK(Commit(conn.get(), 0, "a", true, &is_first) == 0);
+    CHECK(GetSendQueue(conn.get()) == "ab");
+
+    // the current request needs no memory
+    NewItems("c", &head, &tail);
+    g_fail_alloc = true;
+    err = conn->CommitSendItems(2, head, tail, true, &is_first);
+    g_fail_alloc = false;
+    CHECK(err == 0);
+    CHECK(GetSendQueue(conn.get()) == "abc");
+    return 0;
+}
+
+int main(void) {
+    int nr_failed = 0;
+    RUN_TEST(TestOutOfOrder, nr_failed);
+    RUN_TEST(TestPartialCommits, nr_failed);
+    RUN_TEST(TestEmptyDoneCommits, nr_failed);
+    RUN_TEST(TestOutOfMemory, nr_failed);
+    return (nr_failed == 0) ? 0 : 1;
+}
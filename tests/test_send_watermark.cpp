@@ -0,0 +1,133 @@
+#include "check.h"
+#include "netkit/connection.h"
+using namespace netkit;
+
+#include <errno.h>
+using namespace std;
+
+static SendItem* NewItem(uint64_t sz) {
+    Buffer b;
+    if (b.Resize(sz) != 0) {
+        return nullptr;
+    }
+    return new SendItem(std::move(b), {});
+}
+
+// pushes items of `sz` bytes until the queue is blocked. returns the number
+// of items pushed, or -1 if failed.
+static int FillUp(Connection* conn, uint64_t sz) {
+    int nr = 0;
+    while (!conn->IsSendBlocked()) {
+        auto item = NewItem(sz);
+        if (!item) {
+            return -1;
+        }
+        bool is_first = false;
+        if (conn->PushSendItem(item, &is_first) != 0) {
+            delete item;
+            return -1;
+        }
+        ++nr;
+    }
+    return nr;
+}
+
+static int TestBytesHysteresis() {
+    ConnectionPtr conn = Connection::Create(-1);
+    CHECK(conn);
+
+    SendWatermark watermark;
+    watermark.high_bytes = 1000;
+    watermark.low_bytes = 300;
+    conn->SetSendWatermark(watermark);
+
+    uint32_t nr_notified = 0;
+    conn->SetOnWritable([&nr_notified](SendContext*) -> void {
+        ++nr_notified;
+    });
+
+    // 10 items of 100 bytes reach the high mark
+    CHECK(FillUp(conn.get(), 100) == 10);
+
+    auto item = NewItem(100);
+    CHECK(item);
+    bool is_first = false;
+    CHECK(conn->PushSendItem(item, &is_first) == -ENOBUFS);
+    delete item;
+
+    // still blocked above the low mark, and writable once at it
+    uint32_t nr_writable = 0;
+    for (int i = 0; i < 10; ++i) {
+        bool is_writable = false;
+        conn->PopSendItem(&is_writable);
+        if (i < 6) {
+            CHECK(!is_writable);
+            CHECK(conn->IsSendBlocked());
+        }
+        if (is_writable) {
+            ++nr_writable;
+            // what the sender does
+            conn->NotifyWritable(nullptr);
+        }
+    }
+    CHECK(nr_writable == 1);
+    CHECK(nr_notified == 1);
+    CHECK(!conn->IsSendBlocked());
+
+    // accepted again after draining
+    CHECK(FillUp(conn.get(), 100) == 10);
+    return 0;
+}
+
+static int TestItemsHysteresis() {
+    ConnectionPtr conn = Connection::Create(-1);
+    CHECK(conn);
+
+    // the low mark defaults to half of the high one
+    SendWatermark watermark;
+    watermark.high_items = 8;
+    conn->SetSendWatermark(watermark);
+
+    CHECK(FillUp(conn.get(), 1) == 8);
+    auto item = NewItem(1);
+    CHECK(item);
+    bool is_first = false;
+    CHECK(conn->PushSendItem(item, &is_first) == -ENOBUFS);
+    delete item;
+
+    uint32_t nr_writable = 0;
+    for (int i = 0; i < 8; ++i) {
+        bool is_writable = false;
+        conn->PopSendItem(&is_writable);
+        if (is_writable) {
+            // 4 items are left
+            CHECK(i == 3);
+            ++nr_writable;
+        }
+    }
+    CHECK(nr_writable == 1);
+    return 0;
+}
+
+static int TestUnlimited() {
+    ConnectionPtr conn = Connection::Create(-1);
+    CHECK(conn);
+
+    for (int i = 0; i < 1000; ++i) {
+        auto item = NewItem(1000);
+        CHECK(item);
+        bool is_first = false;
+        CHECK(conn->PushSendItem(item, &is_first) == 0);
+        CHECK(is_first == (i == 0));
+    }
+    CHECK(!conn->IsSendBlocked());
+    return 0;
+}
+
+int main(void) {
+    int nr_failed = 0;
+    RUN_TEST(TestBytesHysteresis, nr_failed);
+    RUN_TEST(TestItemsHysteresis, nr_failed);
+    RUN_TEST(TestUnlimited, nr_failed);
+    return (nr_failed == 0) ? 0 : 1;
+}